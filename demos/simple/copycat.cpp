@@ -2,13 +2,13 @@
  * Connects to the first two mobots in the configuration list. Sets up the
  * mobots so that the second mobot copies the motions of the first mobot. */
 #include <mobot.h>
+#include <stdio.h>
+#include <unistd.h>
 
 int main()
 {
   CMobot mobot1;
   CMobot mobot2;
-  double angles[4];
-  int i;
 
   /* Connect to the paired MoBots */
   mobot1.connectWithBluetoothAddress("00:06:66:46:41:FB");
@@ -20,20 +20,17 @@ int main()
   mobot1.stop();
   mobot2.stop();
 
+  /* Stream the first mobot's joint events to the second one, at most 50
+   * updates per second. */
+  CMobotGroup followers;
+  followers.addRobot(mobot2);
+  followers.mirror(mobot1, 50);
+
   while(1) {
-    /* Get the beginning time of loop */
-    /* Get the first mobots joint angles */
-    mobot1.getJointAngles(
-        angles[0],
-        angles[1],
-        angles[2],
-        angles[3]);
-    /* Move the second mobot */
-    mobot2.driveToDirectNB(
-        angles[0],
-        angles[1],
-        angles[2],
-        angles[3]);
+    double mean, max;
+    sleep(5);
+    followers.getMirrorLatency(mean, max);
+    printf("Mirroring latency: %.1f ms average, %.1f ms worst\n", mean, max);
   }
 
   return 0;
@@ -208,6 +208,142 @@ typedef enum mobotFormFactor_e
 #define BR_COMMS_S
 
 struct mobot_s;
+/* NB motions run on a small pool of worker threads shared by the whole
+ * library. Each robot (and each group) owns a task queue whose tasks run one
+ * at a time, in the order they were submitted. */
+typedef struct mobotTask_s mobotTask_t;
+typedef struct mobotTaskQueue_s mobotTaskQueue_t;
+/* A setter waiting in a robot's coalescing queue */
+typedef struct mobotCoalescedCmd_s mobotCoalescedCmd_t;
+/* A running leader/follower joint mirroring pipeline */
+typedef struct mobotMirror_s mobotMirror_t;
+/* A list of joint targets, run one step at a time by Mobot_seqRun */
+typedef struct mobotSeq_s mobotSeq_t;
+/* A robot's background health poller */
+typedef struct mobotTelemetryPoller_s mobotTelemetryPoller_t;
+
+/* Health metrics sampled by Mobot_telemetryStart */
+#define MOBOT_TELEMETRY_BATTERY     0x01
+#define MOBOT_TELEMETRY_ACCEL       0x02
+#define MOBOT_TELEMETRY_BUTTON      0x04
+#define MOBOT_TELEMETRY_MOTORERRORS 0x08
+#define MOBOT_TELEMETRY_STATUS      0x10
+
+/* The latest health sample of a robot. valid is a mask of the
+ * MOBOT_TELEMETRY_* metrics sampled at least once, and each *Age is how many
+ * milliseconds ago that metric was last sampled. Angles are in radians. */
+typedef struct mobotTelemetry_s
+{
+  int valid;
+  int connected;
+  double batteryVoltage;
+  double batteryAge;
+  double accel[3];
+  double accelAge;
+  double buttonVoltage;
+  double buttonAge;
+  double motorErrors[4];
+  double motorErrorsAge;
+  int responding;
+  double statusAge;
+  /* Polls that went out, polls skipped because the link was busy, and
+   * transactions that failed */
+  int polls;
+  int skipped;
+  int failures;
+  /* The poll period in effect, in milliseconds, including any back-off */
+  double period;
+} mobotTelemetry_t;
+
+/* The latest value of one kind of robot event. The event thread overwrites
+ * it under a sequence counter (a seqlock): seq is odd while a write is in
+ * progress, and updates counts the writes. See Mobot_readLatest. */
+typedef struct mobotChannel_s
+{
+  volatile unsigned int seq;
+  unsigned int updates;
+  uint32_t millis;
+  double hostTime;
+  double values[4];
+} mobotChannel_t;
+
+/* A robot's shared memory telemetry export, see Mobot_shmExportStart */
+typedef struct mobotShmExport_s mobotShmExport_t;
+
+/* A consumer of robot events, see Mobot_subscribe */
+typedef struct mobotSubscriber_s mobotSubscriber_t;
+
+/* Event types a subscriber can ask for */
+#define MOBOT_EVENT_BUTTON 0x01
+#define MOBOT_EVENT_JOINT  0x02
+#define MOBOT_EVENT_ACCEL  0x04
+#define MOBOT_EVENT_RAW    0x08
+
+/* One event, as handed to a subscriber. millis is the robot's clock and
+ * hostTime the library's, both in milliseconds. Only the fields of the
+ * event's type are set: button and buttonDown for buttons, joints (in
+ * radians) for joint moves, accel (in g) for the accelerometer, and for
+ * MOBOT_EVENT_RAW the event frame as the robot sent it. */
+typedef struct mobotEvent_s
+{
+  int type;
+  struct mobot_s* robot;
+  double hostTime;
+  uint32_t millis;
+  int button;
+  int buttonDown;
+  double joints[4];
+  double accel[3];
+  int rawSize;
+  uint8_t raw[256];
+} mobotEvent_t;
+
+/* How the readings of a burst are combined into one estimate. For
+ * MOBOT_FILTER_TRIMMED_MEAN the filter parameter is the fraction of readings
+ * dropped from each end, and for MOBOT_FILTER_EXPONENTIAL it is the weight
+ * of each new reading, between 0 and 1. */
+typedef enum mobotFilter_e
+{
+  MOBOT_FILTER_MEAN,
+  MOBOT_FILTER_MEDIAN,
+  MOBOT_FILTER_TRIMMED_MEAN,
+  MOBOT_FILTER_EXPONENTIAL
+} mobotFilter_t;
+
+/* Fields read by Mobot_groupSnapshot */
+#define MOBOT_SNAPSHOT_JOINTS  0x01
+#define MOBOT_SNAPSHOT_BATTERY 0x02
+
+/* The state of several robots, read at once by Mobot_groupSnapshot. Each
+ * array has an entry per robot, in the order the robots were given (angles
+ * and states have four per robot), and all of them share one allocation.
+ * status is 0 if the robot answered, -2 if the deadline passed first and -1
+ * if its answer was malformed. Times are the robots' own clocks, in seconds,
+ * and angles are in radians. */
+typedef struct mobotGroupSnapshot_s
+{
+  int numRobots;
+  int* status;
+  double* time;
+  double* angles;
+  robotJointState_t* states;
+  int* moving;
+  double* battery;
+} mobotGroupSnapshot_t;
+/* A periodic deadline on the monotonic clock, used to pace the recording
+ * threads. Deadlines are start + k*period, so the rate does not drift no
+ * matter how long each sample takes. Jitter is how late each wakeup was. */
+typedef struct mobotPeriodic_s
+{
+  double period;
+  double next;
+  int ticks;
+  int overruns;
+  double jitterSum;
+  double jitterSqSum;
+  double jitterMax;
+} mobotPeriodic_t;
+
 typedef struct mobotInfo_s
 {
   uint16_t zigbeeAddr;
@@ -233,12 +369,21 @@ typedef struct mobot_s
   THREAD_T* thread;
   MUTEX_T* commsLock;
   int motionInProgress;
+  mobotTaskQueue_t* motionQueue;
+  /* The newest NB motion, see Mobot_motionTask */
+  mobotTask_t* lastMotion;
+  /* Runs this robot's part of group queries, on workers of their own so
+   * that queries never wait behind long NB motions */
+  mobotTaskQueue_t* queryQueue;
+  /* Runs this robot's part of Mobot_broadcastStop */
+  mobotTaskQueue_t* stopQueue;
   MUTEX_T* recordingLock;
   int recordingEnabled[4];
   int recordingNumValues[4];
   MUTEX_T* recordingActive_lock;
   COND_T* recordingActive_cond;
   int recordingActive[4];
+  mobotPeriodic_t recordTiming[4];
   double** recordedAngles[4];
   double** recordedTimes;
   int shiftData;
@@ -251,9 +396,49 @@ typedef struct mobot_s
   MUTEX_T* recvBuf_lock;
   COND_T*  recvBuf_cond;
   int recvBuf_bytes;
+  uint8_t* recvDest;
+  uint8_t* recvBuf_data;
+  /* While burstCount is nonzero, responses are collected burstStride bytes
+   * apart starting at burstDest, and the waiter is woken by the last one.
+   * Protected by recvBuf_lock. */
+  uint8_t* burstDest;
+  int burstStride;
+  int burstCount;
+  int burstReceived;
   int commsEngine_bytes;
   int commsWaitingForMessage;
   MUTEX_T* commsWaitingForMessage_lock;
+  /* Round trip estimate and retry policy, in milliseconds. Protected by
+   * rto_lock, which is never held across a transaction. */
+  double srtt;
+  double rttvar;
+  double rto;
+  double rtoMin;
+  double rtoMax;
+  int maxRetries;
+  int deadline;
+  MUTEX_T* rto_lock;
+  /* When the last request went out. Protected by commsLock. */
+  double sendTime;
+  /* Number of stop/safety transactions waiting to jump the queue */
+  int priorityPending;
+  MUTEX_T* priority_lock;
+  COND_T* priority_cond;
+  /* Idempotent setters waiting to be sent, oldest first, at most one per
+   * (command, joint). Protected by coalesce_lock. */
+  int coalesceEnabled;
+  MUTEX_T* coalesce_lock;
+  mobotCoalescedCmd_t* coalesceHead;
+  mobotCoalescedCmd_t* coalesceTail;
+  int coalesceScheduled;
+  int coalesceError;
+  mobotTaskQueue_t* coalesceQueue;
+  /* Created by the first Mobot_telemetryStart and kept until exit, so
+   * Mobot_getTelemetry never races with freeing it */
+  mobotTelemetryPoller_t* telemetry;
+  /* Serialises Mobot_telemetryStart and Mobot_telemetryStop. The poller
+   * never takes it, so stopping can join the poller with it held. */
+  MUTEX_T* telemetry_lock;
   //MUTEX_T* socket_lock;
 
 #ifndef _CH_
@@ -278,11 +463,46 @@ typedef struct mobot_s
   void (*buttonCallback)(void* mobot, int button, int buttonDown);
   void (*jointCallback)(int, double, double, double, double, void*);
   void* jointCallbackData;
+  /* Last known joint angles in radians, fed by angle responses and joint
+   * events. jointCacheMillis is the robot's timestamp for them and
+   * jointCacheHostTime is when we got them, on the monotonic clock.
+   * jointCacheValid is cleared by any command that moves a joint, and
+   * jointCacheGen counts those invalidations. */
+  MUTEX_T* jointCache_lock;
+  int jointCacheValid;
+  unsigned int jointCacheGen;
+  uint32_t jointCacheMillis;
+  double jointCacheHostTime;
+  double jointCacheAngles[4];
+  int jointCacheMaxAge;
+  /* The latest joint event, whether or not the cache took it. jointEventSeq
+   * counts events and jointEvent_cond is broadcast on each one. Also
+   * protected by jointCache_lock. */
+  unsigned int jointEventSeq;
+  double jointEventHostTime;
+  double jointEventAngles[4];
+  COND_T* jointEvent_cond;
+  /* How many library features need the joint event stream on. Protected by
+   * callback_lock. */
+  int jointEventUsers;
+  int accelEventUsers;
+  /* Running mirrors led by this robot. Protected by jointCache_lock. */
+  mobotMirror_t* mirrors;
+  /* The latest joint and accelerometer events, see Mobot_readLatest */
+  mobotChannel_t jointChannel;
+  mobotChannel_t accelChannel;
+  mobotShmExport_t* shmExport;
   void (*accelCallback)(int, double, double, double, void*);
   void* accelCallbackData;
   void* mobot;
   void (*eventCallback)(const uint8_t* buf, int size, void* userdata);
   void* eventCallbackData;
+  /* The event bus subscriptions behind the callbacks above. Protected by
+   * callback_lock. */
+  mobotSubscriber_t* buttonSub;
+  mobotSubscriber_t* jointSub;
+  mobotSubscriber_t* accelSub;
+  mobotSubscriber_t* rawSub;
   char* configFilePath;
   void* itemsToFreeOnExit[64];
   int numItemsToFreeOnExit;
@@ -292,6 +512,12 @@ typedef struct mobot_s
   uint16_t zigbeeAddr;
   char serialID[5];
   mobotFormFactor_t formFactor;
+  /* Properties that never change for a given robot. propertiesKnown is a
+   * mask of MOBOT_PROP_* saying which of them have been read since we
+   * connected, either from the robot or from the property cache. */
+  int propertiesKnown;
+  int protocolVersion;
+  int hwRev;
 
   MUTEX_T* mobotTree_lock;
   COND_T* mobotTree_cond;
@@ -300,6 +526,46 @@ typedef struct mobot_s
    * instance associated with the dongle in order to control it as a robot. */
   struct mobot_s* child; 
   struct mobotInfo_s* children;
+  /* Multi-dongle load balancing. For a dongle, rfChannel is the channel last
+   * set with Mobot_setRFChannel (0 if never set), and congestion counts
+   * recent transaction timeouts through it. For a child, balanceable is set
+   * once the child is fully connected and may be moved between dongles, and
+   * balancePending while a move is scheduled. congestion is protected by
+   * mobotTree_lock. */
+  uint8_t rfChannel;
+  int congestion;
+  int balanceable;
+  int balancePending;
+  /* Fair sharing of the link among the robots on it; see
+   * Mobot_airtimeOwner. On the robot owning the link (the dongle, or the
+   * robot itself for a direct connection), airtimeWindow caps the
+   * transactions on the air at once (0 for no cap), airtimeWaiters lists the
+   * robots waiting for a slot and airtimeVclock is the virtual clock. On
+   * every robot, airtimeVruntime is the link time it has been charged, in
+   * milliseconds, and airtimeRateCap its own limit in transactions per
+   * second (0 for none). airtimeIdleSince is when the owner's link last went
+   * quiet. All protected by the owner's airtime_lock, except
+   * airtimeHolder and airtimeStart, which are protected by commsLock. */
+  MUTEX_T* airtime_lock;
+  COND_T* airtime_cond;
+  int airtimeWindow;
+  int airtimeInFlight;
+  double airtimeVclock;
+  double airtimeBusyTotal;
+  double airtimeIdleSince;
+  struct mobot_s* airtimeWaiters;
+  struct mobot_s* airtimeNextWaiter;
+  int airtimeWaiting;
+  int airtimeGranted;
+  struct mobot_s* airtimeHolder;
+  double airtimeStart;
+  double airtimeVruntime;
+  double airtimeRateCap;
+  double airtimeNextSend;
+  unsigned int airtimeGrants;
+  double airtimeDelayTotal;
+  double airtimeDelayMax;
+  double airtimeBusy;
   MUTEX_T* scan_callback_lock;
   void (*scan_callback) (const char* serialID);
 #if defined (__cplusplus) && defined (NONRELEASE)
@@ -834,6 +1100,7 @@ class DLLIMPORT CMobot
     int setJointDirection(robotJointId_t id, robotJointState_t dir);
     mobot_t *_comms;
     void (*buttonCallback)(CMobot *mobot, int button, int buttonDown);
+    friend class CMobotGroup;
 };
 #endif
 
@@ -967,18 +1234,27 @@ class CMobotGroup
     static void* motionUnstandThread(void*);
     int motionWait();
 
+    /* Make every robot in the group copy leader's joints, hz times a second
+     * at most. See Mobot_mirrorNew. */
+    int mirror(CMobot& leader, double hz);
+    int flushMirror();
+    int stopMirror();
+    int getMirrorLatency(double &mean, double &max);
+    /* Store num keyframes (four joint angles each, in degrees) on every
+     * robot, then play them back on all robots at once. */
+    int uploadPoses(const double* poses, int num);
+    int playPoses(int groupId);
+    /* Every robot's joint angles, in degrees, four per robot, read from all
+     * robots at once. */
+    int getJointAngles(double* angles);
+
   protected:
+    int runMotion(void* (*func)(void*), int i, double d, int nb);
     CMobot **_robots;
     int _numRobots;
-    int argInt;
-    double argDouble;
     int _numAllocated;
-#ifndef _CH_
-    THREAD_T* _thread;
-#else
-    void* _thread;
-#endif
-    int _motionInProgress;
+    mobotTaskQueue_t* _motionQueue;
+    mobotMirror_t* _mirror;
 };
 
 #endif /* If C++ or CH */
@@ -1022,6 +1298,19 @@ DLLIMPORT int Mobot_disableAccelEventCallback(mobot_t* comms);
  * Mobot_dongleGetTTY will write at most len bytes to tty, including the
  * terminating null byte. Returns -1 on error, 0 on success. */
 DLLIMPORT int Mobot_dongleGetTTY(char* tty, size_t len);
+/* Find all attached dongles. ttys points to an array of maxttys buffers,
+ * each len bytes long, which receive the devices' paths in the same format as
+ * Mobot_dongleGetTTY. Returns the number of dongles found (which may be 0), or
+ * -1 on error. Unlike Mobot_dongleGetTTY, no access check is performed. */
+DLLIMPORT int Mobot_dongleGetTTYs(char* ttys, size_t len, int maxttys);
+/* Block until a serial device is plugged in or removed, or until timeout
+ * milliseconds have elapsed. A negative timeout waits forever. Returns 1 if a
+ * change was seen, 0 on timeout, and -1 on error or if hotplug notification
+ * is not supported on this platform (currently only Linux supports it).
+ * Changes since the last Mobot_dongleGetTTYs count too, so one made between
+ * reading the list and waiting is not missed. Call Mobot_dongleGetTTYs again
+ * after a change to get the new list. */
+DLLIMPORT int Mobot_dongleWaitForChange(int timeout);
 DLLIMPORT int Mobot_connectWithZigbeeAddress(mobot_t* comms, uint16_t addr);
 DLLIMPORT int Mobot_enableAccelEventCallback(mobot_t* comms, void* data,
     void (*accelCallback)(int millis, double x, double y, double z, void* data));
@@ -1034,10 +1323,83 @@ DLLIMPORT int Mobot_loadMelody(mobot_t* comms, int id, mobotMelodyNote_t* melody
 DLLIMPORT int Mobot_playMelody(mobot_t* comms, int id);
 DLLIMPORT int Mobot_getAddress(mobot_t* comms);
 DLLIMPORT mobot_t* Mobot_getDongle();
+/* All dongles opened by Mobot_initDongle, in the order they were opened.
+ * Mobot_getDongle() is the same as Mobot_getDongleIndex(0). */
+DLLIMPORT int Mobot_getNumDongles();
+DLLIMPORT mobot_t* Mobot_getDongleIndex(int index);
+/* Move a connected ZigBee child so that its traffic goes through a different
+ * dongle. Both dongles must be on the same RF channel. */
+DLLIMPORT int Mobot_migrateChild(mobot_t* child, mobot_t* dongle);
 DLLIMPORT int Mobot_queryAddresses(mobot_t* comms);
 DLLIMPORT int Mobot_clearQueriedAddresses(mobot_t* comms);
 DLLIMPORT int Mobot_getQueriedAddresses(mobot_t* comms);
 DLLIMPORT int Mobot_setRFChannel(mobot_t* comms, uint8_t channel);
+/* Each connection measures its round trip time and waits about that long
+ * (plus a margin for jitter) for a response before retrying, doubling the wait
+ * on every retry. Mobot_setTimeoutPolicy bounds that wait to [minMsecs,
+ * maxMsecs], sets how many times a message is retried, and sets an overall
+ * deadline per transaction in milliseconds (-1 for none). */
+/* With command coalescing on, setters whose latest value is all that matters
+ * (joint speed, motor power, LED color, direct drive targets) return right
+ * away and are sent in the background. A newer value for the same command and
+ * joint replaces one still waiting, so a saturated link always carries the
+ * latest command. Any other command first waits for the queue to drain, and
+ * stop commands discard it. Mobot_flushCommands waits for the queue to drain
+ * and returns the last error from a background send, if any. */
+DLLIMPORT int Mobot_setCommandCoalescing(mobot_t* comms, int enable);
+DLLIMPORT int Mobot_flushCommands(mobot_t* comms);
+/* Make one or more followers copy the leader's joints. The leader streams
+ * joint events; each follower gets the newest one as a direct motor angle
+ * command, at most hz times a second (hz <= 0 for no limit). Samples that
+ * arrive while a follower is busy are dropped in favor of the next one, so a
+ * slow link adds no backlog. With a rate limit, a sample that arrives before
+ * a follower's next slot waits for the next event; Mobot_mirrorFlush sends
+ * such held samples right away, so call it once the leader comes to rest, or
+ * on a timer of your own to pace updates. Follower joint j is driven to
+ * scale[j]*leader[map[j]-1] + offset[j] (radians), or to offset[j] if map[j]
+ * is 0. NULL map/scale/offset mean joint j follows joint j unchanged.
+ * Followers must be added before Mobot_mirrorStart. Latency is measured in
+ * milliseconds from the leader's event reaching the host to the follower
+ * acknowledging the new target. */
+DLLIMPORT mobotMirror_t* Mobot_mirrorNew(mobot_t* leader);
+DLLIMPORT int Mobot_mirrorAddFollower(mobotMirror_t* mirror, mobot_t* follower,
+    const int map[4], const double scale[4], const double offset[4]);
+DLLIMPORT int Mobot_mirrorStart(mobotMirror_t* mirror, double hz);
+DLLIMPORT int Mobot_mirrorFlush(mobotMirror_t* mirror);
+DLLIMPORT int Mobot_mirrorStop(mobotMirror_t* mirror);
+DLLIMPORT int Mobot_mirrorFree(mobotMirror_t* mirror);
+DLLIMPORT int Mobot_mirrorGetLatency(mobotMirror_t* mirror, int* updates,
+    double* last, double* mean, double* max);
+DLLIMPORT int Mobot_setTimeoutPolicy(mobot_t* comms, int minMsecs, int maxMsecs, int retries, int deadline);
+DLLIMPORT int Mobot_getRoundTripTime(mobot_t* comms, double* srtt, double* rttvar, double* rto);
+/* Commands to robots behind a dongle are queued and coalesced into as few
+ * serial writes as possible. Mobot_flush blocks until everything queued so
+ * far has been written out. Mobot_setTxCoalescing makes the dongle wait up to
+ * usecs microseconds for more commands before writing, and write early once
+ * bytes bytes are queued (bytes == 0 turns coalescing off). Both apply to the
+ * whole dongle, not just this robot. */
+DLLIMPORT int Mobot_flush(mobot_t* comms);
+DLLIMPORT int Mobot_setTxCoalescing(mobot_t* comms, int usecs, int bytes);
+/* Robots sharing a dongle take turns fairly: once the dongle has
+ * Mobot_setAirtimeWindow transactions on the air (default 4, 0 for no cap),
+ * the waiting robot that has used the least link time goes next. The window
+ * belongs to the dongle, so any robot behind it may set it.
+ * Mobot_setRateLimit caps one robot at the given number of transactions per
+ * second (0 removes the cap). Mobot_getAirtimeStats reports how many
+ * transactions the robot has sent, how long they waited for their turn, in
+ * milliseconds, and the robot's share of the link time used so far. */
+DLLIMPORT int Mobot_setAirtimeWindow(mobot_t* comms, int transactions);
+DLLIMPORT int Mobot_setRateLimit(mobot_t* comms, double transactionsPerSecond);
+DLLIMPORT int Mobot_getAirtimeStats(mobot_t* comms, int* transactions,
+    double* meanDelay, double* maxDelay, double* share);
+/* Sample the MOBOT_TELEMETRY_* metrics in the metrics mask every msecs
+ * milliseconds in the background. Polls only go out while the robot's link
+ * is idle, and the period backs off while it is busy, so health polling
+ * never holds up motion commands. Mobot_getTelemetry returns the latest
+ * sample without blocking; it keeps working after Mobot_telemetryStop. */
+DLLIMPORT int Mobot_telemetryStart(mobot_t* comms, int metrics, double msecs);
+DLLIMPORT int Mobot_telemetryStop(mobot_t* comms);
+DLLIMPORT int Mobot_getTelemetry(mobot_t* comms, mobotTelemetry_t* telemetry);
 DLLIMPORT int Mobot_getID(mobot_t* comms);
 DLLIMPORT int Mobot_setID(mobot_t* comms, const char* id);
 DLLIMPORT int Mobot_reboot(mobot_t* comms);
@@ -1068,6 +1430,47 @@ DLLIMPORT int Mobot_driveToNB(mobot_t* comms,
                                double angle4);
 DLLIMPORT int Mobot_enableButtonCallback(mobot_t* comms, void* data, void (*buttonCallback)(void* mobot, int button, int buttonDown));
 DLLIMPORT int Mobot_disableButtonCallback(mobot_t* comms);
+/* Subscribe to the events of comms, or of every robot if comms is NULL.
+ * types is a mask of MOBOT_EVENT_* types, and maxRate, if positive, is the
+ * most events of each type per second the subscriber wants; the rest are
+ * skipped. Every subscriber has its own queue of queueLength events (64 if
+ * 0). When it is full the oldest event is dropped, so a slow subscriber
+ * only ever loses its own events. With a callback, events are delivered on
+ * the subscriber's own thread; without one, call Mobot_pollEvent. */
+DLLIMPORT mobotSubscriber_t* Mobot_subscribe(mobot_t* comms, int types, double maxRate,
+    int queueLength, void (*callback)(const mobotEvent_t* event, void* userdata),
+    void* userdata);
+/* Take the next event off a subscriber's queue, waiting up to msecs
+ * milliseconds for one (forever if negative). Returns -2 on timeout. */
+DLLIMPORT int Mobot_pollEvent(mobotSubscriber_t* sub, mobotEvent_t* event, int msecs);
+DLLIMPORT int Mobot_unsubscribe(mobotSubscriber_t* sub);
+DLLIMPORT int Mobot_getSubscriberStats(mobotSubscriber_t* sub, int* delivered, int* dropped);
+/* Latest-value channels, for consumers that only care about the freshest
+ * joint angles (MOBOT_EVENT_JOINT) or accelerometer reading
+ * (MOBOT_EVENT_ACCEL). Mobot_channelOpen turns the robot's event stream on
+ * and Mobot_channelClose turns it off again once nobody needs it. Each new
+ * event overwrites the last, so there is no queue to fall behind on.
+ * Mobot_readLatest never blocks: it fills in the event and, with cursor
+ * pointing at a counter the caller keeps (starting at 0), sets skipped to
+ * how many updates were overwritten since that caller's last read. Returns 0
+ * for a new value, 1 if nothing changed since the last read and -1 if there
+ * has been no event yet. */
+DLLIMPORT int Mobot_channelOpen(mobot_t* comms, int type);
+DLLIMPORT int Mobot_channelClose(mobot_t* comms, int type);
+DLLIMPORT int Mobot_readLatest(mobot_t* comms, int type, mobotEvent_t* event,
+    unsigned int* cursor, unsigned int* skipped);
+/* Publish the robot's decoded button, joint and accelerometer events to a
+ * named shared memory region that other processes on this machine can map
+ * and read without linking libbarobo; see mobot_shm.h for the layout and
+ * the reading protocol. name may be NULL for "/barobo-<serial ID>". Only
+ * events the robot sends are exported, so turn the streams on as well, for
+ * instance with Mobot_channelOpen. Fails if a region of that name already
+ * exists, as when another process exports the same robot, unless the process
+ * that created it has exited without removing it. Mobot_shmExportStop
+ * removes the region; readers that still have it mapped keep their view of
+ * it. */
+DLLIMPORT int Mobot_shmExportStart(mobot_t* comms, const char* name);
+DLLIMPORT int Mobot_shmExportStop(mobot_t* comms);
 DLLIMPORT int Mobot_enableEventCallback(mobot_t* comms, 
     void (*eventCallback)(const uint8_t* buf, int size, void* userdata), void* data);
 DLLIMPORT int Mobot_disableEventCallback(mobot_t* comms);
@@ -1112,6 +1515,24 @@ DLLIMPORT int Mobot_getFormFactor(mobot_t* comms, int* form);
 DLLIMPORT int Mobot_getHWRev(mobot_t* comms, int* rev);
 DLLIMPORT int Mobot_getJointAngle(mobot_t* comms, robotJointId_t id, double *angle);
 DLLIMPORT int Mobot_getJointAngleAverage(mobot_t* comms, robotJointId_t id, double *angle, int numReadings);
+/* Let joint angle reads, and the relative moves built on them, use angles
+ * the library already has if they are no more than msecs milliseconds old.
+ * A negative value, the default, always asks the robot. */
+DLLIMPORT int Mobot_setJointCacheMaxAge(mobot_t* comms, int msecs);
+/* Like Mobot_getJointAnglesTime, with a staleness bound just for this call */
+DLLIMPORT int Mobot_getJointAnglesCached(mobot_t* comms, 
+                                         int maxAge,
+                                         double *time, 
+                                         double *angle1,
+                                         double *angle2,
+                                         double *angle3,
+                                         double *angle4);
+/* Form factor, protocol version, serial ID, hardware revision and ZigBee
+ * address are cached per serial ID for the life of the process, so
+ * reconnecting to a known robot costs one round trip. With persist set, the
+ * cache is also kept in a file next to the Barobo config file. */
+DLLIMPORT int Mobot_setPropertyCachePersistent(int persist);
+DLLIMPORT int Mobot_clearPropertyCache();
 DLLIMPORT int Mobot_getJointAnglesTime(mobot_t* comms, 
                                        double *time, 
                                        double *angle1, 
@@ -1146,6 +1567,14 @@ DLLIMPORT int Mobot_getJointAnglesAverage(mobot_t* comms,
                                        double *angle3, 
                                        double *angle4,
                                        int numReadings);
+/* Take numReadings joint angle readings in pipelined bursts and combine
+ * them with filter. Each estimate comes with the variance of the readings
+ * behind it; either variance pointer may be NULL. Readings that fail are
+ * left out, and the call only fails if none succeed. */
+DLLIMPORT int Mobot_getJointAngleBurst(mobot_t* comms, robotJointId_t id, int numReadings,
+    mobotFilter_t filter, double param, double *angle, double *variance);
+DLLIMPORT int Mobot_getJointAnglesBurst(mobot_t* comms, int numReadings,
+    mobotFilter_t filter, double param, double angles[4], double variances[4]);
 DLLIMPORT int Mobot_getJointDirection(mobot_t* comms, robotJointId_t id, robotJointState_t *dir);
 DLLIMPORT int Mobot_getJointMaxSpeed(mobot_t* comms, robotJointId_t, double *maxSpeed);
 DLLIMPORT int Mobot_getJointSafetyAngle(mobot_t* comms, double *angle);
@@ -1262,6 +1691,10 @@ DLLIMPORT int Mobot_recordAnglesBegin(mobot_t* comms,
                                      double timeInterval,
                                      int shiftData);
 DLLIMPORT int Mobot_recordAnglesEnd(mobot_t* comms, int* num);
+/* Sampling jitter of the last recording on joint id, in milliseconds, and the
+ * number of samples that were a full period or more late. Recordings of all
+ * four joints report under ROBOT_JOINT1. */
+DLLIMPORT int Mobot_getRecordJitter(mobot_t* comms, robotJointId_t id, double* mean, double* stddev, double* max, int* overruns);
 DLLIMPORT int Mobot_recordDistanceBegin(mobot_t* comms,
                                      robotJointId_t id,
                                      double **time,
@@ -1351,6 +1784,10 @@ DLLIMPORT int Mobot_smoothMoveToNB(
     double vmax, 
     double angle);
 DLLIMPORT int Mobot_stop(mobot_t* comms);
+/* Stop num robots at once. Each stop goes through the priority lane, and all
+ * of them are in flight together, so the worst case latency is that of the
+ * slowest robot rather than growing with the size of the group. */
+DLLIMPORT int Mobot_broadcastStop(mobot_t** comms, int num);
 DLLIMPORT int Mobot_stopOneJoint(mobot_t* comms, robotJointId_t id);
 DLLIMPORT int Mobot_stopTwoJoints(mobot_t* comms, robotJointId_t id1, robotJointId_t id2);
 DLLIMPORT int Mobot_stopThreeJoints(mobot_t* comms, robotJointId_t id1, robotJointId_t id2, robotJointId_t id3);
@@ -1385,6 +1822,10 @@ DLLIMPORT int Mobot_motionUnstand(mobot_t* comms);
 DLLIMPORT int SendToIMobot(mobot_t* comms, uint8_t cmd, const void* data, int datasize);
 //DLLIMPORT int SendToMobotDirect(mobot_t* comms, const void* data, int datasize);
 DLLIMPORT int MobotMsgTransaction(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int sendsize);
+DLLIMPORT int MobotMsgTransactionPriority(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int sendsize);
+/* Like MobotMsgTransaction, but give up after msecs milliseconds in total,
+ * retries included. */
+DLLIMPORT int MobotMsgTransactionDeadline(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int sendsize, int msecs);
 DLLIMPORT int RecvFromIMobot(mobot_t* comms, uint8_t* buf, int size);
 
 /* Non-Blocking compound motion functions */
@@ -1401,6 +1842,61 @@ DLLIMPORT int Mobot_motionTurnLeftNB(mobot_t* comms, double angle);
 DLLIMPORT int Mobot_motionTurnRightNB(mobot_t* comms, double angle);
 DLLIMPORT int Mobot_motionUnstandNB(mobot_t* comms);
 DLLIMPORT int Mobot_motionWait(mobot_t* comms);
+/* A motion sequence is a list of steps, each of which sends joint targets
+ * and then waits for the joints in its waitMask (bit 0 is joint 1) to arrive
+ * before the next step starts. Arrival is detected from the robot's joint
+ * events as soon as every waited joint is within the sequence's tolerance
+ * (default 2 degrees) of its target; once the events go quiet, a single joint
+ * state query settles it instead. Angles are in radians. A step that has not
+ * arrived after the sequence's timeout (default 30 seconds, 0 waits forever)
+ * fails the run with -2. Mobot_seqRunNB runs the sequence on the robot's
+ * motion queue; the sequence must not be freed before Mobot_motionWait
+ * returns. */
+DLLIMPORT mobotSeq_t* Mobot_seqNew();
+DLLIMPORT int Mobot_seqFree(mobotSeq_t* seq);
+DLLIMPORT int Mobot_seqAddMove(mobotSeq_t* seq, int mask, const double angles[4], int waitMask);
+DLLIMPORT int Mobot_seqAddJointTo(mobotSeq_t* seq, robotJointId_t id, double angle);
+DLLIMPORT int Mobot_seqAddDelay(mobotSeq_t* seq, double msecs);
+DLLIMPORT int Mobot_seqSetTolerance(mobotSeq_t* seq, double radians);
+DLLIMPORT int Mobot_seqSetTimeout(mobotSeq_t* seq, double msecs);
+DLLIMPORT int Mobot_seqRun(mobot_t* comms, const mobotSeq_t* seq);
+DLLIMPORT int Mobot_seqRunNB(mobot_t* comms, const mobotSeq_t* seq);
+/* Keyframe poses, stored on the robot. poses holds num keyframes of four
+ * joint angles each, in radians. Mobot_uploadPoses drives the robot through
+ * the keyframes, saves each one as pose 0, 1, ..., and reads them back with
+ * Mobot_verifyPoses. Mobot_uploadPosesGroup does the same on several robots
+ * at once. Mobot_formPoseGroup makes the robots a firmware group with
+ * comms[0] as its master, and Mobot_playPoses tells the master to play the
+ * stored poses on every member in step. */
+DLLIMPORT int Mobot_uploadPoses(mobot_t* comms, const double* poses, int num);
+DLLIMPORT int Mobot_verifyPoses(mobot_t* comms, const double* poses, int num, double tolerance);
+DLLIMPORT int Mobot_uploadPosesGroup(mobot_t** comms, int numRobots, const double* poses, int num);
+/* Read the MOBOT_SNAPSHOT_* fields of numRobots robots at once. Every
+ * robot is asked at the same time, so the whole group costs about one round
+ * trip instead of one per robot. Returns once every robot has answered or
+ * msecs milliseconds have passed, 0 if all of them answered and -1
+ * otherwise; see snap->status for which. */
+DLLIMPORT mobotGroupSnapshot_t* Mobot_groupSnapshotNew(int numRobots);
+DLLIMPORT int Mobot_groupSnapshotFree(mobotGroupSnapshot_t* snap);
+DLLIMPORT int Mobot_groupSnapshot(mobot_t** comms, int numRobots, int fields, int msecs,
+    mobotGroupSnapshot_t* snap);
+DLLIMPORT int Mobot_moveToPose(mobot_t* comms, int index);
+DLLIMPORT int Mobot_formPoseGroup(mobot_t** comms, int num, int groupId);
+DLLIMPORT int Mobot_playPoses(mobot_t* master, int groupId);
+/* Run func(arg) on the motion executor, after every task already submitted
+ * to the same queue has finished. The returned handle must be passed to
+ * exactly one of Mobot_taskJoin or Mobot_taskDetach. */
+DLLIMPORT mobotTask_t* Mobot_taskSubmit(mobotTaskQueue_t* queue, void* (*func)(void*), void* arg);
+DLLIMPORT int Mobot_taskJoin(mobotTask_t* task, void** result);
+DLLIMPORT int Mobot_taskDetach(mobotTask_t* task);
+DLLIMPORT mobotTaskQueue_t* Mobot_taskQueueNew();
+DLLIMPORT int Mobot_taskQueueFree(mobotTaskQueue_t* queue);
+/* Block until every task submitted to the queue so far has finished */
+DLLIMPORT int Mobot_taskQueueWait(mobotTaskQueue_t* queue);
+/* A handle to the motion most recently started with one of the *NB
+ * functions, or NULL if there has been none. The handle must be passed to
+ * exactly one of Mobot_taskJoin or Mobot_taskDetach. */
+DLLIMPORT mobotTask_t* Mobot_motionTask(mobot_t* comms);
 int shiftDataIsEnabled(mobot_t* comms);
 DLLIMPORT double systemTime();
 #ifdef __cplusplus
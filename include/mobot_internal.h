@@ -117,8 +117,82 @@ void* commsEngine(void* arg);
 void* callbackThread(void* arg);
 
 #define MAX_RETRIES 3
+/* Transaction timeouts, in milliseconds. The timeout starts out at
+ * DEF_RTO_INITIAL and then tracks the measured round trip time, staying
+ * between DEF_RTO_MIN and DEF_RTO_MAX. */
+#define DEF_RTO_INITIAL 700
+#define DEF_RTO_MIN 100
+#define DEF_RTO_MAX 2000
+/* Commands that must not run twice, such as relative moves and setID, are
+ * never retried sooner than this, which was the fixed timeout before the
+ * estimate was adaptive */
+#define DEF_RTO_UNSAFE 700
+/* Most worker threads the executor will start for NB motions, for draining
+ * coalesced setters, for short queries such as group snapshots, and for
+ * broadcast stops and mirror updates */
+#define TASK_MAX_WORKERS 32
+#define TASK_MAX_COALESCE_WORKERS 4
+#define TASK_MAX_QUERY_WORKERS 16
+#define TASK_MAX_URGENT_WORKERS 32
+#define TASK_MAX_MIRROR_WORKERS 32
+/* Worker pools of the task executor */
+enum mobotTaskPool_e {
+  TASK_POOL_MOTION,
+  TASK_POOL_COALESCE,
+  TASK_POOL_QUERY,
+  TASK_POOL_URGENT,
+  TASK_POOL_MIRROR,
+  TASK_NUM_POOLS
+};
+/* Transactions a dongle lets onto the air at once before robots sharing it
+ * have to take turns */
+#define DEF_AIRTIME_WINDOW 4
+/* Background transactions only go out once the link has been quiet this
+ * long, in milliseconds */
+#define TELEMETRY_IDLE_GAP 20
+/* Most a busy link may stretch the telemetry poll period, as a multiple */
+#define TELEMETRY_MAX_BACKOFF 16
+/* How long connecting to a robot over TCP may take, in milliseconds */
+#define SOCKET_CONNECT_TIMEOUT 5000
+/* Most bytes the comms engine takes off a TCP or RFCOMM socket at once */
+#define SOCKET_READ_CHUNK 1024
+/* How long CMobotGroup waits for all of its robots to answer a group query,
+ * in milliseconds */
+#define GROUP_QUERY_DEADLINE 1000
+/* Most requests one burst puts on the line at once, and how long each one
+ * is allowed to add to the burst's timeout, in milliseconds */
+#define BURST_MAX_READINGS 8
+#define BURST_SPACING 10
+/* Events an event bus subscriber can have waiting, unless it asks for
+ * another number */
+#define EVENT_QUEUE_DEFAULT 64
+
+/* Bits of mobot_t::propertiesKnown */
+#define MOBOT_PROP_FORMFACTOR 0x01
+#define MOBOT_PROP_VERSION    0x02
+#define MOBOT_PROP_SERIALID   0x04
+#define MOBOT_PROP_HWREV      0x08
+#define MOBOT_PROP_ADDRESS    0x10
 //int MobotMsgTransaction(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int sendsize);
 int Mobot_waitForReportedSerialID(mobot_t* comms, char* id);
+double Mobot_monotonicMsecs();
+unsigned int Mobot_jointCacheGeneration(mobot_t* comms);
+void Mobot_jointCacheInvalidate(mobot_t* comms);
+void Mobot_jointCacheStore(mobot_t* comms, uint32_t millis, const double angles[4], int fromEvent, unsigned int gen);
+int Mobot_jointCacheLookup(mobot_t* comms, int maxAge, double* time, double angles[4]);
+void Mobot_channelWrite(mobotChannel_t* channel, uint32_t millis, const double* values, int num);
+void Mobot_periodicStart(mobotPeriodic_t* p, double msecs);
+int Mobot_periodicWait(mobotPeriodic_t* p);
+void Mobot_sleepUntil(double msecs);
+/* Reference counted joint event stream, shared by the mirroring and motion
+ * sequence code and the user's joint callback */
+int Mobot_jointEventsAcquire(mobot_t* comms);
+int Mobot_jointEventsRelease(mobot_t* comms);
+int Mobot_accelEventsAcquire(mobot_t* comms);
+int Mobot_accelEventsRelease(mobot_t* comms);
+int Mobot_jointEventWait(mobot_t* comms, unsigned int* seq, double angles[4], double msecs);
+/* Send a GRP_CMD_* message, framed with GRP_CMD_END. There is no response. */
+int Mobot_sendGroupCommand(mobot_t* comms, uint8_t cmd, const void* data, int datasize);
 #endif /* Not _CH_ */
 
 #ifdef _WIN32
@@ -134,6 +208,25 @@ int str2ba(const char *str, bdaddr_t *ba);
 int finishConnect (mobot_t* comms);
 int finishConnectWithoutCommsThread(mobot_t* comms);
 int getFormFactor(mobot_t* comms, int* form);
+int getSerialID(mobot_t* comms);
+void Mobot_propertiesStore(mobot_t* comms);
+/* A queue whose tasks run on one of the TASK_POOL_* worker pools */
+mobotTaskQueue_t* Mobot_taskQueueNewPool(int pool);
+/* Start a NB motion on the robot's motion queue, see Mobot_motionTask */
+int Mobot_motionSubmit(mobot_t* comms, void* (*func)(void*), void* arg);
+/* Like MobotMsgTransaction, but for setters where only the latest value per
+ * (cmd, key) matters. With coalescing on, buf gets a fake success response. */
+int MobotMsgTransactionCoalesced(mobot_t* comms, uint8_t cmd, int key, /*IN&OUT*/ void* buf, int size);
+/* Feed bytes read off a TCP or RFCOMM socket to the message parser */
+void Mobot_socketParse(mobot_t* comms, const uint8_t* buf, int len);
+/* Combine n burst readings into one estimate; sorts x */
+double Mobot_burstFilter(double* x, int n, mobotFilter_t filter, double param);
+/* Send count copies of a read request back to back, see mobot.cpp */
+int MobotMsgTransactionBurst(mobot_t* comms, uint8_t cmd, const void* req, int size,
+    uint8_t* dest, int stride, int count);
+/* Like MobotMsgTransaction, but only if the link is idle; returns -3 without
+ * sending anything otherwise. Never retried. */
+int MobotMsgTransactionBackground(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int size);
 
 /* Hide all of the C-style structs and API from CH */
 #ifndef C_ONLY
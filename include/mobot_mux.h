@@ -0,0 +1,68 @@
+/*
+   Copyright 2013 Barobo, Inc.
+
+   This file is part of libbarobo.
+
+   BaroboLink is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   BaroboLink is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with BaroboLink.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MOBOT_MUX_H_
+#define _MOBOT_MUX_H_
+
+/* Protocol spoken by mobotmuxd, the daemon that owns a dongle on behalf of
+ * any number of local processes.
+ *
+ * Clients connect to a Unix domain stream socket (MOBOT_MUX_SOCKET unless
+ * the daemon was told otherwise) and exchange frames. Every frame starts
+ * with a mobotMuxHeader_t, in host byte order since both ends are on the
+ * same machine, followed by length - sizeof(mobotMuxHeader_t) bytes of
+ * payload. A client may have any number of requests outstanding. Responses
+ * carry the tag of the request they answer, and requests to different robots
+ * can be answered out of order.
+ *
+ * serialID names the robot, or is all zero for the robot plugged into the
+ * dongle.
+ *
+ * MOBOT_MUX_TRANSACTION
+ *   Request payload: the command byte as the robot sees it, then the
+ *   command's data. Response payload: the robot's whole response frame.
+ *   status is 0, or the libbarobo error code of the transaction.
+ *
+ * MOBOT_MUX_EXPORT
+ *   Request payload: one byte, a mask of MOBOT_EVENT_JOINT and
+ *   MOBOT_EVENT_ACCEL. The daemon turns those event streams on for as long
+ *   as the client stays connected and exports the robot's events to shared
+ *   memory. Response payload: the NUL-terminated name of the region, laid
+ *   out as described in mobot_shm.h. */
+
+#include <stdint.h>
+
+#define MOBOT_MUX_SOCKET "/tmp/barobo-mux.sock"
+
+#define MOBOT_MUX_TRANSACTION 1
+#define MOBOT_MUX_EXPORT      2
+
+/* Largest frame either side sends */
+#define MOBOT_MUX_MAX_FRAME 512
+
+typedef struct mobotMuxHeader_s
+{
+  uint16_t length;
+  uint8_t op;
+  int8_t status;
+  uint16_t tag;
+  char serialID[4];
+} mobotMuxHeader_t;
+
+#endif
@@ -0,0 +1,84 @@
+/*
+   Copyright 2013 Barobo, Inc.
+
+   This file is part of libbarobo.
+
+   BaroboLink is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   BaroboLink is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with BaroboLink.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MOBOT_SHM_H_
+#define _MOBOT_SHM_H_
+
+/* Layout of the shared memory a robot's telemetry is exported to by
+ * Mobot_shmExportStart. This header does not need the rest of libbarobo,
+ * so reader processes can include it on its own, map the region read-only
+ * and follow the robot without any system call per sample.
+ *
+ * The region is named "/barobo-<serial ID>" unless the exporting process
+ * picked another name (shm_open on POSIX; on Windows a file mapping named
+ * "Local\barobo-<serial ID>"). It starts with a mobotShmHeader_t, followed
+ * by a ring of slots records.
+ *
+ * There is a single writer. Record number n (counting from 0 since the
+ * export started) lives in ring[n % slots]. The writer sets its seq to
+ * 2n+1, fills it in, then sets seq to 2n+2; head is bumped to n+1 after
+ * that. To read record n, a reader checks that seq is 2n+2, copies the
+ * record, and checks seq again: if either check fails the writer has lapped
+ * the reader and the record is lost. latestJoint and latestAccel always hold
+ * the newest record of their type, under a sequence count of their own: seq
+ * is odd while they are written, and a copy is consistent if seq was even
+ * and unchanged around it. All counters wrap at 2^32. */
+
+#include <stdint.h>
+
+#define MOBOT_SHM_MAGIC   0x54424f4d /* "MOBT" */
+#define MOBOT_SHM_VERSION 1
+#define MOBOT_SHM_SLOTS   1024
+
+/* Record types. The same values as the MOBOT_EVENT_* masks. */
+#define MOBOT_SHM_BUTTON 0x01
+#define MOBOT_SHM_JOINT  0x02
+#define MOBOT_SHM_ACCEL  0x04
+
+/* One decoded event. millis is the robot's clock, and hostTime the
+ * exporting process' monotonic clock, both in milliseconds. values holds
+ * the joint angles in radians, the accelerometer reading in g, or the
+ * button number and whether it is down. */
+typedef struct mobotShmRecord_s
+{
+  volatile uint32_t seq;
+  uint32_t type;
+  uint32_t millis;
+  uint32_t reserved;
+  double hostTime;
+  double values[4];
+} mobotShmRecord_t;
+
+typedef struct mobotShmHeader_s
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slots;
+  uint32_t recordSize;
+  char serialID[8];
+  volatile uint32_t head;
+  /* Process ID of the writer, so that a region left behind by one that
+   * died can be told from one still in use */
+  uint32_t writerPid;
+  mobotShmRecord_t latestJoint;
+  mobotShmRecord_t latestAccel;
+  mobotShmRecord_t ring[MOBOT_SHM_SLOTS];
+} mobotShmHeader_t;
+
+#endif
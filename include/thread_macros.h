@@ -54,6 +54,13 @@
 
 #define THREAD_DETACH() 
 
+/* Identity of the calling thread */
+#define THREAD_ID_T DWORD
+#define THREAD_SELF() \
+  GetCurrentThreadId()
+#define THREAD_ID_EQUAL(a, b) \
+  ((a) == (b))
+
 /* ***** */
 /* MUTEX */
 /* ***** */
@@ -91,6 +98,9 @@
 #define COND_INIT(cond) \
   *cond = CreateEvent(NULL, TRUE, TRUE, NULL);\
   ResetEvent(*cond)
+/* WaitForSingleObject timeouts are relative already */
+#define COND_INIT_MONOTONIC(cond) \
+  COND_INIT(cond)
 /* Destroy */
 #define COND_DESTROY(cond)
 /* Functions */
@@ -115,6 +125,26 @@ WaitForSingleObject( *cond, INFINITE)
 #define COND_SIGNAL(cond) \
   SetEvent(*cond)
 
+/* Full memory barrier */
+#define MEMORY_BARRIER() \
+  MemoryBarrier()
+
+/* Run func exactly once, however many threads get here at the same time.
+ * Latecomers wait until it has returned. */
+#define ONCE_T volatile LONG
+#define ONCE_INIT 0
+#define ONCE(once, func) \
+  do { \
+    if(InterlockedCompareExchange(&(once), 1, 0) == 0) { \
+      func(); \
+      InterlockedExchange(&(once), 2); \
+    } else { \
+      while((once) != 2) { \
+        Sleep(0); \
+      } \
+    } \
+  } while(0)
+
 
 /* ********* *
  * SEMAPHORE *
@@ -164,6 +194,7 @@ WaitForSingleObject( *cond, INFINITE)
 /* * * * * * * * * * * * */
 #else
 #include <pthread.h>
+#include <time.h>
 #define THREAD_T pthread_t
 #define THREAD_CREATE( thread_handle, function, arg ) \
   while(pthread_create( \
@@ -189,6 +220,13 @@ WaitForSingleObject( *cond, INFINITE)
 #define THREAD_EXIT() \
   pthread_exit(NULL)
 
+/* Identity of the calling thread */
+#define THREAD_ID_T pthread_t
+#define THREAD_SELF() \
+  pthread_self()
+#define THREAD_ID_EQUAL(a, b) \
+  pthread_equal(a, b)
+
 /* ***** */
 /* MUTEX */
 /* ***** */
@@ -220,6 +258,22 @@ fprintf(stderr, "pthread lock error: %s:%d\n", __FILE__, __LINE__)
 /* Init */
 #define COND_INIT(cond) \
   pthread_cond_init(cond, NULL)
+/* Timed waits on this condition take CLOCK_MONOTONIC deadlines, so they are
+ * not thrown off by the wall clock being set. OS X has no
+ * pthread_condattr_setclock; use pthread_cond_timedwait_relative_np there. */
+#ifdef __MACH__
+#define COND_INIT_MONOTONIC(cond) \
+  pthread_cond_init(cond, NULL)
+#else
+#define COND_INIT_MONOTONIC(cond) \
+  do { \
+    pthread_condattr_t cond_attr; \
+    pthread_condattr_init(&cond_attr); \
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC); \
+    pthread_cond_init(cond, &cond_attr); \
+    pthread_condattr_destroy(&cond_attr); \
+  } while(0)
+#endif
 /* New */
 #define COND_NEW(cond) \
   cond = (pthread_cond_t*)malloc(sizeof(pthread_cond_t)); \
@@ -250,6 +304,17 @@ pthread_cond_wait( cond, mutex );
 #define COND_SIGNAL(cond) \
   pthread_cond_signal( cond )
 
+/* Full memory barrier */
+#define MEMORY_BARRIER() \
+  __sync_synchronize()
+
+/* Run func exactly once, however many threads get here at the same time.
+ * Latecomers wait until it has returned. */
+#define ONCE_T pthread_once_t
+#define ONCE_INIT PTHREAD_ONCE_INIT
+#define ONCE(once, func) \
+  pthread_once(&(once), func)
+
 /* ********* *
  * SEMAPHORE *
  * ********* */
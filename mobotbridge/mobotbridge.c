@@ -0,0 +1,505 @@
+/*
+   Copyright 2013 Barobo, Inc.
+
+   This file is part of libbarobo.
+
+   BaroboLink is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   BaroboLink is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with BaroboLink.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* mobotbridge: exports the robots behind a local dongle over TCP, to be
+ * driven from other machines with Mobot_connectWithIPAddress.
+ *
+ * Each exported robot listens on a port of its own: the dongle's robot on
+ * the default port, and any robot given with -z on the port given there.
+ * Clients speak the plain protocol libbarobo uses for TCP and Bluetooth
+ * robots, so an unmodified client works. The bridge wraps each request in
+ * the ZigBee envelope for its robot and remembers which client it came
+ * from. A robot only has one request on the air at a time, since its
+ * responses carry nothing but its address; requests from several clients
+ * for the same robot wait their turn in order, and different robots run in
+ * parallel. Events go to every client of the robot that sent them.
+ *
+ * Try it over loopback with
+ *   mobotbridge -t /dev/ttyACM0 &
+ * and Mobot_connectWithTCP() in the client. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "mobot.h"
+#include "dongle.h"
+#include "commands.h"
+#include "thread_macros.h"
+
+#define BRIDGE_PORT 5768
+#define BRIDGE_BAUD 230400
+#define MAX_ROBOTS 16
+#define MAX_CLIENTS 64
+/* How long a robot has to answer before the bridge gives up on a request,
+ * in milliseconds. The next request goes out one more timeout later; see
+ * robot_t. The client does its own retrying. */
+#define BRIDGE_TIMEOUT 2000
+
+typedef struct client_s
+{
+  int fd;
+  int robot;
+  uint8_t in[512];
+  int inBytes;
+} client_t;
+
+typedef struct request_s
+{
+  client_t* client;
+  uint8_t frame[256];
+  int len;
+  struct request_s* next;
+} request_t;
+
+typedef struct robot_s
+{
+  uint16_t address;
+  int port;
+  int listener;
+  /* Requests waiting for the air, oldest first */
+  request_t* head;
+  request_t* tail;
+  /* Whose request is on the air, if any. NULL while busy means its client
+   * went away and the answer is thrown out. */
+  int busy;
+  client_t* owner;
+  double sentAt;
+  /* Set once the request on the air has timed out. Nothing in a response
+   * says which request it answers, so the robot stays busy for one more
+   * timeout: a late answer is thrown out then, rather than handed to the
+   * client whose request goes out next. */
+  int draining;
+} robot_t;
+
+static MOBOTdongle g_dongle;
+static robot_t g_robots[MAX_ROBOTS];
+static int g_numRobots = 0;
+static client_t* g_clients[MAX_CLIENTS];
+static int g_numClients = 0;
+/* Protects everything above but the dongle, which has its own locking */
+static MUTEX_T g_lock;
+static volatile sig_atomic_t g_quit = 0;
+static volatile int g_readerDone = 0;
+
+static void onSignal(int sig)
+{
+  g_quit = 1;
+}
+
+static double monotonicMsecs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Write to a client without ever blocking the bridge. A client too slow to
+ * take what it asked for is shut down; the main loop then sees it hang up. */
+static void clientSend(client_t* client, const uint8_t* buf, int len)
+{
+  if(send(client->fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT) != len) {
+    shutdown(client->fd, SHUT_RDWR);
+  }
+}
+
+/* Put the next waiting request for robot on the air. Called with g_lock
+ * held. */
+static void robotDispatch(robot_t* robot)
+{
+  request_t* req;
+  uint8_t env[256];
+  while(!robot->busy && robot->head != NULL) {
+    req = robot->head;
+    robot->head = req->next;
+    if(robot->head == NULL) {
+      robot->tail = NULL;
+    }
+    env[0] = req->frame[0];
+    env[1] = req->len + 5;
+    env[2] = robot->address >> 8;
+    env[3] = robot->address & 0x00ff;
+    env[4] = 1;
+    memcpy(&env[5], req->frame, req->len);
+    if(dongleWrite(&g_dongle, env, req->len + 5) == -1) {
+      fprintf(stderr, "(barobo) ERROR: mobotbridge: could not write to the dongle\n");
+    } else if(req->frame[req->len - 1] == MSG_SENDEND) {
+      /* Group commands go unanswered, so only wait on everything else */
+      robot->busy = 1;
+      robot->owner = req->client;
+      robot->sentAt = monotonicMsecs();
+    }
+    free(req);
+  }
+}
+
+static robot_t* robotFind(uint16_t address)
+{
+  int i;
+  for(i = 0; i < g_numRobots; i++) {
+    if(g_robots[i].address == address) {
+      return &g_robots[i];
+    }
+  }
+  return NULL;
+}
+
+/* Handle one message from the dongle. Called with g_lock held. */
+static void dongleMessage(uint8_t* buf, long len)
+{
+  robot_t* robot;
+  uint16_t address;
+  int i;
+  if(len < 7 || buf[1] != len) {
+    return;
+  }
+  address = (buf[2] << 8) | buf[3];
+  if(buf[0] == RESP_OK || buf[0] == RESP_ERR || buf[0] == RESP_ALREADY_PAIRED) {
+    robot = robotFind(address);
+    if(robot == NULL || !robot->busy) {
+      return;
+    }
+    if(robot->owner != NULL && buf[6] >= 2 && 5 + buf[6] <= len) {
+      clientSend(robot->owner, &buf[5], buf[6]);
+    }
+    robot->busy = 0;
+    robot->owner = NULL;
+    robot->draining = 0;
+    robotDispatch(robot);
+  } else if(buf[0] == EVENT_REPORTADDRESS) {
+    /* Only the dongle's own robot can scan for others */
+    for(i = 0; i < g_numClients; i++) {
+      if(g_robots[g_clients[i]->robot].address == 0) {
+        clientSend(g_clients[i], buf, len);
+      }
+    }
+  } else {
+    /* Each client only ever sees its own robot, which is always address 0
+     * as far as it can tell */
+    buf[2] = 0;
+    buf[3] = 0;
+    for(i = 0; i < g_numClients; i++) {
+      if(g_robots[g_clients[i]->robot].address == address) {
+        clientSend(g_clients[i], buf, len);
+      }
+    }
+  }
+}
+
+static void* dongleThread(void* arg)
+{
+  uint8_t buf[256];
+  long len;
+  while(!g_quit) {
+    len = dongleRead(&g_dongle, buf, sizeof(buf));
+    if(len == -1) {
+      /* Interrupted by main at shutdown, otherwise the dongle is gone */
+      if(!g_quit) {
+        fprintf(stderr, "(barobo) ERROR: mobotbridge: lost the dongle\n");
+        g_quit = 1;
+      }
+      break;
+    }
+    MUTEX_LOCK(&g_lock);
+    dongleMessage(buf, len);
+    MUTEX_UNLOCK(&g_lock);
+  }
+  g_readerDone = 1;
+  return NULL;
+}
+
+/* Queue up whatever complete requests the client has sent. Returns -1 if
+ * the client hung up or sent something that is not a request. Called with
+ * g_lock held. */
+static int clientRead(client_t* client)
+{
+  robot_t* robot = &g_robots[client->robot];
+  request_t* req;
+  ssize_t n;
+  int used = 0;
+  int len;
+  n = recv(client->fd, client->in + client->inBytes, sizeof(client->in) - client->inBytes, MSG_DONTWAIT);
+  if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+    return -1;
+  }
+  if(n < 0) {
+    return 0;
+  }
+  client->inBytes += n;
+  while(client->inBytes - used >= 2) {
+    len = client->in[used + 1];
+    /* The envelope adds five bytes and has to fit in a length byte too */
+    if(len < 3 || len + 5 > 255) {
+      return -1;
+    }
+    if(client->inBytes - used < len) {
+      break;
+    }
+    req = (request_t*)malloc(sizeof(request_t));
+    if(req == NULL) {
+      return -1;
+    }
+    req->client = client;
+    memcpy(req->frame, client->in + used, len);
+    req->len = len;
+    req->next = NULL;
+    if(robot->tail != NULL) {
+      robot->tail->next = req;
+    } else {
+      robot->head = req;
+    }
+    robot->tail = req;
+    used += len;
+  }
+  memmove(client->in, client->in + used, client->inBytes - used);
+  client->inBytes -= used;
+  return 0;
+}
+
+/* Forget a client. Called with g_lock held. */
+static void clientDrop(int index)
+{
+  client_t* client = g_clients[index];
+  robot_t* robot = &g_robots[client->robot];
+  request_t** link = &robot->head;
+  request_t* req;
+  robot->tail = NULL;
+  while(*link != NULL) {
+    req = *link;
+    if(req->client == client) {
+      *link = req->next;
+      free(req);
+    } else {
+      robot->tail = req;
+      link = &req->next;
+    }
+  }
+  if(robot->owner == client) {
+    robot->owner = NULL;
+  }
+  close(client->fd);
+  free(client);
+  g_clients[index] = g_clients[--g_numClients];
+}
+
+static int listenOn(int port)
+{
+  struct sockaddr_in6 addr;
+  int fd;
+  int on = 1;
+  int off = 0;
+  fd = socket(AF_INET6, SOCK_STREAM, 0);
+  if(fd < 0) {
+    return -1;
+  }
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  /* Take IPv4 clients on the same socket */
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void usage(const char* argv0)
+{
+  fprintf(stderr,
+      "Usage: %s [-t tty] [-b baud] [-p port] [-w window_us] [-z address:port]...\n"
+      "  -z exports the robot with the given ZigBee address (hex) as well as\n"
+      "     the dongle's own robot\n", argv0);
+}
+
+int main(int argc, char* argv[])
+{
+  char tty[64];
+  unsigned long baud = BRIDGE_BAUD;
+  long window = 0;
+  struct pollfd fds[MAX_ROBOTS + MAX_CLIENTS];
+  client_t* client;
+  THREAD_T reader;
+  unsigned int address;
+  int port;
+  double now;
+  int nfds;
+  int fd;
+  int on = 1;
+  int rc;
+  int i;
+
+  tty[0] = '\0';
+  g_robots[0].address = 0;
+  g_robots[0].port = BRIDGE_PORT;
+  g_numRobots = 1;
+  for(i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+      snprintf(tty, sizeof(tty), "%s", argv[++i]);
+    } else if(!strcmp(argv[i], "-b") && i + 1 < argc) {
+      baud = strtoul(argv[++i], NULL, 10);
+    } else if(!strcmp(argv[i], "-p") && i + 1 < argc) {
+      g_robots[0].port = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-w") && i + 1 < argc) {
+      window = atol(argv[++i]);
+    } else if(!strcmp(argv[i], "-z") && i + 1 < argc &&
+        g_numRobots < MAX_ROBOTS &&
+        sscanf(argv[++i], "%x:%d", &address, &port) == 2) {
+      g_robots[g_numRobots].address = address;
+      g_robots[g_numRobots].port = port;
+      g_numRobots++;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  if(tty[0] == '\0' && Mobot_dongleGetTTY(tty, sizeof(tty)) == -1) {
+    fprintf(stderr, "(barobo) ERROR: mobotbridge: no dongle found\n");
+    return 1;
+  }
+  if(dongleOpen(&g_dongle, tty, baud)) {
+    fprintf(stderr, "(barobo) ERROR: mobotbridge: could not open %s\n", tty);
+    return 1;
+  }
+  /* Requests from many clients arrive in clumps; give the dongle a chance to
+   * write a clump out at once */
+  dongleSetTxCoalescing(&g_dongle, window, DONGLE_TX_BUFSIZE);
+
+  for(i = 0; i < g_numRobots; i++) {
+    g_robots[i].listener = listenOn(g_robots[i].port);
+    if(g_robots[i].listener < 0) {
+      fprintf(stderr, "(barobo) ERROR: mobotbridge: could not listen on port %d\n",
+          g_robots[i].port);
+      return 1;
+    }
+    g_robots[i].head = g_robots[i].tail = NULL;
+    g_robots[i].busy = 0;
+    g_robots[i].owner = NULL;
+    g_robots[i].draining = 0;
+  }
+
+  MUTEX_INIT(&g_lock);
+  THREAD_CREATE(&reader, dongleThread, NULL);
+
+  while(!g_quit) {
+    nfds = 0;
+    for(i = 0; i < g_numRobots; i++) {
+      fds[nfds].fd = g_robots[i].listener;
+      fds[nfds].events = POLLIN;
+      nfds++;
+    }
+    MUTEX_LOCK(&g_lock);
+    for(i = 0; i < g_numClients; i++) {
+      fds[nfds].fd = g_clients[i]->fd;
+      fds[nfds].events = POLLIN;
+      nfds++;
+    }
+    MUTEX_UNLOCK(&g_lock);
+    /* Wake up now and then to time out robots that never answered */
+    rc = poll(fds, nfds, 100);
+    if(rc < 0 && errno != EINTR) {
+      perror("(barobo) ERROR: mobotbridge: poll");
+      break;
+    }
+
+    MUTEX_LOCK(&g_lock);
+    /* Clients last to first, so that dropping one does not disturb the ones
+     * still to be looked at */
+    for(i = g_numClients - 1; i >= 0; i--) {
+      if(rc > 0 && fds[g_numRobots + i].revents != 0 && clientRead(g_clients[i])) {
+        clientDrop(i);
+      }
+    }
+    now = monotonicMsecs();
+    for(i = 0; i < g_numRobots; i++) {
+      if(g_robots[i].busy && now - g_robots[i].sentAt > BRIDGE_TIMEOUT) {
+        if(g_robots[i].draining) {
+          g_robots[i].busy = 0;
+          g_robots[i].draining = 0;
+        } else {
+          g_robots[i].draining = 1;
+          g_robots[i].sentAt = now;
+        }
+        g_robots[i].owner = NULL;
+      }
+      robotDispatch(&g_robots[i]);
+    }
+    MUTEX_UNLOCK(&g_lock);
+    dongleFlush(&g_dongle);
+
+    for(i = 0; i < g_numRobots; i++) {
+      if(rc <= 0 || !(fds[i].revents & POLLIN)) {
+        continue;
+      }
+      fd = accept(g_robots[i].listener, NULL, NULL);
+      if(fd < 0) {
+        continue;
+      }
+      MUTEX_LOCK(&g_lock);
+      if(g_numClients == MAX_CLIENTS) {
+        MUTEX_UNLOCK(&g_lock);
+        close(fd);
+        continue;
+      }
+      /* Requests and responses are a few bytes each and every one is waited
+       * on, so don't let Nagle sit on them */
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+      client = (client_t*)calloc(1, sizeof(client_t));
+      if(client == NULL) {
+        MUTEX_UNLOCK(&g_lock);
+        close(fd);
+        continue;
+      }
+      client->fd = fd;
+      client->robot = i;
+      g_clients[g_numClients++] = client;
+      MUTEX_UNLOCK(&g_lock);
+    }
+  }
+
+  for(i = 0; i < g_numRobots; i++) {
+    close(g_robots[i].listener);
+  }
+  /* Knock the reader out of dongleRead before closing the dongle under it.
+   * The signal can land just before it starts waiting, so keep at it. */
+  while(!g_readerDone) {
+    pthread_kill(reader, SIGINT);
+    usleep(10000);
+  }
+  THREAD_JOIN(reader);
+  dongleClose(&g_dongle);
+  return 0;
+}
@@ -0,0 +1,544 @@
+/*
+   Copyright 2013 Barobo, Inc.
+
+   This file is part of libbarobo.
+
+   BaroboLink is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   BaroboLink is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with BaroboLink.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* mobotmuxd: owns a dongle so that several local processes can talk to the
+ * robots behind it at once. See mobot_mux.h for the protocol.
+ *
+ * The main thread only moves bytes: it polls the listening socket and the
+ * clients, splits what they send into frames, and hands each request to the
+ * robot's query queue in libbarobo's task executor. The executor runs one
+ * request per robot at a time, robots in parallel, and the worker that ran
+ * a request writes the response straight back to the client. Client sockets
+ * are non-blocking; a client that does not keep up with its responses is
+ * disconnected rather than allowed to hold up a robot. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "mobot.h"
+#include "mobot_mux.h"
+#include "thread_macros.h"
+
+#define MAX_ROBOTS 64
+#define MAX_CLIENTS 64
+
+typedef struct robot_s
+{
+  char serialID[5];
+  mobot_t* comms;
+  /* Clients using the robot's shared memory export. Only touched by tasks
+   * on the robot's queue. */
+  int exporters;
+} robot_t;
+
+typedef struct client_s
+{
+  int fd;
+  /* Protects refs, dead and writes to fd */
+  MUTEX_T lock;
+  /* One for the main loop, one for each request in flight */
+  int refs;
+  int dead;
+  uint8_t in[MOBOT_MUX_MAX_FRAME];
+  int inBytes;
+  /* Event streams this client turned on, per robot. Only touched by tasks
+   * on that robot's queue and, once no requests are in flight, by the
+   * cleanup task. */
+  int streams[MAX_ROBOTS];
+  /* Whether the client counts towards each robot's exporters. Same rules as
+   * streams. */
+  int exported[MAX_ROBOTS];
+} client_t;
+
+typedef struct request_s
+{
+  client_t* client;
+  int robot;
+  mobotMuxHeader_t header;
+  uint8_t payload[MOBOT_MUX_MAX_FRAME];
+  int payloadBytes;
+} request_t;
+
+static robot_t g_robots[MAX_ROBOTS];
+static int g_numRobots = 0;
+/* Protects g_robots and g_numRobots */
+static MUTEX_T g_robotsLock;
+/* Requests for robots that are not connected yet wait here, so connecting
+ * never holds up the main loop */
+static mobotTaskQueue_t* g_connectQueue;
+/* A robot handle left over from a failed connect. libbarobo has no way to
+ * free what Mobot_init set up, so the next connect reuses it. Only touched
+ * on g_connectQueue. */
+static mobot_t* g_spareComms = NULL;
+static volatile sig_atomic_t g_quit = 0;
+
+static void onSignal(int sig)
+{
+  g_quit = 1;
+}
+
+static void clientRelease(client_t* client)
+{
+  int refs;
+  MUTEX_LOCK(&client->lock);
+  refs = --client->refs;
+  MUTEX_UNLOCK(&client->lock);
+  if(refs == 0) {
+    close(client->fd);
+    free(client);
+  }
+}
+
+/* Send one frame to the client, or mark it dead if it can't take it now */
+static void clientSend(client_t* client, const mobotMuxHeader_t* header, const void* payload, int size)
+{
+  uint8_t frame[MOBOT_MUX_MAX_FRAME];
+  mobotMuxHeader_t h = *header;
+  ssize_t n;
+  h.length = sizeof(h) + size;
+  memcpy(frame, &h, sizeof(h));
+  memcpy(frame + sizeof(h), payload, size);
+  MUTEX_LOCK(&client->lock);
+  if(!client->dead) {
+    n = send(client->fd, frame, h.length, MSG_NOSIGNAL);
+    if(n != h.length) {
+      client->dead = 1;
+      shutdown(client->fd, SHUT_RDWR);
+    }
+  }
+  MUTEX_UNLOCK(&client->lock);
+}
+
+/* Return the index of the robot named by serialID, or -1 if it is not
+ * connected yet. All zero means the dongle's own robot. */
+static int robotFind(const char* serialID)
+{
+  static const char dongle[4] = {0, 0, 0, 0};
+  int i;
+  if(!memcmp(serialID, dongle, 4)) {
+    return 0;
+  }
+  MUTEX_LOCK(&g_robotsLock);
+  for(i = 0; i < g_numRobots; i++) {
+    if(!strncmp(g_robots[i].serialID, serialID, 4)) {
+      MUTEX_UNLOCK(&g_robotsLock);
+      return i;
+    }
+  }
+  MUTEX_UNLOCK(&g_robotsLock);
+  return -1;
+}
+
+/* Runs on g_connectQueue */
+static int robotConnect(const char* serialID)
+{
+  mobot_t* comms;
+  char id[5];
+  int i = robotFind(serialID);
+  if(i >= 0) {
+    return i;
+  }
+  if(g_numRobots == MAX_ROBOTS) {
+    return -1;
+  }
+  memcpy(id, serialID, 4);
+  id[4] = '\0';
+  if(g_spareComms != NULL) {
+    comms = g_spareComms;
+    g_spareComms = NULL;
+  } else {
+    comms = (mobot_t*)malloc(sizeof(mobot_t));
+    if(comms == NULL) {
+      return -1;
+    }
+    Mobot_init(comms);
+  }
+  if(Mobot_connectChildID(g_robots[0].comms, comms, id)) {
+    fprintf(stderr, "(barobo) WARNING: mobotmuxd could not connect to %s\n", id);
+    /* In case it got part way */
+    Mobot_disconnect(comms);
+    g_spareComms = comms;
+    return -1;
+  }
+  MUTEX_LOCK(&g_robotsLock);
+  i = g_numRobots;
+  strcpy(g_robots[i].serialID, id);
+  g_robots[i].comms = comms;
+  g_robots[i].exporters = 0;
+  g_numRobots++;
+  MUTEX_UNLOCK(&g_robotsLock);
+  return i;
+}
+
+static void requestRun(request_t* req)
+{
+  robot_t* robot = &g_robots[req->robot];
+  uint8_t buf[256];
+  char name[64];
+  int size;
+  int rc;
+  int types;
+  switch(req->header.op) {
+    case MOBOT_MUX_TRANSACTION:
+      if(req->payloadBytes < 1 || req->payloadBytes > (int)sizeof(buf)) {
+        req->header.status = -1;
+        clientSend(req->client, &req->header, NULL, 0);
+        break;
+      }
+      size = req->payloadBytes - 1;
+      memcpy(buf, &req->payload[1], size);
+      rc = MobotMsgTransaction(robot->comms, req->payload[0], buf, size);
+      req->header.status = rc;
+      clientSend(req->client, &req->header, buf, rc == 0 ? buf[1] : 0);
+      break;
+    case MOBOT_MUX_EXPORT:
+      types = req->payloadBytes > 0 ? req->payload[0] : 0;
+      rc = 0;
+      if((types & MOBOT_EVENT_JOINT) && !(req->client->streams[req->robot] & MOBOT_EVENT_JOINT)) {
+        rc = Mobot_channelOpen(robot->comms, MOBOT_EVENT_JOINT);
+        if(rc == 0) {
+          req->client->streams[req->robot] |= MOBOT_EVENT_JOINT;
+        }
+      }
+      if(rc == 0 && (types & MOBOT_EVENT_ACCEL) && !(req->client->streams[req->robot] & MOBOT_EVENT_ACCEL)) {
+        rc = Mobot_channelOpen(robot->comms, MOBOT_EVENT_ACCEL);
+        if(rc == 0) {
+          req->client->streams[req->robot] |= MOBOT_EVENT_ACCEL;
+        }
+      }
+      snprintf(name, sizeof(name), "/barobo-%s", robot->comms->serialID);
+      if(rc == 0 && !req->client->exported[req->robot]) {
+        if(robot->exporters == 0) {
+          rc = Mobot_shmExportStart(robot->comms, name);
+        }
+        if(rc == 0) {
+          robot->exporters++;
+          req->client->exported[req->robot] = 1;
+        }
+      }
+      req->header.status = rc;
+      clientSend(req->client, &req->header, name, rc == 0 ? strlen(name) + 1 : 0);
+      break;
+    default:
+      req->header.status = -1;
+      clientSend(req->client, &req->header, NULL, 0);
+      break;
+  }
+}
+
+static void* requestThread(void* arg)
+{
+  request_t* req = (request_t*)arg;
+  int dead;
+  /* A client dropped while this request waited for its robot to connect may
+   * have missed that robot's stream release. Opening streams for it now
+   * would leave them open for good. */
+  MUTEX_LOCK(&req->client->lock);
+  dead = req->client->dead;
+  MUTEX_UNLOCK(&req->client->lock);
+  if(!dead) {
+    requestRun(req);
+  }
+  clientRelease(req->client);
+  free(req);
+  return NULL;
+}
+
+static void* connectThread(void* arg)
+{
+  request_t* req = (request_t*)arg;
+  req->robot = robotConnect(req->header.serialID);
+  if(req->robot < 0) {
+    req->header.status = -1;
+    clientSend(req->client, &req->header, NULL, 0);
+    clientRelease(req->client);
+    free(req);
+    return NULL;
+  }
+  /* Queue behind whatever else is waiting for this robot */
+  Mobot_taskDetach(Mobot_taskSubmit(g_robots[req->robot].comms->queryQueue, requestThread, req));
+  return NULL;
+}
+
+/* Turn off the event streams a departed client had on, and the export if it
+ * was the last one using it. Runs on the robot's own queue, after any
+ * requests of the client's that were still queued. */
+typedef struct streamRelease_s
+{
+  client_t* client;
+  int robot;
+} streamRelease_t;
+
+static void* streamReleaseThread(void* arg)
+{
+  streamRelease_t* rel = (streamRelease_t*)arg;
+  mobot_t* comms = g_robots[rel->robot].comms;
+  int streams = rel->client->streams[rel->robot];
+  if(streams & MOBOT_EVENT_JOINT) {
+    Mobot_channelClose(comms, MOBOT_EVENT_JOINT);
+  }
+  if(streams & MOBOT_EVENT_ACCEL) {
+    Mobot_channelClose(comms, MOBOT_EVENT_ACCEL);
+  }
+  rel->client->streams[rel->robot] = 0;
+  if(rel->client->exported[rel->robot]) {
+    rel->client->exported[rel->robot] = 0;
+    if(--g_robots[rel->robot].exporters == 0) {
+      Mobot_shmExportStop(comms);
+    }
+  }
+  clientRelease(rel->client);
+  free(rel);
+  return NULL;
+}
+
+static void clientDrop(client_t* client)
+{
+  streamRelease_t* rel;
+  int i;
+  MUTEX_LOCK(&client->lock);
+  client->dead = 1;
+  MUTEX_UNLOCK(&client->lock);
+  MUTEX_LOCK(&g_robotsLock);
+  for(i = 0; i < g_numRobots; i++) {
+    rel = (streamRelease_t*)malloc(sizeof(streamRelease_t));
+    rel->client = client;
+    rel->robot = i;
+    MUTEX_LOCK(&client->lock);
+    client->refs++;
+    MUTEX_UNLOCK(&client->lock);
+    Mobot_taskDetach(Mobot_taskSubmit(g_robots[i].comms->queryQueue, streamReleaseThread, rel));
+  }
+  MUTEX_UNLOCK(&g_robotsLock);
+  clientRelease(client);
+}
+
+/* Split what the client sent into requests. Returns -1 if the client sent
+ * something that is not a frame. */
+static int clientRead(client_t* client)
+{
+  mobotMuxHeader_t header;
+  request_t* req;
+  ssize_t n;
+  int used = 0;
+  n = recv(client->fd, client->in + client->inBytes, sizeof(client->in) - client->inBytes, 0);
+  if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+    return -1;
+  }
+  if(n < 0) {
+    return 0;
+  }
+  client->inBytes += n;
+  while(client->inBytes - used >= (int)sizeof(header)) {
+    memcpy(&header, client->in + used, sizeof(header));
+    if(header.length < sizeof(header) || header.length > MOBOT_MUX_MAX_FRAME) {
+      return -1;
+    }
+    if(client->inBytes - used < header.length) {
+      break;
+    }
+    req = (request_t*)malloc(sizeof(request_t));
+    if(req == NULL) {
+      return -1;
+    }
+    req->client = client;
+    req->header = header;
+    req->header.status = 0;
+    req->payloadBytes = header.length - sizeof(header);
+    memcpy(req->payload, client->in + used + sizeof(header), req->payloadBytes);
+    used += header.length;
+    MUTEX_LOCK(&client->lock);
+    client->refs++;
+    MUTEX_UNLOCK(&client->lock);
+    req->robot = robotFind(header.serialID);
+    if(req->robot >= 0) {
+      Mobot_taskDetach(Mobot_taskSubmit(g_robots[req->robot].comms->queryQueue, requestThread, req));
+    } else {
+      Mobot_taskDetach(Mobot_taskSubmit(g_connectQueue, connectThread, req));
+    }
+  }
+  memmove(client->in, client->in + used, client->inBytes - used);
+  client->inBytes -= used;
+  return 0;
+}
+
+/* Make sure no other mobotmuxd is serving socketPath. A socket file that
+ * nobody accepts on is left over from one that died, and is removed. */
+static int socketClaim(const char* socketPath)
+{
+  struct sockaddr_un addr;
+  int fd;
+  int rc;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socketPath);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0) {
+    return -1;
+  }
+  rc = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+  close(fd);
+  if(rc == 0) {
+    fprintf(stderr, "(barobo) ERROR: mobotmuxd is already running on %s\n", socketPath);
+    return -1;
+  }
+  if(errno == ECONNREFUSED) {
+    unlink(socketPath);
+  } else if(errno != ENOENT) {
+    perror("(barobo) ERROR: mobotmuxd: connect");
+    return -1;
+  }
+  return 0;
+}
+
+static void usage(const char* argv0)
+{
+  fprintf(stderr, "Usage: %s [-s socket] [-t tty]\n", argv0);
+}
+
+int main(int argc, char* argv[])
+{
+  const char* socketPath = MOBOT_MUX_SOCKET;
+  const char* tty = NULL;
+  struct sockaddr_un addr;
+  struct pollfd fds[MAX_CLIENTS + 1];
+  client_t* clients[MAX_CLIENTS];
+  client_t* client;
+  mobot_t* dongle;
+  int numClients = 0;
+  int listener;
+  int fd;
+  int rc;
+  int i;
+
+  for(i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-s") && i + 1 < argc) {
+      socketPath = argv[++i];
+    } else if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+      tty = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  /* Before the dongle, which the other instance would own */
+  if(socketClaim(socketPath)) {
+    return 1;
+  }
+
+  MUTEX_INIT(&g_robotsLock);
+  g_connectQueue = Mobot_taskQueueNew();
+
+  dongle = (mobot_t*)malloc(sizeof(mobot_t));
+  Mobot_init(dongle);
+  rc = tty ? Mobot_connectWithTTY(dongle, tty) : Mobot_connect(dongle);
+  if(rc) {
+    fprintf(stderr, "(barobo) ERROR: mobotmuxd could not connect to the dongle: %d\n", rc);
+    return 1;
+  }
+  memset(g_robots[0].serialID, 0, sizeof(g_robots[0].serialID));
+  g_robots[0].comms = dongle;
+  g_robots[0].exporters = 0;
+  g_numRobots = 1;
+
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listener < 0) {
+    perror("(barobo) ERROR: mobotmuxd: socket");
+    return 1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socketPath);
+  if(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(listener, 16) < 0) {
+    perror("(barobo) ERROR: mobotmuxd: bind");
+    return 1;
+  }
+
+  while(!g_quit) {
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+    for(i = 0; i < numClients; i++) {
+      fds[i+1].fd = clients[i]->fd;
+      fds[i+1].events = POLLIN;
+    }
+    rc = poll(fds, numClients + 1, -1);
+    if(rc < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      perror("(barobo) ERROR: mobotmuxd: poll");
+      break;
+    }
+    /* Clients first, so that dropping one does not shift fds under us */
+    for(i = numClients - 1; i >= 0; i--) {
+      if(fds[i+1].revents == 0) {
+        continue;
+      }
+      if(clientRead(clients[i])) {
+        clientDrop(clients[i]);
+        clients[i] = clients[--numClients];
+      }
+    }
+    if(fds[0].revents & POLLIN) {
+      fd = accept(listener, NULL, NULL);
+      if(fd < 0) {
+        continue;
+      }
+      if(numClients == MAX_CLIENTS) {
+        close(fd);
+        continue;
+      }
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      client = (client_t*)calloc(1, sizeof(client_t));
+      client->fd = fd;
+      MUTEX_INIT(&client->lock);
+      client->refs = 1;
+      clients[numClients++] = client;
+    }
+  }
+
+  for(i = 0; i < numClients; i++) {
+    clientDrop(clients[i]);
+  }
+  close(listener);
+  unlink(socketPath);
+  /* Let pending connects finish, then the requests and stream releases
+   * queued on every robot, before the robots go away under them */
+  Mobot_taskQueueWait(g_connectQueue);
+  for(i = 0; i < g_numRobots; i++) {
+    Mobot_taskQueueWait(g_robots[i].comms->queryQueue);
+  }
+  for(i = g_numRobots - 1; i >= 0; i--) {
+    Mobot_disconnect(g_robots[i].comms);
+  }
+  return 0;
+}
@@ -0,0 +1,163 @@
+#ifndef _BAROBO_CODEC_H_
+#define _BAROBO_CODEC_H_
+
+/* Packing and unpacking of command payloads.
+ *
+ * Every request and response layout the library decodes is listed once in
+ * CODEC_COMMANDS below, as the size in bytes of the request payload and of
+ * the response payload. The frame lengths the getters and setters check
+ * against are derived from that table instead of being spelled out as magic
+ * numbers at each call site.
+ *
+ * Responses are read in place: CODEC_VIEW checks the frame and hands back a
+ * pointer to its payload, and the codecGet* helpers read fields straight out
+ * of it. All helpers work a byte at a time, so they don't care about the
+ * alignment of the field or the byte order of the host. Despite what the
+ * notes in commands.h say, the firmware sends floats and timestamps least
+ * significant byte first; ZigBee addresses and buzzer frequencies are sent
+ * most significant byte first. */
+
+#include <string.h>
+#include "commands.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*       command                          request  response */
+#define CODEC_COMMANDS(X) \
+  X(CMD_STATUS,                            0,       0) \
+  X(CMD_SETMOTORDIR,                       2,       0) \
+  X(CMD_GETMOTORDIR,                       1,       1) \
+  X(CMD_SETMOTORSPEED,                     5,       0) \
+  X(CMD_GETMOTORSPEED,                     1,       4) \
+  X(CMD_GETMOTORANGLESTIMESTAMPABS,        0,      20) \
+  X(CMD_GETMOTORANGLEABS,                  1,       4) \
+  X(CMD_GETMOTORSTATE,                     1,       1) \
+  X(CMD_GETMOTORMAXSPEED,                  1,       4) \
+  X(CMD_GETENCODERVOLTAGE,                 1,       4) \
+  X(CMD_GETBUTTONVOLTAGE,                  0,       4) \
+  X(CMD_GETMOTORSAFETYLIMIT,               0,       4) \
+  X(CMD_SETMOTORSAFETYLIMIT,               4,       0) \
+  X(CMD_GETMOTORSAFETYTIMEOUT,             0,       4) \
+  X(CMD_SETMOTORSAFETYTIMEOUT,             4,       0) \
+  X(CMD_GETVERSION,                        0,       1) \
+  X(CMD_GETHWREV,                          0,       1) \
+  X(CMD_SETHWREV,                          1,       0) \
+  X(CMD_TIMEDACTION,                   1+4*6,       0) \
+  X(CMD_GETBIGSTATE,                       0,      24) \
+  X(CMD_SETMOTORPOWER,                    10,       0) \
+  X(CMD_GETBATTERYVOLTAGE,                 0,       4) \
+  X(CMD_BUZZERFREQ,                        2,       0) \
+  X(CMD_GETACCEL,                          0,       6) \
+  X(CMD_RGBLED,                            6,       0) \
+  X(CMD_GETRGB,                            0,       3) \
+  X(CMD_GET_MOTOR_ERRORS,                  0,      16) \
+  X(CMD_GET_MASTER_ADDRESS,                0,       2) \
+  X(CMD_GET_NUM_SLAVES,                    0,       1) \
+  X(CMD_GET_SLAVE_ADDR,                    1,       2) \
+  X(CMD_GET_NUM_POSES,                     0,       1) \
+  X(CMD_GET_POSE_DATA,                     1,      16)
+
+/* A response frame is [RESP_OK] [length] [payload] [end], and its length
+ * byte counts the whole frame. A request must also fit in the ZigBee
+ * envelope, which adds eight bytes and has a one byte length of its own. */
+#define CODEC_DEFINE_SIZES(cmd, req, resp) \
+  CODEC_REQ_##cmd = (req), \
+  CODEC_RESP_##cmd = (resp) + 3,
+enum codecSizes_e {
+  CODEC_COMMANDS(CODEC_DEFINE_SIZES)
+  CODEC_NUM_SIZES
+};
+#undef CODEC_DEFINE_SIZES
+
+/* Refuse to compile if a layout in the table cannot be framed */
+#define CODEC_CHECK_SIZES(cmd, req, resp) \
+  typedef char codec_size_check_##cmd[ \
+    ((req) >= 0 && (req) + 8 <= 255 && (resp) >= 0 && (resp) + 3 <= 255) ? 1 : -1];
+CODEC_COMMANDS(CODEC_CHECK_SIZES)
+#undef CODEC_CHECK_SIZES
+
+/* Request payload size to pass to MobotMsgTransaction for cmd */
+#define CODEC_REQ(cmd) (CODEC_REQ_##cmd)
+
+/* Full length of a well-formed response to cmd */
+#define CODEC_RESP_LEN(cmd) (CODEC_RESP_##cmd)
+
+/* If buf holds a well-formed response to cmd, return a pointer to its
+ * payload, otherwise NULL. */
+#define CODEC_VIEW(buf, cmd) codecView((buf), CODEC_RESP_LEN(cmd))
+
+static inline const uint8_t* codecView(const uint8_t* buf, int len)
+{
+  if(buf[0] != RESP_OK || buf[1] != len) {
+    return NULL;
+  }
+  return &buf[2];
+}
+
+/* Like CODEC_VIEW, but also takes responses longer than the table says. For
+ * the getters that only ever checked RESP_OK before reading fixed offsets,
+ * so that firmware which appends fields keeps working. */
+#define CODEC_VIEW_MIN(buf, cmd) codecViewMin((buf), CODEC_RESP_LEN(cmd))
+
+static inline const uint8_t* codecViewMin(const uint8_t* buf, int len)
+{
+  if(buf[0] != RESP_OK || buf[1] < len) {
+    return NULL;
+  }
+  return &buf[2];
+}
+
+static inline uint16_t codecGetU16BE(const uint8_t* p)
+{
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline int16_t codecGetI16LE(const uint8_t* p)
+{
+  return (int16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t codecGetU32LE(const uint8_t* p)
+{
+  return (uint32_t)p[0] |
+    ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) |
+    ((uint32_t)p[3] << 24);
+}
+
+static inline float codecGetFloat(const uint8_t* p)
+{
+  uint32_t u = codecGetU32LE(p);
+  float f;
+  memcpy(&f, &u, 4);
+  return f;
+}
+
+static inline void codecPutU16BE(uint8_t* p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+static inline void codecPutU32LE(uint8_t* p, uint32_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+static inline void codecPutFloat(uint8_t* p, float f)
+{
+  uint32_t u;
+  memcpy(&u, &f, 4);
+  codecPutU32LE(p, u);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
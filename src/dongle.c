@@ -15,6 +15,7 @@
 #include <unistd.h>
 #include <termios.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #endif
 
@@ -77,6 +78,55 @@ static long dongleWriteRaw (MOBOTdongle *dongle, const uint8_t *buf, size_t len)
   return ret;
 }
 
+/* Write two buffers back to back, in one syscall where the platform allows
+ * it. Returns -1 on error, otherwise the total number of bytes written. */
+static long dongleWrite2Raw (MOBOTdongle *dongle, const uint8_t *buf1, size_t len1,
+    const uint8_t *buf2, size_t len2) {
+#ifdef _WIN32
+  long ret1 = len1 ? dongleWriteRaw(dongle, buf1, len1) : 0;
+  if (-1 == ret1) {
+    return -1;
+  }
+  long ret2 = len2 ? dongleWriteRaw(dongle, buf2, len2) : 0;
+  if (-1 == ret2) {
+    return -1;
+  }
+  return ret1 + ret2;
+#else
+  struct iovec iov[2];
+  iov[0].iov_base = (void*)buf1;
+  iov[0].iov_len = len1;
+  iov[1].iov_base = (void*)buf2;
+  iov[1].iov_len = len2;
+
+  long total = 0;
+  int i = 0;
+  while (i < 2) {
+    ssize_t ret = writev(dongle->fd, &iov[i], 2 - i);
+    if (-1 == ret) {
+      if (EINTR == errno) {
+        continue;
+      }
+      char errbuf[256];
+      strerror_r(errno, errbuf, sizeof(errbuf));
+      fprintf(stderr, "(barobo) ERROR: in dongleWrite2Raw, writev(): %s\n", errbuf);
+      return -1;
+    }
+    total += ret;
+    /* Pick up where a short write left off. */
+    while (i < 2 && (size_t)ret >= iov[i].iov_len) {
+      ret -= iov[i].iov_len;
+      ++i;
+    }
+    if (i < 2) {
+      iov[i].iov_base = (uint8_t*)iov[i].iov_base + ret;
+      iov[i].iov_len -= ret;
+    }
+  }
+  return total;
+#endif
+}
+
 #ifdef _WIN32
 
 /* WIN32 implementation of dongleTimedReadRaw. */
@@ -288,10 +338,103 @@ static void sfp_unlock (void *data) {
   MUTEX_UNLOCK((MUTEX_T *)data);
 }
 
-/* Callback to be provided to libsfp. */
+/* Write out everything in the transmit queue. Must be called with sfpTxLock
+ * held; the lock is released while the write is in progress so libsfp can
+ * keep queueing frames behind it. */
+static long dongleTxFlushLocked (MOBOTdongle *dongle) {
+  if (!dongle->txLen) {
+    return 0;
+  }
+
+  /* Wait for any write already in progress, so the order on the wire
+   * matches the order frames were queued. */
+  MUTEX_LOCK(dongle->txWriteLock);
+
+  uint8_t *out = dongle->txBuf;
+  size_t outlen = dongle->txLen;
+  dongle->txBuf = dongle->txOutBuf;
+  dongle->txOutBuf = out;
+  dongle->txLen = 0;
+
+  MUTEX_UNLOCK(dongle->sfpTxLock);
+  long ret = dongleWriteRaw(dongle, out, outlen);
+  MUTEX_UNLOCK(dongle->txWriteLock);
+  MUTEX_LOCK(dongle->sfpTxLock);
+
+  return ret;
+}
+
+static void* dongleTxThread (void *arg) {
+  MOBOTdongle *dongle = (MOBOTdongle *)arg;
+
+  MUTEX_LOCK(dongle->sfpTxLock);
+  while (!dongle->txStop) {
+    if (!dongle->txLen) {
+#ifndef _WIN32
+      COND_WAIT(dongle->txCond, dongle->sfpTxLock);
+#else
+      /* The Windows COND_WAIT leaves the mutex released */
+      ResetEvent(*dongle->txCond);
+      MUTEX_UNLOCK(dongle->sfpTxLock);
+      WaitForSingleObject(*dongle->txCond, INFINITE);
+      MUTEX_LOCK(dongle->sfpTxLock);
+#endif
+      continue;
+    }
+
+    if (dongle->txWindow > 0) {
+      /* Give other threads a chance to queue up behind this frame. */
+      long window = dongle->txWindow;
+      MUTEX_UNLOCK(dongle->sfpTxLock);
+#ifdef _WIN32
+      Sleep((window + 999) / 1000);
+#else
+      usleep(window);
+#endif
+      MUTEX_LOCK(dongle->sfpTxLock);
+    }
+
+    dongleTxFlushLocked(dongle);
+  }
+
+  /* Don't lose anything that was queued right before dongleClose(). */
+  dongleTxFlushLocked(dongle);
+  MUTEX_UNLOCK(dongle->sfpTxLock);
+
+  return NULL;
+}
+
+/* Callback to be provided to libsfp. libsfp calls this with sfpTxLock held,
+ * once per frame. */
 static int sfp_write (uint8_t *octets, size_t len, size_t *outlen, void *data) {
   MOBOTdongle *dongle = (MOBOTdongle *)data;
-  long ret = dongleWriteRaw(dongle, octets, len);
+  long ret;
+
+  if (!dongle->txThread || !dongle->txMax) {
+    /* No transmit queue. */
+    ret = dongleWriteRaw(dongle, octets, len);
+  }
+  else if (dongle->txLen + len > dongle->txMax) {
+    /* The queue is full. Write what we have plus this frame right now, in
+     * one go. Taking txWriteLock keeps us behind any write the transmit
+     * thread already has in flight. */
+    MUTEX_LOCK(dongle->txWriteLock);
+    ret = dongleWrite2Raw(dongle, dongle->txBuf, dongle->txLen, octets, len);
+    if (ret >= 0) {
+      ret = ret >= (long)dongle->txLen ? ret - dongle->txLen : 0;
+    }
+    dongle->txLen = 0;
+    MUTEX_UNLOCK(dongle->txWriteLock);
+  }
+  else {
+    memcpy(dongle->txBuf + dongle->txLen, octets, len);
+    if (!dongle->txLen) {
+      COND_SIGNAL(dongle->txCond);
+    }
+    dongle->txLen += len;
+    ret = len;
+  }
+
   if (outlen && ret >= 0) {
     *outlen = ret;
     ret = 0;
@@ -299,6 +442,90 @@ static int sfp_write (uint8_t *octets, size_t len, size_t *outlen, void *data) {
   return ret;
 }
 
+int dongleFlush (MOBOTdongle *dongle) {
+  assert(dongle);
+
+  if (MOBOT_DONGLE_FRAMING_SFP != dongle->framing || !dongle->txThread) {
+    return 0;
+  }
+
+  MUTEX_LOCK(dongle->sfpTxLock);
+  long ret = dongleTxFlushLocked(dongle);
+  MUTEX_UNLOCK(dongle->sfpTxLock);
+
+  /* The transmit thread may have grabbed the queue just before us; wait for
+   * its write to finish too. */
+  MUTEX_LOCK(dongle->txWriteLock);
+  MUTEX_UNLOCK(dongle->txWriteLock);
+
+  return -1 == ret ? -1 : 0;
+}
+
+void dongleSetTxCoalescing (MOBOTdongle *dongle, long window_us, size_t max_bytes) {
+  assert(dongle);
+
+  if (max_bytes > DONGLE_TX_BUFSIZE) {
+    max_bytes = DONGLE_TX_BUFSIZE;
+  }
+  if (window_us < 0) {
+    window_us = 0;
+  }
+
+  if (MOBOT_DONGLE_FRAMING_SFP != dongle->framing || !dongle->txThread) {
+    dongle->txWindow = window_us;
+    dongle->txMax = max_bytes;
+    return;
+  }
+
+  MUTEX_LOCK(dongle->sfpTxLock);
+  /* Anything already queued goes out under the old rules. */
+  dongleTxFlushLocked(dongle);
+  dongle->txWindow = window_us;
+  dongle->txMax = max_bytes;
+  MUTEX_UNLOCK(dongle->sfpTxLock);
+}
+
+static void dongleStartTx (MOBOTdongle *dongle) {
+  dongle->txBuf = (uint8_t*)malloc(DONGLE_TX_BUFSIZE);
+  dongle->txOutBuf = (uint8_t*)malloc(DONGLE_TX_BUFSIZE);
+  assert(dongle->txBuf && dongle->txOutBuf);
+  dongle->txLen = 0;
+  dongle->txStop = 0;
+
+  MUTEX_NEW(dongle->txWriteLock);
+  MUTEX_INIT(dongle->txWriteLock);
+  COND_NEW(dongle->txCond);
+  COND_INIT(dongle->txCond);
+
+  dongle->txThread = (THREAD_T*)malloc(sizeof(THREAD_T));
+  THREAD_CREATE(dongle->txThread, dongleTxThread, dongle);
+}
+
+static void dongleStopTx (MOBOTdongle *dongle) {
+  if (!dongle->txThread) {
+    return;
+  }
+
+  MUTEX_LOCK(dongle->sfpTxLock);
+  dongle->txStop = 1;
+  COND_SIGNAL(dongle->txCond);
+  MUTEX_UNLOCK(dongle->sfpTxLock);
+  THREAD_JOIN(*dongle->txThread);
+
+  free(dongle->txThread);
+  dongle->txThread = NULL;
+  MUTEX_DESTROY(dongle->txWriteLock);
+  free(dongle->txWriteLock);
+  dongle->txWriteLock = NULL;
+  COND_DESTROY(dongle->txCond);
+  free(dongle->txCond);
+  dongle->txCond = NULL;
+  free(dongle->txBuf);
+  free(dongle->txOutBuf);
+  dongle->txBuf = NULL;
+  dongle->txOutBuf = NULL;
+}
+
 long dongleWrite (MOBOTdongle *dongle, const uint8_t *buf, size_t len) {
   assert(dongle);
   assert(buf);
@@ -366,6 +593,9 @@ static int dongleSetupSFP (MOBOTdongle *dongle) {
   assert(dongle->sfpContext);
 
   sfpInit(dongle->sfpContext);
+
+  /* The transmit thread has to be running before libsfp starts writing. */
+  dongleStartTx(dongle);
   
   sfpSetWriteCallback(dongle->sfpContext, SFP_WRITE_MULTIPLE, sfp_write, dongle);
   /* We do not currently use the libsfp deliver callback in libbarobo, but
@@ -398,6 +628,16 @@ static void dongleInit (MOBOTdongle *dongle) {
    * need it until we detect the framing used by the firmware. */
   dongle->sfpContext = NULL;
 
+  dongle->txBuf = NULL;
+  dongle->txOutBuf = NULL;
+  dongle->txLen = 0;
+  dongle->txMax = DONGLE_TX_BUFSIZE;
+  dongle->txWindow = 0;
+  dongle->txStop = 0;
+  dongle->txWriteLock = NULL;
+  dongle->txCond = NULL;
+  dongle->txThread = NULL;
+
 #ifdef _WIN32
   /* Halp! Is this right? */
   dongle->handle = NULL;
@@ -748,6 +988,9 @@ void dongleClose (MOBOTdongle *dongle) {
     return;
   }
 
+  /* Drain the transmit queue while we still have a port to write to. */
+  dongleStopTx(dongle);
+
 #ifdef _WIN32
   /* I dunno, MSDN said you're supposed to reset these to the way you found
    * them. Whatever. */
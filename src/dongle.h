@@ -33,8 +33,26 @@ struct MOBOTdongle {
   MOBOTdongleFraming framing;
   SFPcontext *sfpContext;
   MUTEX_T *sfpTxLock;
+
+  /* Transmit queue. Frames produced by libsfp are appended to txBuf under
+   * sfpTxLock, and txThread writes them out in as few syscalls as possible.
+   * txWriteLock serializes the actual writes so frames hit the wire in the
+   * order they were queued. */
+  uint8_t *txBuf;
+  uint8_t *txOutBuf;
+  size_t txLen;
+  size_t txMax;
+  long txWindow;
+  int txStop;
+  MUTEX_T *txWriteLock;
+  COND_T *txCond;
+  THREAD_T *txThread;
 };
 
+/* Size of the transmit queue. Anything larger than this is written through
+ * immediately. */
+#define DONGLE_TX_BUFSIZE 1024
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -45,6 +63,18 @@ void dongleClose (MOBOTdongle *dongle);
 long dongleRead (MOBOTdongle *dongle, uint8_t *buf, size_t len);
 long dongleWrite (MOBOTdongle *dongle, const uint8_t *buf, size_t len);
 
+/* Block until every frame queued by dongleWrite so far has been written to
+ * the serial port. Returns 0 on success, -1 on error. */
+int dongleFlush (MOBOTdongle *dongle);
+
+/* Configure transmit coalescing. Once a frame is queued, the transmit thread
+ * waits window_us microseconds for more frames before writing them all out
+ * at once. The queue is also written out whenever it would grow past
+ * max_bytes (at most DONGLE_TX_BUFSIZE). A max_bytes of 0 disables the queue
+ * entirely, so every frame gets its own write. The default is no extra
+ * window: frames only coalesce while a previous write is in progress. */
+void dongleSetTxCoalescing (MOBOTdongle *dongle, long window_us, size_t max_bytes);
+
 #ifdef __cplusplus
 }
 #endif
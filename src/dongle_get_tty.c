@@ -28,3 +28,18 @@ static const usb_dongle_id g_barobo_usb_dongle_ids[] = {
 #else
 #error No dongle_get_tty.c available for this platform.
 #endif
+
+#ifndef __linux__
+/* Platforms without a native multi-dongle search only ever report the first
+ * dongle found. */
+int Mobot_dongleGetTTYs (char *ttys, size_t len, int maxttys) {
+  if (maxttys < 1) {
+    return 0;
+  }
+  return -1 == Mobot_dongleGetTTY(ttys, len) ? 0 : 1;
+}
+
+int Mobot_dongleWaitForChange (int timeout) {
+  return -1;
+}
+#endif
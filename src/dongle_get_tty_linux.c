@@ -1,6 +1,4 @@
 #include "logging.h"
-#include "popen3.h"
-#include "sysfs.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -8,70 +6,340 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include "thread_macros.h"
 
-int Mobot_dongleGetTTY (char *buf, size_t len) {
+/* The Linux kernel exposes system devices via sysfs, documented at
+ * kernel.org/doc/Documentation/sysfs-rules.txt. Every tty device has an entry
+ * in /sys/class/tty which is a symlink into the /sys/devices hierarchy. For a
+ * USB-serial adapter, one of that device's ancestors is the USB device
+ * itself, which carries the "manufacturer" and "product" attributes we match
+ * against g_barobo_usb_dongle_ids. The device node name comes from the tty's
+ * uevent file (DEVNAME=ttyACM0).
+ *
+ * This used to be done by shelling out to find/xargs/grep/cut, which forked
+ * several processes per dongle id on every connect. Walking the tree
+ * ourselves costs a handful of readlink/open calls. As the kernel docs
+ * suggest, "$SYSFS_PATH" overrides "/sys", so a fake sysfs tree can be used
+ * for testing. */
+
+/* Read a single-line sysfs attribute into buf, stripping the trailing
+ * newline. Return 0 on success, -1 if the attribute does not exist or could
+ * not be read. */
+static int sysfs_read_attr (const char *dir, const char *attr, char *buf, size_t len) {
+  char path[PATH_MAX];
+  if (snprintf(path, sizeof(path), "%s/%s", dir, attr) >= (int)sizeof(path)) {
+    return -1;
+  }
+
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return -1;
+  }
+
+  if (!fgets(buf, len, fp)) {
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+
+  buf[strcspn(buf, "\n")] = '\0';
+  return 0;
+}
+
+/* Look for DEVNAME=<name> in the tty's uevent file. If it is not there (some
+ * fake sysfs trees omit uevent), fall back to the class entry's name, which
+ * the kernel guarantees to be the same thing. */
+static void sysfs_tty_devname (const char *ttydir, const char *fallback,
+    char *buf, size_t len) {
+  char path[PATH_MAX];
+  FILE *fp = NULL;
+  if (snprintf(path, sizeof(path), "%s/uevent", ttydir) < (int)sizeof(path)) {
+    fp = fopen(path, "r");
+  }
+  if (fp) {
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+      if (!strncmp(line, "DEVNAME=", strlen("DEVNAME="))) {
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(buf, len, "%s", line + strlen("DEVNAME="));
+        fclose(fp);
+        return;
+      }
+    }
+    fclose(fp);
+  }
+
+  snprintf(buf, len, "%s", fallback);
+}
+
+/* Starting at the tty's device directory, walk up the /sys/devices hierarchy
+ * until we find a directory with both a manufacturer and a product
+ * attribute, i.e., the USB device. Return the index into
+ * g_barobo_usb_dongle_ids of the matching entry, or -1 if this tty does not
+ * belong to a Barobo dongle. */
+static int sysfs_match_dongle (const char *devdir, const char *sysfs_root) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", devdir);
+
+  size_t rootlen = strlen(sysfs_root);
+
+  while (strlen(dir) > rootlen && !strncmp(dir, sysfs_root, rootlen)) {
+    char manufacturer[256];
+    char product[256];
+    if (!sysfs_read_attr(dir, "manufacturer", manufacturer, sizeof(manufacturer)) &&
+        !sysfs_read_attr(dir, "product", product, sizeof(product))) {
+      size_t i;
+      for (i = 0; i < NUM_BAROBO_USB_DONGLE_IDS; ++i) {
+        /* Substring matches, as the grep-based search used to do */
+        if (strstr(manufacturer, g_barobo_usb_dongle_ids[i].manufacturer) &&
+            strstr(product, g_barobo_usb_dongle_ids[i].product)) {
+          return i;
+        }
+      }
+      /* This was the closest USB device, and it's not ours. */
+      return -1;
+    }
+
+    char *slash = strrchr(dir, '/');
+    if (!slash || slash == dir) {
+      break;
+    }
+    *slash = '\0';
+  }
+
+  return -1;
+}
+
+static const char* sysfs_path (void) {
   const char* sysfs = getenv("SYSFS_PATH");
   if (!sysfs) {
     sysfs = "/sys";
   }
+  return sysfs;
+}
 
-  size_t i;
-  int dongle_found = 0;
-  for (i = 0; !dongle_found && i < NUM_BAROBO_USB_DONGLE_IDS; ++i) {
-    char cmd[1024];
+/* One inotify watch on /dev for the life of the process, set up by the first
+ * Mobot_dongleGetTTYs or Mobot_dongleWaitForChange. A watch made afresh for
+ * every wait would miss whatever was plugged in between reading the list
+ * and starting to wait. sysfs does not generate inotify events, but
+ * devtmpfs/udev create and remove the /dev nodes for us, so watching /dev is
+ * the cheapest hotplug signal that does not require linking libudev. -1 if
+ * the watch could not be set up. */
+static ONCE_T g_hotplugOnce = ONCE_INIT;
+static int g_hotplugFd = -1;
 
-    snprintf(cmd, sizeof(cmd),
-            /* Generate a list of all dongles. */
-            FROM("%s/devices") SELECT SYSATTRF("manufacturer", "%s")
-                               AND SYSATTRF("product", "%s")
-                               SELECT SUBSYSTEMF("tty")
-            /* Look up the dongles' /dev/tty* path. */
-            " | xargs -I{} grep DEVNAME '{}'/uevent"
-            " | cut -d= -f2",
-      sysfs, g_barobo_usb_dongle_ids[i].manufacturer, g_barobo_usb_dongle_ids[i].product);
+static void hotplug_init (void) {
+  int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (-1 == fd) {
+    char errbuf[256];
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    fprintf(stderr, "(barobo) ERROR: in hotplug_init, inotify_init1(): %s\n", errbuf);
+    return;
+  }
 
-    /* Using popen3() so that stderr is suppressed upon failure. */
-    process_t cmd_proc = popen3(cmd);
+  if (-1 == inotify_add_watch(fd, "/dev", IN_CREATE | IN_DELETE)) {
+    char errbuf[256];
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    fprintf(stderr, "(barobo) ERROR: in hotplug_init, inotify_add_watch(): %s\n", errbuf);
+    close(fd);
+    return;
+  }
 
-    if (-1 == cmd_proc.pid) {
-      char errbuf[256];
-      strerror_r(errno, errbuf, sizeof(errbuf));
-      fprintf(stderr, "(barobo) ERROR: unable to execute find dongle command: %s", errbuf);
-      return -1;
-    }
+  g_hotplugFd = fd;
+}
 
-    char* line = NULL;
-    size_t n = 0;
-    long read;
-
-    while (-1 != (read = getline(&line, &n, cmd_proc.out))) {
-      line[read - 1] = '\0';  /* Overwrite newline */
-      snprintf(buf, len, "/dev/%s", line);
-      if (!access(buf, R_OK | W_OK)) {
-        bInfo(stderr, "(barobo) INFO: dongle found at %s\n", buf);
-        dongle_found = 1;
-        break;
-      }
-      if (EACCES == errno) {
-        fprintf(stderr, "(barobo) WARNING: dongle found at %s, but user does not have "
-            "sufficient read/write permissions.\n", buf);
+static int hotplug_fd (void) {
+  ONCE(g_hotplugOnce, hotplug_init);
+  return g_hotplugFd;
+}
+
+/* Read whatever events are queued on the watch. Return 1 if any of them was
+ * about a tty node, 0 otherwise. */
+static int hotplug_drain (int fd) {
+  char evbuf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  int ret = 0;
+  ssize_t n;
+  while ((n = read(fd, evbuf, sizeof(evbuf))) > 0) {
+    char *p;
+    for (p = evbuf; p < evbuf + n; ) {
+      struct inotify_event *ev = (struct inotify_event*)p;
+      if (ev->len && !strncmp(ev->name, "tty", 3)) {
+        ret = 1;
       }
-      else {
-        char errbuf[256];
-        strerror_r(errno, errbuf, sizeof(errbuf));
-        fprintf(stderr, "(barobo) WARNING: attempted to access %s: %s\n", buf, errbuf);
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+  return ret;
+}
+
+/* Find all attached dongles. ttys is an array of maxttys buffers, each len
+ * bytes long. Dongles are reported in g_barobo_usb_dongle_ids order, then in
+ * /sys/class/tty order, so the first entry is the same dongle the old
+ * find-based search would have returned. Return the number of dongles found,
+ * or -1 on error. */
+int Mobot_dongleGetTTYs (char *ttys, size_t len, int maxttys) {
+  const char* sysfs = sysfs_path();
+
+  /* Whatever changed before now shows up in this scan, so only changes from
+   * here on should wake Mobot_dongleWaitForChange */
+  int hotplug = hotplug_fd();
+  if (-1 != hotplug) {
+    hotplug_drain(hotplug);
+  }
+
+  char sysfs_root[PATH_MAX];
+  if (!realpath(sysfs, sysfs_root)) {
+    char errbuf[256];
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    fprintf(stderr, "(barobo) ERROR: in Mobot_dongleGetTTYs, realpath(%s): %s\n",
+        sysfs, errbuf);
+    return -1;
+  }
+
+  char classdir[PATH_MAX];
+  if (snprintf(classdir, sizeof(classdir), "%s/class/tty", sysfs_root)
+      >= (int)sizeof(classdir)) {
+    fprintf(stderr, "(barobo) ERROR: in Mobot_dongleGetTTYs, path too long: %s\n",
+        sysfs_root);
+    return -1;
+  }
+
+  struct dirent **entries;
+  int numentries = scandir(classdir, &entries, NULL, alphasort);
+  if (-1 == numentries) {
+    char errbuf[256];
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    fprintf(stderr, "(barobo) ERROR: in Mobot_dongleGetTTYs, scandir(%s): %s\n",
+        classdir, errbuf);
+    return -1;
+  }
+
+  /* Remember which dongle id each tty matched, so we can report them in
+   * g_barobo_usb_dongle_ids order. -1 means no match. */
+  int *match = (int*)malloc(sizeof(int) * (numentries ? numentries : 1));
+  char (*devnames)[64] = (char(*)[64])malloc(sizeof(*devnames) * (numentries ? numentries : 1));
+
+  int i;
+  if (!match || !devnames) {
+    fprintf(stderr, "(barobo) ERROR: in Mobot_dongleGetTTYs, out of memory\n");
+    for (i = 0; i < numentries; ++i) {
+      free(entries[i]);
+    }
+    free(entries);
+    free(match);
+    free(devnames);
+    return -1;
+  }
+  for (i = 0; i < numentries; ++i) {
+    match[i] = -1;
+    const char *name = entries[i]->d_name;
+    if ('.' == name[0]) {
+      continue;
+    }
+
+    char entry[PATH_MAX];
+    char devdir[PATH_MAX];
+    if (snprintf(entry, sizeof(entry), "%s/%s", classdir, name) >= (int)sizeof(entry) ||
+        !realpath(entry, devdir)) {
+      continue;
+    }
+
+    match[i] = sysfs_match_dongle(devdir, sysfs_root);
+    if (-1 != match[i]) {
+      sysfs_tty_devname(devdir, name, devnames[i], sizeof(devnames[i]));
+    }
+  }
+
+  int numfound = 0;
+  size_t id;
+  for (id = 0; id < NUM_BAROBO_USB_DONGLE_IDS; ++id) {
+    for (i = 0; i < numentries && numfound < maxttys; ++i) {
+      if ((int)id == match[i]) {
+        snprintf(ttys + numfound * len, len, "/dev/%s", devnames[i]);
+        ++numfound;
       }
     }
+  }
+
+  for (i = 0; i < numentries; ++i) {
+    free(entries[i]);
+  }
+  free(entries);
+  free(match);
+  free(devnames);
+
+  return numfound;
+}
+
+#define MAX_DONGLES 16
+
+int Mobot_dongleGetTTY (char *buf, size_t len) {
+  char ttys[MAX_DONGLES][64];
+  int numttys = Mobot_dongleGetTTYs(&ttys[0][0], sizeof(ttys[0]), MAX_DONGLES);
+  if (-1 == numttys) {
+    return -1;
+  }
+
+  int i;
+  for (i = 0; i < numttys; ++i) {
+    snprintf(buf, len, "%s", ttys[i]);
+    if (!access(buf, R_OK | W_OK)) {
+      bInfo(stderr, "(barobo) INFO: dongle found at %s\n", buf);
+      return 0;
+    }
+    if (EACCES == errno) {
+      fprintf(stderr, "(barobo) WARNING: dongle found at %s, but user does not have "
+          "sufficient read/write permissions.\n", buf);
+    }
+    else {
+      char errbuf[256];
+      strerror_r(errno, errbuf, sizeof(errbuf));
+      fprintf(stderr, "(barobo) WARNING: attempted to access %s: %s\n", buf, errbuf);
+    }
+  }
+
+  return -1;
+}
 
-    free(line);
-    if (-1 == pclose3(cmd_proc)) {
+/* Block until a tty device node is created or removed in /dev, or until
+ * timeout milliseconds have passed. A negative timeout waits forever.
+ * Changes since the last Mobot_dongleGetTTYs count, so none is missed
+ * between reading the list and waiting. */
+int Mobot_dongleWaitForChange (int timeout) {
+  int fd = hotplug_fd();
+  if (-1 == fd) {
+    return -1;
+  }
+
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+
+  /* Only tty nodes are interesting. Anything else (disks, input devices), we
+   * ignore and keep waiting. This does restart the timeout, but hotplug
+   * events are rare enough that it doesn't matter. */
+  while (!hotplug_drain(fd)) {
+    int rc = poll(&pfd, 1, timeout);
+    if (-1 == rc) {
+      if (EINTR == errno) {
+        continue;
+      }
       char errbuf[256];
       strerror_r(errno, errbuf, sizeof(errbuf));
-      fprintf(stderr, "(barobo) WARNING: error closing find dongle command: %s\n", errbuf);
+      fprintf(stderr, "(barobo) ERROR: in Mobot_dongleWaitForChange, poll(): %s\n",
+          errbuf);
       return -1;
     }
+    if (!rc) {
+      /* Timed out. */
+      return 0;
+    }
   }
 
-  return dongle_found ? 0 : -1;
+  return 1;
 }
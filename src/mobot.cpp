@@ -46,6 +46,8 @@
 #include <time.h>
 #include <sys/time.h>
 #include <termios.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #else
 #include <windows.h>
 #include <shlobj.h>
@@ -64,7 +66,9 @@
 #include <netdb.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 
 #include <arpa/inet.h>
 #else
@@ -72,6 +76,8 @@
 #endif
 
 #include "commands.h"
+#include "codec.h"
+#include "mobot_shm.h"
 #include <BaroboConfigFile.h>
 
 /* FIXME hlh: hacky, shouldn't be using statically-sized arrays for filenames
@@ -82,6 +88,12 @@
 
 #define MOBOT_BAUD 230400
 
+/* Maximum number of dongles Mobot_initDongle() will open */
+#define MAX_DONGLES 16
+/* Number of timeouts through a dongle before its children start migrating
+ * to a less busy dongle */
+#define DONGLE_CONGESTION_THRESHOLD 3
+
 #define ABS(x) ((x)<0?-(x):(x))
 
 #define DEPRECATED(from, to) \
@@ -93,10 +105,37 @@ int g_disconnectSignal = 0;
 volatile int g_mobotThreadInitializing = 0;
 
 mobot_t* g_dongleMobot = NULL;
+/* Every dongle we have opened. g_dongleMobot is always the first entry. */
+mobot_t* g_dongleMobots[MAX_DONGLES];
+char g_dongleTTYs[MAX_DONGLES][64];
+int g_numDongleMobots = 0;
+/* Protects the three above, and each child's balancePending */
+static ONCE_T g_dongleListOnce = ONCE_INIT;
+static MUTEX_T g_dongleListLock;
+
+static void Mobot_dongleListInit(void)
+{
+  MUTEX_INIT(&g_dongleListLock);
+}
+
+static void Mobot_dongleListLock()
+{
+  ONCE(g_dongleListOnce, Mobot_dongleListInit);
+  MUTEX_LOCK(&g_dongleListLock);
+}
+
+static void Mobot_dongleListUnlock()
+{
+  MUTEX_UNLOCK(&g_dongleListLock);
+}
 
 bcf_t* g_bcf;
 
 void* eventThread(void* arg);
+static void Mobot_buttonSubscriber(const mobotEvent_t* event, void* userdata);
+static void Mobot_jointSubscriber(const mobotEvent_t* event, void* userdata);
+static void Mobot_accelSubscriber(const mobotEvent_t* event, void* userdata);
+static void Mobot_rawSubscriber(const mobotEvent_t* event, void* userdata);
 
 char* mc_strdup(const char* str)
 {
@@ -315,6 +354,56 @@ int Mobot_connect(mobot_t* comms)
 
 #define PORT "5768"
 #define MAXDATASIZE 128
+
+/* connect(), but give up after msecs milliseconds rather than whenever the
+ * system does, which can be minutes for an unreachable host. The socket is
+ * blocking again when this returns. */
+static int Mobot_socketConnect(int sockfd, const struct sockaddr* addr, socklen_t addrlen, int msecs)
+{
+  fd_set wfds;
+  fd_set efds;
+  struct timeval tv;
+  int err = 0;
+  socklen_t errlen = sizeof(err);
+  int rc;
+#ifndef _WIN32
+  int flags = fcntl(sockfd, F_GETFL, 0);
+  fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+  rc = connect(sockfd, addr, addrlen);
+  if(rc == -1 && errno != EINPROGRESS) {
+    err = -1;
+  }
+#else
+  u_long mode = 1;
+  ioctlsocket(sockfd, FIONBIO, &mode);
+  rc = connect(sockfd, addr, addrlen);
+  if(rc == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+    err = -1;
+  }
+#endif
+  if(rc != 0 && err == 0) {
+    /* Windows reports a failed connect in the exception set */
+    FD_ZERO(&wfds);
+    FD_SET(sockfd, &wfds);
+    FD_ZERO(&efds);
+    FD_SET(sockfd, &efds);
+    tv.tv_sec = msecs / 1000;
+    tv.tv_usec = (msecs % 1000) * 1000;
+    rc = select(sockfd + 1, NULL, &wfds, &efds, &tv);
+    if(rc == 1 && FD_ISSET(sockfd, &wfds)) {
+      getsockopt(sockfd, SOL_SOCKET, SO_ERROR, (char*)&err, &errlen);
+    } else {
+      err = -1;
+    }
+  }
+#ifndef _WIN32
+  fcntl(sockfd, F_SETFL, flags);
+#else
+  mode = 0;
+  ioctlsocket(sockfd, FIONBIO, &mode);
+#endif
+  return err ? -1 : 0;
+}
 int Mobot_connectWithTCP(mobot_t* comms)
 {
   return Mobot_connectWithIPAddress(comms, "localhost", PORT);
@@ -344,7 +433,7 @@ int Mobot_connectWithIPAddress(mobot_t* comms, const char address[], const char
       continue;
     }
 
-    if (connect(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
+    if (Mobot_socketConnect(sockfd, p->ai_addr, p->ai_addrlen, SOCKET_CONNECT_TIMEOUT) == -1) {
 #ifndef _WIN32
       close(sockfd);
 #else
@@ -368,6 +457,14 @@ int Mobot_connectWithIPAddress(mobot_t* comms, const char address[], const char
   //printf("client: connecting to %s\n", s);
 
   freeaddrinfo(servinfo); // all done with this structure
+
+  /* Commands are a few bytes each and every one waits for its answer, so
+   * don't let Nagle hold them back. Keepalives notice a robot that went
+   * away without closing the connection. */
+  rv = 1;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (const char*)&rv, sizeof(rv));
+  setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, (const char*)&rv, sizeof(rv));
+
   comms->socket = sockfd;
   comms->connected = 1;
   comms->connectionMode = MOBOTCONNECT_TCP;
@@ -376,22 +473,352 @@ int Mobot_connectWithIPAddress(mobot_t* comms, const char address[], const char
   return 0;
 }
 
+/* Called with g_dongleListLock held. Returns nonzero if tty is open already
+ * or there is no room for another dongle. */
+static int Mobot_dongleListRefuses(const char* tty)
+{
+  int i;
+  if(g_numDongleMobots >= MAX_DONGLES) {
+    return 1;
+  }
+  for(i = 0; i < g_numDongleMobots; i++) {
+    if(!strcmp(g_dongleTTYs[i], tty)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void Mobot_addDongle(const char* tty)
+{
+  mobot_t* dongle;
+  int refused;
+  Mobot_dongleListLock();
+  refused = Mobot_dongleListRefuses(tty);
+  Mobot_dongleListUnlock();
+  if(refused) {
+    return;
+  }
+  /* Opening a dongle takes a while; don't hold up the list meanwhile */
+  dongle = (mobot_t*)malloc(sizeof(mobot_t));
+  Mobot_init(dongle);
+  if(Mobot_connectWithTTY(dongle, tty)) {
+    fprintf(stderr, "(barobo) WARNING: in %s, could not open dongle at %s.\n",
+        __func__, tty);
+    free(dongle);
+    return;
+  }
+  Mobot_dongleListLock();
+  refused = Mobot_dongleListRefuses(tty);
+  if(!refused) {
+    snprintf(g_dongleTTYs[g_numDongleMobots], sizeof(g_dongleTTYs[0]), "%s", tty);
+    g_dongleMobots[g_numDongleMobots] = dongle;
+    g_numDongleMobots++;
+    g_dongleMobot = g_dongleMobots[0];
+  }
+  Mobot_dongleListUnlock();
+  if(refused) {
+    /* Someone else opened it while we were at it */
+    Mobot_disconnect(dongle);
+    free(dongle);
+  }
+}
+
+static void Mobot_removeDongle(mobot_t* dongle)
+{
+  int i;
+  Mobot_dongleListLock();
+  for(i = 0; i < g_numDongleMobots; i++) {
+    if(g_dongleMobots[i] == dongle) {
+      break;
+    }
+  }
+  if(i == g_numDongleMobots) {
+    Mobot_dongleListUnlock();
+    return;
+  }
+  for(; i < g_numDongleMobots-1; i++) {
+    g_dongleMobots[i] = g_dongleMobots[i+1];
+    memcpy(g_dongleTTYs[i], g_dongleTTYs[i+1], sizeof(g_dongleTTYs[0]));
+  }
+  g_numDongleMobots--;
+  if(g_dongleMobot == dongle) {
+    g_dongleMobot = g_numDongleMobots > 0 ? g_dongleMobots[0] : NULL;
+  }
+  Mobot_dongleListUnlock();
+}
+
+/* Open every dongle we can find: first the ones plugged into this computer,
+ * then any listed in the configuration file. Children are spread across them
+ * by Mobot_connectChildID(). */
 void Mobot_initDongle()
 {
-  int rc;
-  char buf[32];
+  char ttys[MAX_DONGLES][64];
+  int numttys;
+  int numDongles;
   int i;
-  if(g_dongleMobot == NULL) {
-    g_dongleMobot = (mobot_t*)malloc(sizeof(mobot_t));
-    Mobot_init(g_dongleMobot);
+  const char* tty;
+  Mobot_dongleListLock();
+  numDongles = (g_dongleMobot != NULL && g_dongleMobot->connected);
+  Mobot_dongleListUnlock();
+  if(numDongles) {
+    return;
+  }
+  numttys = Mobot_dongleGetTTYs(&ttys[0][0], sizeof(ttys[0]), MAX_DONGLES);
+  for(i = 0; i < numttys; i++) {
+    Mobot_addDongle(ttys[i]);
+  }
+  if(g_bcf != NULL) {
+    for(i = 0; (tty = BCF_GetDongle(g_bcf, i)) != NULL; i++) {
+      Mobot_addDongle(tty);
+    }
   }
-  if( -1 == Mobot_dongleGetTTY(buf, sizeof(buf)) ) {
+  numDongles = Mobot_getNumDongles();
+  if(numDongles == 0) {
     fprintf(stderr, "(barobo) ERROR: in %s, no dongle found.\n", __func__);
-    free(g_dongleMobot);
-    g_dongleMobot = NULL;
     return;
   }
-  Mobot_connectWithTTY(g_dongleMobot, buf);
+  bInfo(stderr, "(barobo) INFO: %d dongle(s) opened\n", numDongles);
+}
+
+/* A dongle's load is the number of connected children it is carrying plus
+ * its recent timeouts. */
+static int Mobot_dongleLoad(mobot_t* dongle)
+{
+  int load = 0;
+  mobotInfo_t* iter;
+  MUTEX_LOCK(dongle->mobotTree_lock);
+  for(iter = dongle->children; iter != NULL; iter = iter->next) {
+    if(iter->mobot != NULL && iter->mobot->connected) {
+      load++;
+    }
+  }
+  load += dongle->congestion;
+  MUTEX_UNLOCK(dongle->mobotTree_lock);
+  return load;
+}
+
+/* Try to connect the child through each dongle, least loaded first. A robot
+ * only answers CMD_FINDMOBOT on its own RF channel, so this also assigns the
+ * child to a dongle on the right channel. */
+static int Mobot_connectChildAnyDongle(mobot_t* child, const char* childSerialID)
+{
+  mobot_t* dongles[MAX_DONGLES];
+  int loads[MAX_DONGLES];
+  int numDongles;
+  int i, j, rc = -2;
+  Mobot_dongleListLock();
+  numDongles = g_numDongleMobots;
+  for(i = 0; i < numDongles; i++) {
+    dongles[i] = g_dongleMobots[i];
+  }
+  Mobot_dongleListUnlock();
+  for(i = 0; i < numDongles; i++) {
+    loads[i] = Mobot_dongleLoad(dongles[i]);
+  }
+  /* Insertion sort by load; there are only ever a handful of dongles */
+  for(i = 1; i < numDongles; i++) {
+    mobot_t* d = dongles[i];
+    int l = loads[i];
+    for(j = i; j > 0 && loads[j-1] > l; j--) {
+      dongles[j] = dongles[j-1];
+      loads[j] = loads[j-1];
+    }
+    dongles[j] = d;
+    loads[j] = l;
+  }
+  for(i = 0; i < numDongles; i++) {
+    rc = Mobot_connectChildID(dongles[i], child, childSerialID);
+    if(rc == 0) {
+      break;
+    }
+  }
+  return rc;
+}
+
+int Mobot_getNumDongles()
+{
+  int num;
+  Mobot_dongleListLock();
+  num = g_numDongleMobots;
+  Mobot_dongleListUnlock();
+  return num;
+}
+
+mobot_t* Mobot_getDongleIndex(int index)
+{
+  mobot_t* dongle = NULL;
+  Mobot_dongleListLock();
+  if(index >= 0 && index < g_numDongleMobots) {
+    dongle = g_dongleMobots[index];
+  }
+  Mobot_dongleListUnlock();
+  return dongle;
+}
+
+int Mobot_migrateChild(mobot_t* child, mobot_t* dongle)
+{
+  mobot_t* oldParent = child->parent;
+  mobotInfo_t *iter, *existing, **prev;
+  mobotInfo_t* spare;
+  int balanceable;
+  int rc;
+  if(
+      (child->connectionMode != MOBOTCONNECT_ZIGBEE) ||
+      (oldParent == NULL) ||
+      (dongle == NULL) ||
+      (dongle->connectionMode != MOBOTCONNECT_TTY)
+    )
+  {
+    return -1;
+  }
+  if(dongle == oldParent) {
+    return 0;
+  }
+  /* The dongle's own robot cannot be moved anywhere */
+  if(child == oldParent->child) {
+    return -1;
+  }
+  /* CMD_SETRFCHANNEL answers on the new channel, which the old dongle cannot
+   * hear, so we only move children between dongles sharing a channel. */
+  if(dongle->rfChannel != oldParent->rfChannel) {
+    fprintf(stderr, "(barobo) ERROR: in %s, dongles are on different RF channels.\n",
+        __func__);
+    return -1;
+  }
+  /* In case the old dongle has no entry to bring along. Allocated up front,
+   * as there is no going back once the child is unpaired. */
+  spare = (mobotInfo_t*)malloc(sizeof(mobotInfo_t));
+  if(spare == NULL) {
+    return -1;
+  }
+  /* Don't let the transactions below try to balance this child again */
+  balanceable = child->balanceable;
+  child->balanceable = 0;
+
+  Mobot_unpair(child);
+
+  /* Nothing may be in flight while the child changes parents */
+  MUTEX_LOCK(child->commsLock);
+  MUTEX_LOCK(oldParent->mobotTree_lock);
+  for(prev = &oldParent->children; *prev != NULL; prev = &(*prev)->next) {
+    if((*prev)->mobot == child) {
+      break;
+    }
+  }
+  iter = *prev;
+  if(iter != NULL) {
+    *prev = iter->next;
+  }
+  MUTEX_UNLOCK(oldParent->mobotTree_lock);
+
+  MUTEX_LOCK(dongle->mobotTree_lock);
+  /* The new dongle may already know about this robot from a scan */
+  for(existing = dongle->children; existing != NULL; existing = existing->next) {
+    if(!strncmp(existing->serialID, child->serialID, 4)) {
+      break;
+    }
+  }
+  if(existing != NULL) {
+    existing->mobot = child;
+    existing->zigbeeAddr = child->zigbeeAddr;
+    free(iter);
+    free(spare);
+  } else {
+    if(iter == NULL) {
+      iter = spare;
+      memset(iter, 0, sizeof(mobotInfo_t));
+      iter->zigbeeAddr = child->zigbeeAddr;
+      memcpy(iter->serialID, child->serialID, 4);
+      iter->mobot = child;
+    } else {
+      free(spare);
+    }
+    iter->parent = dongle;
+    iter->next = dongle->children;
+    dongle->children = iter;
+  }
+  MUTEX_UNLOCK(dongle->mobotTree_lock);
+  child->parent = dongle;
+  MUTEX_UNLOCK(child->commsLock);
+
+  /* Events should now be reported to the new dongle */
+  rc = Mobot_pair(child);
+  bInfo(stderr, "(barobo) INFO: moved %s to another dongle\n", child->serialID);
+  child->balanceable = balanceable;
+  return rc;
+}
+
+/* Move the child to the least loaded dongle on the same RF channel, if that
+ * would actually help. */
+static void Mobot_balanceChild(mobot_t* child)
+{
+  mobot_t* parent = child->parent;
+  mobot_t* dongles[MAX_DONGLES];
+  mobot_t* best = NULL;
+  int numDongles;
+  int bestLoad;
+  int load;
+  int i;
+  if(parent == NULL) {
+    return;
+  }
+  Mobot_dongleListLock();
+  numDongles = g_numDongleMobots;
+  for(i = 0; i < numDongles; i++) {
+    dongles[i] = g_dongleMobots[i];
+  }
+  Mobot_dongleListUnlock();
+  /* Don't count the child itself against its current dongle */
+  bestLoad = Mobot_dongleLoad(parent) - 1;
+  for(i = 0; i < numDongles; i++) {
+    if(
+        (dongles[i] == parent) ||
+        (dongles[i]->rfChannel != parent->rfChannel)
+      )
+    {
+      continue;
+    }
+    load = Mobot_dongleLoad(dongles[i]);
+    if(load < bestLoad) {
+      best = dongles[i];
+      bestLoad = load;
+    }
+  }
+  if(best != NULL) {
+    Mobot_migrateChild(child, best);
+    /* Give the old dongle a clean slate */
+    MUTEX_LOCK(parent->mobotTree_lock);
+    parent->congestion = 0;
+    MUTEX_UNLOCK(parent->mobotTree_lock);
+  }
+}
+
+static void* Mobot_balanceThread(void* arg)
+{
+  mobot_t* child = (mobot_t*)arg;
+  Mobot_balanceChild(child);
+  Mobot_dongleListLock();
+  child->balancePending = 0;
+  Mobot_dongleListUnlock();
+  return NULL;
+}
+
+/* Called when a transaction through a congested dongle times out. Moving the
+ * child takes transactions of its own, so it happens on the child's query
+ * queue rather than inside the transaction that noticed. */
+static void Mobot_scheduleBalance(mobot_t* child)
+{
+  int schedule;
+  Mobot_dongleListLock();
+  schedule = !child->balancePending && g_numDongleMobots >= 2;
+  if(schedule) {
+    child->balancePending = 1;
+  }
+  Mobot_dongleListUnlock();
+  if(schedule) {
+    Mobot_taskDetach(Mobot_taskSubmit(child->queryQueue, Mobot_balanceThread, child));
+  }
 }
 
 int Mobot_connectWithAddress(mobot_t* comms, const char* address, int channel)
@@ -423,7 +850,7 @@ int Mobot_connectWithAddress(mobot_t* comms, const char* address, int channel)
     assert(0);  // FIXME :(
 #endif
   } else {
-    rc = Mobot_connectChildID(g_dongleMobot, comms, address);
+    rc = Mobot_connectChildID(NULL, comms, address);
     return rc;
   }
   return 0;
@@ -431,7 +858,7 @@ int Mobot_connectWithAddress(mobot_t* comms, const char* address, int channel)
 
 int Mobot_connectWithSerialID(mobot_t* comms, const char address[])
 {
-  return Mobot_connectChildID(g_dongleMobot, comms, address);
+  return Mobot_connectChildID(NULL, comms, address);
 }
 
 int Mobot_connectWithZigbeeAddress(mobot_t* comms, uint16_t addr)
@@ -719,91 +1146,378 @@ int getFormFactor(mobot_t* comms, int* form)
   return 0;
 }
 
-int Mobot_connectChild(mobot_t* parent, mobot_t* child)
+/* Ask the robot for its serial ID, bypassing the property cache */
+int getSerialID(mobot_t* comms)
 {
-  /* First check to see if the requested child is already in the list of knows
-   * Serial ID's */  
-  int idFound = 0;
-  mobotInfo_t* iter;
-  int i;
-  int rc;
-  Mobot_initDongle();
-  for(i = 0; i < 2; i++) {
-    MUTEX_LOCK(parent->mobotTree_lock);
-    if(parent->children != NULL) {
-      child->connected = 1;
-      child->connectionMode = MOBOTCONNECT_ZIGBEE;
-      strcpy(child->serialID, parent->children->serialID);
-      child->zigbeeAddr = parent->children->zigbeeAddr;
+  int status;
+  uint8_t buf[8];
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETSERIALID), buf, 0);
+  if(status < 0) return status;
+  /* Make sure the buf size is correct */
+  if(buf[1] != 7) {
+    return -1;
+  }
+  memcpy(comms->serialID, &buf[2], 4);
+  comms->serialID[4] = '\0';
+  comms->propertiesKnown |= MOBOT_PROP_SERIALID;
+  return 0;
+}
 
-      rc = finishConnect(child);
-      if(rc) {
-        child->connected = 0;
-        child->connectionMode = MOBOTCONNECT_NONE;
-      } else {
-        parent->children->mobot = child;
-      }
-      MUTEX_UNLOCK(parent->mobotTree_lock);
-      return rc;
-    }
-    MUTEX_UNLOCK(parent->mobotTree_lock);
-    Mobot_queryAddresses(parent);
+/* Immutable robot properties, keyed by serial ID. -1 means not known. */
+typedef struct mobotProperties_s
+{
+  char serialID[5];
+  int formFactor;
+  int protocolVersion;
+  int hwRev;
+  int zigbeeAddr;
+  struct mobotProperties_s* next;
+} mobotProperties_t;
+
+static ONCE_T g_propertiesOnce = ONCE_INIT;
+static MUTEX_T g_properties_lock;
+static mobotProperties_t* g_properties = NULL;
+static int g_propertiesPersist = 0;
+static int g_propertiesLoaded = 0;
+
+static void Mobot_propertiesInitOnce(void)
+{
+  MUTEX_INIT(&g_properties_lock);
+}
+
+static void Mobot_propertiesInit()
+{
+  ONCE(g_propertiesOnce, Mobot_propertiesInitOnce);
+}
+
+/* The default Barobo config file, which every robot starts out with. path
+ * must hold MAX_PATH characters. */
+static void Mobot_configPath(char* path)
+{
 #ifdef _WIN32
-    Sleep(5000);
+  /* Find the user's local appdata directory */
+  if(SHGetFolderPathA(NULL, CSIDL_LOCAL_APPDATA, NULL, 0, path) != S_OK) 
+  {
+    /* Could not get the user's app data directory */
+  } else {
+    //MessageBox((LPCTSTR)path, (LPCTSTR)"Test");
+    //fprintf(fp, "%s", path); 
+  }
+  strcat(path, "\\Barobo.config");
 #else
-    sleep(5);
+  /* Try to open the barobo configuration file. */
+  strcpy(path, getenv("HOME"));
+  strcat(path, "/.Barobo.config");
 #endif
-  }
-  /* Did not find the child */
-  MUTEX_UNLOCK(parent->mobotTree_lock);
-  return -1;
 }
 
-int Mobot_findMobot(mobot_t* parent, const char* childSerialID)
+/* The cache file lives next to the config file: Barobo.config becomes
+ * Barobo.properties */
+static void Mobot_propertiesPath(const char* configPath, char* path, size_t len)
 {
-  uint8_t buf[64];
-  int rc;
-  /* If a parent was specified, use it as a dongle */
-  if(parent == NULL) {
-    Mobot_initDongle();
-    parent = g_dongleMobot;
+  size_t n = strlen(configPath);
+  if(n >= strlen("config") && !strcmp(configPath + n - strlen("config"), "config")) {
+    snprintf(path, len, "%.*sproperties", (int)(n - strlen("config")), configPath);
+  } else {
+    snprintf(path, len, "%s.properties", configPath);
   }
-  memcpy(buf, childSerialID, 4);
-  rc = MobotMsgTransaction(parent, BTCMD(CMD_FINDMOBOT), buf, 4);
-  if(rc) {return rc;}
-  if(buf[0] == 0xff) { return -1; } 
-  return 0;
 }
 
-int Mobot_connectChildID(mobot_t* parent, mobot_t* child, const char* childSerialID)
-{ 
-  int form; int rc;
-  int i;
-  char* _childSerialID;
-  _childSerialID = strdup(childSerialID);
-  for(i = 0; i < strlen(_childSerialID); i++) {
-    _childSerialID[i] = toupper(_childSerialID[i]);
+/* Called with g_properties_lock held */
+static mobotProperties_t* Mobot_propertiesFind(const char* serialID)
+{
+  mobotProperties_t* iter;
+  for(iter = g_properties; iter != NULL; iter = iter->next) {
+    if(!strcmp(iter->serialID, serialID)) {
+      return iter;
+    }
   }
-  /* If a parent was specified, use it as a dongle */
-  if(parent == NULL) {
-    if(g_bcf == NULL) {
-      g_bcf = BCF_New();
-      if(BCF_Read(g_bcf, child->configFilePath)) {
-        fprintf(stderr, 
-            "ERROR: Your Barobo configuration file does not exist.\n"
-            "Please create one by opening the MoBot remote control, clicking on\n"
-            "the 'Robot' menu entry, and selecting 'Configure Robot Bluetooth'.\n");
-        BCF_Destroy(g_bcf);
-        g_bcf = NULL;
-        free(_childSerialID);
-        return -1;
-      }
+  return NULL;
+}
+
+/* Called with g_properties_lock held */
+static mobotProperties_t* Mobot_propertiesAdd(const char* serialID)
+{
+  mobotProperties_t* props = Mobot_propertiesFind(serialID);
+  if(props == NULL) {
+    props = (mobotProperties_t*)malloc(sizeof(mobotProperties_t));
+    if(props == NULL) {
+      return NULL;
     }
-    Mobot_initDongle();
-    parent = g_dongleMobot;
-  } else {
+    snprintf(props->serialID, sizeof(props->serialID), "%s", serialID);
+    props->formFactor = -1;
+    props->protocolVersion = -1;
+    props->hwRev = -1;
+    props->zigbeeAddr = -1;
+    props->next = g_properties;
+    g_properties = props;
   }
-  /* If parent is still NULL, return error */
+  return props;
+}
+
+/* Called with g_properties_lock held */
+static void Mobot_propertiesLoad(const char* configPath)
+{
+  char path[512];
+  char line[128];
+  char serialID[5];
+  int form, version, rev, addr;
+  FILE* fp;
+  mobotProperties_t* props;
+  g_propertiesLoaded = 1;
+  Mobot_propertiesPath(configPath, path, sizeof(path));
+  fp = fopen(path, "r");
+  if(fp == NULL) {
+    return;
+  }
+  while(fgets(line, sizeof(line), fp)) {
+    if(sscanf(line, "%4s %d %d %d %d", serialID, &form, &version, &rev, &addr) != 5) {
+      continue;
+    }
+    props = Mobot_propertiesAdd(serialID);
+    if(props == NULL) {
+      break;
+    }
+    props->formFactor = form;
+    props->protocolVersion = version;
+    props->hwRev = rev;
+    props->zigbeeAddr = addr;
+  }
+  fclose(fp);
+}
+
+/* Called with g_properties_lock held */
+static void Mobot_propertiesSave(const char* configPath)
+{
+  char path[512];
+  FILE* fp;
+  mobotProperties_t* iter;
+  Mobot_propertiesPath(configPath, path, sizeof(path));
+  fp = fopen(path, "w");
+  if(fp == NULL) {
+    char errbuf[256];
+#ifndef _WIN32
+    strerror_r(errno, errbuf, sizeof(errbuf));
+#else
+    strerror_s(errbuf, sizeof(errbuf), errno);
+#endif
+    fprintf(stderr, "(barobo) WARNING: could not save robot properties to %s: %s\n",
+        path, errbuf);
+    return;
+  }
+  for(iter = g_properties; iter != NULL; iter = iter->next) {
+    fprintf(fp, "%s %d %d %d %d\n", iter->serialID, iter->formFactor,
+        iter->protocolVersion, iter->hwRev, iter->zigbeeAddr);
+  }
+  fclose(fp);
+}
+
+/* Fill in whatever the cache knows about the robot with comms->serialID.
+ * Returns 0 if the form factor and protocol version were both found. The
+ * ZigBee address is left alone: the live connection knows it better. */
+static int Mobot_propertiesLookup(mobot_t* comms)
+{
+  mobotProperties_t* props;
+  int rc = -1;
+  Mobot_propertiesInit();
+  MUTEX_LOCK(&g_properties_lock);
+  if(g_propertiesPersist && !g_propertiesLoaded) {
+    Mobot_propertiesLoad(comms->configFilePath);
+  }
+  props = Mobot_propertiesFind(comms->serialID);
+  if(props && props->formFactor >= 0 && props->protocolVersion >= 0) {
+    comms->formFactor = (mobotFormFactor_t)props->formFactor;
+    comms->protocolVersion = props->protocolVersion;
+    comms->propertiesKnown |= MOBOT_PROP_FORMFACTOR | MOBOT_PROP_VERSION;
+    if(props->hwRev >= 0) {
+      comms->hwRev = props->hwRev;
+      comms->propertiesKnown |= MOBOT_PROP_HWREV;
+    }
+    rc = 0;
+  }
+  MUTEX_UNLOCK(&g_properties_lock);
+  return rc;
+}
+
+/* Remember everything we know about this robot under its serial ID */
+void Mobot_propertiesStore(mobot_t* comms)
+{
+  mobotProperties_t* props;
+  if(!(comms->propertiesKnown & MOBOT_PROP_SERIALID)) {
+    return;
+  }
+  Mobot_propertiesInit();
+  MUTEX_LOCK(&g_properties_lock);
+  if(g_propertiesPersist && !g_propertiesLoaded) {
+    Mobot_propertiesLoad(comms->configFilePath);
+  }
+  props = Mobot_propertiesAdd(comms->serialID);
+  if(props == NULL) {
+    MUTEX_UNLOCK(&g_properties_lock);
+    return;
+  }
+  if(comms->propertiesKnown & MOBOT_PROP_FORMFACTOR) {
+    props->formFactor = comms->formFactor;
+  }
+  if(comms->propertiesKnown & MOBOT_PROP_VERSION) {
+    props->protocolVersion = comms->protocolVersion;
+  }
+  if(comms->propertiesKnown & MOBOT_PROP_HWREV) {
+    props->hwRev = comms->hwRev;
+  }
+  if(comms->propertiesKnown & MOBOT_PROP_ADDRESS) {
+    props->zigbeeAddr = comms->zigbeeAddr;
+  }
+  if(g_propertiesPersist) {
+    Mobot_propertiesSave(comms->configFilePath);
+  }
+  MUTEX_UNLOCK(&g_properties_lock);
+}
+
+/* Drop what the cache knows under the robot's current serial ID, for when
+ * that ID is about to change */
+static void Mobot_propertiesForget(mobot_t* comms)
+{
+  mobotProperties_t** link;
+  mobotProperties_t* props;
+  if(!(comms->propertiesKnown & MOBOT_PROP_SERIALID)) {
+    return;
+  }
+  Mobot_propertiesInit();
+  MUTEX_LOCK(&g_properties_lock);
+  for(link = &g_properties; *link != NULL; link = &(*link)->next) {
+    if(!strcmp((*link)->serialID, comms->serialID)) {
+      props = *link;
+      *link = props->next;
+      free(props);
+      if(g_propertiesPersist) {
+        Mobot_propertiesSave(comms->configFilePath);
+      }
+      break;
+    }
+  }
+  MUTEX_UNLOCK(&g_properties_lock);
+}
+
+int Mobot_setPropertyCachePersistent(int persist)
+{
+  Mobot_propertiesInit();
+  MUTEX_LOCK(&g_properties_lock);
+  g_propertiesPersist = persist;
+  MUTEX_UNLOCK(&g_properties_lock);
+  return 0;
+}
+
+int Mobot_clearPropertyCache()
+{
+  mobotProperties_t* iter;
+  char path[MAX_PATH];
+  Mobot_propertiesInit();
+  MUTEX_LOCK(&g_properties_lock);
+  while(g_properties != NULL) {
+    iter = g_properties;
+    g_properties = iter->next;
+    free(iter);
+  }
+  /* An empty cache on disk as well, rather than reloading the old one */
+  g_propertiesLoaded = 1;
+  if(g_propertiesPersist) {
+    Mobot_configPath(path);
+    Mobot_propertiesSave(path);
+  }
+  MUTEX_UNLOCK(&g_properties_lock);
+  return 0;
+}
+
+int Mobot_connectChild(mobot_t* parent, mobot_t* child)
+{
+  /* First check to see if the requested child is already in the list of knows
+   * Serial ID's */  
+  int idFound = 0;
+  mobotInfo_t* iter;
+  int i;
+  int rc;
+  Mobot_initDongle();
+  for(i = 0; i < 2; i++) {
+    MUTEX_LOCK(parent->mobotTree_lock);
+    if(parent->children != NULL) {
+      child->connected = 1;
+      child->connectionMode = MOBOTCONNECT_ZIGBEE;
+      strcpy(child->serialID, parent->children->serialID);
+      child->zigbeeAddr = parent->children->zigbeeAddr;
+
+      rc = finishConnect(child);
+      if(rc) {
+        child->connected = 0;
+        child->connectionMode = MOBOTCONNECT_NONE;
+      } else {
+        parent->children->mobot = child;
+      }
+      MUTEX_UNLOCK(parent->mobotTree_lock);
+      return rc;
+    }
+    MUTEX_UNLOCK(parent->mobotTree_lock);
+    Mobot_queryAddresses(parent);
+#ifdef _WIN32
+    Sleep(5000);
+#else
+    sleep(5);
+#endif
+  }
+  /* Did not find the child */
+  MUTEX_UNLOCK(parent->mobotTree_lock);
+  return -1;
+}
+
+int Mobot_findMobot(mobot_t* parent, const char* childSerialID)
+{
+  uint8_t buf[64];
+  int rc;
+  /* If a parent was specified, use it as a dongle */
+  if(parent == NULL) {
+    Mobot_initDongle();
+    parent = g_dongleMobot;
+  }
+  memcpy(buf, childSerialID, 4);
+  rc = MobotMsgTransaction(parent, BTCMD(CMD_FINDMOBOT), buf, 4);
+  if(rc) {return rc;}
+  if(buf[0] == 0xff) { return -1; } 
+  return 0;
+}
+
+int Mobot_connectChildID(mobot_t* parent, mobot_t* child, const char* childSerialID)
+{ 
+  int form; int rc;
+  int i;
+  char* _childSerialID;
+  _childSerialID = strdup(childSerialID);
+  for(i = 0; i < strlen(_childSerialID); i++) {
+    _childSerialID[i] = toupper(_childSerialID[i]);
+  }
+  /* If a parent was specified, use it as a dongle */
+  if(parent == NULL) {
+    if(g_bcf == NULL) {
+      g_bcf = BCF_New();
+      if(BCF_Read(g_bcf, child->configFilePath)) {
+        fprintf(stderr, 
+            "ERROR: Your Barobo configuration file does not exist.\n"
+            "Please create one by opening the MoBot remote control, clicking on\n"
+            "the 'Robot' menu entry, and selecting 'Configure Robot Bluetooth'.\n");
+        BCF_Destroy(g_bcf);
+        g_bcf = NULL;
+        free(_childSerialID);
+        return -1;
+      }
+    }
+    Mobot_initDongle();
+    free(_childSerialID);
+    if(Mobot_getNumDongles() == 0) {
+      return -2;
+    }
+    return Mobot_connectChildAnyDongle(child, childSerialID);
+  } else {
+  }
+  /* If parent is still NULL, return error */
   if(parent == NULL) {
     return -2;
   }
@@ -881,6 +1595,7 @@ int Mobot_connectChildID(mobot_t* parent, mobot_t* child, const char* childSeria
 }
 
 int finishConnectWithoutCommsThread (mobot_t* comms);
+static int Mobot_taskQueuesOpen(mobot_t* comms);
 
 int finishConnect (mobot_t* comms) {
   /* Start the comms engine */
@@ -917,6 +1632,13 @@ int finishConnectWithoutCommsThread(mobot_t* comms)
   mobotFormFactor_t form;
   uint8_t buf[256];
 
+  /* A previous Mobot_disconnect freed the task queues */
+  if(Mobot_taskQueuesOpen(comms)) {
+    fprintf(stderr, "(barobo) ERROR: Could not create the task queues.\n");
+    Mobot_disconnect(comms);
+    return -1;
+  }
+
   /* Make sure we are connected to a Mobot */
   if(Mobot_getStatus(comms)) {
     fprintf(stderr, "(barobo) ERROR: Mobot_getStatus() returned something not good.\n");
@@ -924,16 +1646,31 @@ int finishConnectWithoutCommsThread(mobot_t* comms)
     return -1;
   }
 
-  /* Get form factor */
-  rc = getFormFactor(comms, (int*)&form);
-  if(rc == -1) {
-    form = MOBOTFORM_ORIGINAL;
-  } else if (rc == -2) {
-    fprintf(stderr, "(barobo) ERROR: getFormFactor() returned something not good.\n");
-    Mobot_disconnect(comms);
-    return rc;
+  /* Linkbots can tell us their serial ID, and with that the property cache
+   * may already know everything else we would ask for. The original Mobot
+   * has no serial ID, so only try this with dongles and ZigBee children. */
+  comms->propertiesKnown = 0;
+  if(
+      (comms->connectionMode == MOBOTCONNECT_TTY ||
+       comms->connectionMode == MOBOTCONNECT_ZIGBEE) &&
+      !getSerialID(comms) &&
+      !Mobot_propertiesLookup(comms)
+    )
+  {
+    form = comms->formFactor;
+  } else {
+    /* Get form factor */
+    rc = getFormFactor(comms, (int*)&form);
+    if(rc == -1) {
+      form = MOBOTFORM_ORIGINAL;
+    } else if (rc == -2) {
+      fprintf(stderr, "(barobo) ERROR: getFormFactor() returned something not good.\n");
+      Mobot_disconnect(comms);
+      return rc;
+    }
+    comms->formFactor = form;
+    comms->propertiesKnown |= MOBOT_PROP_FORMFACTOR;
   }
-  comms->formFactor = form;
   switch(form) {
     case MOBOTFORM_ORIGINAL:
       numJoints = 4;
@@ -988,7 +1725,10 @@ int finishConnectWithoutCommsThread(mobot_t* comms)
       (comms->formFactor == MOBOTFORM_L) 
     )
   {
-    comms->zigbeeAddr = Mobot_getAddress(comms);
+    rc = Mobot_getAddress(comms);
+    if(rc >= 0) {
+      comms->zigbeeAddr = rc;
+    }
     /* See if we can get the serial id */
     rc = Mobot_getID(comms);
     if (-1 == rc) {
@@ -999,9 +1739,15 @@ int finishConnectWithoutCommsThread(mobot_t* comms)
     }
   }
 
+  Mobot_propertiesStore(comms);
+
   /* Start the eventqueue thread */
   THREAD_CREATE(comms->eventthread, eventThread, comms);
 
+  if(comms->connectionMode == MOBOTCONNECT_ZIGBEE) {
+    comms->balanceable = 1;
+  }
+
   return 0;
 }
 
@@ -1156,6 +1902,9 @@ int Mobot_getAddress(mobot_t* comms)
   int status;
   uint8_t buf[8];
   int addr;
+  if(comms->propertiesKnown & MOBOT_PROP_ADDRESS) {
+    return comms->zigbeeAddr;
+  }
   status = MobotMsgTransaction(comms, BTCMD(CMD_GETADDRESS), buf, 0);
   if(status < 0) return status;
   /* Make sure the buf size is correct */
@@ -1163,6 +1912,8 @@ int Mobot_getAddress(mobot_t* comms)
     return -1;
   }
   addr = (buf[2]<<8) | buf[3];
+  comms->zigbeeAddr = addr;
+  comms->propertiesKnown |= MOBOT_PROP_ADDRESS;
   return addr;
 }
 
@@ -1205,9 +1956,33 @@ mobot_t* Mobot_getDongle()
   return g_dongleMobot;
 }
 
+/* Make comms the default dongle. Dongles opened before it stay open and
+ * keep carrying their children. */
 int Mobot_setDongleMobot(mobot_t* comms)
 {
+  int i;
+  Mobot_dongleListLock();
+  for(i = 0; i < g_numDongleMobots; i++) {
+    if(g_dongleMobots[i] == comms) {
+      break;
+    }
+  }
+  if(i == g_numDongleMobots) {
+    if(g_numDongleMobots >= MAX_DONGLES) {
+      Mobot_dongleListUnlock();
+      return -1;
+    }
+    g_numDongleMobots++;
+  }
+  /* Move everything in front of it back by one */
+  for(; i > 0; i--) {
+    g_dongleMobots[i] = g_dongleMobots[i-1];
+    memcpy(g_dongleTTYs[i], g_dongleTTYs[i-1], sizeof(g_dongleTTYs[0]));
+  }
+  g_dongleMobots[0] = comms;
+  g_dongleTTYs[0][0] = '\0';
   g_dongleMobot = comms;
+  Mobot_dongleListUnlock();
   return 0;
 }
 
@@ -1223,6 +1998,42 @@ int Mobot_setRFChannel(mobot_t* comms, uint8_t channel)
   if(buf[1] != 3) {
     return -1;
   }
+  comms->rfChannel = channel;
+  return 0;
+}
+
+/* The dongle a robot's traffic goes through, or NULL if it isn't talking
+ * through a dongle at all. */
+static MOBOTdongle* Mobot_getTxDongle(mobot_t* comms)
+{
+  if(comms->connectionMode == MOBOTCONNECT_TTY) {
+    return comms->dongle;
+  } else if (
+      (comms->connectionMode == MOBOTCONNECT_ZIGBEE) &&
+      (comms->parent != NULL)
+      )
+  {
+    return comms->parent->dongle;
+  }
+  return NULL;
+}
+
+int Mobot_flush(mobot_t* comms)
+{
+  MOBOTdongle* dongle = Mobot_getTxDongle(comms);
+  if(dongle == NULL) {
+    return 0;
+  }
+  return dongleFlush(dongle);
+}
+
+int Mobot_setTxCoalescing(mobot_t* comms, int usecs, int bytes)
+{
+  MOBOTdongle* dongle = Mobot_getTxDongle(comms);
+  if(dongle == NULL || usecs < 0 || bytes < 0) {
+    return -1;
+  }
+  dongleSetTxCoalescing(dongle, usecs, bytes);
   return 0;
 }
 
@@ -1242,6 +2053,12 @@ int Mobot_setID(mobot_t* comms, const char* id)
   if(buf[1] != 3) {
     return -1;
   }
+  /* Move the cached properties over to the new ID */
+  Mobot_propertiesForget(comms);
+  comms->propertiesKnown &= ~MOBOT_PROP_SERIALID;
+  if(!getSerialID(comms)) {
+    Mobot_propertiesStore(comms);
+  }
   return 0;
 }
 
@@ -1266,6 +2083,67 @@ int Mobot_reboot(mobot_t* comms)
   return 0;
 }
 
+/* Cancel the legacy callback subscription in *slot. callback_lock must not
+ * be held: Mobot_unsubscribe waits for a callback in progress, and that
+ * callback may take callback_lock itself. */
+static void Mobot_callbackUnsubscribe(mobot_t* comms, mobotSubscriber_t** slot)
+{
+  mobotSubscriber_t* sub;
+  MUTEX_LOCK(comms->callback_lock);
+  sub = *slot;
+  *slot = NULL;
+  MUTEX_UNLOCK(comms->callback_lock);
+  Mobot_unsubscribe(sub);
+}
+
+/* Create whichever of the robot's task queues it doesn't have yet. They are
+ * freed again by Mobot_disconnect. */
+static int Mobot_taskQueuesOpen(mobot_t* comms)
+{
+  if(comms->motionQueue == NULL) {
+    comms->motionQueue = Mobot_taskQueueNew();
+  }
+  if(comms->queryQueue == NULL) {
+    comms->queryQueue = Mobot_taskQueueNewPool(TASK_POOL_QUERY);
+  }
+  if(comms->stopQueue == NULL) {
+    comms->stopQueue = Mobot_taskQueueNewPool(TASK_POOL_URGENT);
+  }
+  if(comms->coalesceQueue == NULL) {
+    comms->coalesceQueue = Mobot_taskQueueNewPool(TASK_POOL_COALESCE);
+  }
+  if(
+      (comms->motionQueue == NULL) ||
+      (comms->queryQueue == NULL) ||
+      (comms->stopQueue == NULL) ||
+      (comms->coalesceQueue == NULL)
+    )
+  {
+    return -1;
+  }
+  return 0;
+}
+
+/* Let whatever is queued for the robot finish, then free its queues. Called
+ * once the connection is closed, so tasks still waiting fail quickly. */
+static void Mobot_taskQueueClose(mobotTaskQueue_t** queue)
+{
+  if(*queue == NULL) {
+    return;
+  }
+  Mobot_taskQueueWait(*queue);
+  Mobot_taskQueueFree(*queue);
+  *queue = NULL;
+}
+
+static void Mobot_taskQueuesClose(mobot_t* comms)
+{
+  Mobot_taskQueueClose(&comms->motionQueue);
+  Mobot_taskQueueClose(&comms->queryQueue);
+  Mobot_taskQueueClose(&comms->stopQueue);
+  Mobot_taskQueueClose(&comms->coalesceQueue);
+}
+
 int Mobot_disconnect(mobot_t* comms)
 {
   int rc = 0;
@@ -1281,6 +2159,15 @@ int Mobot_disconnect(mobot_t* comms)
     MUTEX_UNLOCK(&lock);
     return 0;
   }
+  /* Whatever we connect to next may be a different robot */
+  comms->propertiesKnown = 0;
+  Mobot_telemetryStop(comms);
+  Mobot_shmExportStop(comms);
+  /* No more callbacks once we are gone */
+  Mobot_callbackUnsubscribe(comms, &comms->buttonSub);
+  Mobot_callbackUnsubscribe(comms, &comms->jointSub);
+  Mobot_callbackUnsubscribe(comms, &comms->accelSub);
+  Mobot_callbackUnsubscribe(comms, &comms->rawSub);
   bInfo(stderr, "(barobo) INFO: disconnecting %s\n", comms->serialID);
 #ifndef _WIN32
   switch(comms->connectionMode) {
@@ -1312,8 +2199,10 @@ int Mobot_disconnect(mobot_t* comms)
       //while(g_disconnectSignal);
       dongleClose(comms->dongle);
       free(comms->dongle);
+      Mobot_removeDongle(comms);
       break;
     case MOBOTCONNECT_ZIGBEE:
+      comms->balanceable = 0;
       Mobot_unpair(comms);
       /* If we are the ghost-child of a TTY connected robot, we need to set
        * child back to NULL */
@@ -1382,6 +2271,7 @@ int Mobot_disconnect(mobot_t* comms)
       rc = 0;
   }
 #endif
+  Mobot_taskQueuesClose(comms);
   if(g_numConnected > 0) {
     g_numConnected--;
   }
@@ -1394,6 +2284,7 @@ int Mobot_enableButtonCallback(mobot_t* comms, void* data,
 {
   uint8_t buf[16];
   int status;
+  Mobot_callbackUnsubscribe(comms, &comms->buttonSub);
   MUTEX_LOCK(comms->callback_lock);
   /* Send a message to the Mobot */
   buf[0] = 1;
@@ -1411,6 +2302,8 @@ int Mobot_enableButtonCallback(mobot_t* comms, void* data,
   comms->buttonCallback = (void(*)(void*,int,int))buttonCallback;
   comms->callbackEnabled = 1;
   comms->mobot = data;
+  comms->buttonSub = Mobot_subscribe(comms, MOBOT_EVENT_BUTTON, 0, 0,
+      Mobot_buttonSubscriber, comms);
   MUTEX_UNLOCK(comms->callback_lock);
   return 0;
 }
@@ -1422,6 +2315,7 @@ int Mobot_enableJointEventCallback(mobot_t* comms, void* userdata,
   int status;
   uint8_t buf[24];
   buf[0] = 7;
+  Mobot_callbackUnsubscribe(comms, &comms->jointSub);
   MUTEX_LOCK(comms->callback_lock);
   status = MobotMsgTransaction(comms, BTCMD(CMD_SET_ENABLE_JOINT_EVENT), buf, 1);
   if(status < 0) {
@@ -1435,6 +2329,8 @@ int Mobot_enableJointEventCallback(mobot_t* comms, void* userdata,
   }
   comms->jointCallback = jointCallback;
   comms->jointCallbackData = userdata;
+  comms->jointSub = Mobot_subscribe(comms, MOBOT_EVENT_JOINT, 0, 0,
+      Mobot_jointSubscriber, comms);
   MUTEX_UNLOCK(comms->callback_lock);
 
   return 0;
@@ -1446,52 +2342,114 @@ int Mobot_disableJointEventCallback(mobot_t* comms)
   uint8_t buf[24];
   buf[0] = 0;
   MUTEX_LOCK(comms->callback_lock);
-  status = MobotMsgTransaction(comms, BTCMD(CMD_SET_ENABLE_JOINT_EVENT), buf, 1);
-  if(status < 0) {
-    MUTEX_UNLOCK(comms->callback_lock);
-    return status;
+  /* Keep the events coming if the library itself still needs them */
+  if(comms->jointEventUsers == 0) {
+    status = MobotMsgTransaction(comms, BTCMD(CMD_SET_ENABLE_JOINT_EVENT), buf, 1);
+    if(status < 0) {
+      MUTEX_UNLOCK(comms->callback_lock);
+      return status;
+    }
+    /* Make sure the data size is correct */
+    if(buf[1] != 0x03) {
+      MUTEX_UNLOCK(comms->callback_lock);
+      return -1;
+    }
   }
-  /* Make sure the data size is correct */
-  if(buf[1] != 0x03) {
-    MUTEX_UNLOCK(comms->callback_lock);
-    return -1;
+  MUTEX_UNLOCK(comms->callback_lock);
+  Mobot_callbackUnsubscribe(comms, &comms->jointSub);
+  MUTEX_LOCK(comms->callback_lock);
+  if(comms->jointSub == NULL) {
+    comms->jointCallback = NULL;
+    comms->jointCallbackData = NULL;
   }
-  comms->jointCallback = NULL;
-  comms->jointCallbackData = NULL;
   MUTEX_UNLOCK(comms->callback_lock);
 
   return 0;
 }
 
-int Mobot_enableAccelEventCallback(mobot_t* comms, void* data,
-    void (*accelCallback)(int millis, double x, double y, double z, void* data))
+int Mobot_jointEventsAcquire(mobot_t* comms)
 {
-  int status;
+  int status = 0;
   uint8_t buf[24];
-  buf[0] = 7;
   MUTEX_LOCK(comms->callback_lock);
-  status = MobotMsgTransaction(comms, BTCMD(CMD_SET_ENABLE_ACCEL_EVENT), buf, 1);
-  if(status < 0) {
-    MUTEX_UNLOCK(comms->callback_lock);
-    return status;
+  if(comms->jointEventUsers == 0 && comms->jointCallback == NULL) {
+    buf[0] = 7;
+    status = MobotMsgTransaction(comms, BTCMD(CMD_SET_ENABLE_JOINT_EVENT), buf, 1);
+    /* Make sure the data size is correct */
+    if(status == 0 && buf[1] != 0x03) {
+      status = -1;
+    }
   }
-  /* Make sure the data size is correct */
-  if(buf[1] != 0x03) {
-    MUTEX_UNLOCK(comms->callback_lock);
-    return -1;
+  if(status == 0) {
+    comms->jointEventUsers++;
   }
-  comms->accelCallback = accelCallback;
-  comms->accelCallbackData = data;
   MUTEX_UNLOCK(comms->callback_lock);
-
-  return 0;
+  return status;
 }
 
-int Mobot_disableAccelEventCallback(mobot_t* comms)
-{ 
+int Mobot_jointEventsRelease(mobot_t* comms)
+{
+  int status = 0;
+  uint8_t buf[24];
+  MUTEX_LOCK(comms->callback_lock);
+  comms->jointEventUsers--;
+  if(comms->jointEventUsers == 0 && comms->jointCallback == NULL) {
+    buf[0] = 0;
+    status = MobotMsgTransaction(comms, BTCMD(CMD_SET_ENABLE_JOINT_EVENT), buf, 1);
+    /* Make sure the data size is correct */
+    if(status == 0 && buf[1] != 0x03) {
+      status = -1;
+    }
+  }
+  MUTEX_UNLOCK(comms->callback_lock);
+  return status;
+}
+
+int Mobot_accelEventsAcquire(mobot_t* comms)
+{
+  int status = 0;
+  uint8_t buf[24];
+  MUTEX_LOCK(comms->callback_lock);
+  if(comms->accelEventUsers == 0 && comms->accelCallback == NULL) {
+    buf[0] = 7;
+    status = MobotMsgTransaction(comms, BTCMD(CMD_SET_ENABLE_ACCEL_EVENT), buf, 1);
+    /* Make sure the data size is correct */
+    if(status == 0 && buf[1] != 0x03) {
+      status = -1;
+    }
+  }
+  if(status == 0) {
+    comms->accelEventUsers++;
+  }
+  MUTEX_UNLOCK(comms->callback_lock);
+  return status;
+}
+
+int Mobot_accelEventsRelease(mobot_t* comms)
+{
+  int status = 0;
+  uint8_t buf[24];
+  MUTEX_LOCK(comms->callback_lock);
+  comms->accelEventUsers--;
+  if(comms->accelEventUsers == 0 && comms->accelCallback == NULL) {
+    buf[0] = 0;
+    status = MobotMsgTransaction(comms, BTCMD(CMD_SET_ENABLE_ACCEL_EVENT), buf, 1);
+    /* Make sure the data size is correct */
+    if(status == 0 && buf[1] != 0x03) {
+      status = -1;
+    }
+  }
+  MUTEX_UNLOCK(comms->callback_lock);
+  return status;
+}
+
+int Mobot_enableAccelEventCallback(mobot_t* comms, void* data,
+    void (*accelCallback)(int millis, double x, double y, double z, void* data))
+{
   int status;
   uint8_t buf[24];
   buf[0] = 7;
+  Mobot_callbackUnsubscribe(comms, &comms->accelSub);
   MUTEX_LOCK(comms->callback_lock);
   status = MobotMsgTransaction(comms, BTCMD(CMD_SET_ENABLE_ACCEL_EVENT), buf, 1);
   if(status < 0) {
@@ -1503,8 +2461,41 @@ int Mobot_disableAccelEventCallback(mobot_t* comms)
     MUTEX_UNLOCK(comms->callback_lock);
     return -1;
   }
-  comms->accelCallback = NULL;
-  comms->accelCallbackData = NULL;
+  comms->accelCallback = accelCallback;
+  comms->accelCallbackData = data;
+  comms->accelSub = Mobot_subscribe(comms, MOBOT_EVENT_ACCEL, 0, 0,
+      Mobot_accelSubscriber, comms);
+  MUTEX_UNLOCK(comms->callback_lock);
+
+  return 0;
+}
+
+int Mobot_disableAccelEventCallback(mobot_t* comms)
+{ 
+  int status;
+  uint8_t buf[24];
+  buf[0] = 0;
+  MUTEX_LOCK(comms->callback_lock);
+  /* Keep the events coming if the library itself still needs them */
+  if(comms->accelEventUsers == 0) {
+    status = MobotMsgTransaction(comms, BTCMD(CMD_SET_ENABLE_ACCEL_EVENT), buf, 1);
+    if(status < 0) {
+      MUTEX_UNLOCK(comms->callback_lock);
+      return status;
+    }
+    /* Make sure the data size is correct */
+    if(buf[1] != 0x03) {
+      MUTEX_UNLOCK(comms->callback_lock);
+      return -1;
+    }
+  }
+  MUTEX_UNLOCK(comms->callback_lock);
+  Mobot_callbackUnsubscribe(comms, &comms->accelSub);
+  MUTEX_LOCK(comms->callback_lock);
+  if(comms->accelSub == NULL) {
+    comms->accelCallback = NULL;
+    comms->accelCallbackData = NULL;
+  }
   MUTEX_UNLOCK(comms->callback_lock);
 
   return 0;
@@ -1528,8 +2519,13 @@ int Mobot_disableButtonCallback(mobot_t* comms)
     return -1;
   }
 
-  comms->buttonCallback = NULL;
-  comms->callbackEnabled = 0;
+  MUTEX_UNLOCK(comms->callback_lock);
+  Mobot_callbackUnsubscribe(comms, &comms->buttonSub);
+  MUTEX_LOCK(comms->callback_lock);
+  if(comms->buttonSub == NULL) {
+    comms->buttonCallback = NULL;
+    comms->callbackEnabled = 0;
+  }
   MUTEX_UNLOCK(comms->callback_lock);
   return 0;
 }
@@ -1537,15 +2533,25 @@ int Mobot_disableButtonCallback(mobot_t* comms)
 int Mobot_enableEventCallback(mobot_t* comms, 
     void (*eventCallback)(const uint8_t* buf, int size, void* userdata), void* data)
 {
+  Mobot_callbackUnsubscribe(comms, &comms->rawSub);
+  MUTEX_LOCK(comms->callback_lock);
   comms->eventCallback = eventCallback;
   comms->eventCallbackData = data;
+  comms->rawSub = Mobot_subscribe(comms, MOBOT_EVENT_RAW, 0, 0,
+      Mobot_rawSubscriber, comms);
+  MUTEX_UNLOCK(comms->callback_lock);
   return 0;
 }
 
 int Mobot_disableEventCallback(mobot_t* comms)
 {
-  comms->eventCallback = NULL;
-  comms->eventCallbackData = NULL;
+  Mobot_callbackUnsubscribe(comms, &comms->rawSub);
+  MUTEX_LOCK(comms->callback_lock);
+  if(comms->rawSub == NULL) {
+    comms->eventCallback = NULL;
+    comms->eventCallbackData = NULL;
+  }
+  MUTEX_UNLOCK(comms->callback_lock);
   return 0;
 }
 
@@ -1589,16 +2595,72 @@ int Mobot_init(mobot_t* comms)
   comms->recordingActive_cond = (COND_T*)malloc(sizeof(COND_T));
   COND_INIT(comms->recordingActive_cond);
   comms->motionInProgress = 0;
+  comms->lastMotion = NULL;
+  Mobot_taskQueuesOpen(comms);
   MUTEX_NEW(comms->recvBuf_lock);
   MUTEX_INIT(comms->recvBuf_lock);
   COND_NEW(comms->recvBuf_cond);
-  COND_INIT(comms->recvBuf_cond);
+  COND_INIT_MONOTONIC(comms->recvBuf_cond);
   comms->recvBuf_ready = 0;
+  comms->recvDest = NULL;
+  comms->recvBuf_data = comms->recvBuf;
+  comms->burstDest = NULL;
+  comms->burstCount = 0;
   comms->commsEngine_bytes = 0;
 
   comms->commsWaitingForMessage = 0;
   MUTEX_NEW(comms->commsWaitingForMessage_lock);
   MUTEX_INIT(comms->commsWaitingForMessage_lock);
+
+  comms->srtt = 0;
+  comms->rttvar = 0;
+  comms->rto = DEF_RTO_INITIAL;
+  comms->rtoMin = DEF_RTO_MIN;
+  comms->rtoMax = DEF_RTO_MAX;
+  comms->maxRetries = MAX_RETRIES;
+  comms->deadline = -1;
+
+  comms->priorityPending = 0;
+  MUTEX_NEW(comms->priority_lock);
+  MUTEX_INIT(comms->priority_lock);
+  MUTEX_NEW(comms->rto_lock);
+  MUTEX_INIT(comms->rto_lock);
+  COND_NEW(comms->priority_cond);
+  COND_INIT(comms->priority_cond);
+
+  comms->coalesceEnabled = 0;
+  MUTEX_NEW(comms->coalesce_lock);
+  MUTEX_INIT(comms->coalesce_lock);
+  comms->coalesceHead = NULL;
+  comms->coalesceTail = NULL;
+  comms->coalesceScheduled = 0;
+  comms->coalesceError = 0;
+  comms->telemetry = NULL;
+  MUTEX_NEW(comms->telemetry_lock);
+  MUTEX_INIT(comms->telemetry_lock);
+
+  MUTEX_NEW(comms->airtime_lock);
+  MUTEX_INIT(comms->airtime_lock);
+  COND_NEW(comms->airtime_cond);
+  COND_INIT_MONOTONIC(comms->airtime_cond);
+  comms->airtimeWindow = DEF_AIRTIME_WINDOW;
+  comms->airtimeInFlight = 0;
+  comms->airtimeVclock = 0;
+  comms->airtimeBusyTotal = 0;
+  comms->airtimeIdleSince = 0;
+  comms->airtimeWaiters = NULL;
+  comms->airtimeNextWaiter = NULL;
+  comms->airtimeWaiting = 0;
+  comms->airtimeGranted = 0;
+  comms->airtimeHolder = NULL;
+  comms->airtimeStart = 0;
+  comms->airtimeVruntime = 0;
+  comms->airtimeRateCap = 0;
+  comms->airtimeNextSend = 0;
+  comms->airtimeGrants = 0;
+  comms->airtimeDelayTotal = 0;
+  comms->airtimeDelayMax = 0;
+  comms->airtimeBusy = 0;
 #if 0
   /* deprecated by libsfp */
 
@@ -1625,41 +2687,43 @@ int Mobot_init(mobot_t* comms)
 #endif
 
   /* Find the configuration file path */
-#ifdef _WIN32
-  /* Find the user's local appdata directory */
-  char path[MAX_PATH];
-  if(SHGetFolderPathA(NULL, CSIDL_LOCAL_APPDATA, NULL, 0, path) != S_OK) 
-  {
-    /* Could not get the user's app data directory */
-  } else {
-    //MessageBox((LPCTSTR)path, (LPCTSTR)"Test");
-    //fprintf(fp, "%s", path); 
-  }
-  strcat(path, "\\Barobo.config");
-  comms->configFilePath = strdup(path);
-
-#else
-  /* Try to open the barobo configuration file. */
   char path[MAX_PATH];
-  strcpy(path, getenv("HOME"));
-  strcat(path, "/.Barobo.config");
+  Mobot_configPath(path);
   comms->configFilePath = strdup(path);
-#endif
   comms->numItemsToFreeOnExit = 0;
   memset(comms->serialID, 5, sizeof(char));
   MUTEX_NEW(comms->mobotTree_lock);
   MUTEX_INIT(comms->mobotTree_lock);
   COND_NEW(comms->mobotTree_cond);
-  COND_INIT(comms->mobotTree_cond);
+  COND_INIT_MONOTONIC(comms->mobotTree_cond);
   comms->parent = NULL;
   comms->children = NULL;
 
   MUTEX_NEW(comms->scan_callback_lock);
   MUTEX_INIT(comms->scan_callback_lock);
   comms->jointCallback = NULL;
+  MUTEX_NEW(comms->jointCache_lock);
+  MUTEX_INIT(comms->jointCache_lock);
+  comms->jointCacheValid = 0;
+  comms->jointCacheGen = 0;
+  comms->jointCacheMaxAge = -1;
+  comms->jointEventSeq = 0;
+  COND_NEW(comms->jointEvent_cond);
+  COND_INIT_MONOTONIC(comms->jointEvent_cond);
+  comms->jointEventUsers = 0;
+  comms->accelEventUsers = 0;
+  comms->mirrors = NULL;
+  memset(&comms->jointChannel, 0, sizeof(comms->jointChannel));
+  memset(&comms->accelChannel, 0, sizeof(comms->accelChannel));
+  comms->propertiesKnown = 0;
   comms->accelCallback = NULL;
   comms->eventCallback = NULL;
   comms->eventCallbackData = NULL;
+  comms->buttonSub = NULL;
+  comms->jointSub = NULL;
+  comms->accelSub = NULL;
+  comms->rawSub = NULL;
+  comms->shmExport = NULL;
 
   /* FIXME properly abstract links */
   comms->dongle = NULL;
@@ -1796,25 +2860,26 @@ int Mobot_setFourierCoefficients(mobot_t* comms, robotJointId_t id, double* a, d
 
 int Mobot_twiSend(mobot_t* comms, uint8_t addr, uint8_t* buf, int size)
 {
-  uint8_t* sendbuf = (uint8_t*)malloc(size+10);
+  uint8_t sendbuf[256];
+  if(size < 0 || size + 3 > 255 - 8) {
+    return -1;
+  }
   sendbuf[0] = addr;
   sendbuf[1] = size;
   memcpy(&sendbuf[2], buf, size);
   sendbuf[2+size] = 0x00;
-  int rc = MobotMsgTransaction(comms, BTCMD(CMD_TWI_SEND), sendbuf, 3+size);
-  free(sendbuf);
-  return rc;
+  return MobotMsgTransaction(comms, BTCMD(CMD_TWI_SEND), sendbuf, 3+size);
 }
 
 int Mobot_twiRecv(mobot_t* comms, uint8_t addr, void* buf, int size)
 {
-  uint8_t* sendbuf = (uint8_t*)malloc(size+10);
+  /* The response can be as large as any response */
+  uint8_t sendbuf[256];
   sendbuf[0] = addr;
   sendbuf[1] = size;
   sendbuf[2] = 0x0;
   int rc = MobotMsgTransaction(comms, BTCMD(CMD_TWI_RECV), sendbuf, 3);
   if(rc == 0) memcpy(buf, &sendbuf[2], sendbuf[1]-3);
-  free(sendbuf);
   return rc;
 }
 
@@ -1822,7 +2887,10 @@ int Mobot_twiSendRecv(mobot_t* comms, uint8_t addr,
     uint8_t* sendbuf, int sendsize,
     void* recvbuf, int recvsize)
 {
-  uint8_t *buf = (uint8_t*)malloc(sendsize+recvsize+10);
+  uint8_t buf[256];
+  if(sendsize < 0 || sendsize + 4 > 255 - 8) {
+    return -1;
+  }
   buf[0] = addr;
   buf[1] = sendsize;
   memcpy(&buf[2], sendbuf, sendsize);
@@ -1835,39 +2903,21 @@ int Mobot_twiSendRecv(mobot_t* comms, uint8_t addr,
   return rc;
 }
 
+#ifndef _WIN32
+static int Mobot_condTimedWait(COND_T* cond, MUTEX_T* lock, double msecs);
+#endif
+
 int Mobot_waitForReportedSerialID(mobot_t* comms, char* id) 
 {
   /* Wait on the mobot tree condition variable... Return if our mobot shows up
    * or we time out */
   int rc;
   mobotInfo_t *iter;
-#ifndef _WIN32
-  struct timespec ts;
-#else
-#endif
   /* Wait until transaction is ready */
   MUTEX_LOCK(comms->mobotTree_lock);
   while(1) {
 #ifndef _WIN32
-    /* Set up a wait with timeout */
-    /* Get the current time */
-#ifndef __MACH__
-    clock_gettime(CLOCK_REALTIME, &ts);
-#else
-    clock_serv_t cclock;
-    mach_timespec_t mts;
-    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-    clock_get_time(cclock, &mts);
-    mach_port_deallocate(mach_task_self(), cclock);
-    ts.tv_sec = mts.tv_sec;
-    ts.tv_nsec = mts.tv_nsec;
-#endif
-    /* Add a timeout */
-    ts.tv_sec += 1;
-    rc = pthread_cond_timedwait(
-      comms->mobotTree_cond, 
-      comms->mobotTree_lock,
-      &ts);
+    rc = Mobot_condTimedWait(comms->mobotTree_cond, comms->mobotTree_lock, 1000);
     if(rc) {
       /* Timed out */
       /* return error */
@@ -1943,31 +2993,439 @@ int str2ba(const char *str, bdaddr_t *ba)
  * case a response times out. The buffer "buf" is used as both the send buffer
  * and receive buffer, so care must be taken to ensure that it is large enough
  * to hold any response from the Mobot. */
-int MobotMsgTransaction(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int size)
+static int SendToIMobotEx(mobot_t* comms, uint8_t cmd, const void* data, int datasize, int priority, uint8_t* recvDest, double msecs);
+static int Mobot_writeMessage(mobot_t* comms, uint8_t cmd, const void* data, int datasize, uint8_t end);
+static void Mobot_airtimeRelease(mobot_t* comms);
+
+/* Milliseconds on a clock that never jumps, for measuring round trips and
+ * pacing periodic work */
+double Mobot_monotonicMsecs()
+{
+#ifdef _WIN32
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart * 1000.0 / (double)freq.QuadPart;
+#elif defined __MACH__
+  clock_serv_t cclock;
+  mach_timespec_t mts;
+  host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &cclock);
+  clock_get_time(cclock, &mts);
+  mach_port_deallocate(mach_task_self(), cclock);
+  return mts.tv_sec * 1000.0 + mts.tv_nsec / 1000000.0;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#endif
+}
+
+#ifndef _WIN32
+/* Wait on a condition set up with COND_INIT_MONOTONIC for at most msecs
+ * milliseconds. Returns 0 or the pthread_cond_timedwait error. */
+static int Mobot_condTimedWait(COND_T* cond, MUTEX_T* lock, double msecs)
+{
+  struct timespec ts;
+  long nsecs = (long)(msecs * 1000000.0);
+#ifdef __MACH__
+  ts.tv_sec = nsecs / 1000000000;
+  ts.tv_nsec = nsecs % 1000000000;
+  return pthread_cond_timedwait_relative_np(cond, lock, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ts.tv_sec += nsecs / 1000000000;
+  ts.tv_nsec += nsecs % 1000000000;
+  if(ts.tv_nsec >= 1000000000) {
+    ts.tv_nsec -= 1000000000;
+    ts.tv_sec += 1;
+  }
+  return pthread_cond_timedwait(cond, lock, &ts);
+#endif
+}
+#endif
+
+/* Sleep until the monotonic clock reads msecs */
+void Mobot_sleepUntil(double msecs)
+{
+#if defined _WIN32
+  double now = Mobot_monotonicMsecs();
+  if(msecs > now) {
+    Sleep((DWORD)(msecs - now + 0.5));
+  }
+#elif defined __MACH__
+  struct timespec ts;
+  double now = Mobot_monotonicMsecs();
+  long nsecs;
+  if(msecs > now) {
+    nsecs = (long)((msecs - now) * 1000000.0);
+    ts.tv_sec = nsecs / 1000000000;
+    ts.tv_nsec = nsecs % 1000000000;
+    while(nanosleep(&ts, &ts) == -1 && errno == EINTR);
+  }
+#else
+  struct timespec ts;
+  ts.tv_sec = (time_t)(msecs / 1000);
+  ts.tv_nsec = (long)((msecs - ts.tv_sec * 1000.0) * 1000000.0);
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#endif
+}
+
+void Mobot_periodicStart(mobotPeriodic_t* p, double msecs)
+{
+  p->period = msecs;
+  p->next = Mobot_monotonicMsecs();
+  p->ticks = 0;
+  p->overruns = 0;
+  p->jitterSum = 0;
+  p->jitterSqSum = 0;
+  p->jitterMax = 0;
+}
+
+/* Sleep until the next deadline. If a whole period or more has already gone
+ * by, do not sleep, and skip the missed deadlines instead of firing a burst of
+ * catch-up samples. Returns 1 on overrun, 0 otherwise. */
+int Mobot_periodicWait(mobotPeriodic_t* p)
+{
+  double now;
+  double late;
+  int overrun = 0;
+  p->next += p->period;
+  now = Mobot_monotonicMsecs();
+  if(now >= p->next + p->period) {
+    p->next += floor((now - p->next) / p->period) * p->period;
+    p->overruns++;
+    overrun = 1;
+  } else {
+    Mobot_sleepUntil(p->next);
+    now = Mobot_monotonicMsecs();
+  }
+  late = now - p->next;
+  if(late < 0) {
+    late = 0;
+  }
+  p->ticks++;
+  p->jitterSum += late;
+  p->jitterSqSum += late * late;
+  if(late > p->jitterMax) {
+    p->jitterMax = late;
+  }
+  return overrun;
+}
+
+/* Fold a new round trip sample into the estimate, the same way TCP does it
+ * (RFC 6298): SRTT and RTTVAR are smoothed with gains of 1/8 and 1/4, and the
+ * retransmission timeout is SRTT + 4*RTTVAR. */
+static void Mobot_updateRTT(mobot_t* comms, double rtt)
+{
+  MUTEX_LOCK(comms->rto_lock);
+  if(comms->srtt <= 0) {
+    comms->srtt = rtt;
+    comms->rttvar = rtt / 2;
+  } else {
+    comms->rttvar = 0.75 * comms->rttvar + 0.25 * ABS(comms->srtt - rtt);
+    comms->srtt = 0.875 * comms->srtt + 0.125 * rtt;
+  }
+  comms->rto = comms->srtt + 4 * comms->rttvar;
+  if(comms->rto < comms->rtoMin) {
+    comms->rto = comms->rtoMin;
+  }
+  if(comms->rto > comms->rtoMax) {
+    comms->rto = comms->rtoMax;
+  }
+  MUTEX_UNLOCK(comms->rto_lock);
+}
+
+/* Back off, as TCP does after a retransmission timeout */
+static void Mobot_backoffRTO(mobot_t* comms)
+{
+  MUTEX_LOCK(comms->rto_lock);
+  comms->rto = comms->rto * 2 > comms->rtoMax ? comms->rtoMax : comms->rto * 2;
+  MUTEX_UNLOCK(comms->rto_lock);
+}
+
+static double Mobot_currentRTO(mobot_t* comms)
+{
+  double rto;
+  MUTEX_LOCK(comms->rto_lock);
+  rto = comms->rto;
+  MUTEX_UNLOCK(comms->rto_lock);
+  return rto;
+}
+
+/* Commands that must not run twice on the robot: relative moves and other
+ * one-shot actions. A retransmission of one of these that crosses a late
+ * response would repeat it, so they always wait at least DEF_RTO_UNSAFE
+ * before trying again. */
+static int Mobot_repeatUnsafe(uint8_t cmd)
+{
+  switch(cmd) {
+    case BTCMD(CMD_DEMO):
+    case BTCMD(CMD_SETMOTORANGLES):
+    case BTCMD(CMD_SETMOTORANGLESPID):
+    case BTCMD(CMD_SETMOTORANGLE):
+    case BTCMD(CMD_SETMOTORANGLEPID):
+    case BTCMD(CMD_RESETABSCOUNTER):
+    case BTCMD(CMD_TIMEDACTION):
+    case BTCMD(CMD_STARTFOURIER):
+    case BTCMD(CMD_LOADMELODY):
+    case BTCMD(CMD_PLAYMELODY):
+    case BTCMD(CMD_QUERYADDRESSES):
+    case BTCMD(CMD_REBOOT):
+    case BTCMD(CMD_SETSERIALID):
+    case BTCMD(CMD_PAIRPARENT):
+    case BTCMD(CMD_SAVE_POSE):
+    case BTCMD(CMD_MOVE_TO_POSE):
+    case BTCMD(CMD_MOVE_MOTORS):
+    case BTCMD(CMD_SMOOTHMOVE):
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static int RecvFromIMobotTimeout(mobot_t* comms, uint8_t* buf, int size, double msecs, int sampleRTT);
+
+/* Commands after which the cached joint angles can no longer be trusted */
+static int Mobot_jointCacheInvalidatedBy(uint8_t cmd)
+{
+  switch(cmd) {
+    case BTCMD(CMD_SETMOTORDIR):
+    case BTCMD(CMD_SETMOTORANGLES):
+    case BTCMD(CMD_SETMOTORANGLESABS):
+    case BTCMD(CMD_SETMOTORANGLESDIRECT):
+    case BTCMD(CMD_SETMOTORANGLESPID):
+    case BTCMD(CMD_SETMOTORANGLE):
+    case BTCMD(CMD_SETMOTORANGLEABS):
+    case BTCMD(CMD_SETMOTORANGLEDIRECT):
+    case BTCMD(CMD_SETMOTORANGLEPID):
+    case BTCMD(CMD_STOP):
+    case BTCMD(CMD_RESETABSCOUNTER):
+    case BTCMD(CMD_TIMEDACTION):
+    case BTCMD(CMD_STARTFOURIER):
+    case BTCMD(CMD_SETMOTORPOWER):
+    case BTCMD(CMD_MOVE_TO_POSE):
+    case BTCMD(CMD_MOVE_MOTORS):
+    case BTCMD(CMD_SMOOTHMOVE):
+    case BTCMD(CMD_SETMOTORSTATES):
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static void Mobot_mirrorNotify(mobot_t* leader);
+
+/* Take this before sending a request whose response goes to
+ * Mobot_jointCacheStore */
+unsigned int Mobot_jointCacheGeneration(mobot_t* comms)
+{
+  unsigned int gen;
+  MUTEX_LOCK(comms->jointCache_lock);
+  gen = comms->jointCacheGen;
+  MUTEX_UNLOCK(comms->jointCache_lock);
+  return gen;
+}
+
+/* Forget the cached angles. Responses to requests sent before this are
+ * ignored when they arrive. */
+void Mobot_jointCacheInvalidate(mobot_t* comms)
+{
+  MUTEX_LOCK(comms->jointCache_lock);
+  comms->jointCacheValid = 0;
+  comms->jointCacheGen++;
+  MUTEX_UNLOCK(comms->jointCache_lock);
+}
+
+/* Record joint angles read from the robot at robot time millis. A response
+ * refreshes the cache unless a motion command invalidated it after the
+ * request went out, i.e. unless gen is no longer current. An event only
+ * refreshes it if the cache is already valid and the event is newer than
+ * what we have: one sent before the last motion command, but delivered after
+ * it, must not bring back the old angles. gen is ignored for events. */
+void Mobot_jointCacheStore(mobot_t* comms, uint32_t millis, const double angles[4], int fromEvent, unsigned int gen)
+{
+  int i;
+  MUTEX_LOCK(comms->jointCache_lock);
+  if(fromEvent) {
+    for(i = 0; i < 4; i++) {
+      comms->jointEventAngles[i] = angles[i];
+    }
+    comms->jointEventHostTime = Mobot_monotonicMsecs();
+    comms->jointEventSeq++;
+    COND_BROADCAST(comms->jointEvent_cond);
+    Mobot_mirrorNotify(comms);
+  }
+  if((fromEvent && 
+      (!comms->jointCacheValid || (int32_t)(millis - comms->jointCacheMillis) <= 0)) ||
+      (!fromEvent && gen != comms->jointCacheGen))
+  {
+    MUTEX_UNLOCK(comms->jointCache_lock);
+    return;
+  }
+  for(i = 0; i < 4; i++) {
+    comms->jointCacheAngles[i] = angles[i];
+  }
+  comms->jointCacheMillis = millis;
+  comms->jointCacheHostTime = Mobot_monotonicMsecs();
+  comms->jointCacheValid = 1;
+  MUTEX_UNLOCK(comms->jointCache_lock);
+}
+
+/* Return 0 and fill in the cached angles if they are at most maxAge
+ * milliseconds old, -1 otherwise */
+int Mobot_jointCacheLookup(mobot_t* comms, int maxAge, double* time, double angles[4])
+{
+  int i;
+  int rc = -1;
+  if(maxAge < 0) {
+    return -1;
+  }
+  MUTEX_LOCK(comms->jointCache_lock);
+  if(comms->jointCacheValid &&
+      Mobot_monotonicMsecs() - comms->jointCacheHostTime <= maxAge)
+  {
+    for(i = 0; i < 4; i++) {
+      angles[i] = comms->jointCacheAngles[i];
+    }
+    if(time) {
+      *time = comms->jointCacheMillis / 1000.0;
+    }
+    rc = 0;
+  }
+  MUTEX_UNLOCK(comms->jointCache_lock);
+  return rc;
+}
+
+/* Wait up to msecs milliseconds for a joint event newer than *seq. Returns 0
+ * and the newest event's angles, updating *seq, or -1 on timeout. */
+int Mobot_jointEventWait(mobot_t* comms, unsigned int* seq, double angles[4], double msecs)
+{
+  int i;
+  int rc = -1;
+  double deadline = Mobot_monotonicMsecs() + msecs;
+  double remaining;
+  MUTEX_LOCK(comms->jointCache_lock);
+  while(comms->jointEventSeq == *seq) {
+    remaining = deadline - Mobot_monotonicMsecs();
+    if(remaining <= 0) {
+      break;
+    }
+#ifndef _WIN32
+    Mobot_condTimedWait(comms->jointEvent_cond, comms->jointCache_lock, remaining);
+#else
+    ResetEvent(*comms->jointEvent_cond);
+    MUTEX_UNLOCK(comms->jointCache_lock);
+    WaitForSingleObject(*comms->jointEvent_cond, (DWORD)remaining);
+    MUTEX_LOCK(comms->jointCache_lock);
+#endif
+  }
+  if(comms->jointEventSeq != *seq) {
+    *seq = comms->jointEventSeq;
+    for(i = 0; i < 4; i++) {
+      angles[i] = comms->jointEventAngles[i];
+    }
+    rc = 0;
+  }
+  MUTEX_UNLOCK(comms->jointCache_lock);
+  return rc;
+}
+
+/* If deadline is non-negative, give up once that many milliseconds have
+ * passed, no matter how many retries are left. */
+static int MobotMsgTransactionEx(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int size, int priority, int deadline)
 {
+  mobot_t* parent;
+  int rebalance = 0;
   int retries = 0;
+  int maxRetries;
   int rc = 1;
-  void* sendbuf;
-  if(size > 0) {
-    sendbuf = malloc(size); 
-    memcpy(sendbuf, buf, size);
+  double start = Mobot_monotonicMsecs();
+  double timeout;
+  double rtoMax;
+  double remaining;
+  MUTEX_LOCK(comms->rto_lock);
+  timeout = comms->rto;
+  rtoMax = comms->rtoMax;
+  maxRetries = comms->maxRetries;
+  if(deadline < 0) {
+    deadline = comms->deadline;
   }
+  MUTEX_UNLOCK(comms->rto_lock);
+  if(Mobot_repeatUnsafe(cmd) && timeout < DEF_RTO_UNSAFE) {
+    timeout = DEF_RTO_UNSAFE < rtoMax ? DEF_RTO_UNSAFE : rtoMax;
+  }
+  if(Mobot_jointCacheInvalidatedBy(cmd)) {
+    Mobot_jointCacheInvalidate(comms);
+  }
+  /* buf is only overwritten once a response has been delivered, which ends
+   * the loop, so every retry can send straight out of it. */
   while(
-      (retries <= MAX_RETRIES) &&
+      (retries <= maxRetries) &&
       (rc != 0)
       ) 
   {
+    if(deadline >= 0) {
+      remaining = deadline - (Mobot_monotonicMsecs() - start);
+      if(remaining <= 0) {
+        rc = -2;
+        break;
+      }
+      if(timeout > remaining) {
+        timeout = remaining;
+      }
+    }
     MUTEX_LOCK(comms->commsWaitingForMessage_lock);
     comms->commsWaitingForMessage = 1;
     MUTEX_UNLOCK(comms->commsWaitingForMessage_lock);
-    SendToIMobot(comms, cmd, sendbuf, size);
-    rc = RecvFromIMobot(comms, (uint8_t*)buf, size);
+    /* -3 means a background transaction found the link busy, -1 that the
+     * message could not be written out. Neither leaves anything to wait for. */
+    rc = SendToIMobotEx(comms, cmd, buf, size, priority, (uint8_t*)buf,
+        deadline >= 0 ? remaining : -1);
+    if(rc == 0) {
+      /* Only the first attempt gives an unambiguous round trip sample; after a
+       * retry we cannot tell which send the answer belongs to (Karn's rule). */
+      rc = RecvFromIMobotTimeout(comms, (uint8_t*)buf, size, timeout, retries == 0);
+    }
+    if(rc == -2) {
+      /* Exponential back-off for the next attempt */
+      timeout *= 2;
+      if(timeout > rtoMax) {
+        timeout = rtoMax;
+      }
+    }
     MUTEX_LOCK(comms->commsWaitingForMessage_lock);
     comms->commsWaitingForMessage = 0;
     MUTEX_UNLOCK(comms->commsWaitingForMessage_lock);
+    if(rc == -3 || rc == -1) {
+      break;
+    }
+    /* Keep track of how congested our dongle is */
+    parent = comms->parent;
+    if(
+        (comms->connectionMode == MOBOTCONNECT_ZIGBEE) &&
+        (parent != NULL)
+      )
+    {
+      MUTEX_LOCK(parent->mobotTree_lock);
+      if(rc == -2) {
+        parent->congestion++;
+        if(
+            comms->balanceable &&
+            (parent->congestion >= DONGLE_CONGESTION_THRESHOLD)
+          )
+        {
+          rebalance = 1;
+        }
+      } else if(parent->congestion > 0) {
+        parent->congestion--;
+      }
+      MUTEX_UNLOCK(parent->mobotTree_lock);
+    }
     retries++;
   }
-  if(size > 0) free(sendbuf);
+  if(rebalance) {
+    Mobot_scheduleBalance(comms);
+  }
   if(rc) {return rc;}
   if(((uint8_t*)buf)[0] == 0xff) {
     return -1;
@@ -1975,19 +3433,1219 @@ int MobotMsgTransaction(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int s
   return 0;
 }
 
-int SendToIMobot(mobot_t* comms, uint8_t cmd, const void* data, int datasize)
+struct mobotCoalescedCmd_s
 {
-  int err = 0;
-  int i;
-  int len;
-  uint8_t str[1024];
-  if(comms->connected == 0) {
-    return -1;
+  uint8_t cmd;
+  int key;
+  uint8_t buf[32];
+  int size;
+  mobotCoalescedCmd_t* next;
+};
+
+static void Mobot_coalesceFlushWait(mobot_t* comms);
+
+int MobotMsgTransaction(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int size)
+{
+  Mobot_coalesceFlushWait(comms);
+  return MobotMsgTransactionEx(comms, cmd, buf, size, 0, -1);
+}
+
+int MobotMsgTransactionDeadline(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int size, int msecs)
+{
+  Mobot_coalesceFlushWait(comms);
+  return MobotMsgTransactionEx(comms, cmd, buf, size, 0, msecs);
+}
+
+/* Health polls and the like. The transaction only goes out if the link has
+ * been idle for TELEMETRY_IDLE_GAP and nothing else is waiting for it, and it
+ * is never retried. Returns -3 without sending anything if the link is
+ * busy. */
+int MobotMsgTransactionBackground(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int size)
+{
+  int pending;
+  MUTEX_LOCK(comms->coalesce_lock);
+  pending = comms->coalesceHead != NULL;
+  MUTEX_UNLOCK(comms->coalesce_lock);
+  if(pending) {
+    return -3;
   }
-  MUTEX_LOCK(comms->commsLock);
-  comms->recvBuf_ready = 0;
+  return MobotMsgTransactionEx(comms, cmd, buf, size, -1, Mobot_currentRTO(comms));
+}
 
-  if(
+/* Wait for the responses to the sent requests of a burst, which are
+ * collected by Mobot_deliverResponse. If they are not all in after msecs,
+ * keep collecting for up to rtoMax more before letting go of the link: a
+ * straggler that arrived after commsLock was released would be taken for
+ * the answer to the next transaction, whose length check would not
+ * necessarily catch it. Returns 0 if everything arrived within msecs, -2
+ * otherwise. Called with commsLock and the airtime slot held, and releases
+ * both. */
+static int Mobot_burstFinish(mobot_t* comms, int sent, double msecs)
+{
+  int rc = 0;
+  double start = Mobot_monotonicMsecs();
+  double drain;
+  double elapsed;
+  MUTEX_LOCK(comms->rto_lock);
+  drain = msecs + comms->rtoMax;
+  MUTEX_UNLOCK(comms->rto_lock);
+  MUTEX_LOCK(comms->recvBuf_lock);
+  /* Only wait for what actually went out */
+  comms->burstCount = sent;
+  if(comms->burstReceived >= sent) {
+    comms->burstCount = 0;
+    comms->recvBuf_ready = 1;
+  }
+  while(!comms->recvBuf_ready) {
+    elapsed = Mobot_monotonicMsecs() - start;
+    if(rc == 0 && elapsed >= msecs) {
+      rc = -2;
+      Mobot_backoffRTO(comms);
+    }
+    if(elapsed >= drain) {
+      break;
+    }
+#ifndef _WIN32
+    Mobot_condTimedWait(comms->recvBuf_cond, comms->recvBuf_lock,
+        (rc ? drain : msecs) - elapsed);
+#else
+    ResetEvent(*comms->recvBuf_cond);
+    ReleaseMutex(*comms->recvBuf_lock);
+    WaitForSingleObject(*comms->recvBuf_cond, (DWORD)((rc ? drain : msecs) - elapsed));
+    MUTEX_LOCK(comms->recvBuf_lock);
+#endif
+  }
+  comms->burstCount = 0;
+  comms->recvDest = NULL;
+  MUTEX_UNLOCK(comms->recvBuf_lock);
+  Mobot_airtimeRelease(comms);
+  MUTEX_UNLOCK(comms->commsLock);
+  return rc;
+}
+
+/* Send count copies of the same read request back to back and collect the
+ * responses in dest, stride bytes apart, in the order they arrive. The
+ * requests go out without waiting for each other, so the burst costs one
+ * round trip plus count times the time a message spends on the wire. Slots
+ * whose response never arrived are left zeroed. Bursts are not retried.
+ * Returns -1 if not even the first request could be sent. */
+int MobotMsgTransactionBurst(mobot_t* comms, uint8_t cmd, const void* req, int size,
+    uint8_t* dest, int stride, int count)
+{
+  int sent;
+  int rc;
+  if(count <= 0 || count > BURST_MAX_READINGS || stride < 3) {
+    return -1;
+  }
+  memset(dest, 0, stride*count);
+  Mobot_coalesceFlushWait(comms);
+  MUTEX_LOCK(comms->commsWaitingForMessage_lock);
+  comms->commsWaitingForMessage = 1;
+  MUTEX_UNLOCK(comms->commsWaitingForMessage_lock);
+  /* The first request takes the robot's slot on the link and leaves
+   * commsLock held for the rest */
+  rc = SendToIMobotEx(comms, cmd, req, size, 0, dest, -1);
+  if(rc == 0) {
+    MUTEX_LOCK(comms->recvBuf_lock);
+    if(comms->recvBuf_ready && comms->recvBuf_data != dest) {
+      /* The first answer beat us here */
+      memcpy(dest, comms->recvBuf_data, comms->recvBuf_bytes < stride ? comms->recvBuf_bytes : stride);
+      comms->recvBuf_data = dest;
+    }
+    if(count > 1) {
+      comms->recvDest = NULL;
+      comms->burstDest = dest;
+      comms->burstStride = stride;
+      comms->burstReceived = comms->recvBuf_ready ? 1 : 0;
+      comms->burstCount = count;
+      comms->recvBuf_ready = 0;
+    }
+    MUTEX_UNLOCK(comms->recvBuf_lock);
+    for(sent = 1; sent < count; sent++) {
+      if(Mobot_writeMessage(comms, cmd, req, size, MSG_SENDEND)) {
+        break;
+      }
+    }
+    if(count == 1) {
+      rc = RecvFromIMobotTimeout(comms, dest, stride, Mobot_currentRTO(comms), 0);
+    } else {
+      rc = Mobot_burstFinish(comms, sent,
+          Mobot_currentRTO(comms) + sent*BURST_SPACING);
+    }
+  }
+  MUTEX_LOCK(comms->commsWaitingForMessage_lock);
+  comms->commsWaitingForMessage = 0;
+  MUTEX_UNLOCK(comms->commsWaitingForMessage_lock);
+  return rc;
+}
+
+/* Send queued setters, oldest first, until the queue is empty. Runs on the
+ * robot's coalesceQueue, so there is never more than one of these at a time
+ * per robot. That queue has a worker pool of its own: transactions wait for
+ * the drain from whatever thread they run on, motion workers included. */
+static void* Mobot_coalesceDrain(void* arg)
+{
+  mobot_t* comms = (mobot_t*)arg;
+  mobotCoalescedCmd_t* entry;
+  int rc;
+  while(1) {
+    MUTEX_LOCK(comms->coalesce_lock);
+    entry = comms->coalesceHead;
+    if(entry == NULL) {
+      comms->coalesceScheduled = 0;
+      MUTEX_UNLOCK(comms->coalesce_lock);
+      return NULL;
+    }
+    comms->coalesceHead = entry->next;
+    if(comms->coalesceHead == NULL) {
+      comms->coalesceTail = NULL;
+    }
+    MUTEX_UNLOCK(comms->coalesce_lock);
+
+    rc = MobotMsgTransactionEx(comms, entry->cmd, entry->buf, entry->size, 0, -1);
+    if(rc == 0 && entry->buf[1] != 3) {
+      rc = -1;
+    }
+    if(rc) {
+      MUTEX_LOCK(comms->coalesce_lock);
+      comms->coalesceError = rc;
+      MUTEX_UNLOCK(comms->coalesce_lock);
+    }
+    free(entry);
+  }
+}
+
+/* Anything that is not a coalesced setter has to see the effect of the
+ * setters issued before it, so let the queue drain first. */
+static void Mobot_coalesceFlushWait(mobot_t* comms)
+{
+  int pending;
+  MUTEX_LOCK(comms->coalesce_lock);
+  pending = comms->coalesceScheduled;
+  MUTEX_UNLOCK(comms->coalesce_lock);
+  if(pending) {
+    Mobot_taskQueueWait(comms->coalesceQueue);
+  }
+}
+
+/* Called with coalesce_lock held */
+static void Mobot_coalesceDiscard(mobot_t* comms)
+{
+  mobotCoalescedCmd_t* entry;
+  while(comms->coalesceHead != NULL) {
+    entry = comms->coalesceHead;
+    comms->coalesceHead = entry->next;
+    free(entry);
+  }
+  comms->coalesceTail = NULL;
+}
+
+int MobotMsgTransactionCoalesced(mobot_t* comms, uint8_t cmd, int key, /*IN&OUT*/ void* buf, int size)
+{
+  mobotCoalescedCmd_t* entry;
+  mobotCoalescedCmd_t* prev = NULL;
+  MUTEX_LOCK(comms->coalesce_lock);
+  if(!comms->coalesceEnabled || size > (int)sizeof(entry->buf)) {
+    MUTEX_UNLOCK(comms->coalesce_lock);
+    return MobotMsgTransaction(comms, cmd, buf, size);
+  }
+  /* A newer value replaces the waiting one. It also moves to the back of the
+   * queue, so that commands touching the same joint (e.g. a single-joint and
+   * an all-joint target) still take effect in the order they were issued. */
+  for(entry = comms->coalesceHead; entry != NULL; prev = entry, entry = entry->next) {
+    if(entry->cmd == cmd && entry->key == key) {
+      if(prev) {
+        prev->next = entry->next;
+      } else {
+        comms->coalesceHead = entry->next;
+      }
+      if(comms->coalesceTail == entry) {
+        comms->coalesceTail = prev;
+      }
+      break;
+    }
+  }
+  if(entry == NULL) {
+    entry = (mobotCoalescedCmd_t*)malloc(sizeof(mobotCoalescedCmd_t));
+    if(entry == NULL) {
+      MUTEX_UNLOCK(comms->coalesce_lock);
+      return -1;
+    }
+    entry->cmd = cmd;
+    entry->key = key;
+  }
+  memcpy(entry->buf, buf, size);
+  entry->size = size;
+  entry->next = NULL;
+  if(comms->coalesceTail) {
+    comms->coalesceTail->next = entry;
+  } else {
+    comms->coalesceHead = entry;
+  }
+  comms->coalesceTail = entry;
+  if(!comms->coalesceScheduled) {
+    comms->coalesceScheduled = 1;
+    Mobot_taskDetach(Mobot_taskSubmit(comms->coalesceQueue, Mobot_coalesceDrain, comms));
+  }
+  MUTEX_UNLOCK(comms->coalesce_lock);
+  /* What the robot would have answered */
+  ((uint8_t*)buf)[0] = RESP_OK;
+  ((uint8_t*)buf)[1] = 3;
+  ((uint8_t*)buf)[2] = RESP_END;
+  return 0;
+}
+
+int Mobot_setCommandCoalescing(mobot_t* comms, int enable)
+{
+  MUTEX_LOCK(comms->coalesce_lock);
+  comms->coalesceEnabled = enable;
+  MUTEX_UNLOCK(comms->coalesce_lock);
+  if(!enable) {
+    return Mobot_flushCommands(comms);
+  }
+  return 0;
+}
+
+int Mobot_flushCommands(mobot_t* comms)
+{
+  int rc;
+  Mobot_taskQueueWait(comms->coalesceQueue);
+  MUTEX_LOCK(comms->coalesce_lock);
+  rc = comms->coalesceError;
+  comms->coalesceError = 0;
+  MUTEX_UNLOCK(comms->coalesce_lock);
+  return rc;
+}
+
+int Mobot_setTimeoutPolicy(mobot_t* comms, int minMsecs, int maxMsecs, int retries, int deadline)
+{
+  if(minMsecs <= 0 || maxMsecs < minMsecs || retries < 0) {
+    return -1;
+  }
+  MUTEX_LOCK(comms->rto_lock);
+  comms->rtoMin = minMsecs;
+  comms->rtoMax = maxMsecs;
+  comms->maxRetries = retries;
+  comms->deadline = deadline;
+  if(comms->rto < comms->rtoMin) {
+    comms->rto = comms->rtoMin;
+  }
+  if(comms->rto > comms->rtoMax) {
+    comms->rto = comms->rtoMax;
+  }
+  MUTEX_UNLOCK(comms->rto_lock);
+  return 0;
+}
+
+int Mobot_getRoundTripTime(mobot_t* comms, double* srtt, double* rttvar, double* rto)
+{
+  MUTEX_LOCK(comms->rto_lock);
+  *srtt = comms->srtt;
+  *rttvar = comms->rttvar;
+  *rto = comms->rto;
+  MUTEX_UNLOCK(comms->rto_lock);
+  return 0;
+}
+
+static void Mobot_airtimeWake(mobot_t* comms);
+
+/* Stop and safety commands go through here. While a priority transaction is
+ * waiting, no new ordinary transaction may start on this robot, so the
+ * priority command only ever waits for the one exchange already on the air.
+ * The dongle's transmit queue is flushed right after sending so that
+ * coalescing never delays it either. */
+int MobotMsgTransactionPriority(mobot_t* comms, uint8_t cmd, /*IN&OUT*/ void* buf, int size)
+{
+  int rc;
+  /* Setters still waiting to be sent would undo a stop */
+  MUTEX_LOCK(comms->coalesce_lock);
+  Mobot_coalesceDiscard(comms);
+  MUTEX_UNLOCK(comms->coalesce_lock);
+  MUTEX_LOCK(comms->priority_lock);
+  comms->priorityPending++;
+  MUTEX_UNLOCK(comms->priority_lock);
+  Mobot_airtimeWake(comms);
+
+  rc = MobotMsgTransactionEx(comms, cmd, buf, size, 1, -1);
+
+  MUTEX_LOCK(comms->priority_lock);
+  comms->priorityPending--;
+  if(comms->priorityPending == 0) {
+    COND_BROADCAST(comms->priority_cond);
+  }
+  MUTEX_UNLOCK(comms->priority_lock);
+  return rc;
+}
+
+static void* broadcastStopThread(void* arg)
+{
+  return (void*)(intptr_t)Mobot_stop((mobot_t*)arg);
+}
+
+int Mobot_broadcastStop(mobot_t** comms, int num)
+{
+  int i;
+  int rc = 0;
+  void* result;
+  mobotTask_t** tasks;
+  if(num <= 0) {
+    return 0;
+  }
+  tasks = (mobotTask_t**)malloc(sizeof(mobotTask_t*)*num);
+  /* Stop every robot at once rather than one after another, so the worst
+   * case is that of the slowest robot instead of the sum over all of them.
+   * The stop queues have workers of their own, so this never waits behind
+   * running motions. */
+  for(i = 0; i < num; i++) {
+    tasks[i] = Mobot_taskSubmit(comms[i]->stopQueue, broadcastStopThread, comms[i]);
+  }
+  for(i = 0; i < num; i++) {
+    if(Mobot_taskJoin(tasks[i], &result) || result != NULL) {
+      rc = -1;
+    }
+  }
+  free(tasks);
+  return rc;
+}
+
+typedef struct mobotMirrorFollower_s
+{
+  mobotMirror_t* mirror;
+  mobot_t* comms;
+  int map[4];
+  double scale[4];
+  double offset[4];
+  /* Runs this follower's updates, one at a time */
+  mobotTaskQueue_t* queue;
+  /* The last leader event this follower has seen, whether an update task is
+   * queued or running, and when the rate limit lets the next one go out.
+   * Protected by the leader's jointCache_lock. */
+  unsigned int seq;
+  int busy;
+  double nextSend;
+} mobotMirrorFollower_t;
+
+struct mobotMirror_s
+{
+  mobot_t* leader;
+  mobotMirrorFollower_t* followers;
+  int numFollowers;
+  int running;
+  /* The leader's list of running mirrors, and the stop flag. Protected by
+   * the leader's jointCache_lock. */
+  struct mobotMirror_s* next;
+  int stop;
+  double period;
+  /* Latency statistics, in milliseconds. Protected by lock. */
+  MUTEX_T lock;
+  int updates;
+  double latencyLast;
+  double latencySum;
+  double latencyMax;
+};
+
+mobotMirror_t* Mobot_mirrorNew(mobot_t* leader)
+{
+  mobotMirror_t* mirror = (mobotMirror_t*)malloc(sizeof(mobotMirror_t));
+  if(mirror == NULL) {
+    return NULL;
+  }
+  mirror->leader = leader;
+  mirror->followers = NULL;
+  mirror->numFollowers = 0;
+  mirror->running = 0;
+  mirror->next = NULL;
+  mirror->stop = 0;
+  mirror->period = 0;
+  MUTEX_INIT(&mirror->lock);
+  mirror->updates = 0;
+  mirror->latencyLast = 0;
+  mirror->latencySum = 0;
+  mirror->latencyMax = 0;
+  return mirror;
+}
+
+int Mobot_mirrorAddFollower(mobotMirror_t* mirror, mobot_t* follower,
+    const int map[4], const double scale[4], const double offset[4])
+{
+  int i;
+  mobotMirrorFollower_t* followers;
+  mobotMirrorFollower_t* f;
+  mobotTaskQueue_t* queue;
+  if(mirror->running) {
+    return -1;
+  }
+  if(map) {
+    for(i = 0; i < 4; i++) {
+      if(map[i] < 0 || map[i] > 4) {
+        return -1;
+      }
+    }
+  }
+  queue = Mobot_taskQueueNewPool(TASK_POOL_MIRROR);
+  if(queue == NULL) {
+    return -1;
+  }
+  followers = (mobotMirrorFollower_t*)realloc(mirror->followers,
+      sizeof(mobotMirrorFollower_t) * (mirror->numFollowers + 1));
+  if(followers == NULL) {
+    Mobot_taskQueueFree(queue);
+    return -1;
+  }
+  mirror->followers = followers;
+  f = &mirror->followers[mirror->numFollowers];
+  f->mirror = mirror;
+  f->comms = follower;
+  f->queue = queue;
+  f->busy = 0;
+  f->nextSend = 0;
+  for(i = 0; i < 4; i++) {
+    f->map[i] = map ? map[i] : i+1;
+    f->scale[i] = scale ? scale[i] : 1;
+    f->offset[i] = offset ? offset[i] : 0;
+  }
+  mirror->numFollowers++;
+  return 0;
+}
+
+/* Runs on the follower's queue whenever the leader sends a joint event and
+ * the follower is not already busy, so a slow follower never holds up the
+ * others. Whatever arrived from the leader while the last command was on the
+ * air is collapsed into the newest sample. With a rate limit, the task sends
+ * one sample and returns rather than sleeping on a shared pool worker; the
+ * next event after f->nextSend queues the next update. */
+static void* Mobot_mirrorUpdate(void* arg)
+{
+  mobotMirrorFollower_t* f = (mobotMirrorFollower_t*)arg;
+  mobotMirror_t* mirror = f->mirror;
+  mobot_t* leader = mirror->leader;
+  double angles[4];
+  double targets[4];
+  double eventTime;
+  double sendTime;
+  double latency;
+  int i;
+  while(1) {
+    MUTEX_LOCK(leader->jointCache_lock);
+    if(mirror->stop || leader->jointEventSeq == f->seq) {
+      /* Caught up: the next event queues a new update */
+      f->busy = 0;
+      MUTEX_UNLOCK(leader->jointCache_lock);
+      break;
+    }
+    f->seq = leader->jointEventSeq;
+    for(i = 0; i < 4; i++) {
+      angles[i] = leader->jointEventAngles[i];
+    }
+    eventTime = leader->jointEventHostTime;
+    MUTEX_UNLOCK(leader->jointCache_lock);
+
+    for(i = 0; i < 4; i++) {
+      if(f->map[i]) {
+        targets[i] = f->scale[i] * angles[f->map[i]-1] + f->offset[i];
+      } else {
+        targets[i] = f->offset[i];
+      }
+    }
+    sendTime = Mobot_monotonicMsecs();
+    if(!Mobot_moveToDirectNB(f->comms, targets[0], targets[1], targets[2], targets[3])) {
+      latency = Mobot_monotonicMsecs() - eventTime;
+      MUTEX_LOCK(&mirror->lock);
+      mirror->updates++;
+      mirror->latencyLast = latency;
+      mirror->latencySum += latency;
+      if(latency > mirror->latencyMax) {
+        mirror->latencyMax = latency;
+      }
+      MUTEX_UNLOCK(&mirror->lock);
+    }
+    if(mirror->period > 0) {
+      MUTEX_LOCK(leader->jointCache_lock);
+      f->nextSend = sendTime + mirror->period;
+      f->busy = 0;
+      MUTEX_UNLOCK(leader->jointCache_lock);
+      break;
+    }
+  }
+  return NULL;
+}
+
+/* Called with the leader's jointCache_lock held */
+static void Mobot_mirrorQueueUpdate(mobotMirrorFollower_t* f)
+{
+  mobotTask_t* task;
+  f->busy = 1;
+  task = Mobot_taskSubmit(f->queue, Mobot_mirrorUpdate, f);
+  if(task == NULL) {
+    /* Let the next event try again */
+    f->busy = 0;
+    return;
+  }
+  Mobot_taskDetach(task);
+}
+
+/* Called from Mobot_jointCacheStore with the leader's jointCache_lock held */
+static void Mobot_mirrorNotify(mobot_t* leader)
+{
+  mobotMirror_t* mirror;
+  mobotMirrorFollower_t* f;
+  double now = Mobot_monotonicMsecs();
+  int i;
+  for(mirror = leader->mirrors; mirror != NULL; mirror = mirror->next) {
+    for(i = 0; i < mirror->numFollowers; i++) {
+      f = &mirror->followers[i];
+      if(!f->busy && (mirror->period <= 0 || now >= f->nextSend)) {
+        Mobot_mirrorQueueUpdate(f);
+      }
+    }
+  }
+}
+
+int Mobot_mirrorStart(mobotMirror_t* mirror, double hz)
+{
+  int i;
+  int status;
+  if(mirror->running || mirror->numFollowers == 0) {
+    return -1;
+  }
+  /* Ask the leader to stream joint events */
+  status = Mobot_jointEventsAcquire(mirror->leader);
+  if(status) return status;
+  mirror->period = (hz > 0) ? 1000.0 / hz : 0;
+  MUTEX_LOCK(mirror->leader->jointCache_lock);
+  mirror->stop = 0;
+  for(i = 0; i < mirror->numFollowers; i++) {
+    mirror->followers[i].seq = mirror->leader->jointEventSeq;
+    mirror->followers[i].nextSend = 0;
+  }
+  mirror->next = mirror->leader->mirrors;
+  mirror->leader->mirrors = mirror;
+  MUTEX_UNLOCK(mirror->leader->jointCache_lock);
+  mirror->running = 1;
+  return 0;
+}
+
+int Mobot_mirrorFlush(mobotMirror_t* mirror)
+{
+  int i;
+  mobotMirrorFollower_t* f;
+  mobot_t* leader = mirror->leader;
+  if(!mirror->running) {
+    return -1;
+  }
+  MUTEX_LOCK(leader->jointCache_lock);
+  for(i = 0; i < mirror->numFollowers; i++) {
+    f = &mirror->followers[i];
+    if(!mirror->stop && !f->busy && f->seq != leader->jointEventSeq) {
+      Mobot_mirrorQueueUpdate(f);
+    }
+  }
+  MUTEX_UNLOCK(leader->jointCache_lock);
+  return 0;
+}
+
+int Mobot_mirrorStop(mobotMirror_t* mirror)
+{
+  int i;
+  mobotMirror_t** link;
+  if(!mirror->running) {
+    return 0;
+  }
+  MUTEX_LOCK(mirror->leader->jointCache_lock);
+  mirror->stop = 1;
+  for(link = &mirror->leader->mirrors; *link != NULL; link = &(*link)->next) {
+    if(*link == mirror) {
+      *link = mirror->next;
+      break;
+    }
+  }
+  MUTEX_UNLOCK(mirror->leader->jointCache_lock);
+  /* No new updates are queued now; let the ones in flight finish */
+  for(i = 0; i < mirror->numFollowers; i++) {
+    Mobot_taskQueueWait(mirror->followers[i].queue);
+  }
+  mirror->running = 0;
+  return Mobot_jointEventsRelease(mirror->leader);
+}
+
+int Mobot_mirrorFree(mobotMirror_t* mirror)
+{
+  int i;
+  Mobot_mirrorStop(mirror);
+  for(i = 0; i < mirror->numFollowers; i++) {
+    Mobot_taskQueueFree(mirror->followers[i].queue);
+  }
+  MUTEX_DESTROY(&mirror->lock);
+  free(mirror->followers);
+  free(mirror);
+  return 0;
+}
+
+int Mobot_mirrorGetLatency(mobotMirror_t* mirror, int* updates,
+    double* last, double* mean, double* max)
+{
+  MUTEX_LOCK(&mirror->lock);
+  if(updates) *updates = mirror->updates;
+  if(last) *last = mirror->latencyLast;
+  if(mean) *mean = mirror->updates ? mirror->latencySum / mirror->updates : 0;
+  if(max) *max = mirror->latencyMax;
+  MUTEX_UNLOCK(&mirror->lock);
+  return 0;
+}
+
+/* Background health polling. One thread per robot samples the enabled
+ * metrics with background transactions, which only go out while the link is
+ * idle. A poll that finds the link busy is dropped and the period doubles, up
+ * to TELEMETRY_MAX_BACKOFF times the configured one, and it halves again with
+ * each poll that gets through. The latest sample is published under a
+ * sequence counter (a seqlock), so readers never take a lock: they copy the
+ * snapshot and try again if the poller wrote it meanwhile. */
+struct mobotTelemetryPoller_s
+{
+  mobot_t* comms;
+  int metrics;
+  double period;
+  int backoff;
+  int running;
+  /* Protected by lock */
+  int stop;
+  MUTEX_T lock;
+  COND_T cond;
+  THREAD_T thread;
+  /* Odd while the snapshot is being written. The *Age fields of the
+   * snapshot hold sample times; Mobot_getTelemetry turns them into ages. */
+  volatile unsigned int seq;
+  mobotTelemetry_t snapshot;
+};
+
+/* Take one sample of each enabled metric. Returns -3 if the link was busy
+ * and the rest of the poll was skipped. */
+static int Mobot_telemetrySample(mobotTelemetryPoller_t* t, mobotTelemetry_t* sample)
+{
+  static const struct {
+    int metric;
+    uint8_t cmd;
+    int len;
+  } polls[] = {
+    {MOBOT_TELEMETRY_STATUS, CMD_STATUS, CODEC_RESP_LEN(CMD_STATUS)},
+    {MOBOT_TELEMETRY_BATTERY, CMD_GETBATTERYVOLTAGE, CODEC_RESP_LEN(CMD_GETBATTERYVOLTAGE)},
+    {MOBOT_TELEMETRY_ACCEL, CMD_GETACCEL, CODEC_RESP_LEN(CMD_GETACCEL)},
+    {MOBOT_TELEMETRY_BUTTON, CMD_GETBUTTONVOLTAGE, CODEC_RESP_LEN(CMD_GETBUTTONVOLTAGE)},
+    {MOBOT_TELEMETRY_MOTORERRORS, CMD_GET_MOTOR_ERRORS, CODEC_RESP_LEN(CMD_GET_MOTOR_ERRORS)},
+  };
+  uint8_t buf[32];
+  const uint8_t* p;
+  double now;
+  int i, j;
+  int rc;
+  sample->connected = t->comms->connected;
+  for(i = 0; i < (int)(sizeof(polls)/sizeof(polls[0])); i++) {
+    if(!(t->metrics & polls[i].metric)) {
+      continue;
+    }
+    rc = MobotMsgTransactionBackground(t->comms, BTCMD(polls[i].cmd), buf, 0);
+    if(rc == -3) {
+      sample->skipped++;
+      return -3;
+    }
+    now = Mobot_monotonicMsecs();
+    p = rc ? NULL : codecView(buf, polls[i].len);
+    if(polls[i].metric == MOBOT_TELEMETRY_STATUS) {
+      sample->responding = (p != NULL);
+      sample->statusAge = now;
+      sample->valid |= MOBOT_TELEMETRY_STATUS;
+    }
+    if(p == NULL) {
+      sample->failures++;
+      continue;
+    }
+    switch(polls[i].metric) {
+      case MOBOT_TELEMETRY_BATTERY:
+        sample->batteryVoltage = codecGetFloat(p);
+        sample->batteryAge = now;
+        break;
+      case MOBOT_TELEMETRY_ACCEL:
+        for(j = 0; j < 3; j++) {
+          sample->accel[j] = codecGetI16LE(&p[j*2]) / 16384.0;
+        }
+        sample->accelAge = now;
+        break;
+      case MOBOT_TELEMETRY_BUTTON:
+        sample->buttonVoltage = codecGetFloat(p);
+        sample->buttonAge = now;
+        break;
+      case MOBOT_TELEMETRY_MOTORERRORS:
+        for(j = 0; j < 4; j++) {
+          sample->motorErrors[j] = codecGetFloat(&p[j*4]);
+        }
+        sample->motorErrorsAge = now;
+        break;
+    }
+    sample->valid |= polls[i].metric;
+  }
+  sample->polls++;
+  return 0;
+}
+
+/* Only the poller thread writes the snapshot */
+static void Mobot_telemetryPublish(mobotTelemetryPoller_t* t, const mobotTelemetry_t* sample)
+{
+  t->seq++;
+  MEMORY_BARRIER();
+  t->snapshot = *sample;
+  MEMORY_BARRIER();
+  t->seq++;
+}
+
+static void* Mobot_telemetryThread(void* arg)
+{
+  mobotTelemetryPoller_t* t = (mobotTelemetryPoller_t*)arg;
+  mobotTelemetry_t sample;
+  double next = Mobot_monotonicMsecs();
+  double now;
+  int rc;
+  sample = t->snapshot;
+  MUTEX_LOCK(&t->lock);
+  while(!t->stop) {
+    now = Mobot_monotonicMsecs();
+    if(now < next) {
+#ifndef _WIN32
+      Mobot_condTimedWait(&t->cond, &t->lock, next - now);
+#else
+      ResetEvent(t->cond);
+      MUTEX_UNLOCK(&t->lock);
+      WaitForSingleObject(t->cond, (DWORD)(next - now) + 1);
+      MUTEX_LOCK(&t->lock);
+#endif
+      continue;
+    }
+    MUTEX_UNLOCK(&t->lock);
+    rc = Mobot_telemetrySample(t, &sample);
+    if(rc == -3) {
+      if(t->backoff < TELEMETRY_MAX_BACKOFF) {
+        t->backoff *= 2;
+      }
+    } else if(t->backoff > 1) {
+      t->backoff /= 2;
+    }
+    sample.period = t->period * t->backoff;
+    Mobot_telemetryPublish(t, &sample);
+    next = Mobot_monotonicMsecs() + sample.period;
+    MUTEX_LOCK(&t->lock);
+  }
+  MUTEX_UNLOCK(&t->lock);
+  return NULL;
+}
+
+/* Called with telemetry_lock held. Never called with callback_lock held:
+ * the poller's transactions can need it to dispatch events. */
+static void Mobot_telemetryStopLocked(mobot_t* comms)
+{
+  mobotTelemetryPoller_t* t = comms->telemetry;
+  if(t == NULL || !t->running) {
+    return;
+  }
+  MUTEX_LOCK(&t->lock);
+  t->stop = 1;
+  COND_BROADCAST(&t->cond);
+  MUTEX_UNLOCK(&t->lock);
+  THREAD_JOIN(t->thread);
+  t->running = 0;
+}
+
+int Mobot_telemetryStart(mobot_t* comms, int metrics, double msecs)
+{
+  mobotTelemetryPoller_t* t;
+  if(msecs <= 0 || metrics == 0) {
+    return -1;
+  }
+  MUTEX_LOCK(comms->telemetry_lock);
+  Mobot_telemetryStopLocked(comms);
+  t = comms->telemetry;
+  if(t == NULL) {
+    t = (mobotTelemetryPoller_t*)malloc(sizeof(mobotTelemetryPoller_t));
+    if(t == NULL) {
+      MUTEX_UNLOCK(comms->telemetry_lock);
+      return -1;
+    }
+    t->comms = comms;
+    t->running = 0;
+    MUTEX_INIT(&t->lock);
+    COND_INIT_MONOTONIC(&t->cond);
+    t->seq = 0;
+    memset(&t->snapshot, 0, sizeof(t->snapshot));
+    comms->telemetry = t;
+  }
+  t->metrics = metrics;
+  t->period = msecs;
+  t->backoff = 1;
+  t->stop = 0;
+  THREAD_CREATE(&t->thread, Mobot_telemetryThread, t);
+  t->running = 1;
+  MUTEX_UNLOCK(comms->telemetry_lock);
+  return 0;
+}
+
+int Mobot_telemetryStop(mobot_t* comms)
+{
+  MUTEX_LOCK(comms->telemetry_lock);
+  Mobot_telemetryStopLocked(comms);
+  MUTEX_UNLOCK(comms->telemetry_lock);
+  return 0;
+}
+
+int Mobot_getTelemetry(mobot_t* comms, mobotTelemetry_t* telemetry)
+{
+  mobotTelemetryPoller_t* t = comms->telemetry;
+  unsigned int seq;
+  double now;
+  if(t == NULL) {
+    return -1;
+  }
+  do {
+    while((seq = t->seq) & 1);
+    MEMORY_BARRIER();
+    *telemetry = t->snapshot;
+    MEMORY_BARRIER();
+  } while(seq != t->seq);
+  now = Mobot_monotonicMsecs();
+  telemetry->batteryAge = now - telemetry->batteryAge;
+  telemetry->accelAge = now - telemetry->accelAge;
+  telemetry->buttonAge = now - telemetry->buttonAge;
+  telemetry->motorErrorsAge = now - telemetry->motorErrorsAge;
+  telemetry->statusAge = now - telemetry->statusAge;
+  return 0;
+}
+
+struct mobotTask_s
+{
+  void* (*func)(void*);
+  void* arg;
+  void* result;
+  int done;
+  /* One reference for the worker, one for whoever holds the handle */
+  int refs;
+  struct mobotTask_s* next;
+};
+
+struct mobotTaskQueue_s
+{
+  mobotTask_t* head;
+  mobotTask_t* tail;
+  /* Tasks submitted but not yet finished */
+  int pending;
+  /* Set while the queue is on the ready list or one of its tasks is running */
+  int scheduled;
+  /* The worker pool that runs this queue's tasks */
+  int pool;
+  struct mobotTaskQueue_s* nextReady;
+};
+
+/* The executor. Queues with work waiting are kept on their pool's ready
+ * list. Workers take the head task of the first ready queue, and a queue goes
+ * back on the list only after its running task finishes, which is what keeps
+ * each robot's motions in order. Workers are started on demand, up to the
+ * pool's limit, and then stay around for the next task.
+ *
+ * Each pool has a worker budget of its own, so work of one kind never waits
+ * for a worker behind work of another. A task may wait on tasks of another
+ * pool, but never on a task of its own pool: with every worker of a pool
+ * doing that, nothing would be left to run what they wait for. */
+typedef struct mobotTaskPool_s
+{
+  mobotTaskQueue_t* readyHead;
+  mobotTaskQueue_t* readyTail;
+  int numReady;
+  int numWorkers;
+  int idleWorkers;
+  int maxWorkers;
+  COND_T cond;
+} mobotTaskPool_t;
+
+static ONCE_T g_taskOnce = ONCE_INIT;
+static MUTEX_T g_taskLock;
+static COND_T g_taskDoneCond;
+static mobotTaskPool_t g_taskPools[TASK_NUM_POOLS];
+
+static void Mobot_taskInitOnce(void)
+{
+  int i;
+  MUTEX_INIT(&g_taskLock);
+  COND_INIT(&g_taskDoneCond);
+  for(i = 0; i < TASK_NUM_POOLS; i++) {
+    g_taskPools[i].readyHead = NULL;
+    g_taskPools[i].readyTail = NULL;
+    g_taskPools[i].numReady = 0;
+    g_taskPools[i].numWorkers = 0;
+    g_taskPools[i].idleWorkers = 0;
+    COND_INIT(&g_taskPools[i].cond);
+  }
+  g_taskPools[TASK_POOL_MOTION].maxWorkers = TASK_MAX_WORKERS;
+  g_taskPools[TASK_POOL_COALESCE].maxWorkers = TASK_MAX_COALESCE_WORKERS;
+  g_taskPools[TASK_POOL_QUERY].maxWorkers = TASK_MAX_QUERY_WORKERS;
+  g_taskPools[TASK_POOL_URGENT].maxWorkers = TASK_MAX_URGENT_WORKERS;
+  g_taskPools[TASK_POOL_MIRROR].maxWorkers = TASK_MAX_MIRROR_WORKERS;
+}
+
+static void Mobot_taskInit()
+{
+  ONCE(g_taskOnce, Mobot_taskInitOnce);
+}
+
+/* Called with g_taskLock held */
+static void Mobot_taskMakeReady(mobotTaskQueue_t* queue)
+{
+  mobotTaskPool_t* pool = &g_taskPools[queue->pool];
+  queue->nextReady = NULL;
+  if(pool->readyTail) {
+    pool->readyTail->nextReady = queue;
+  } else {
+    pool->readyHead = queue;
+  }
+  pool->readyTail = queue;
+  pool->numReady++;
+}
+
+/* Called with g_taskLock held */
+static void Mobot_taskRelease(mobotTask_t* task)
+{
+  task->refs--;
+  if(task->refs == 0) {
+    free(task);
+  }
+}
+
+/* Wait on cond. Called with g_taskLock held, and returns with it held
+ * again. */
+static void Mobot_taskCondWait(COND_T* cond)
+{
+#ifndef _WIN32
+  COND_WAIT(cond, &g_taskLock);
+#else
+  ResetEvent(*cond);
+  MUTEX_UNLOCK(&g_taskLock);
+  WaitForSingleObject(*cond, INFINITE);
+  MUTEX_LOCK(&g_taskLock);
+#endif
+}
+
+static void* Mobot_taskWorker(void* arg)
+{
+  mobotTaskPool_t* pool = (mobotTaskPool_t*)arg;
+  mobotTaskQueue_t* queue;
+  mobotTask_t* task;
+  MUTEX_LOCK(&g_taskLock);
+  while(1) {
+    while(pool->readyHead == NULL) {
+      pool->idleWorkers++;
+      Mobot_taskCondWait(&pool->cond);
+      pool->idleWorkers--;
+    }
+    queue = pool->readyHead;
+    pool->readyHead = queue->nextReady;
+    if(pool->readyHead == NULL) {
+      pool->readyTail = NULL;
+    }
+    pool->numReady--;
+    task = queue->head;
+    queue->head = task->next;
+    if(queue->head == NULL) {
+      queue->tail = NULL;
+    }
+    MUTEX_UNLOCK(&g_taskLock);
+
+    task->result = task->func(task->arg);
+
+    MUTEX_LOCK(&g_taskLock);
+    task->done = 1;
+    queue->pending--;
+    if(queue->head) {
+      Mobot_taskMakeReady(queue);
+    } else {
+      queue->scheduled = 0;
+    }
+    Mobot_taskRelease(task);
+    COND_BROADCAST(&g_taskDoneCond);
+  }
+  return NULL;
+}
+
+mobotTaskQueue_t* Mobot_taskQueueNewPool(int pool)
+{
+  mobotTaskQueue_t* queue;
+  if(pool < 0 || pool >= TASK_NUM_POOLS) {
+    return NULL;
+  }
+  queue = (mobotTaskQueue_t*)malloc(sizeof(mobotTaskQueue_t));
+  if(queue == NULL) {
+    return NULL;
+  }
+  queue->head = NULL;
+  queue->tail = NULL;
+  queue->pending = 0;
+  queue->scheduled = 0;
+  queue->pool = pool;
+  queue->nextReady = NULL;
+  return queue;
+}
+
+mobotTaskQueue_t* Mobot_taskQueueNew()
+{
+  return Mobot_taskQueueNewPool(TASK_POOL_MOTION);
+}
+
+int Mobot_taskQueueFree(mobotTaskQueue_t* queue)
+{
+  if(queue == NULL) {
+    return 0;
+  }
+  if(queue->pending) {
+    return -1;
+  }
+  free(queue);
+  return 0;
+}
+
+mobotTask_t* Mobot_taskSubmit(mobotTaskQueue_t* queue, void* (*func)(void*), void* arg)
+{
+  mobotTask_t* task;
+  mobotTaskPool_t* pool;
+  THREAD_T worker;
+  if(queue == NULL) {
+    return NULL;
+  }
+  Mobot_taskInit();
+  pool = &g_taskPools[queue->pool];
+  task = (mobotTask_t*)malloc(sizeof(mobotTask_t));
+  if(task == NULL) {
+    return NULL;
+  }
+  task->func = func;
+  task->arg = arg;
+  task->result = NULL;
+  task->done = 0;
+  task->refs = 2;
+  task->next = NULL;
+
+  MUTEX_LOCK(&g_taskLock);
+  if(queue->tail) {
+    queue->tail->next = task;
+  } else {
+    queue->head = task;
+  }
+  queue->tail = task;
+  queue->pending++;
+  if(!queue->scheduled) {
+    queue->scheduled = 1;
+    Mobot_taskMakeReady(queue);
+    if(pool->numReady > pool->idleWorkers && pool->numWorkers < pool->maxWorkers) {
+      THREAD_CREATE(&worker, Mobot_taskWorker, pool);
+      pool->numWorkers++;
+    } else {
+      COND_SIGNAL(&pool->cond);
+    }
+  }
+  MUTEX_UNLOCK(&g_taskLock);
+  return task;
+}
+
+int Mobot_taskJoin(mobotTask_t* task, void** result)
+{
+  if(task == NULL) {
+    return -1;
+  }
+  MUTEX_LOCK(&g_taskLock);
+  while(!task->done) {
+    Mobot_taskCondWait(&g_taskDoneCond);
+  }
+  if(result) {
+    *result = task->result;
+  }
+  Mobot_taskRelease(task);
+  MUTEX_UNLOCK(&g_taskLock);
+  return 0;
+}
+
+int Mobot_taskDetach(mobotTask_t* task)
+{
+  if(task == NULL) {
+    return -1;
+  }
+  MUTEX_LOCK(&g_taskLock);
+  Mobot_taskRelease(task);
+  MUTEX_UNLOCK(&g_taskLock);
+  return 0;
+}
+
+/* Start a NB motion on the robot's motion queue. The robot keeps the
+ * handle of the newest one for Mobot_motionTask. */
+int Mobot_motionSubmit(mobot_t* comms, void* (*func)(void*), void* arg)
+{
+  mobotTask_t* task = Mobot_taskSubmit(comms->motionQueue, func, arg);
+  mobotTask_t* old;
+  if(task == NULL) {
+    return -1;
+  }
+  MUTEX_LOCK(&g_taskLock);
+  old = comms->lastMotion;
+  comms->lastMotion = task;
+  if(old != NULL) {
+    Mobot_taskRelease(old);
+  }
+  MUTEX_UNLOCK(&g_taskLock);
+  return 0;
+}
+
+mobotTask_t* Mobot_motionTask(mobot_t* comms)
+{
+  mobotTask_t* task;
+  Mobot_taskInit();
+  MUTEX_LOCK(&g_taskLock);
+  task = comms->lastMotion;
+  if(task != NULL) {
+    task->refs++;
+  }
+  MUTEX_UNLOCK(&g_taskLock);
+  return task;
+}
+
+int Mobot_taskQueueWait(mobotTaskQueue_t* queue)
+{
+  if(queue == NULL) {
+    return -1;
+  }
+  Mobot_taskInit();
+  MUTEX_LOCK(&g_taskLock);
+  while(queue->pending) {
+    Mobot_taskCondWait(&g_taskDoneCond);
+  }
+  MUTEX_UNLOCK(&g_taskLock);
+  return 0;
+}
+
+int SendToIMobot(mobot_t* comms, uint8_t cmd, const void* data, int datasize)
+{
+  return SendToIMobotEx(comms, cmd, data, datasize, 0, NULL, -1);
+}
+
+static MOBOTdongle* Mobot_getTxDongle(mobot_t* comms);
+
+/* Frame one message for comms' connection and write it out. end is the
+ * terminator: MSG_SENDEND for ordinary commands, GRP_CMD_END for group
+ * commands. Called with commsLock held. */
+static int Mobot_writeMessage(mobot_t* comms, uint8_t cmd, const void* data, int datasize, uint8_t end)
+{
+  int err = 0;
+  int i;
+  int len;
+  /* The length byte of the ZigBee envelope counts the whole frame */
+  uint8_t str[256];
+  if(datasize < 0 || datasize + 8 > 255) {
+    fprintf(stderr, "(barobo) ERROR: in Mobot_writeMessage, "
+        "message of %d bytes is too large\n", datasize);
+    return -1;
+  }
+  if(
       (comms->connectionMode == MOBOTCONNECT_BLUETOOTH) ||
       (comms->connectionMode == MOBOTCONNECT_TCP) 
     ) 
@@ -1997,7 +4655,7 @@ int SendToIMobot(mobot_t* comms, uint8_t cmd, const void* data, int datasize)
     if(datasize > 0) {
       memcpy(&str[2], data, datasize);
     }
-    str[datasize+2] = MSG_SENDEND;
+    str[datasize+2] = end;
     len = datasize + 3;
   } else {
     str[0] = cmd;
@@ -2014,7 +4672,7 @@ int SendToIMobot(mobot_t* comms, uint8_t cmd, const void* data, int datasize)
     str[6] = datasize + 3;
 
     if(datasize > 0) memcpy(&str[7], data, datasize);
-    str[datasize+7] = MSG_SENDEND;
+    str[datasize+7] = end;
     len = datasize + 8;
   }
 #if 0
@@ -2058,6 +4716,340 @@ int SendToIMobot(mobot_t* comms, uint8_t cmd, const void* data, int datasize)
   return 0;
 }
 
+/* Fair sharing of a link among the robots on it. The owner of a link is the
+ * robot whose dongle or socket carries the traffic: the parent for a ZigBee
+ * child, the robot itself otherwise. A robot has at most one transaction on
+ * the air, since commsLock is held from send to receive, so each robot is a
+ * queue of depth one and the threads waiting on its commsLock queue up behind
+ * it. When the owner's window of in-flight transactions is full, the waiting
+ * robot that has been charged the least link time goes next (start-time fair
+ * queuing). A robot coming back from idle starts at the owner's virtual
+ * clock, so it cannot bank credit while it is quiet. */
+static mobot_t* Mobot_airtimeOwner(mobot_t* comms)
+{
+  if(
+      (comms->connectionMode == MOBOTCONNECT_ZIGBEE) &&
+      (comms->parent != NULL)
+    )
+  {
+    return comms->parent;
+  }
+  return comms;
+}
+
+/* Hand out free slots. Called with owner->airtime_lock held. */
+static void Mobot_airtimeDispatch(mobot_t* owner)
+{
+  mobot_t* iter;
+  mobot_t* best;
+  mobot_t** link;
+  int granted = 0;
+  double now = Mobot_monotonicMsecs();
+  while(
+      (owner->airtimeWindow <= 0) ||
+      (owner->airtimeInFlight < owner->airtimeWindow)
+      )
+  {
+    best = NULL;
+    for(iter = owner->airtimeWaiters; iter != NULL; iter = iter->airtimeNextWaiter) {
+      /* Held back by its rate cap */
+      if(iter->airtimeNextSend > now) {
+        continue;
+      }
+      if(best == NULL || iter->airtimeVruntime < best->airtimeVruntime) {
+        best = iter;
+      }
+    }
+    if(best == NULL) {
+      break;
+    }
+    for(link = &owner->airtimeWaiters; *link != best; link = &(*link)->airtimeNextWaiter);
+    *link = best->airtimeNextWaiter;
+    best->airtimeNextWaiter = NULL;
+    best->airtimeWaiting = 0;
+    best->airtimeGranted = 1;
+    owner->airtimeInFlight++;
+    if(best->airtimeVruntime > owner->airtimeVclock) {
+      owner->airtimeVclock = best->airtimeVruntime;
+    }
+    if(best->airtimeRateCap > 0) {
+      if(best->airtimeNextSend < now) {
+        best->airtimeNextSend = now;
+      }
+      best->airtimeNextSend += 1000.0 / best->airtimeRateCap;
+    }
+    granted = 1;
+  }
+  if(granted) {
+    COND_BROADCAST(owner->airtime_cond);
+  }
+}
+
+/* Wait for comms' turn on its link. Called with commsLock held. Priority
+ * transactions (priority > 0) never wait, but still count against the
+ * window. Returns -1 without a slot if a priority transaction for this robot
+ * turns up while we wait, so the caller can step aside for it. Background
+ * transactions (priority < 0) never wait either: they get a slot only if the
+ * link is idle, and -3 otherwise. Returns -2 without a slot if the monotonic
+ * clock passes limit first; a negative limit waits for ever. */
+static int Mobot_airtimeAcquire(mobot_t* comms, int priority, double limit)
+{
+  mobot_t* owner = Mobot_airtimeOwner(comms);
+  double start = Mobot_monotonicMsecs();
+  double now = start;
+  double wake;
+  int rc = 0;
+  MUTEX_LOCK(owner->airtime_lock);
+  if(priority > 0) {
+    owner->airtimeInFlight++;
+  } else if(priority < 0) {
+    if(
+        (owner->airtimeInFlight > 0) ||
+        (owner->airtimeWaiters != NULL) ||
+        (now - owner->airtimeIdleSince < TELEMETRY_IDLE_GAP)
+      )
+    {
+      rc = -3;
+    } else {
+      owner->airtimeInFlight++;
+    }
+  } else {
+    if(comms->airtimeVruntime < owner->airtimeVclock) {
+      comms->airtimeVruntime = owner->airtimeVclock;
+    }
+    comms->airtimeWaiting = 1;
+    comms->airtimeNextWaiter = owner->airtimeWaiters;
+    owner->airtimeWaiters = comms;
+    Mobot_airtimeDispatch(owner);
+    while(!comms->airtimeGranted) {
+      if(comms->priorityPending > 0) {
+        rc = -1;
+        break;
+      }
+      if(limit >= 0 && now >= limit) {
+        rc = -2;
+        break;
+      }
+      /* Wake up for whichever comes first: our pacing slot or the limit */
+      wake = comms->airtimeNextSend > now ? comms->airtimeNextSend : -1;
+      if(limit >= 0 && (wake < 0 || limit < wake)) {
+        wake = limit;
+      }
+#ifndef _WIN32
+      if(wake >= 0) {
+        Mobot_condTimedWait(owner->airtime_cond, owner->airtime_lock, wake - now);
+      } else {
+        COND_WAIT(owner->airtime_cond, owner->airtime_lock);
+      }
+#else
+      ResetEvent(*owner->airtime_cond);
+      MUTEX_UNLOCK(owner->airtime_lock);
+      WaitForSingleObject(*owner->airtime_cond,
+          wake >= 0 ? (DWORD)(wake - now) + 1 : INFINITE);
+      MUTEX_LOCK(owner->airtime_lock);
+#endif
+      now = Mobot_monotonicMsecs();
+      Mobot_airtimeDispatch(owner);
+    }
+    if(rc) {
+      mobot_t** link;
+      if(comms->airtimeWaiting) {
+        for(link = &owner->airtimeWaiters; *link != comms; link = &(*link)->airtimeNextWaiter);
+        *link = comms->airtimeNextWaiter;
+        comms->airtimeNextWaiter = NULL;
+        comms->airtimeWaiting = 0;
+      } else {
+        /* Granted just as we gave up */
+        comms->airtimeGranted = 0;
+        owner->airtimeInFlight--;
+        Mobot_airtimeDispatch(owner);
+      }
+    } else {
+      comms->airtimeGranted = 0;
+      comms->airtimeGrants++;
+      comms->airtimeDelayTotal += now - start;
+      if(now - start > comms->airtimeDelayMax) {
+        comms->airtimeDelayMax = now - start;
+      }
+    }
+  }
+  MUTEX_UNLOCK(owner->airtime_lock);
+  if(rc == 0) {
+    comms->airtimeHolder = owner;
+    comms->airtimeStart = now;
+  }
+  return rc;
+}
+
+/* Give back comms' slot, if it holds one, and charge it for the link time
+ * it used. Called with commsLock held. */
+static void Mobot_airtimeRelease(mobot_t* comms)
+{
+  mobot_t* owner = comms->airtimeHolder;
+  double used;
+  if(owner == NULL) {
+    return;
+  }
+  used = Mobot_monotonicMsecs() - comms->airtimeStart;
+  MUTEX_LOCK(owner->airtime_lock);
+  owner->airtimeInFlight--;
+  if(owner->airtimeInFlight == 0) {
+    owner->airtimeIdleSince = Mobot_monotonicMsecs();
+  }
+  comms->airtimeVruntime += used;
+  comms->airtimeBusy += used;
+  owner->airtimeBusyTotal += used;
+  Mobot_airtimeDispatch(owner);
+  MUTEX_UNLOCK(owner->airtime_lock);
+  comms->airtimeHolder = NULL;
+}
+
+/* Wake anyone waiting for a slot on comms' link, so a thread queued for
+ * comms can notice a pending priority transaction. */
+static void Mobot_airtimeWake(mobot_t* comms)
+{
+  mobot_t* owner = Mobot_airtimeOwner(comms);
+  MUTEX_LOCK(owner->airtime_lock);
+  COND_BROADCAST(owner->airtime_cond);
+  MUTEX_UNLOCK(owner->airtime_lock);
+}
+
+int Mobot_setAirtimeWindow(mobot_t* comms, int transactions)
+{
+  mobot_t* owner = Mobot_airtimeOwner(comms);
+  if(transactions < 0) {
+    return -1;
+  }
+  MUTEX_LOCK(owner->airtime_lock);
+  owner->airtimeWindow = transactions;
+  Mobot_airtimeDispatch(owner);
+  MUTEX_UNLOCK(owner->airtime_lock);
+  return 0;
+}
+
+int Mobot_setRateLimit(mobot_t* comms, double transactionsPerSecond)
+{
+  mobot_t* owner = Mobot_airtimeOwner(comms);
+  if(transactionsPerSecond < 0) {
+    return -1;
+  }
+  MUTEX_LOCK(owner->airtime_lock);
+  comms->airtimeRateCap = transactionsPerSecond;
+  comms->airtimeNextSend = 0;
+  COND_BROADCAST(owner->airtime_cond);
+  MUTEX_UNLOCK(owner->airtime_lock);
+  return 0;
+}
+
+int Mobot_getAirtimeStats(mobot_t* comms, int* transactions,
+    double* meanDelay, double* maxDelay, double* share)
+{
+  mobot_t* owner = Mobot_airtimeOwner(comms);
+  MUTEX_LOCK(owner->airtime_lock);
+  if(transactions != NULL) {
+    *transactions = comms->airtimeGrants;
+  }
+  if(meanDelay != NULL) {
+    *meanDelay = comms->airtimeGrants ? comms->airtimeDelayTotal / comms->airtimeGrants : 0;
+  }
+  if(maxDelay != NULL) {
+    *maxDelay = comms->airtimeDelayMax;
+  }
+  if(share != NULL) {
+    *share = owner->airtimeBusyTotal > 0 ? comms->airtimeBusy / owner->airtimeBusyTotal : 0;
+  }
+  MUTEX_UNLOCK(owner->airtime_lock);
+  return 0;
+}
+
+/* If recvDest is not NULL, the response is delivered straight into it
+ * instead of going through comms->recvBuf. A transaction waits at most
+ * msecs milliseconds for its turn on the link, or for ever if msecs is
+ * negative, and returns -2 if it runs out. */
+static int SendToIMobotEx(mobot_t* comms, uint8_t cmd, const void* data, int datasize, int priority, uint8_t* recvDest, double msecs)
+{
+  int rc;
+  double limit = msecs >= 0 ? Mobot_monotonicMsecs() + msecs : -1;
+  if(comms->connected == 0) {
+    return -1;
+  }
+  MUTEX_LOCK(comms->commsLock);
+  while(1) {
+    if(priority <= 0) {
+      /* Step aside for any stop or safety command waiting for the line */
+      MUTEX_LOCK(comms->priority_lock);
+      while(comms->priorityPending > 0) {
+        MUTEX_UNLOCK(comms->commsLock);
+#ifndef _WIN32
+        COND_WAIT(comms->priority_cond, comms->priority_lock);
+        MUTEX_UNLOCK(comms->priority_lock);
+#else
+        ResetEvent(*comms->priority_cond);
+        MUTEX_UNLOCK(comms->priority_lock);
+        WaitForSingleObject(*comms->priority_cond, INFINITE);
+#endif
+        MUTEX_LOCK(comms->commsLock);
+        MUTEX_LOCK(comms->priority_lock);
+      }
+      MUTEX_UNLOCK(comms->priority_lock);
+    }
+    /* Only full transactions, which always end in RecvFromIMobotTimeout,
+     * take a slot on the link */
+    if(recvDest == NULL) {
+      break;
+    }
+    rc = Mobot_airtimeAcquire(comms, priority, limit);
+    if(rc == 0) {
+      break;
+    } else if(rc == -3 || rc == -2) {
+      MUTEX_UNLOCK(comms->commsLock);
+      return rc;
+    }
+  }
+  comms->recvBuf_ready = 0;
+
+  if(Mobot_writeMessage(comms, cmd, data, datasize, MSG_SENDEND)) {
+    /* A transaction gives the link back here, as there is no response to
+     * wait for. Plain sends leave commsLock to the caller, as always. */
+    if(recvDest != NULL) {
+      Mobot_airtimeRelease(comms);
+      MUTEX_UNLOCK(comms->commsLock);
+    }
+    return -1;
+  }
+  /* Register the destination only after the message is written out: data
+   * may be the same buffer, and a straggling answer to an earlier attempt must
+   * not land in it while we are still sending from it. */
+  if(recvDest != NULL) {
+    MUTEX_LOCK(comms->recvBuf_lock);
+    if(!comms->recvBuf_ready) {
+      comms->recvDest = recvDest;
+    }
+    MUTEX_UNLOCK(comms->recvBuf_lock);
+  }
+  if(priority > 0 && Mobot_getTxDongle(comms) != NULL) {
+    dongleFlush(Mobot_getTxDongle(comms));
+  }
+  comms->sendTime = Mobot_monotonicMsecs();
+  return 0;
+}
+
+/* Group commands are not answered, so this only sends */
+int Mobot_sendGroupCommand(mobot_t* comms, uint8_t cmd, const void* data, int datasize)
+{
+  int rc;
+  if(comms->connected == 0) {
+    return -1;
+  }
+  MUTEX_LOCK(comms->commsLock);
+  rc = Mobot_writeMessage(comms, cmd, data, datasize, GRP_CMD_END);
+  if(rc == 0 && Mobot_getTxDongle(comms) != NULL) {
+    dongleFlush(Mobot_getTxDongle(comms));
+  }
+  MUTEX_UNLOCK(comms->commsLock);
+  return rc;
+}
+
 #if 0
 /* hlh: unused? */
 
@@ -2089,39 +5081,21 @@ int SendToMobotDirect(mobot_t* comms, const void* data, int datasize)
 #endif
 
 int RecvFromIMobot(mobot_t* comms, uint8_t* buf, int size)
+{
+  return RecvFromIMobotTimeout(comms, buf, size, Mobot_currentRTO(comms), 0);
+}
+
+/* Wait up to msecs milliseconds for the response. If sampleRTT is set, the
+ * round trip is folded into the connection's timeout estimate on success. On
+ * timeout the estimate is backed off instead. */
+static int RecvFromIMobotTimeout(mobot_t* comms, uint8_t* buf, int size, double msecs, int sampleRTT)
 {
   int rc;
-#ifndef _WIN32
-  struct timespec ts;
-#else
-#endif
   /* Wait until transaction is ready */
   MUTEX_LOCK(comms->recvBuf_lock);
   while(!comms->recvBuf_ready) {
 #ifndef _WIN32
-    /* Set up a wait with timeout */
-    /* Get the current time */
-#ifndef __MACH__
-    clock_gettime(CLOCK_REALTIME, &ts);
-#else
-    clock_serv_t cclock;
-    mach_timespec_t mts;
-    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-    clock_get_time(cclock, &mts);
-    mach_port_deallocate(mach_task_self(), cclock);
-    ts.tv_sec = mts.tv_sec;
-    ts.tv_nsec = mts.tv_nsec;
-#endif
-    /* Add a timeout */
-    ts.tv_nsec += 700000000; // 100 ms
-    if(ts.tv_nsec > 1000000000) {
-      ts.tv_nsec -= 1000000000;
-      ts.tv_sec += 1;
-    }
-    rc = pthread_cond_timedwait(
-      comms->recvBuf_cond, 
-      comms->recvBuf_lock,
-      &ts);
+    rc = Mobot_condTimedWait(comms->recvBuf_cond, comms->recvBuf_lock, msecs);
     /*
     rc = pthread_cond_wait(
       comms->recvBuf_cond, 
@@ -2137,25 +5111,45 @@ int RecvFromIMobot(mobot_t* comms, uint8_t* buf, int size)
 
       /* Reset the incoming message queue */
       comms->commsEngine_bytes = 0;
+      /* buf goes out of scope once we return */
+      comms->recvDest = NULL;
+      comms->burstCount = 0;
+      Mobot_backoffRTO(comms);
       /* Disconnect and return error */
       MUTEX_UNLOCK(comms->recvBuf_lock);
+      Mobot_airtimeRelease(comms);
       MUTEX_UNLOCK(comms->commsLock);
       //Mobot_disconnect(comms);
       return -2;
     }
 #else
     ResetEvent(*comms->recvBuf_cond);
-    ReleaseMutex(*comms->recvBuf_lock);
-    rc = WaitForSingleObject(*comms->recvBuf_cond, 700);
-    if(rc == WAIT_TIMEOUT) {
+    MUTEX_UNLOCK(comms->recvBuf_lock);
+    rc = WaitForSingleObject(*comms->recvBuf_cond, (DWORD)msecs);
+    /* The response may have come in since; recvBuf_ready is only
+     * trustworthy, and recvDest only safe to clear, under the lock */
+    MUTEX_LOCK(comms->recvBuf_lock);
+    if(rc == WAIT_TIMEOUT && !comms->recvBuf_ready) {
+      Mobot_backoffRTO(comms);
+      /* buf goes out of scope once we return */
+      comms->recvDest = NULL;
+      comms->burstCount = 0;
       MUTEX_UNLOCK(comms->recvBuf_lock);
+      Mobot_airtimeRelease(comms);
       MUTEX_UNLOCK(comms->commsLock);
       //Mobot_disconnect(comms);
       return -2;
     }
 #endif
   }
-  memcpy(buf, comms->recvBuf, comms->recvBuf_bytes);
+  /* Usually the response was delivered straight into buf */
+  if(comms->recvBuf_data != buf) {
+    memcpy(buf, comms->recvBuf_data, comms->recvBuf_bytes);
+  }
+  comms->recvDest = NULL;
+  if(sampleRTT) {
+    Mobot_updateRTT(comms, Mobot_monotonicMsecs() - comms->sendTime);
+  }
 
   /* Print out results */
   int i;
@@ -2167,6 +5161,7 @@ int RecvFromIMobot(mobot_t* comms, uint8_t* buf, int size)
   printf("\n");
   */
   MUTEX_UNLOCK(comms->recvBuf_lock);
+  Mobot_airtimeRelease(comms);
   MUTEX_UNLOCK(comms->commsLock);
   return 0;
 }
@@ -2256,13 +5251,48 @@ void sigint_handler(int sig)
 
 static void Mobot_processMessage (mobot_t *comms, uint8_t *buf, size_t len);
 
+/* Split bytes read off a TCP or RFCOMM socket into messages. A message that
+ * arrives across several reads is collected in recvBuf; RecvFromIMobot
+ * throws away a partial message if the rest never comes. */
+void Mobot_socketParse(mobot_t* comms, const uint8_t* buf, int len)
+{
+  int want;
+  int n;
+  int complete;
+  while(len > 0) {
+    MUTEX_LOCK(comms->recvBuf_lock);
+    want = comms->commsEngine_bytes < 2 ? 2 : comms->recvBuf[1];
+    if(want < 2) {
+      /* Not a message we can frame. Drop the rest of the read and start over
+       * with the next one. */
+      comms->commsEngine_bytes = 0;
+      MUTEX_UNLOCK(comms->recvBuf_lock);
+      return;
+    }
+    n = want - comms->commsEngine_bytes;
+    if(n > len) {
+      n = len;
+    }
+    memcpy(&comms->recvBuf[comms->commsEngine_bytes], buf, n);
+    comms->commsEngine_bytes += n;
+    buf += n;
+    len -= n;
+    complete = comms->commsEngine_bytes >= 2 &&
+      comms->recvBuf[1] == comms->commsEngine_bytes;
+    MUTEX_UNLOCK(comms->recvBuf_lock);
+    if(complete) {
+      Mobot_processMessage(comms, comms->recvBuf, comms->commsEngine_bytes);
+    }
+  }
+}
+
 /* The comms engine will watch the incoming comm channel for any message. If a
  * message is expected, it will get the data to RecvFromIMobot(). If it was
  * triggered by an event, then the appropriate callback will be called. */
 void* commsEngine(void* arg)
 {
   mobot_t* comms = (mobot_t*)arg;
-  uint8_t byte;
+  uint8_t chunk[SOCKET_READ_CHUNK];
   int err;
 #ifndef _WIN32
   struct sigaction int_handler;
@@ -2288,9 +5318,9 @@ void* commsEngine(void* arg)
       Mobot_processMessage(comms, buf, len);
     }
     else {
-      /* Try and receive a byte */
+      /* Take whatever has arrived, up to a chunk at a time */
 #ifndef _WIN32
-      err = read(comms->socket, &byte, 1);
+      err = read(comms->socket, chunk, sizeof(chunk));
       /* Check to see if we were interrupted */
       if(-1 == err) {
         if(errno == EINTR) {
@@ -2306,7 +5336,7 @@ void* commsEngine(void* arg)
         }
       }
 #else
-      err = recvfrom(comms->socket, (char*)&byte, 1, 0, (struct sockaddr*)0, 0);
+      err = recv(comms->socket, (char*)chunk, sizeof(chunk), 0);
 #endif
     }
     /* If we are no longer connected, just return */
@@ -2317,30 +5347,650 @@ void* commsEngine(void* arg)
       continue;
     }
 
-    /* DEBUG */
+    if (MOBOTCONNECT_TTY != comms->connectionMode) {
 #ifdef COMMSDEBUG
-    /* hlh: note that comms->commsEngine_bytes will probably always be zero
-     * now for TTY-connected mobots. */
-    printf("%d RECV: 0x%0x\n", comms->commsEngine_bytes, byte);
+      int i;
+      printf("Recv: ");
+      for(i = 0; i < err; i++) {
+        printf("0x%X ", chunk[i]);
+      }
+      printf("\n");
 #endif
+      Mobot_socketParse(comms, chunk, err);
+    }
+  }
+  return NULL;
+}
 
-    if (MOBOTCONNECT_TTY != comms->connectionMode) {
-      MUTEX_LOCK(comms->recvBuf_lock);
-      comms->recvBuf[comms->commsEngine_bytes] = byte;
-      comms->commsEngine_bytes++;
-      MUTEX_UNLOCK(comms->recvBuf_lock);
-      if (comms->recvBuf[1] == comms->commsEngine_bytes) {
-        Mobot_processMessage(comms, comms->recvBuf, comms->commsEngine_bytes);
+/* The event bus. Events are copied into the queue of every subscriber that
+ * wants them, which never blocks on a subscriber: a full queue loses its
+ * oldest event. Each callback subscriber drains its queue on its own thread,
+ * so a slow consumer only ever delays itself. The library's own per-robot
+ * callbacks are subscribers too. */
+struct mobotSubscriber_s
+{
+  mobot_t* comms;
+  int types;
+  double minInterval;
+  double lastTime[4];
+  void (*callback)(const mobotEvent_t* event, void* userdata);
+  void* userdata;
+  MUTEX_T lock;
+  COND_T cond;
+  mobotEvent_t* queue;
+  int queueLength;
+  int head;
+  int num;
+  int delivered;
+  int dropped;
+  int stop;
+  /* Set if the subscriber was cancelled from its own callback, in which
+   * case its thread frees it */
+  int detached;
+  THREAD_T thread;
+  THREAD_ID_T threadId;
+  struct mobotSubscriber_s* next;
+};
+
+static ONCE_T g_busOnce = ONCE_INIT;
+static MUTEX_T g_busLock;
+static mobotSubscriber_t* g_busSubscribers = NULL;
+
+static void Mobot_busInitOnce(void)
+{
+  MUTEX_INIT(&g_busLock);
+}
+
+static void Mobot_busInit()
+{
+  ONCE(g_busOnce, Mobot_busInitOnce);
+}
+
+/* Wait for sub's queue to change. Called with sub->lock held, and returns
+ * nonzero if msecs passed first. */
+static int Mobot_busWait(mobotSubscriber_t* sub, int msecs)
+{
+#ifndef _WIN32
+  if(msecs < 0) {
+    COND_WAIT(&sub->cond, &sub->lock);
+    return 0;
+  }
+  return Mobot_condTimedWait(&sub->cond, &sub->lock, msecs);
+#else
+  DWORD rc;
+  ResetEvent(sub->cond);
+  MUTEX_UNLOCK(&sub->lock);
+  rc = WaitForSingleObject(sub->cond, msecs < 0 ? INFINITE : (DWORD)msecs);
+  MUTEX_LOCK(&sub->lock);
+  return rc == WAIT_TIMEOUT;
+#endif
+}
+
+static void Mobot_publishEvent(mobotEvent_t* event)
+{
+  mobotSubscriber_t* sub;
+  int type;
+  Mobot_busInit();
+  event->hostTime = Mobot_monotonicMsecs();
+  for(type = 0; (1 << type) != event->type; type++);
+  MUTEX_LOCK(&g_busLock);
+  for(sub = g_busSubscribers; sub != NULL; sub = sub->next) {
+    if(!(sub->types & event->type) ||
+        (sub->comms != NULL && sub->comms != event->robot)) {
+      continue;
+    }
+    MUTEX_LOCK(&sub->lock);
+    if(event->hostTime - sub->lastTime[type] >= sub->minInterval) {
+      sub->lastTime[type] = event->hostTime;
+      if(sub->num == sub->queueLength) {
+        sub->head = (sub->head + 1) % sub->queueLength;
+        sub->num--;
+        sub->dropped++;
       }
+      sub->queue[(sub->head + sub->num) % sub->queueLength] = *event;
+      sub->num++;
+      COND_SIGNAL(&sub->cond);
+    }
+    MUTEX_UNLOCK(&sub->lock);
+  }
+  MUTEX_UNLOCK(&g_busLock);
+}
+
+static void Mobot_subscriberFree(mobotSubscriber_t* sub)
+{
+  free(sub->queue);
+  free(sub);
+}
+
+static void* Mobot_subscriberThread(void* arg)
+{
+  mobotSubscriber_t* sub = (mobotSubscriber_t*)arg;
+  mobotEvent_t event;
+  int detached;
+  MUTEX_LOCK(&sub->lock);
+  sub->threadId = THREAD_SELF();
+  while(1) {
+    while(sub->num == 0 && !sub->stop) {
+      Mobot_busWait(sub, -1);
     }
+    if(sub->stop) {
+      break;
+    }
+    event = sub->queue[sub->head];
+    sub->head = (sub->head + 1) % sub->queueLength;
+    sub->num--;
+    sub->delivered++;
+    MUTEX_UNLOCK(&sub->lock);
+    sub->callback(&event, sub->userdata);
+    MUTEX_LOCK(&sub->lock);
+  }
+  detached = sub->detached;
+  MUTEX_UNLOCK(&sub->lock);
+  if(detached) {
+    Mobot_subscriberFree(sub);
   }
   return NULL;
 }
 
+mobotSubscriber_t* Mobot_subscribe(mobot_t* comms, int types, double maxRate,
+    int queueLength, void (*callback)(const mobotEvent_t* event, void* userdata),
+    void* userdata)
+{
+  mobotSubscriber_t* sub;
+  int i;
+  if(queueLength <= 0) {
+    queueLength = EVENT_QUEUE_DEFAULT;
+  }
+  Mobot_busInit();
+  sub = (mobotSubscriber_t*)malloc(sizeof(mobotSubscriber_t));
+  sub->comms = comms;
+  sub->types = types;
+  sub->minInterval = maxRate > 0 ? 1000.0 / maxRate : 0;
+  for(i = 0; i < 4; i++) {
+    sub->lastTime[i] = -sub->minInterval;
+  }
+  sub->callback = callback;
+  sub->userdata = userdata;
+  MUTEX_INIT(&sub->lock);
+  COND_INIT_MONOTONIC(&sub->cond);
+  sub->queue = (mobotEvent_t*)malloc(sizeof(mobotEvent_t) * queueLength);
+  sub->queueLength = queueLength;
+  sub->head = 0;
+  sub->num = 0;
+  sub->delivered = 0;
+  sub->dropped = 0;
+  sub->stop = 0;
+  sub->detached = 0;
+  sub->threadId = THREAD_SELF();
+  if(callback) {
+    THREAD_CREATE(&sub->thread, Mobot_subscriberThread, sub);
+  }
+  MUTEX_LOCK(&g_busLock);
+  sub->next = g_busSubscribers;
+  g_busSubscribers = sub;
+  MUTEX_UNLOCK(&g_busLock);
+  return sub;
+}
+
+int Mobot_unsubscribe(mobotSubscriber_t* sub)
+{
+  mobotSubscriber_t** iter;
+  if(sub == NULL) {
+    return 0;
+  }
+  MUTEX_LOCK(&g_busLock);
+  for(iter = &g_busSubscribers; *iter != NULL; iter = &(*iter)->next) {
+    if(*iter == sub) {
+      *iter = sub->next;
+      break;
+    }
+  }
+  MUTEX_UNLOCK(&g_busLock);
+  if(sub->callback == NULL) {
+    Mobot_subscriberFree(sub);
+    return 0;
+  }
+  MUTEX_LOCK(&sub->lock);
+  sub->stop = 1;
+  COND_SIGNAL(&sub->cond);
+  if(THREAD_ID_EQUAL(sub->threadId, THREAD_SELF())) {
+    /* Called from the subscriber's own callback, or before its thread
+     * started */
+    sub->detached = 1;
+#ifndef _WIN32
+    THREAD_DETACH(sub->thread);
+#else
+    CloseHandle(sub->thread);
+#endif
+    MUTEX_UNLOCK(&sub->lock);
+    return 0;
+  }
+  MUTEX_UNLOCK(&sub->lock);
+  THREAD_JOIN(sub->thread);
+  Mobot_subscriberFree(sub);
+  return 0;
+}
+
+int Mobot_pollEvent(mobotSubscriber_t* sub, mobotEvent_t* event, int msecs)
+{
+  double deadline = Mobot_monotonicMsecs() + msecs;
+  double remaining;
+  if(sub->callback != NULL) {
+    return -1;
+  }
+  MUTEX_LOCK(&sub->lock);
+  while(sub->num == 0) {
+    remaining = deadline - Mobot_monotonicMsecs();
+    if(msecs >= 0 && remaining <= 0) {
+      MUTEX_UNLOCK(&sub->lock);
+      return -2;
+    }
+    Mobot_busWait(sub, msecs < 0 ? -1 : (int)remaining + 1);
+  }
+  *event = sub->queue[sub->head];
+  sub->head = (sub->head + 1) % sub->queueLength;
+  sub->num--;
+  sub->delivered++;
+  MUTEX_UNLOCK(&sub->lock);
+  return 0;
+}
+
+int Mobot_getSubscriberStats(mobotSubscriber_t* sub, int* delivered, int* dropped)
+{
+  MUTEX_LOCK(&sub->lock);
+  if(delivered) *delivered = sub->delivered;
+  if(dropped) *dropped = sub->dropped;
+  MUTEX_UNLOCK(&sub->lock);
+  return 0;
+}
+
+/* The per-robot callbacks of the older API, as bus subscribers. The
+ * callback pointers are set before subscribing and cleared only after
+ * unsubscribing, so they can be read here without callback_lock. */
+static void Mobot_buttonSubscriber(const mobotEvent_t* event, void* userdata)
+{
+  mobot_t* comms = (mobot_t*)userdata;
+  comms->buttonCallback(comms->mobot, event->button, event->buttonDown);
+}
+
+static void Mobot_jointSubscriber(const mobotEvent_t* event, void* userdata)
+{
+  mobot_t* comms = (mobot_t*)userdata;
+  comms->jointCallback(
+      event->millis,
+      RAD2DEG(event->joints[0]),
+      RAD2DEG(event->joints[1]),
+      RAD2DEG(event->joints[2]),
+      RAD2DEG(event->joints[3]),
+      comms->jointCallbackData);
+}
+
+static void Mobot_accelSubscriber(const mobotEvent_t* event, void* userdata)
+{
+  mobot_t* comms = (mobot_t*)userdata;
+  comms->accelCallback(
+      event->millis,
+      event->accel[0],
+      event->accel[1],
+      event->accel[2],
+      comms->accelCallbackData);
+}
+
+static void Mobot_rawSubscriber(const mobotEvent_t* event, void* userdata)
+{
+  mobot_t* comms = (mobot_t*)userdata;
+  comms->eventCallback(event->raw, event->rawSize, comms->eventCallbackData);
+}
+
+/* Publish the frame of an event from the robot as a MOBOT_EVENT_RAW event */
+static void Mobot_publishRawEvent(mobot_t* comms, const uint8_t* buf, int size)
+{
+  mobotEvent_t event;
+  event.type = MOBOT_EVENT_RAW;
+  event.robot = comms;
+  event.millis = 0;
+  event.rawSize = size;
+  memcpy(event.raw, buf, size);
+  Mobot_publishEvent(&event);
+}
+
+/* Export of a robot's events to shared memory, laid out as described in
+ * mobot_shm.h. The event thread is the only writer. The export is allocated
+ * the first time it is started and kept, so the event thread can check it
+ * under its lock without racing with Mobot_shmExportStop. */
+struct mobotShmExport_s
+{
+  MUTEX_T lock;
+  mobotShmHeader_t* shm;
+  uint32_t next;
+  char name[64];
+#ifdef _WIN32
+  HANDLE mapping;
+#endif
+};
+
+static void Mobot_shmWriteRecord(mobotShmRecord_t* rec, uint32_t seq, int type,
+    uint32_t millis, double hostTime, const double* values, int num)
+{
+  int i;
+  rec->seq = seq;
+  MEMORY_BARRIER();
+  rec->type = type;
+  rec->millis = millis;
+  rec->hostTime = hostTime;
+  for(i = 0; i < 4; i++) {
+    rec->values[i] = i < num ? values[i] : 0;
+  }
+  MEMORY_BARRIER();
+  rec->seq = seq + 1;
+}
+
+static void Mobot_shmWrite(mobot_t* comms, int type, uint32_t millis, const double* values, int num)
+{
+  mobotShmExport_t* ex = comms->shmExport;
+  mobotShmHeader_t* shm;
+  mobotShmRecord_t* latest = NULL;
+  double now;
+  if(ex == NULL) {
+    return;
+  }
+  MUTEX_LOCK(&ex->lock);
+  shm = ex->shm;
+  if(shm != NULL) {
+    now = Mobot_monotonicMsecs();
+    Mobot_shmWriteRecord(&shm->ring[ex->next % MOBOT_SHM_SLOTS], 2*ex->next + 1,
+        type, millis, now, values, num);
+    ex->next++;
+    MEMORY_BARRIER();
+    shm->head = ex->next;
+    if(type == MOBOT_SHM_JOINT) {
+      latest = &shm->latestJoint;
+    } else if(type == MOBOT_SHM_ACCEL) {
+      latest = &shm->latestAccel;
+    }
+    if(latest) {
+      Mobot_shmWriteRecord(latest, latest->seq + 1, type, millis, now, values, num);
+    }
+  }
+  MUTEX_UNLOCK(&ex->lock);
+}
+
+#ifndef _WIN32
+/* Whether the region called name was left behind by an exporter that exited
+ * without removing it. A region not finished yet, or whose writer we cannot
+ * check, counts as in use. Windows removes a mapping with its last handle,
+ * so there is no such thing there. */
+static int Mobot_shmAbandoned(const char* name)
+{
+  mobotShmHeader_t* shm;
+  struct stat st;
+  pid_t pid = 0;
+  int fd;
+  int rc = 0;
+  /* The caller reports the original error if the region is in use */
+  int err = errno;
+  fd = shm_open(name, O_RDONLY, 0);
+  if(fd >= 0) {
+    if(fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(mobotShmHeader_t)) {
+      shm = (mobotShmHeader_t*)mmap(NULL, sizeof(mobotShmHeader_t), PROT_READ,
+          MAP_SHARED, fd, 0);
+      if(shm != (mobotShmHeader_t*)MAP_FAILED) {
+        if(shm->magic == MOBOT_SHM_MAGIC) {
+          pid = shm->writerPid;
+        }
+        munmap(shm, sizeof(mobotShmHeader_t));
+      }
+    }
+    close(fd);
+  }
+  rc = pid > 0 && kill(pid, 0) < 0 && errno == ESRCH;
+  errno = err;
+  return rc;
+}
+#endif
+
+int Mobot_shmExportStart(mobot_t* comms, const char* name)
+{
+  mobotShmExport_t* ex;
+  mobotShmHeader_t* shm;
+#ifndef _WIN32
+  int fd;
+#endif
+  Mobot_shmExportStop(comms);
+  MUTEX_LOCK(comms->callback_lock);
+  ex = comms->shmExport;
+  if(ex == NULL) {
+    ex = (mobotShmExport_t*)malloc(sizeof(mobotShmExport_t));
+    MUTEX_INIT(&ex->lock);
+    ex->shm = NULL;
+    comms->shmExport = ex;
+  }
+  MUTEX_UNLOCK(comms->callback_lock);
+  MUTEX_LOCK(&ex->lock);
+  if(name != NULL) {
+    snprintf(ex->name, sizeof(ex->name), "%s", name);
+  } else {
+#ifndef _WIN32
+    snprintf(ex->name, sizeof(ex->name), "/barobo-%s", comms->serialID);
+#else
+    snprintf(ex->name, sizeof(ex->name), "Local\\barobo-%s", comms->serialID);
+#endif
+  }
+#ifndef _WIN32
+  /* Never take over a region someone else is still writing */
+  fd = shm_open(ex->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if(fd < 0 && errno == EEXIST && Mobot_shmAbandoned(ex->name)) {
+    fprintf(stderr, "(barobo) WARNING: in Mobot_shmExportStart, reclaiming %s "
+        "from an exporter that exited\n", ex->name);
+    shm_unlink(ex->name);
+    fd = shm_open(ex->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  }
+  if(fd < 0) {
+    char errbuf[256];
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    fprintf(stderr, "(barobo) ERROR: in Mobot_shmExportStart, shm_open(%s): %s\n",
+        ex->name, errbuf);
+    MUTEX_UNLOCK(&ex->lock);
+    return -1;
+  }
+  if(ftruncate(fd, sizeof(mobotShmHeader_t)) < 0) {
+    char errbuf[256];
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    fprintf(stderr, "(barobo) ERROR: in Mobot_shmExportStart, ftruncate(): %s\n", errbuf);
+    close(fd);
+    shm_unlink(ex->name);
+    MUTEX_UNLOCK(&ex->lock);
+    return -1;
+  }
+  shm = (mobotShmHeader_t*)mmap(NULL, sizeof(mobotShmHeader_t),
+      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(shm == (mobotShmHeader_t*)MAP_FAILED) {
+    char errbuf[256];
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    fprintf(stderr, "(barobo) ERROR: in Mobot_shmExportStart, mmap(): %s\n", errbuf);
+    shm_unlink(ex->name);
+    MUTEX_UNLOCK(&ex->lock);
+    return -1;
+  }
+#else
+  ex->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+      0, sizeof(mobotShmHeader_t), ex->name);
+  if(ex->mapping == NULL) {
+    fprintf(stderr, "(barobo) ERROR: in Mobot_shmExportStart, CreateFileMapping(%s): %lu\n",
+        ex->name, GetLastError());
+    MUTEX_UNLOCK(&ex->lock);
+    return -1;
+  }
+  /* Never take over a region someone else is still writing */
+  if(GetLastError() == ERROR_ALREADY_EXISTS) {
+    fprintf(stderr, "(barobo) ERROR: in Mobot_shmExportStart, %s is already in use\n",
+        ex->name);
+    CloseHandle(ex->mapping);
+    MUTEX_UNLOCK(&ex->lock);
+    return -1;
+  }
+  shm = (mobotShmHeader_t*)MapViewOfFile(ex->mapping, FILE_MAP_ALL_ACCESS, 0, 0,
+      sizeof(mobotShmHeader_t));
+  if(shm == NULL) {
+    fprintf(stderr, "(barobo) ERROR: in Mobot_shmExportStart, MapViewOfFile(): %lu\n",
+        GetLastError());
+    CloseHandle(ex->mapping);
+    MUTEX_UNLOCK(&ex->lock);
+    return -1;
+  }
+#endif
+  memset(shm, 0, sizeof(mobotShmHeader_t));
+  shm->version = MOBOT_SHM_VERSION;
+  shm->slots = MOBOT_SHM_SLOTS;
+  shm->recordSize = sizeof(mobotShmRecord_t);
+  snprintf(shm->serialID, sizeof(shm->serialID), "%s", comms->serialID);
+#ifndef _WIN32
+  shm->writerPid = getpid();
+#else
+  shm->writerPid = GetCurrentProcessId();
+#endif
+  /* Readers go by the magic number, so it is written last */
+  MEMORY_BARRIER();
+  shm->magic = MOBOT_SHM_MAGIC;
+  ex->next = 0;
+  ex->shm = shm;
+  MUTEX_UNLOCK(&ex->lock);
+  return 0;
+}
+
+int Mobot_shmExportStop(mobot_t* comms)
+{
+  mobotShmExport_t* ex = comms->shmExport;
+  if(ex == NULL) {
+    return 0;
+  }
+  MUTEX_LOCK(&ex->lock);
+  if(ex->shm != NULL) {
+#ifndef _WIN32
+    munmap(ex->shm, sizeof(mobotShmHeader_t));
+    shm_unlink(ex->name);
+#else
+    UnmapViewOfFile(ex->shm);
+    CloseHandle(ex->mapping);
+#endif
+    ex->shm = NULL;
+  }
+  MUTEX_UNLOCK(&ex->lock);
+  return 0;
+}
+
+/* Only the event thread writes a robot's channels */
+void Mobot_channelWrite(mobotChannel_t* channel, uint32_t millis, const double* values, int num)
+{
+  int i;
+  channel->seq++;
+  MEMORY_BARRIER();
+  channel->millis = millis;
+  channel->hostTime = Mobot_monotonicMsecs();
+  for(i = 0; i < num; i++) {
+    channel->values[i] = values[i];
+  }
+  channel->updates++;
+  MEMORY_BARRIER();
+  channel->seq++;
+}
+
+static mobotChannel_t* Mobot_channel(mobot_t* comms, int type)
+{
+  switch(type) {
+    case MOBOT_EVENT_JOINT:
+      return &comms->jointChannel;
+    case MOBOT_EVENT_ACCEL:
+      return &comms->accelChannel;
+    default:
+      return NULL;
+  }
+}
+
+int Mobot_channelOpen(mobot_t* comms, int type)
+{
+  switch(type) {
+    case MOBOT_EVENT_JOINT:
+      return Mobot_jointEventsAcquire(comms);
+    case MOBOT_EVENT_ACCEL:
+      return Mobot_accelEventsAcquire(comms);
+    default:
+      return -1;
+  }
+}
+
+int Mobot_channelClose(mobot_t* comms, int type)
+{
+  switch(type) {
+    case MOBOT_EVENT_JOINT:
+      return Mobot_jointEventsRelease(comms);
+    case MOBOT_EVENT_ACCEL:
+      return Mobot_accelEventsRelease(comms);
+    default:
+      return -1;
+  }
+}
+
+int Mobot_readLatest(mobot_t* comms, int type, mobotEvent_t* event,
+    unsigned int* cursor, unsigned int* skipped)
+{
+  mobotChannel_t* channel = Mobot_channel(comms, type);
+  mobotChannel_t copy;
+  unsigned int seq;
+  int i;
+  if(channel == NULL) {
+    return -1;
+  }
+  do {
+    while((seq = channel->seq) & 1);
+    MEMORY_BARRIER();
+    copy.updates = channel->updates;
+    copy.millis = channel->millis;
+    copy.hostTime = channel->hostTime;
+    for(i = 0; i < 4; i++) {
+      copy.values[i] = channel->values[i];
+    }
+    MEMORY_BARRIER();
+  } while(seq != channel->seq);
+  if(copy.updates == 0) {
+    return -1;
+  }
+  event->type = type;
+  event->robot = comms;
+  event->millis = copy.millis;
+  event->hostTime = copy.hostTime;
+  event->rawSize = 0;
+  for(i = 0; i < 4; i++) {
+    if(type == MOBOT_EVENT_JOINT) {
+      event->joints[i] = copy.values[i];
+    } else if(i < 3) {
+      event->accel[i] = copy.values[i];
+    }
+  }
+  if(cursor == NULL) {
+    return 0;
+  }
+  if(skipped) {
+    *skipped = copy.updates - *cursor > 1 ? copy.updates - *cursor - 1 : 0;
+  }
+  if(copy.updates == *cursor) {
+    return 1;
+  }
+  *cursor = copy.updates;
+  return 0;
+}
+
 void* eventThread(void* arg)
 {
   mobot_t* comms = (mobot_t*)arg;
   int addressFound;
+  int i;
+  double angles[4];
+  /* Only the fields of the event's own type are filled in */
+  mobotEvent_t busEvent;
+  busEvent.robot = comms;
+  busEvent.rawSize = 0;
   while(comms->connected) {
     comms->eventqueue->lock();
     while(comms->eventqueue->num() <= 0) {
@@ -2351,16 +6001,18 @@ void* eventThread(void* arg)
     comms->eventqueue->unlock();
     switch(event->event) {
       case EVENT_BUTTON:
-        MUTEX_LOCK(comms->callback_lock);
-        if(comms->callbackEnabled && comms->buttonCallback) {
-          int bit;
-          for(bit = 0; bit < 3; bit++) {
-            if(event->data.button_data.event_mask & (1<<bit)) {
-              comms->buttonCallback(comms->mobot, bit, (event->data.button_data.down_mask & (1<<bit)) ? 1 : 0);
-            }
+        busEvent.type = MOBOT_EVENT_BUTTON;
+        busEvent.millis = event->millis;
+        for(i = 0; i < 3; i++) {
+          if(event->data.button_data.event_mask & (1<<i)) {
+            busEvent.button = i;
+            busEvent.buttonDown = (event->data.button_data.down_mask & (1<<i)) ? 1 : 0;
+            Mobot_publishEvent(&busEvent);
+            angles[0] = busEvent.button;
+            angles[1] = busEvent.buttonDown;
+            Mobot_shmWrite(comms, MOBOT_SHM_BUTTON, event->millis, angles, 2);
           }
         }
-        MUTEX_UNLOCK(comms->callback_lock);
         break;
       case EVENT_REPORTADDRESS:
         /* Check the list to see if the reported address aready exists */
@@ -2406,29 +6058,28 @@ void* eventThread(void* arg)
             comms->serialID, event->data.debug_data);
         break;
       case EVENT_JOINT_MOVED:
-        MUTEX_LOCK(comms->callback_lock);
-        if(comms->jointCallback) {
-          comms->jointCallback(
-              event->millis,
-              event->data.joint_data[0],
-              event->data.joint_data[1],
-              event->data.joint_data[2],
-              event->data.joint_data[3],
-              comms->jointCallbackData);
+        for(i = 0; i < 4; i++) {
+          angles[i] = DEG2RAD(event->data.joint_data[i]);
+        }
+        Mobot_jointCacheStore(comms, event->millis, angles, 1, 0);
+        Mobot_channelWrite(&comms->jointChannel, event->millis, angles, 4);
+        Mobot_shmWrite(comms, MOBOT_SHM_JOINT, event->millis, angles, 4);
+        busEvent.type = MOBOT_EVENT_JOINT;
+        busEvent.millis = event->millis;
+        for(i = 0; i < 4; i++) {
+          busEvent.joints[i] = angles[i];
         }
-        MUTEX_UNLOCK(comms->callback_lock);
+        Mobot_publishEvent(&busEvent);
         break;
       case EVENT_ACCEL_CHANGED:
-        MUTEX_LOCK(comms->callback_lock);
-        if(comms->accelCallback) {
-          comms->accelCallback(
-              event->millis,
-              event->data.accel_data[0]/16384.0,
-              event->data.accel_data[1]/16384.0,
-              event->data.accel_data[2]/16384.0,
-              comms->accelCallbackData);
+        busEvent.type = MOBOT_EVENT_ACCEL;
+        busEvent.millis = event->millis;
+        for(i = 0; i < 3; i++) {
+          busEvent.accel[i] = event->data.accel_data[i]/16384.0;
         }
-        MUTEX_UNLOCK(comms->callback_lock);
+        Mobot_channelWrite(&comms->accelChannel, event->millis, busEvent.accel, 3);
+        Mobot_shmWrite(comms, MOBOT_SHM_ACCEL, event->millis, busEvent.accel, 3);
+        Mobot_publishEvent(&busEvent);
         break;
     }
     //delete event;
@@ -2436,6 +6087,30 @@ void* eventThread(void* arg)
   return NULL;
 }
 
+/* Hand a response to whoever is waiting on target. If the waiter registered
+ * its own buffer, the response is copied there once and the waiter does not
+ * copy it again. During a burst each response goes to the next slot, and only
+ * the last one wakes the waiter. Called with target's recvBuf_lock held. */
+static void Mobot_deliverResponse (mobot_t *target, const uint8_t *msg, size_t len) {
+  uint8_t *dest;
+  if (target->burstCount > 0) {
+    dest = target->burstDest + target->burstReceived * target->burstStride;
+    memmove(dest, msg, len < (size_t)target->burstStride ? len : target->burstStride);
+    if (++target->burstReceived < target->burstCount) {
+      return;
+    }
+    target->burstCount = 0;
+  } else {
+    dest = target->recvDest != NULL ? target->recvDest : target->recvBuf;
+    memmove(dest, msg, len);
+  }
+  target->recvDest = NULL;
+  target->recvBuf_data = dest;
+  target->recvBuf_ready = 1;
+  target->recvBuf_bytes = dest[1];
+  COND_BROADCAST(target->recvBuf_cond);
+}
+
 /* Formerly part of commsEngine */
 static void Mobot_processMessage (mobot_t *comms, uint8_t *buf, size_t len) {
   uint16_t uint16;
@@ -2467,11 +6142,8 @@ static void Mobot_processMessage (mobot_t *comms, uint8_t *buf, size_t len) {
       ) 
     {
       MUTEX_LOCK(comms->recvBuf_lock);
-      memmove(comms->recvBuf, buf, len);
-      comms->recvBuf_ready = 1;
-      comms->recvBuf_bytes = comms->recvBuf[1];
+      Mobot_deliverResponse(comms, buf, len);
       delivered_message = 1;
-      COND_BROADCAST(comms->recvBuf_cond);
       MUTEX_UNLOCK(comms->recvBuf_lock);
     } else {
       /* Check to see if it matches our address */
@@ -2484,20 +6156,14 @@ static void Mobot_processMessage (mobot_t *comms, uint8_t *buf, size_t len) {
         if(comms->commsWaitingForMessage) {
           /* Address of 0 means the connected TTY mobot */
           MUTEX_LOCK(comms->recvBuf_lock);
-          memmove(comms->recvBuf, &buf[5], buf[6]);
-          comms->recvBuf_ready = 1;
-          comms->recvBuf_bytes = comms->recvBuf[1];
+          Mobot_deliverResponse(comms, &buf[5], buf[6]);
           delivered_message = 1;
-          COND_BROADCAST(comms->recvBuf_cond);
           MUTEX_UNLOCK(comms->recvBuf_lock);
         } else if (comms->child != NULL) {
           MUTEX_LOCK(comms->child->recvBuf_lock);
           MUTEX_LOCK(comms->recvBuf_lock);
-          memmove(comms->child->recvBuf, &buf[5], buf[6]);
-          comms->child->recvBuf_ready = 1;
-          comms->child->recvBuf_bytes = comms->child->recvBuf[1];
+          Mobot_deliverResponse(comms->child, &buf[5], buf[6]);
           delivered_message = 1;
-          COND_BROADCAST(comms->child->recvBuf_cond);
           MUTEX_UNLOCK(comms->child->recvBuf_lock);
           MUTEX_UNLOCK(comms->recvBuf_lock);
         }
@@ -2505,11 +6171,8 @@ static void Mobot_processMessage (mobot_t *comms, uint8_t *buf, size_t len) {
       } else if ((comms->child != NULL) && (comms->child->zigbeeAddr == uint16)) {
         MUTEX_LOCK(comms->child->recvBuf_lock);
         MUTEX_LOCK(comms->recvBuf_lock);
-        memmove(comms->child->recvBuf, &buf[5], buf[6]);
-        comms->child->recvBuf_ready = 1;
-        comms->child->recvBuf_bytes = comms->child->recvBuf[1];
+        Mobot_deliverResponse(comms->child, &buf[5], buf[6]);
         delivered_message = 1;
-        COND_BROADCAST(comms->child->recvBuf_cond);
         MUTEX_UNLOCK(comms->child->recvBuf_lock);
         MUTEX_UNLOCK(comms->recvBuf_lock);
       } else { 
@@ -2517,11 +6180,8 @@ static void Mobot_processMessage (mobot_t *comms, uint8_t *buf, size_t len) {
         for(iter = comms->children; iter != NULL; iter = iter->next) {
           if(uint16 == iter->zigbeeAddr) {
             MUTEX_LOCK(iter->mobot->recvBuf_lock);
-            memcpy(((mobot_t*)iter->mobot)->recvBuf, &buf[5], buf[6]);
-            iter->mobot->recvBuf_ready = 1;
-            iter->mobot->recvBuf_bytes = iter->mobot->recvBuf[1];
+            Mobot_deliverResponse((mobot_t*)iter->mobot, &buf[5], buf[6]);
             delivered_message = 1;
-            COND_BROADCAST(iter->mobot->recvBuf_cond);
             MUTEX_UNLOCK(iter->mobot->recvBuf_lock);
             break;
           }
@@ -2629,18 +6289,14 @@ static void Mobot_processMessage (mobot_t *comms, uint8_t *buf, size_t len) {
         comms->eventqueue->push(event);
         comms->eventqueue->signal();
         comms->eventqueue->unlock();
-        if(comms->eventCallback) {
-          comms->eventCallback(&buf[5], buf[6], comms->eventCallbackData);
-        }
+        Mobot_publishRawEvent(comms, &buf[5], buf[6]);
       }
     } else if ((comms->child != NULL) && (comms->child->zigbeeAddr == event->address)) {
       comms->child->eventqueue->lock();
       comms->child->eventqueue->push(event);
       comms->child->eventqueue->signal();
       comms->child->eventqueue->unlock();
-      if(comms->child->eventCallback) {
-        comms->child->eventCallback(&buf[5], buf[6], comms->child->eventCallbackData);
-      }
+      Mobot_publishRawEvent(comms->child, &buf[5], buf[6]);
     } else {
       /* See if it is one of the connected children */
       bool success = false;
@@ -2650,9 +6306,7 @@ static void Mobot_processMessage (mobot_t *comms, uint8_t *buf, size_t len) {
           iter->mobot->eventqueue->push(event);
           iter->mobot->eventqueue->signal();
           iter->mobot->eventqueue->unlock();
-          if(iter->mobot->eventCallback) {
-            iter->mobot->eventCallback(&buf[5], buf[6], iter->mobot->eventCallbackData);
-          }
+          Mobot_publishRawEvent((mobot_t*)iter->mobot, &buf[5], buf[6]);
           success = true;
           break;
         }
@@ -61,6 +61,7 @@
 #endif
 
 #include "commands.h"
+#include "codec.h"
 
 #include "rgbhashtable.h"
 
@@ -128,72 +129,56 @@ int Mobot_getQueriedAddresses(mobot_t* comms)
 
 int Mobot_getID(mobot_t* comms)
 {
-  int status;
-  uint8_t buf[8];
-  int addr;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETSERIALID), buf, 0);
-  if(status < 0) return status;
-  /* Make sure the buf size is correct */
-  if(buf[1] != 7) {
-    return -1;
+  if(comms->propertiesKnown & MOBOT_PROP_SERIALID) {
+    return 0;
   }
-  memcpy(comms->serialID, &buf[2], 4);
-  return 0;
+  return getSerialID(comms);
 }
 
 int Mobot_getAccelerometerData(mobot_t* comms, double *accel_x, double *accel_y, double *accel_z)
 {
   uint8_t buf[32];
-  float f;
+  const uint8_t* p;
   int status;
-  int16_t i;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETACCEL), buf, 0);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETACCEL), buf, CODEC_REQ(CMD_GETACCEL));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 0x09) {
+  if((p = CODEC_VIEW(buf, CMD_GETACCEL)) == NULL) {
     return -1;
   }
-  /* Copy the data */
-  memcpy(&i, &buf[2], 2);
-  *accel_x = (double)i/16384.0;
-  memcpy(&i, &buf[4], 2);
-  *accel_y = (double)i/16384.0;
-  memcpy(&i, &buf[6], 2);
-  *accel_z = (double)i/16384.0;
+  *accel_x = (double)codecGetI16LE(&p[0])/16384.0;
+  *accel_y = (double)codecGetI16LE(&p[2])/16384.0;
+  *accel_z = (double)codecGetI16LE(&p[4])/16384.0;
   return 0;
 }
 
 int Mobot_getBatteryVoltage(mobot_t* comms, double *voltage)
 {
   uint8_t buf[32];
-  float f;
+  const uint8_t* p;
   int status;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETBATTERYVOLTAGE), buf, 0);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETBATTERYVOLTAGE), buf, CODEC_REQ(CMD_GETBATTERYVOLTAGE));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 7) {
+  if((p = CODEC_VIEW(buf, CMD_GETBATTERYVOLTAGE)) == NULL) {
     return -1;
   }
-  /* Copy the data */
-  memcpy(&f, &buf[2], 4);
-  *voltage = f;
+  *voltage = codecGetFloat(p);
   return 0;
 }
 
 int Mobot_getButtonVoltage(mobot_t* comms, double *voltage)
 {
   uint8_t buf[32];
-  float f;
+  const uint8_t* p;
   int status;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETBUTTONVOLTAGE), buf, 0);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETBUTTONVOLTAGE), buf, CODEC_REQ(CMD_GETBUTTONVOLTAGE));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 7) {
+  if((p = CODEC_VIEW(buf, CMD_GETBUTTONVOLTAGE)) == NULL) {
     return -1;
   }
-  /* Copy the data */
-  memcpy(&f, &buf[2], 4);
-  *voltage = f;
+  *voltage = codecGetFloat(p);
   return 0;
 }
 
@@ -258,18 +243,16 @@ int Mobot_getDistance(mobot_t* comms, double *distance, double radius)
 int Mobot_getEncoderVoltage(mobot_t* comms, int pinNumber, double *voltage)
 {
   uint8_t buf[32];
-  float f;
+  const uint8_t* p;
   int status;
   buf[0] = pinNumber;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETENCODERVOLTAGE), buf, 1);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETENCODERVOLTAGE), buf, CODEC_REQ(CMD_GETENCODERVOLTAGE));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 7) {
+  if((p = CODEC_VIEW(buf, CMD_GETENCODERVOLTAGE)) == NULL) {
     return -1;
   }
-  /* Copy the data */
-  memcpy(&f, &buf[2], 4);
-  *voltage = f;
+  *voltage = codecGetFloat(p);
   return 0;
 }
 
@@ -282,77 +265,232 @@ int Mobot_getFormFactor(mobot_t* comms, int* form)
 int Mobot_getHWRev(mobot_t* comms, int* rev)
 {
   uint8_t buf[20];
+  const uint8_t* p;
   int status;
-  if(status = MobotMsgTransaction(comms, BTCMD(CMD_GETHWREV), buf, 0)) {
+  if(comms->propertiesKnown & MOBOT_PROP_HWREV) {
+    *rev = comms->hwRev;
+    return 0;
+  }
+  if(status = MobotMsgTransaction(comms, BTCMD(CMD_GETHWREV), buf, CODEC_REQ(CMD_GETHWREV))) {
     return status;
   }
-  if(buf[0] != RESP_OK) {
+  if((p = CODEC_VIEW_MIN(buf, CMD_GETHWREV)) == NULL) {
     return -1;
   }
-  *rev = buf[2];
+  *rev = p[0];
+  comms->hwRev = *rev;
+  comms->propertiesKnown |= MOBOT_PROP_HWREV;
+  Mobot_propertiesStore(comms);
   return 0;
 }
 
 int Mobot_getJointAngle(mobot_t* comms, robotJointId_t id, double *angle)
 {
   uint8_t buf[32];
-  float f;
+  const uint8_t* p;
   int status;
+  double angles[4];
+  if(id < ROBOT_JOINT1 || id > ROBOT_JOINT4) {
+    return -1;
+  }
+  if(!Mobot_jointCacheLookup(comms, comms->jointCacheMaxAge, NULL, angles)) {
+    *angle = angles[id-1];
+    return 0;
+  }
   buf[0] = (uint8_t)id-1;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORANGLEABS), buf, 1);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORANGLEABS), buf, CODEC_REQ(CMD_GETMOTORANGLEABS));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 7) {
+  if((p = CODEC_VIEW(buf, CMD_GETMOTORANGLEABS)) == NULL) {
     return -1;
   }
-  /* Copy the data */
-  memcpy(&f, &buf[2], 4);
-  *angle = f;
+  *angle = codecGetFloat(p);
   return 0;
 }
 
 int Mobot_getJointAngleAverage(mobot_t* comms, robotJointId_t id, double *angle, int numReadings)
 {
-  int i;
-  double d;
-  *angle = 0;
-  for(i = 0; i < numReadings; i++) {
-    if(Mobot_getJointAngle(comms, id, &d)) {
-      return -1;
+  return Mobot_getJointAngleBurst(comms, id, numReadings, MOBOT_FILTER_MEAN, 0, angle, NULL);
+}
+
+/* Room for any response a burst reads */
+#define BURST_STRIDE 32
+
+static int burstCompare(const void* a, const void* b)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Combine the n readings in x, in the order they were taken, into one
+ * estimate. Sorts x. */
+double Mobot_burstFilter(double* x, int n, mobotFilter_t filter, double param)
+{
+  double sum = 0;
+  int i, k;
+  switch(filter) {
+    case MOBOT_FILTER_EXPONENTIAL:
+      if(param <= 0 || param > 1) {
+        param = 1;
+      }
+      sum = x[0];
+      for(i = 1; i < n; i++) {
+        sum = param * x[i] + (1 - param) * sum;
+      }
+      return sum;
+    case MOBOT_FILTER_MEDIAN:
+      qsort(x, n, sizeof(double), burstCompare);
+      return n % 2 ? x[n/2] : (x[n/2 - 1] + x[n/2]) / 2;
+    case MOBOT_FILTER_TRIMMED_MEAN:
+      qsort(x, n, sizeof(double), burstCompare);
+      k = param > 0 ? (int)(n * param) : 0;
+      if(n - 2*k < 1) {
+        k = (n - 1) / 2;
+      }
+      for(i = k; i < n - k; i++) {
+        sum += x[i];
+      }
+      return sum / (n - 2*k);
+    case MOBOT_FILTER_MEAN:
+    default:
+      for(i = 0; i < n; i++) {
+        sum += x[i];
+      }
+      return sum / n;
+  }
+}
+
+/* Read numReadings responses to cmd, in bursts of at most
+ * BURST_MAX_READINGS. From each well-formed response of length respLen, the
+ * nvalues floats starting at payload offset offset are appended to samples.
+ * Returns the number of good readings, or -1 if out of memory. */
+static int burstCollect(mobot_t* comms, uint8_t cmd, const uint8_t* req, int reqsize,
+    int respLen, int offset, int nvalues, int numReadings, double* samples)
+{
+  uint8_t* bufs = (uint8_t*)malloc(BURST_STRIDE * BURST_MAX_READINGS);
+  const uint8_t* p;
+  double angles[4];
+  unsigned int gen;
+  int good = 0;
+  int count;
+  int i, j;
+  if(bufs == NULL) {
+    return -1;
+  }
+  while(numReadings > 0) {
+    count = numReadings < BURST_MAX_READINGS ? numReadings : BURST_MAX_READINGS;
+    numReadings -= count;
+    gen = Mobot_jointCacheGeneration(comms);
+    /* A burst that timed out may still have collected some readings */
+    if(MobotMsgTransactionBurst(comms, BTCMD(cmd), req, reqsize, bufs, BURST_STRIDE, count) == -1) {
+      continue;
     }
-    *angle += d;
+    for(i = 0; i < count; i++) {
+      if((p = codecView(&bufs[i*BURST_STRIDE], respLen)) == NULL) {
+        continue;
+      }
+      for(j = 0; j < nvalues; j++) {
+        samples[good*nvalues + j] = codecGetFloat(&p[offset + j*4]);
+      }
+      good++;
+      if(cmd == CMD_GETMOTORANGLESTIMESTAMPABS) {
+        for(j = 0; j < 4; j++) {
+          angles[j] = samples[(good-1)*nvalues + j];
+        }
+        Mobot_jointCacheStore(comms, codecGetU32LE(p), angles, 0, gen);
+      }
+    }
+  }
+  free(bufs);
+  return good;
+}
+
+/* Filter each of the nvalues columns of the n readings in samples. Returns
+ * -1 if out of memory. */
+static int burstEstimate(const double* samples, int n, int nvalues,
+    mobotFilter_t filter, double param, double* estimates, double* variances)
+{
+  double* x = (double*)malloc(sizeof(double) * n);
+  double mean, var;
+  int i, j;
+  if(x == NULL) {
+    return -1;
   }
-  *angle = *angle / numReadings;
+  for(j = 0; j < nvalues; j++) {
+    mean = 0;
+    for(i = 0; i < n; i++) {
+      x[i] = samples[i*nvalues + j];
+      mean += x[i];
+    }
+    mean /= n;
+    var = 0;
+    for(i = 0; i < n; i++) {
+      var += (x[i] - mean) * (x[i] - mean);
+    }
+    if(variances) {
+      variances[j] = n > 1 ? var / (n - 1) : 0;
+    }
+    estimates[j] = Mobot_burstFilter(x, n, filter, param);
+  }
+  free(x);
   return 0;
 }
 
+int Mobot_getJointAngleBurst(mobot_t* comms, robotJointId_t id, int numReadings,
+    mobotFilter_t filter, double param, double *angle, double *variance)
+{
+  uint8_t req[CODEC_REQ(CMD_GETMOTORANGLEABS)];
+  double* samples;
+  int n;
+  if(numReadings <= 0 || id < ROBOT_JOINT1 || id > ROBOT_JOINT4) {
+    return -1;
+  }
+  req[0] = (uint8_t)id-1;
+  samples = (double*)malloc(sizeof(double) * numReadings);
+  if(samples == NULL) {
+    return -1;
+  }
+  n = burstCollect(comms, CMD_GETMOTORANGLEABS, req, CODEC_REQ(CMD_GETMOTORANGLEABS),
+      CODEC_RESP_LEN(CMD_GETMOTORANGLEABS), 0, 1, numReadings, samples);
+  if(n > 0 && burstEstimate(samples, n, 1, filter, param, angle, variance)) {
+    n = -1;
+  }
+  free(samples);
+  return n > 0 ? 0 : -1;
+}
+
+int Mobot_getJointAnglesBurst(mobot_t* comms, int numReadings,
+    mobotFilter_t filter, double param, double angles[4], double variances[4])
+{
+  double* samples;
+  int n;
+  if(numReadings <= 0) {
+    return -1;
+  }
+  samples = (double*)malloc(sizeof(double) * 4 * numReadings);
+  if(samples == NULL) {
+    return -1;
+  }
+  n = burstCollect(comms, CMD_GETMOTORANGLESTIMESTAMPABS, NULL,
+      CODEC_REQ(CMD_GETMOTORANGLESTIMESTAMPABS), CODEC_RESP_LEN(CMD_GETMOTORANGLESTIMESTAMPABS),
+      4, 4, numReadings, samples);
+  if(n > 0 && burstEstimate(samples, n, 4, filter, param, angles, variances)) {
+    n = -1;
+  }
+  free(samples);
+  return n > 0 ? 0 : -1;
+}
+
 int Mobot_getJointAngles(mobot_t* comms, 
                              double *angle1,
                              double *angle2,
                              double *angle3,
                              double *angle4)
 {
-  uint8_t buf[32];
-  float f;
-  uint32_t millis;
-  int status;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORANGLESTIMESTAMPABS), buf, 0);
-  if(status < 0) return status;
-  /* Make sure the data size is correct */
-  if(buf[1] != 0x17) {
-    return -1;
-  }
-  /* Copy the data */
-  /* Copy 4 joint angles */
-  memcpy(&f, &buf[6], 4);
-  *angle1 = f;
-  memcpy(&f, &buf[10], 4);
-  *angle2 = f;
-  memcpy(&f, &buf[14], 4);
-  *angle3 = f;
-  memcpy(&f, &buf[18], 4);
-  *angle4 = f;
-  return 0;
+  double time;
+  return Mobot_getJointAnglesCached(comms, comms->jointCacheMaxAge, &time,
+      angle1, angle2, angle3, angle4);
 }
 
 int Mobot_getJointAnglesAverage(mobot_t* comms, 
@@ -362,27 +500,16 @@ int Mobot_getJointAnglesAverage(mobot_t* comms,
                              double *angle4,
                              int numReadings)
 {
-  double d[4] = {0, 0, 0, 0};
-  int i;
-  *angle1 = 0;
-  *angle2 = 0;
-  *angle3 = 0;
-  *angle4 = 0;
-  for(i = 0; i < numReadings; i++) {
-    Mobot_getJointAngles(comms, 
-        &d[0],
-        &d[1],
-        &d[2],
-        &d[3]);
-    *angle1 += d[0];
-    *angle2 += d[1];
-    *angle3 += d[2];
-    *angle4 += d[3];
-  }
-  *angle1 = *angle1 / numReadings;
-  *angle2 = *angle2 / numReadings;
-  *angle3 = *angle3 / numReadings;
-  *angle4 = *angle4 / numReadings;
+  double angles[4];
+  int rc;
+  rc = Mobot_getJointAnglesBurst(comms, numReadings, MOBOT_FILTER_MEAN, 0, angles, NULL);
+  if(rc) {
+    return rc;
+  }
+  *angle1 = angles[0];
+  *angle2 = angles[1];
+  *angle3 = angles[2];
+  *angle4 = angles[3];
   return 0;
 }
 
@@ -392,29 +519,47 @@ int Mobot_getJointAnglesTime(mobot_t* comms,
                              double *angle2,
                              double *angle3,
                              double *angle4)
+{
+  return Mobot_getJointAnglesCached(comms, comms->jointCacheMaxAge, time,
+      angle1, angle2, angle3, angle4);
+}
+
+int Mobot_getJointAnglesCached(mobot_t* comms, 
+                             int maxAge,
+                             double *time, 
+                             double *angle1,
+                             double *angle2,
+                             double *angle3,
+                             double *angle4)
 {
   uint8_t buf[32];
-  float f;
+  const uint8_t* p;
   uint32_t millis;
+  unsigned int gen;
   int status;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORANGLESTIMESTAMPABS), buf, 0);
-  if(status < 0) return status;
-  /* Make sure the data size is correct */
-  if(buf[1] != 0x17) {
-    return -1;
+  int i;
+  double angles[4];
+  if(Mobot_jointCacheLookup(comms, maxAge, time, angles)) {
+    /* A motion command sent while we wait makes this answer stale */
+    gen = Mobot_jointCacheGeneration(comms);
+    status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORANGLESTIMESTAMPABS), buf,
+        CODEC_REQ(CMD_GETMOTORANGLESTIMESTAMPABS));
+    if(status < 0) return status;
+    /* Make sure the data size is correct */
+    if((p = CODEC_VIEW(buf, CMD_GETMOTORANGLESTIMESTAMPABS)) == NULL) {
+      return -1;
+    }
+    millis = codecGetU32LE(&p[0]);
+    *time = millis / 1000.0;
+    for(i = 0; i < 4; i++) {
+      angles[i] = codecGetFloat(&p[4 + i*4]);
+    }
+    Mobot_jointCacheStore(comms, millis, angles, 0, gen);
   }
-  /* Copy the data */
-  memcpy(&millis, &buf[2], 4);
-  *time = millis / 1000.0;
-  /* Copy 4 joint angles */
-  memcpy(&f, &buf[6], 4);
-  *angle1 = f;
-  memcpy(&f, &buf[10], 4);
-  *angle2 = f;
-  memcpy(&f, &buf[14], 4);
-  *angle3 = f;
-  memcpy(&f, &buf[18], 4);
-  *angle4 = f;
+  *angle1 = angles[0];
+  *angle2 = angles[1];
+  *angle3 = angles[2];
+  *angle4 = angles[3];
   return 0;
 }
 
@@ -429,8 +574,8 @@ int Mobot_getJointAnglesTimeState(mobot_t* comms,
                              robotJointState_t* state3,
                              robotJointState_t* state4)
 {
-  uint32_t millis;
   uint8_t buf[64];
+  const uint8_t* p;
   int status;
   int i;
   float angles[4];
@@ -439,20 +584,16 @@ int Mobot_getJointAnglesTimeState(mobot_t* comms,
   states[1] = state2;
   states[2] = state3;
   states[3] = state4;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETBIGSTATE), buf, 0);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETBIGSTATE), buf, CODEC_REQ(CMD_GETBIGSTATE));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 27) {
+  if((p = CODEC_VIEW(buf, CMD_GETBIGSTATE)) == NULL) {
     return -1;
   }
-  /* Copy the timestamp */
-  memcpy(&millis, &buf[2], 4);
-  *time = millis/1000.0;
+  *time = codecGetU32LE(&p[0])/1000.0;
   for(i = 0; i < 4; i++) {
-    /* Copy the motor angles */
-    memcpy(&angles[i], &buf[6 + i*4], 4);
-    /* Copy the motor states */
-    *states[i] = (robotJointState_t)buf[22+i];
+    angles[i] = codecGetFloat(&p[4 + i*4]);
+    *states[i] = (robotJointState_t)p[20+i];
   }
   *angle1 = angles[0];
   *angle2 = angles[1];
@@ -511,18 +652,193 @@ int Mobot_getJointAnglesTimeIsMoving(mobot_t* comms,
   return 0;
 }
 
+mobotGroupSnapshot_t* Mobot_groupSnapshotNew(int numRobots)
+{
+  mobotGroupSnapshot_t* snap;
+  char* p;
+  if(numRobots <= 0) {
+    return NULL;
+  }
+  /* The doubles go first so that every array is suitably aligned */
+  snap = (mobotGroupSnapshot_t*)malloc(sizeof(mobotGroupSnapshot_t) +
+      numRobots * (sizeof(double)*6 + sizeof(robotJointState_t)*4 + sizeof(int)*2));
+  if(snap == NULL) {
+    return NULL;
+  }
+  p = (char*)(snap + 1);
+  snap->numRobots = numRobots;
+  snap->time = (double*)p;
+  p += sizeof(double)*numRobots;
+  snap->angles = (double*)p;
+  p += sizeof(double)*4*numRobots;
+  snap->battery = (double*)p;
+  p += sizeof(double)*numRobots;
+  snap->states = (robotJointState_t*)p;
+  p += sizeof(robotJointState_t)*4*numRobots;
+  snap->status = (int*)p;
+  p += sizeof(int)*numRobots;
+  snap->moving = (int*)p;
+  return snap;
+}
+
+int Mobot_groupSnapshotFree(mobotGroupSnapshot_t* snap)
+{
+  free(snap);
+  return 0;
+}
+
+typedef struct groupSnapshotArg_s
+{
+  mobot_t* comms;
+  mobotGroupSnapshot_t* snap;
+  int index;
+  int fields;
+  double deadline;
+} groupSnapshotArg_t;
+
+/* Read one robot's part of a snapshot. The requests are sent as deadline
+ * transactions, so this never runs past the group's deadline by more than
+ * one exchange. */
+static void* groupSnapshotThread(void* arg)
+{
+  groupSnapshotArg_t* a = (groupSnapshotArg_t*)arg;
+  mobot_t* comms = a->comms;
+  mobotGroupSnapshot_t* snap = a->snap;
+  int n = a->index;
+  double* angles = &snap->angles[4*n];
+  robotJointState_t* states = &snap->states[4*n];
+  uint8_t buf[64];
+  const uint8_t* p;
+  double remaining;
+  int status = 0;
+  int i;
+  if(a->fields & MOBOT_SNAPSHOT_JOINTS) {
+    remaining = a->deadline - Mobot_monotonicMsecs();
+    if(remaining <= 0) {
+      status = -2;
+    } else {
+      status = MobotMsgTransactionDeadline(comms, BTCMD(CMD_GETBIGSTATE), buf,
+          CODEC_REQ(CMD_GETBIGSTATE), (int)remaining);
+    }
+    /* Make sure the data size is correct */
+    if(status == 0 && (p = CODEC_VIEW(buf, CMD_GETBIGSTATE)) == NULL) {
+      status = -1;
+    }
+    if(status == 0) {
+      snap->time[n] = codecGetU32LE(&p[0])/1000.0;
+      snap->moving[n] = 0;
+      for(i = 0; i < 4; i++) {
+        angles[i] = codecGetFloat(&p[4 + i*4]);
+        states[i] = (robotJointState_t)p[20+i];
+      }
+      if(comms->formFactor == MOBOTFORM_I) {
+        if(states[2] == ROBOT_FORWARD) {
+          states[2] = ROBOT_BACKWARD;
+        } else if(states[2] == ROBOT_BACKWARD) {
+          states[2] = ROBOT_FORWARD;
+        }
+        angles[1] = 0;
+        states[1] = ROBOT_NEUTRAL;
+        angles[3] = 0;
+        states[3] = ROBOT_NEUTRAL;
+      } else if(comms->formFactor == MOBOTFORM_L) {
+        angles[2] = 0;
+        states[2] = ROBOT_NEUTRAL;
+        angles[3] = 0;
+        states[3] = ROBOT_NEUTRAL;
+      }
+      for(i = 0; i < 4; i++) {
+        if(states[i] == ROBOT_FORWARD ||
+            states[i] == ROBOT_BACKWARD ||
+            states[i] == ROBOT_ACCEL)
+        {
+          snap->moving[n] = 1;
+        }
+      }
+    }
+  }
+  if(status == 0 && (a->fields & MOBOT_SNAPSHOT_BATTERY)) {
+    remaining = a->deadline - Mobot_monotonicMsecs();
+    if(remaining <= 0) {
+      status = -2;
+    } else {
+      status = MobotMsgTransactionDeadline(comms, BTCMD(CMD_GETBATTERYVOLTAGE), buf,
+          CODEC_REQ(CMD_GETBATTERYVOLTAGE), (int)remaining);
+    }
+    /* Make sure the data size is correct */
+    if(status == 0 && (p = CODEC_VIEW(buf, CMD_GETBATTERYVOLTAGE)) == NULL) {
+      status = -1;
+    }
+    if(status == 0) {
+      snap->battery[n] = codecGetFloat(p);
+    }
+  }
+  snap->status[n] = status;
+  return NULL;
+}
+
+int Mobot_groupSnapshot(mobot_t** comms, int numRobots, int fields, int msecs,
+    mobotGroupSnapshot_t* snap)
+{
+  int i;
+  int rc = 0;
+  double deadline = Mobot_monotonicMsecs() + msecs;
+  groupSnapshotArg_t* args;
+  mobotTask_t** tasks;
+  if(snap == NULL || numRobots > snap->numRobots) {
+    return -1;
+  }
+  if(numRobots <= 0) {
+    return 0;
+  }
+  args = (groupSnapshotArg_t*)malloc(sizeof(groupSnapshotArg_t)*numRobots);
+  tasks = (mobotTask_t**)malloc(sizeof(mobotTask_t*)*numRobots);
+  if(args == NULL || tasks == NULL) {
+    free(args);
+    free(tasks);
+    return -1;
+  }
+  /* Fan out: each robot's queries run on its own query queue, so they all
+   * go out together, and robots behind the same dongle share its
+   * transaction window. */
+  for(i = 0; i < numRobots; i++) {
+    args[i].comms = comms[i];
+    args[i].snap = snap;
+    args[i].index = i;
+    args[i].fields = fields;
+    args[i].deadline = deadline;
+    tasks[i] = Mobot_taskSubmit(comms[i]->queryQueue, groupSnapshotThread, &args[i]);
+  }
+  /* Fan in. A robot whose query could not be queued, such as one that is
+   * not connected, has no task to wait for. */
+  for(i = 0; i < numRobots; i++) {
+    if(tasks[i] == NULL) {
+      snap->status[i] = -1;
+    } else {
+      Mobot_taskJoin(tasks[i], NULL);
+    }
+    if(snap->status[i]) {
+      rc = -1;
+    }
+  }
+  free(tasks);
+  free(args);
+  return rc;
+}
+
 int Mobot_getJointDirection(mobot_t* comms, robotJointId_t id, robotJointState_t *dir)
 {
   uint8_t buf[32];
+  const uint8_t* p;
   int status;
   buf[0] = (uint8_t)id-1;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORDIR), buf, 1);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORDIR), buf, CODEC_REQ(CMD_GETMOTORDIR));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 0x04) {
+  if((p = CODEC_VIEW(buf, CMD_GETMOTORDIR)) == NULL) {
     return -1;
   }
-  *dir = (robotJointState_t)buf[2];
+  *dir = (robotJointState_t)p[0];
   if(
       (comms->formFactor == MOBOTFORM_I) &&
       (id == ROBOT_JOINT3)
@@ -539,69 +855,63 @@ int Mobot_getJointDirection(mobot_t* comms, robotJointId_t id, robotJointState_t
 
 int Mobot_getJointMaxSpeed(mobot_t* comms, robotJointId_t id, double *maxSpeed)
 {
-  float f;
   uint8_t buf[64];
+  const uint8_t* p;
   int status;
-  int bytes_read;
   buf[0] = (uint8_t) id-1;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORMAXSPEED), &buf[0], 1);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORMAXSPEED), buf, CODEC_REQ(CMD_GETMOTORMAXSPEED));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 7) {
+  if((p = CODEC_VIEW(buf, CMD_GETMOTORMAXSPEED)) == NULL) {
     return -1;
   }
-  /* Copy the data */
-  memcpy(&f, &buf[2], 4);
-  *maxSpeed = f;
+  *maxSpeed = codecGetFloat(p);
   return 0;
 }
 
 int Mobot_getJointSafetyAngle(mobot_t* comms, double *angle) 
 {
   uint8_t buf[32];
-  float f;
+  const uint8_t* p;
   int status;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORSAFETYLIMIT), buf, 0);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORSAFETYLIMIT), buf, CODEC_REQ(CMD_GETMOTORSAFETYLIMIT));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 0x07) {
+  if((p = CODEC_VIEW(buf, CMD_GETMOTORSAFETYLIMIT)) == NULL) {
     return -1;
   }
-  memcpy(&f, &buf[2], 4);
-  *angle = f;
+  *angle = codecGetFloat(p);
   return 0;
 }
 
 int Mobot_getJointSafetyAngleTimeout(mobot_t* comms, double *seconds) 
 {
   uint8_t buf[32];
-  float f;
+  const uint8_t* p;
   int status;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORSAFETYTIMEOUT), buf, 0);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORSAFETYTIMEOUT), buf, CODEC_REQ(CMD_GETMOTORSAFETYTIMEOUT));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 0x07) {
+  if((p = CODEC_VIEW(buf, CMD_GETMOTORSAFETYTIMEOUT)) == NULL) {
     return -1;
   }
-  memcpy(&f, &buf[2], 4);
-  *seconds = f;
+  *seconds = codecGetFloat(p);
   return 0;
 }
 
 int Mobot_getJointSpeed(mobot_t* comms, robotJointId_t id, double *speed)
 {
   uint8_t buf[32];
-  float f;
+  const uint8_t* p;
   int status;
   buf[0] = (uint8_t)id-1;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORSPEED), buf, 1);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORSPEED), buf, CODEC_REQ(CMD_GETMOTORSPEED));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 0x07) {
+  if((p = CODEC_VIEW(buf, CMD_GETMOTORSPEED)) == NULL) {
     return -1;
   }
-  memcpy(&f, &buf[2], 4);
-  *speed = ABS(f);
+  *speed = ABS(codecGetFloat(p));
   comms->jointSpeeds[id-1] = *speed;
   return 0;
 }
@@ -631,16 +941,17 @@ int Mobot_getJointSpeedRatios(mobot_t* comms, double *ratio1, double *ratio2, do
 int Mobot_getJointState(mobot_t* comms, robotJointId_t id, robotJointState_t *state)
 {
   uint8_t buf[32];
+  const uint8_t* p;
   int status;
   buf[0] = (uint8_t)id-1;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORSTATE), buf, 1);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETMOTORSTATE), buf, CODEC_REQ(CMD_GETMOTORSTATE));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 0x04) {
+  if((p = CODEC_VIEW(buf, CMD_GETMOTORSTATE)) == NULL) {
     *state = ROBOT_NEUTRAL;
     return -1;
   }
-  *state = (robotJointState_t)buf[2];
+  *state = (robotJointState_t)p[0];
   if(
       (comms->formFactor == MOBOTFORM_I) &&
       (id == ROBOT_JOINT3)
@@ -672,14 +983,14 @@ int Mobot_getJointSpeeds(mobot_t* comms, double *speed1, double *speed2, double
 int Mobot_getMasterAddress(mobot_t* comms, uint16_t* addr)
 {
   uint8_t buf[32];
+  const uint8_t* p;
   int status;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GET_MASTER_ADDRESS), buf, 0);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GET_MASTER_ADDRESS), buf, CODEC_REQ(CMD_GET_MASTER_ADDRESS));
   if(status < 0) return status;
-  if(buf[0] != RESP_OK) {
+  if((p = CODEC_VIEW_MIN(buf, CMD_GET_MASTER_ADDRESS)) == NULL) {
     return -1;
   }
-  *addr = buf[2]<<8;
-  *addr |= buf[3];
+  *addr = codecGetU16BE(p);
 
   return 0;
 }
@@ -687,103 +998,101 @@ int Mobot_getMasterAddress(mobot_t* comms, uint16_t* addr)
 int Mobot_getNumSlaves(mobot_t* comms, int* num)
 {
   uint8_t buf[32];
+  const uint8_t* p;
   int status;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GET_NUM_SLAVES), buf, 0);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GET_NUM_SLAVES), buf, CODEC_REQ(CMD_GET_NUM_SLAVES));
   if(status < 0) return status;
-  if(buf[0] != RESP_OK) {
+  if((p = CODEC_VIEW_MIN(buf, CMD_GET_NUM_SLAVES)) == NULL) {
     return -1;
   }
-  *num = buf[2];
+  *num = p[0];
   return 0;
 }
 
 int Mobot_getSlaveAddr(mobot_t* comms, uint8_t index, uint16_t* addr)
 {
   uint8_t buf[32];
+  const uint8_t* p;
   int status;
   buf[0] = index;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GET_SLAVE_ADDR), buf, 1);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GET_SLAVE_ADDR), buf, CODEC_REQ(CMD_GET_SLAVE_ADDR));
   if(status < 0) return status;
-  if(buf[0] != RESP_OK) {
+  if((p = CODEC_VIEW_MIN(buf, CMD_GET_SLAVE_ADDR)) == NULL) {
     return -1;
   }
-  *addr = buf[2]<<8;
-  *addr |= buf[3];
+  *addr = codecGetU16BE(p);
   return 0;
 }
 
 int Mobot_getNumPoses(mobot_t* comms, int* num)
 {
   uint8_t buf[32];
+  const uint8_t* p;
   int status;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GET_NUM_POSES), buf, 0);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GET_NUM_POSES), buf, CODEC_REQ(CMD_GET_NUM_POSES));
   if(status < 0) return status;
-  if(buf[0] != RESP_OK) {
+  if((p = CODEC_VIEW_MIN(buf, CMD_GET_NUM_POSES)) == NULL) {
     return -1;
   }
-  *num = buf[2];
+  *num = p[0];
   return 0;
 }
 
 int Mobot_getPoseData(mobot_t* comms, uint8_t index, double *angle1, double *angle2, double *angle3, double *angle4)
 {
   uint8_t buf[32];
+  const uint8_t* p;
   int status;
-  float f[4];
   buf[0] = index;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GET_POSE_DATA), buf, 1);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GET_POSE_DATA), buf, CODEC_REQ(CMD_GET_POSE_DATA));
   if(status < 0) return status;
-  if(buf[0] != RESP_OK) {
+  if((p = CODEC_VIEW_MIN(buf, CMD_GET_POSE_DATA)) == NULL) {
     return -1;
   }
-  memcpy(&f[0], &buf[2], 4);
-  memcpy(&f[1], &buf[6], 4);
-  memcpy(&f[2], &buf[10], 4);
-  memcpy(&f[3], &buf[14], 4);
-  *angle1 = f[0];
-  *angle2 = f[1];
-  *angle3 = f[2];
-  *angle4 = f[3];
+  *angle1 = codecGetFloat(&p[0]);
+  *angle2 = codecGetFloat(&p[4]);
+  *angle3 = codecGetFloat(&p[8]);
+  *angle4 = codecGetFloat(&p[12]);
   return 0;
 }
 
 int Mobot_getColorRGB(mobot_t* comms, int *r, int *g, int *b)
 {
   uint8_t buf[32];
-  float f;
+  const uint8_t* p;
   int status;
 
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETRGB), buf, 0);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETRGB), buf, CODEC_REQ(CMD_GETRGB));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 6) {
+  if((p = CODEC_VIEW(buf, CMD_GETRGB)) == NULL) {
     return -1;
   }
-  *r = buf[2];
-  *g = buf[3];
-  *b = buf[4];
+  *r = p[0];
+  *g = p[1];
+  *b = p[2];
   return 0;
 }
 
 int Mobot_getColor(mobot_t* comms, char color[])
 {
   uint8_t buf[32];
-  float f;
+  const uint8_t* p;
   int status;
   int getRGB[3];
   int retval;
   rgbHashTable * rgbTable = NULL;
 
-  status = MobotMsgTransaction(comms, BTCMD(CMD_GETRGB), buf, 0);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_GETRGB), buf, CODEC_REQ(CMD_GETRGB));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 6){
-	return -1;
+  if((p = CODEC_VIEW(buf, CMD_GETRGB)) == NULL) {
+    return -1;
   }
 
-  getRGB[0] = buf[2];
-  getRGB[1] = buf[3]; 
-  getRGB[2] = buf[4];
+  getRGB[0] = p[0];
+  getRGB[1] = p[1];
+  getRGB[2] = p[2];
 
   rgbTable = HT_Create();
   retval = HT_GetKey(rgbTable, getRGB, color);
@@ -796,13 +1105,10 @@ int Mobot_getStatus(mobot_t* comms)
 {
   uint8_t buf[64];
   int rc;
-  rc = MobotMsgTransaction(comms, BTCMD(CMD_STATUS), buf, 0);
+  rc = MobotMsgTransaction(comms, BTCMD(CMD_STATUS), buf, CODEC_REQ(CMD_STATUS));
   //bInfo(stderr, "(barobo) INFO: %d == MobotMsgTransaction(): %02x %02x %02x\n", rc, buf[0], buf[1], buf[2]);
   if(rc) {return rc;}
-  if(buf[0] != RESP_OK) {
-    return -1;
-  }
-  if(buf[1] != 3 ) {
+  if(CODEC_VIEW(buf, CMD_STATUS) == NULL) {
     return -1;
   }
   if(buf[2] != RESP_END) {
@@ -814,20 +1120,23 @@ int Mobot_getStatus(mobot_t* comms)
 int Mobot_getVersion(mobot_t* comms)
 {
   uint8_t buf[16];
+  const uint8_t* p;
   int version;
   int rc;
-  rc = MobotMsgTransaction(comms, BTCMD(CMD_GETVERSION), buf, 0);
-  if(rc) {return rc;}
-  if(buf[0] != RESP_OK) {
-    return -1;
+  if(comms->propertiesKnown & MOBOT_PROP_VERSION) {
+    return comms->protocolVersion;
   }
-  if(buf[1] != 4 ) {
+  rc = MobotMsgTransaction(comms, BTCMD(CMD_GETVERSION), buf, CODEC_REQ(CMD_GETVERSION));
+  if(rc) {return rc;}
+  if((p = CODEC_VIEW(buf, CMD_GETVERSION)) == NULL) {
     return -1;
   }
-  if(buf[3] != RESP_END) {
+  if(p[1] != RESP_END) {
     return -1;
   }
-  version = buf[2];
+  version = p[0];
+  comms->protocolVersion = version;
+  comms->propertiesKnown |= MOBOT_PROP_VERSION;
   return version;
 }
 
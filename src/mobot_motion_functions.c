@@ -65,6 +65,435 @@
 #define DEPRECATED(from, to) \
   fprintf(stderr, "Warning: The function \"%s()\" is deprecated. Please use \"%s()\"\n" , from, to)
 
+/* How long the joint events may be silent before we ask the robot whether
+ * the joints have stopped. Never less than the connection's retry timeout. */
+#define SEQ_QUIET_MSECS 50
+/* How long a step may take to arrive, by default */
+#define SEQ_DEF_TIMEOUT_MSECS 30000
+
+typedef struct mobotSeqStep_s
+{
+  int mask;
+  double angles[4];
+  int waitMask;
+  /* If positive, this step just waits this many milliseconds */
+  double delay;
+} mobotSeqStep_t;
+
+struct mobotSeq_s
+{
+  mobotSeqStep_t* steps;
+  int numSteps;
+  int numAllocated;
+  double tolerance;
+  double timeout;
+};
+
+mobotSeq_t* Mobot_seqNew()
+{
+  mobotSeq_t* seq = (mobotSeq_t*)malloc(sizeof(mobotSeq_t));
+  seq->steps = NULL;
+  seq->numSteps = 0;
+  seq->numAllocated = 0;
+  seq->tolerance = DEG2RAD(2);
+  seq->timeout = SEQ_DEF_TIMEOUT_MSECS;
+  return seq;
+}
+
+int Mobot_seqFree(mobotSeq_t* seq)
+{
+  free(seq->steps);
+  free(seq);
+  return 0;
+}
+
+static mobotSeqStep_t* Mobot_seqAppend(mobotSeq_t* seq)
+{
+  mobotSeqStep_t* step;
+  if(seq->numSteps >= seq->numAllocated) {
+    seq->numAllocated += 16;
+    seq->steps = (mobotSeqStep_t*)realloc(seq->steps,
+        sizeof(mobotSeqStep_t) * seq->numAllocated);
+  }
+  step = &seq->steps[seq->numSteps++];
+  memset(step, 0, sizeof(mobotSeqStep_t));
+  return step;
+}
+
+int Mobot_seqAddMove(mobotSeq_t* seq, int mask, const double angles[4], int waitMask)
+{
+  int i;
+  mobotSeqStep_t* step;
+  if((mask & ~0x0f) || (waitMask & ~mask)) {
+    return -1;
+  }
+  step = Mobot_seqAppend(seq);
+  step->mask = mask;
+  step->waitMask = waitMask;
+  for(i = 0; i < 4; i++) {
+    step->angles[i] = angles[i];
+  }
+  return 0;
+}
+
+int Mobot_seqAddJointTo(mobotSeq_t* seq, robotJointId_t id, double angle)
+{
+  double angles[4] = {0, 0, 0, 0};
+  if(id < ROBOT_JOINT1 || id > ROBOT_JOINT4) {
+    return -1;
+  }
+  angles[id-1] = angle;
+  return Mobot_seqAddMove(seq, 1<<(id-1), angles, 1<<(id-1));
+}
+
+int Mobot_seqAddDelay(mobotSeq_t* seq, double msecs)
+{
+  Mobot_seqAppend(seq)->delay = msecs;
+  return 0;
+}
+
+int Mobot_seqSetTolerance(mobotSeq_t* seq, double radians)
+{
+  seq->tolerance = radians;
+  return 0;
+}
+
+int Mobot_seqSetTimeout(mobotSeq_t* seq, double msecs)
+{
+  seq->timeout = msecs;
+  return 0;
+}
+
+/* Wait until every joint in the step's waitMask has arrived at its target.
+ * *eventSeq is the last joint event seen before the step was sent. Returns -2
+ * if that takes longer than timeout milliseconds. */
+static int Mobot_seqWaitArrival(mobot_t* comms, const mobotSeqStep_t* step,
+    double tolerance, double timeout, unsigned int* eventSeq)
+{
+  double angles[4];
+  double quiet;
+  double srtt, rttvar, rto;
+  double remaining;
+  double start = Mobot_monotonicMsecs();
+  robotJointState_t state;
+  int arrived;
+  int i;
+  while(1) {
+    remaining = timeout - (Mobot_monotonicMsecs() - start);
+    if(timeout > 0 && remaining <= 0) {
+      return -2;
+    }
+    Mobot_getRoundTripTime(comms, &srtt, &rttvar, &rto);
+    quiet = rto > SEQ_QUIET_MSECS ? rto : SEQ_QUIET_MSECS;
+    if(timeout > 0 && quiet > remaining) {
+      quiet = remaining;
+    }
+    if(!Mobot_jointEventWait(comms, eventSeq, angles, quiet)) {
+      arrived = 1;
+      for(i = 0; i < 4; i++) {
+        if((step->waitMask & (1<<i)) &&
+            ABS(angles[i] - step->angles[i]) > tolerance) {
+          arrived = 0;
+        }
+      }
+      if(arrived) {
+        return 0;
+      }
+      continue;
+    }
+    /* The joints have stopped reporting motion. Either they are there, or
+     * they never had to move, or they are stuck; the robot knows which. */
+    arrived = 1;
+    for(i = 0; i < 4; i++) {
+      if(!(step->waitMask & (1<<i))) {
+        continue;
+      }
+      if(Mobot_getJointState(comms, (robotJointId_t)(i+1), &state)) {
+        return -1;
+      }
+      if((state != ROBOT_NEUTRAL) && (state != ROBOT_HOLD)) {
+        arrived = 0;
+      }
+    }
+    if(arrived) {
+      return 0;
+    }
+  }
+}
+
+int Mobot_seqRun(mobot_t* comms, const mobotSeq_t* seq)
+{
+  int i, j;
+  int rc = 0;
+  unsigned int eventSeq;
+  const mobotSeqStep_t* step;
+  /* Robots without joint events still work; every arrival is then settled
+   * by polling the joint states once per quiet period. */
+  int events = !Mobot_jointEventsAcquire(comms);
+  for(i = 0; i < seq->numSteps && rc == 0; i++) {
+    step = &seq->steps[i];
+    if(step->delay > 0) {
+      Mobot_sleepUntil(Mobot_monotonicMsecs() + step->delay);
+      continue;
+    }
+    /* Only events caused by this step count towards its arrival */
+    MUTEX_LOCK(comms->jointCache_lock);
+    eventSeq = comms->jointEventSeq;
+    MUTEX_UNLOCK(comms->jointCache_lock);
+    for(j = 0; j < 4 && rc == 0; j++) {
+      if(step->mask & (1<<j)) {
+        rc = Mobot_moveJointToNB(comms, (robotJointId_t)(j+1), step->angles[j]);
+      }
+    }
+    if(rc == 0 && step->waitMask) {
+      rc = Mobot_seqWaitArrival(comms, step, seq->tolerance, seq->timeout, &eventSeq);
+    }
+  }
+  if(events) {
+    Mobot_jointEventsRelease(comms);
+  }
+  return rc;
+}
+
+typedef struct seqRunArg_s
+{
+  mobot_t* comms;
+  const mobotSeq_t* seq;
+} seqRunArg_t;
+
+static void* seqRunThread(void* arg)
+{
+  seqRunArg_t* sarg = (seqRunArg_t*)arg;
+  Mobot_seqRun(sarg->comms, sarg->seq);
+  free(sarg);
+  return NULL;
+}
+
+int Mobot_seqRunNB(mobot_t* comms, const mobotSeq_t* seq)
+{
+  seqRunArg_t* sarg = (seqRunArg_t*)malloc(sizeof(seqRunArg_t));
+  sarg->comms = comms;
+  sarg->seq = seq;
+  return Mobot_motionSubmit(comms, seqRunThread, sarg);
+}
+
+/* How close a saved pose has to be to the keyframe it was made from */
+#define POSE_VERIFY_TOLERANCE DEG2RAD(2)
+
+/* The joints this kind of robot actually has */
+static int Mobot_jointMask(mobot_t* comms)
+{
+  switch(comms->formFactor) {
+    case MOBOTFORM_I:
+      return (1<<0) | (1<<2);
+    case MOBOTFORM_L:
+      return (1<<0) | (1<<1);
+    default:
+      return 0x0f;
+  }
+}
+
+/* The firmware can only save the pose the robot is in, so each keyframe is
+ * driven to and then saved. The next keyframe goes out as soon as the joints
+ * are seen to arrive, and the result is read back to check it. */
+int Mobot_uploadPoses(mobot_t* comms, const double* poses, int num)
+{
+  int i;
+  int rc = 0;
+  int mask = Mobot_jointMask(comms);
+  int events;
+  uint8_t buf[32];
+  mobotSeq_t* seq;
+  if(num < 0 || num > 256) {
+    return -1;
+  }
+  /* Keep the joint events on across all the keyframes, not per keyframe */
+  events = !Mobot_jointEventsAcquire(comms);
+  seq = Mobot_seqNew();
+  /* The pose is saved from where the joints are, so let them settle closer
+   * than a sequence normally would */
+  Mobot_seqSetTolerance(seq, DEG2RAD(0.5));
+  for(i = 0; i < num && rc == 0; i++) {
+    seq->numSteps = 0;
+    Mobot_seqAddMove(seq, mask, &poses[4*i], mask);
+    rc = Mobot_seqRun(comms, seq);
+    if(rc) {
+      break;
+    }
+    buf[0] = (uint8_t)i;
+    rc = MobotMsgTransaction(comms, BTCMD(CMD_SAVE_POSE), buf, 1);
+    /* Make sure the data size is correct */
+    if(rc == 0 && buf[1] != 3) {
+      rc = -1;
+    }
+  }
+  Mobot_seqFree(seq);
+  if(events) {
+    Mobot_jointEventsRelease(comms);
+  }
+  if(rc) {
+    return rc;
+  }
+  return Mobot_verifyPoses(comms, poses, num, POSE_VERIFY_TOLERANCE);
+}
+
+int Mobot_verifyPoses(mobot_t* comms, const double* poses, int num, double tolerance)
+{
+  int i, j;
+  int numPoses;
+  int mask = Mobot_jointMask(comms);
+  double angles[4];
+  if(Mobot_getNumPoses(comms, &numPoses) || numPoses < num) {
+    return -1;
+  }
+  for(i = 0; i < num; i++) {
+    if(Mobot_getPoseData(comms, (uint8_t)i,
+          &angles[0], &angles[1], &angles[2], &angles[3])) {
+      return -1;
+    }
+    for(j = 0; j < 4; j++) {
+      if((mask & (1<<j)) && ABS(angles[j] - poses[4*i+j]) > tolerance) {
+        fprintf(stderr, "(barobo) WARNING: pose %d joint %d was saved as %.1f degrees, "
+            "expected %.1f.\n", i, j+1, RAD2DEG(angles[j]), RAD2DEG(poses[4*i+j]));
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+typedef struct poseUploadArg_s
+{
+  mobot_t* comms;
+  const double* poses;
+  int num;
+  int rc;
+} poseUploadArg_t;
+
+static void* poseUploadThread(void* arg)
+{
+  poseUploadArg_t* parg = (poseUploadArg_t*)arg;
+  parg->rc = Mobot_uploadPoses(parg->comms, parg->poses, parg->num);
+  return NULL;
+}
+
+int Mobot_uploadPosesGroup(mobot_t** comms, int numRobots, const double* poses, int num)
+{
+  int i;
+  int rc = 0;
+  poseUploadArg_t* args;
+  mobotTask_t** tasks;
+  if(numRobots <= 0) {
+    return 0;
+  }
+  args = (poseUploadArg_t*)malloc(sizeof(poseUploadArg_t)*numRobots);
+  tasks = (mobotTask_t**)malloc(sizeof(mobotTask_t*)*numRobots);
+  /* Every robot teaches itself at the same time, each behind whatever is
+   * already on its own motion queue */
+  for(i = 0; i < numRobots; i++) {
+    args[i].comms = comms[i];
+    args[i].poses = poses;
+    args[i].num = num;
+    args[i].rc = -1;
+    tasks[i] = Mobot_taskSubmit(comms[i]->motionQueue, poseUploadThread, &args[i]);
+  }
+  for(i = 0; i < numRobots; i++) {
+    Mobot_taskJoin(tasks[i], NULL);
+    if(args[i].rc) {
+      rc = args[i].rc;
+    }
+  }
+  free(tasks);
+  free(args);
+  return rc;
+}
+
+int Mobot_moveToPose(mobot_t* comms, int index)
+{
+  uint8_t buf[32];
+  int status;
+  buf[0] = (uint8_t)index;
+  status = MobotMsgTransaction(comms, BTCMD(CMD_MOVE_TO_POSE), buf, 1);
+  if(status < 0) return status;
+  /* Make sure the data size is correct */
+  if(buf[1] != 3) {
+    return -1;
+  }
+  return 0;
+}
+
+/* How long the master gets to hear from all of its slaves */
+#define POSE_GROUP_TIMEOUT_MSECS 2000
+
+int Mobot_formPoseGroup(mobot_t** comms, int num, int groupId)
+{
+  uint8_t buf[32];
+  int i;
+  int r, g, b;
+  int status;
+  double deadline;
+  if(num <= 0) {
+    return -1;
+  }
+  if(Mobot_getColorRGB(comms[0], &r, &g, &b)) {
+    r = 0;
+    g = 255;
+    b = 0;
+  }
+  for(i = 0; i < num; i++) {
+    buf[0] = (groupId >> 8) & 0xff;
+    buf[1] = groupId & 0xff;
+    buf[2] = (uint8_t)r;
+    buf[3] = (uint8_t)g;
+    buf[4] = (uint8_t)b;
+    status = MobotMsgTransaction(comms[i], BTCMD(CMD_SET_GRP), buf, 5);
+    if(status < 0) return status;
+    /* Make sure the data size is correct */
+    if(buf[1] != 3) {
+      return -1;
+    }
+  }
+  status = MobotMsgTransaction(comms[0], BTCMD(CMD_SET_GRP_MASTER), buf, 0);
+  if(status < 0) return status;
+  if(buf[1] != 3) {
+    return -1;
+  }
+  /* The slaves announce themselves to the master on their own; wait until it
+   * has heard from all of them */
+  deadline = Mobot_monotonicMsecs() + POSE_GROUP_TIMEOUT_MSECS;
+  while(1) {
+    status = MobotMsgTransaction(comms[0], BTCMD(CMD_GET_NUM_SLAVES), buf, 0);
+    if(status < 0) return status;
+    if(buf[0] == RESP_OK && buf[2] >= num-1) {
+      return 0;
+    }
+    if(Mobot_monotonicMsecs() >= deadline) {
+      fprintf(stderr, "(barobo) WARNING: group master only found %d of %d slaves.\n",
+          buf[2], num-1);
+      return -1;
+    }
+    Mobot_sleepUntil(Mobot_monotonicMsecs() + 50);
+  }
+}
+
+int Mobot_playPoses(mobot_t* master, int groupId)
+{
+  uint8_t buf[2];
+  buf[0] = (groupId >> 8) & 0xff;
+  buf[1] = groupId & 0xff;
+  return Mobot_sendGroupCommand(master, GRPCMD(GRP_CMD_PLAY_POSES), buf, 2);
+}
+
+/* Joints 2 and 3, the body joints of the original Mobot */
+#define SEQ_BODY_JOINTS ((1<<1) | (1<<2))
+
+static int Mobot_seqRunAndFree(mobot_t* comms, mobotSeq_t* seq)
+{
+  int rc = Mobot_seqRun(comms, seq);
+  Mobot_seqFree(seq);
+  return rc;
+}
+
 int Mobot_motionArch(mobot_t* comms, double angle)
 {
   Mobot_moveJointToNB(comms, ROBOT_JOINT2, -angle/2.0);
@@ -83,7 +512,6 @@ void* motionArchThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionArch(marg->mobot, marg->d);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -92,9 +520,7 @@ int Mobot_motionArchNB(mobot_t* comms, double angle)
 {
   INIT_MARG
   marg->d = angle;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionArchThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionArchThread, marg);
 }
 
 int Mobot_motionDistance(mobot_t* comms, double distance, double radius)
@@ -107,7 +533,6 @@ void* motionDistanceThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionRollForward(marg->mobot, marg->d);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -116,33 +541,30 @@ int Mobot_motionDistanceNB(mobot_t* comms, double distance, double radius)
 {
   INIT_MARG
   marg->d = distance / radius;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionDistanceThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionDistanceThread, marg);
 }
 
 int Mobot_motionInchwormLeft(mobot_t* comms, int num)
 {
   int i;
-  Mobot_moveJointToNB(comms, ROBOT_JOINT2, 0);
-  Mobot_moveJointToNB(comms, ROBOT_JOINT3, 0);
-  Mobot_moveWait(comms);
+  double zero[4] = {0, 0, 0, 0};
+  mobotSeq_t* seq = Mobot_seqNew();
+  Mobot_seqAddMove(seq, SEQ_BODY_JOINTS, zero, SEQ_BODY_JOINTS);
 
   for(i = 0; i < num; i++) {
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(-50));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(50));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, 0);
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, 0);
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(-50));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(50));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, 0);
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, 0);
   }
 
-  return 0;
+  return Mobot_seqRunAndFree(comms, seq);
 }
 
 void* motionInchwormLeftThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionInchwormLeft(marg->mobot, marg->i);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -151,33 +573,30 @@ int Mobot_motionInchwormLeftNB(mobot_t* comms, int num)
 {
   INIT_MARG
   marg->i = num;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionInchwormLeftThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionInchwormLeftThread, marg);
 }
 
 int Mobot_motionInchwormRight(mobot_t* comms, int num)
 {
   int i;
-  Mobot_moveJointToNB(comms, ROBOT_JOINT2, 0);
-  Mobot_moveJointToNB(comms, ROBOT_JOINT3, 0);
-  Mobot_moveWait(comms);
+  double zero[4] = {0, 0, 0, 0};
+  mobotSeq_t* seq = Mobot_seqNew();
+  Mobot_seqAddMove(seq, SEQ_BODY_JOINTS, zero, SEQ_BODY_JOINTS);
 
   for(i = 0; i < num; i++) {
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(50));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(-50));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, 0);
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, 0);
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(50));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(-50));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, 0);
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, 0);
   }
 
-  return 0;
+  return Mobot_seqRunAndFree(comms, seq);
 }
 
 void* motionInchwormRightThread(void* arg)
 {
   motionArg_t *marg = (motionArg_t*)arg;
   Mobot_motionInchwormRight(marg->mobot, marg->i);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -186,9 +605,7 @@ int Mobot_motionInchwormRightNB(mobot_t* comms, int num)
 {
   INIT_MARG
   marg->i = num;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionInchwormRightThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionInchwormRightThread, marg);
 }
 
 int Mobot_motionRollBackward(mobot_t* comms, double angle)
@@ -210,7 +627,6 @@ void* motionRollBackwardThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionRollBackward(marg->mobot, marg->d);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -219,9 +635,7 @@ int Mobot_motionRollBackwardNB(mobot_t* comms, double angle)
 {
   INIT_MARG
   marg->d = angle;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionRollBackwardThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionRollBackwardThread, marg);
 }
 
 int Mobot_motionRollForward(mobot_t* comms, double angle)
@@ -251,7 +665,6 @@ void* motionRollForwardThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionRollForward(marg->mobot, marg->d);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -260,35 +673,28 @@ int Mobot_motionRollForwardNB(mobot_t* comms, double angle)
 {
   INIT_MARG
   marg->d = angle;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionRollForwardThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionRollForwardThread, marg);
 }
 
 int Mobot_motionStand(mobot_t* comms)
 {
-  double speed;
+  mobotSeq_t* seq;
   Mobot_resetToZero(comms);
-  Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(-85));
-  Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(70));
-  Mobot_moveWait(comms);
-  Mobot_moveJointTo(comms, ROBOT_JOINT1, DEG2RAD(45));
-  /* Sleep for a second, wait for it to settle down */
-#ifdef _WIN32
-  Sleep(1000);
-#else
-  sleep(1);
-#endif
-  Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(20));
-  //Mobot_setJointSpeed(comms, ROBOT_JOINT2, speed);
-  return 0;
+  seq = Mobot_seqNew();
+  Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(-85));
+  Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(70));
+  Mobot_seqAddJointTo(seq, ROBOT_JOINT1, DEG2RAD(45));
+  /* The robot is balancing on one end now. Give it a second to stop
+   * swaying, which the joint angles cannot tell us about. */
+  Mobot_seqAddDelay(seq, 1000);
+  Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(20));
+  return Mobot_seqRunAndFree(comms, seq);
 }
 
 void* motionStandThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionStand(marg->mobot);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -296,9 +702,7 @@ void* motionStandThread(void* arg)
 int Mobot_motionStandNB(mobot_t* comms)
 {
   INIT_MARG
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionStandThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionStandThread, marg);
 }
 
 int Mobot_motionSkinny(mobot_t* comms, double angle)
@@ -313,7 +717,6 @@ void* motionSkinnyThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionSkinny(marg->mobot, marg->d);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -322,9 +725,7 @@ int Mobot_motionSkinnyNB(mobot_t* comms, double angle)
 {
   INIT_MARG
   marg->d = angle;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionSkinnyThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionSkinnyThread, marg);
 }
 
 int Mobot_motionTurnLeft(mobot_t* comms, double angle)
@@ -346,7 +747,6 @@ void* motionTurnLeftThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionTurnLeft(marg->mobot, marg->d);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -355,9 +755,7 @@ int Mobot_motionTurnLeftNB(mobot_t* comms, double angle)
 {
   INIT_MARG
   marg->d = angle;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionTurnLeftThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionTurnLeftThread, marg);
 }
 
 int Mobot_motionTurnRight(mobot_t* comms, double angle)
@@ -379,7 +777,6 @@ void* motionTurnRightThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionTurnRight(marg->mobot, marg->d);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -388,48 +785,42 @@ int Mobot_motionTurnRightNB(mobot_t* comms, double angle)
 {
   INIT_MARG
   marg->d = angle;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionTurnRightThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionTurnRightThread, marg);
 }
 
 int Mobot_motionTumbleRight(mobot_t* comms, int num)
 {
   int i;
+  double zero[4] = {0, 0, 0, 0};
+  mobotSeq_t* seq;
+  /* resetToZero already waits for the joints to hold still */
   Mobot_resetToZero(comms);
-#ifndef _WIN32
-  sleep(1);
-#else
-  Sleep(1000);
-#endif
+  seq = Mobot_seqNew();
 
   for(i = 0; i < num; i++) {
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(85));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(-80));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(0));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(0));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(-80));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(-45));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(85));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(-80));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(0));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(0));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(-80));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(85));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(-80));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(0));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(0));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(-80));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(-45));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(85));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(-80));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(0));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(0));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(-80));
     if(i != (num-1)) {
-      Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(-45));
+      Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(-45));
     }
   }
-  Mobot_moveJointToNB(comms, ROBOT_JOINT3, 0);
-  Mobot_moveJointToNB(comms, ROBOT_JOINT2, 0);
-  Mobot_moveWait(comms);
-  return 0;
+  Mobot_seqAddMove(seq, SEQ_BODY_JOINTS, zero, SEQ_BODY_JOINTS);
+  return Mobot_seqRunAndFree(comms, seq);
 }
 
 void* motionTumbleRightThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionTumbleRight(marg->mobot, marg->i);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -438,48 +829,42 @@ int Mobot_motionTumbleRightNB(mobot_t* comms, int num)
 {
   INIT_MARG
   marg->i = num;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionTumbleRightThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionTumbleRightThread, marg);
 }
 
 int Mobot_motionTumbleLeft(mobot_t* comms, int num)
 {
   int i;
+  double zero[4] = {0, 0, 0, 0};
+  mobotSeq_t* seq;
+  /* resetToZero already waits for the joints to hold still */
   Mobot_resetToZero(comms);
-#ifndef _WIN32
-  sleep(1);
-#else
-  Sleep(1000);
-#endif
+  seq = Mobot_seqNew();
 
   for(i = 0; i < num; i++) {
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(-85));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(80));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(0));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(0));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(80));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(45));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(-85));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(80));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(0));
-    Mobot_moveJointTo(comms, ROBOT_JOINT2, DEG2RAD(0));
-    Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(80));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(-85));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(80));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(0));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(0));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(80));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(45));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(-85));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(80));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(0));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT2, DEG2RAD(0));
+    Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(80));
     if(i != (num-1)) {
-      Mobot_moveJointTo(comms, ROBOT_JOINT3, DEG2RAD(45));
+      Mobot_seqAddJointTo(seq, ROBOT_JOINT3, DEG2RAD(45));
     }
   }
-  Mobot_moveJointToNB(comms, ROBOT_JOINT2, 0);
-  Mobot_moveJointToNB(comms, ROBOT_JOINT3, 0);
-  Mobot_moveWait(comms);
-  return 0;
+  Mobot_seqAddMove(seq, SEQ_BODY_JOINTS, zero, SEQ_BODY_JOINTS);
+  return Mobot_seqRunAndFree(comms, seq);
 }
 
 void* motionTumbleLeftThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionTumbleLeft(marg->mobot, marg->i);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -488,9 +873,7 @@ int Mobot_motionTumbleLeftNB(mobot_t* comms, int num)
 {
   INIT_MARG
   marg->i = num;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionTumbleLeftThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionTumbleLeftThread, marg);
 }
 
 int Mobot_motionUnstand(mobot_t* comms)
@@ -508,7 +891,6 @@ void* motionUnstandThread(void* arg)
 {
   motionArg_t* marg = (motionArg_t*)arg;
   Mobot_motionUnstand(marg->mobot);
-  marg->mobot->motionInProgress--;
   free(marg);
   return NULL;
 }
@@ -516,20 +898,12 @@ void* motionUnstandThread(void* arg)
 int Mobot_motionUnstandNB(mobot_t* comms)
 {
   INIT_MARG
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, motionUnstandThread, marg);
-  return 0;
+  return Mobot_motionSubmit(comms, motionUnstandThread, marg);
 }
 
 int Mobot_motionWait(mobot_t* comms)
 {
-  while(comms->motionInProgress) {
-#ifdef _WIN32
-    Sleep(200);
-#else
-    usleep(200000);
-#endif
-  }
+  Mobot_taskQueueWait(comms->motionQueue);
   Mobot_moveWait(comms);
   return 0;
 }
@@ -275,7 +275,7 @@ int Mobot_driveJointToDirectNB(mobot_t* comms, robotJointId_t id, double angle)
   buf[0] = (uint8_t)id-1;
   f = angle;
   memcpy(&buf[1], &f, 4);
-  status = MobotMsgTransaction(comms, BTCMD(CMD_SETMOTORANGLEPID), buf, 5);
+  status = MobotMsgTransactionCoalesced(comms, BTCMD(CMD_SETMOTORANGLEPID), id, buf, 5);
   if(status < 0) return status;
   /* Make sure the data size is correct */
   if(buf[1] != 3) {
@@ -518,7 +518,7 @@ int Mobot_driveToDirectNB(mobot_t* comms,
   memcpy(&buf[8], &f, 4);
   f = angle4;
   memcpy(&buf[12], &f, 4);
-  status = MobotMsgTransaction(comms, BTCMD(CMD_SETMOTORANGLESPID), buf, 16);
+  status = MobotMsgTransactionCoalesced(comms, BTCMD(CMD_SETMOTORANGLESPID), 0, buf, 16);
   if(status < 0) return status;
   /* Make sure the data size is correct */
   if(buf[1] != 3) {
@@ -589,31 +589,32 @@ int Mobot_movexy(mobot_t* comms, double x, double y, double radius, double track
   return 0;
 }
 
+typedef struct movexyArg_s
+{
+  mobot_t* comms;
+  double x;
+  double y;
+  double radius;
+  double trackwidth;
+} movexyArg_t;
+
 void* Mobot_movexyThread(void* arg)
 {
-  mobot_t* comms = (mobot_t*)arg;
-  double* args = &(((double*)arg)[1]);
-  Mobot_movexy(comms, args[0], args[1], args[2], args[3]);
-  comms->motionInProgress--;
+  movexyArg_t* a = (movexyArg_t*)arg;
+  Mobot_movexy(a->comms, a->x, a->y, a->radius, a->trackwidth);
+  free(a);
   return NULL;
 }
 
 int Mobot_movexyNB(mobot_t* comms, double x, double y, double radius, double trackwidth)
 {
-  static void* args[5];
-  static double _x, _y, _r, _t;
-  _x = x;
-  _y = y;
-  _r = radius;
-  _t = trackwidth;
-  args[0] = (void*)comms;
-  args[1] = (void*)&_x;
-  args[2] = (void*)&_y;
-  args[3] = (void*)&_r;
-  args[4] = (void*)&_t;
-  comms->motionInProgress++;
-  THREAD_CREATE(comms->thread, Mobot_movexyThread, args);
-  return 0;
+  movexyArg_t* a = (movexyArg_t*)malloc(sizeof(movexyArg_t));
+  a->comms = comms;
+  a->x = x;
+  a->y = y;
+  a->radius = radius;
+  a->trackwidth = trackwidth;
+  return Mobot_motionSubmit(comms, Mobot_movexyThread, a);
 }
 
 int Mobot_beginFourierControl(mobot_t* comms, uint8_t motorMask)
@@ -635,7 +636,7 @@ int Mobot_stop(mobot_t* comms)
   uint8_t buf[32];
   float f;
   int status;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_STOP), buf, 0);
+  status = MobotMsgTransactionPriority(comms, BTCMD(CMD_STOP), buf, 0);
   if(status < 0) return status;
   /* Make sure the data size is correct */
   if(buf[1] != 3) {
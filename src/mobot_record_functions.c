@@ -86,16 +86,6 @@ int Mobot_recordAngle(mobot_t* comms, robotJointId_t id, double* time, double* a
   return 0;
 }
 
-#ifndef _WIN32
-unsigned int diff_msecs(struct timespec t1, struct timespec t2)
-{
-  unsigned int t;
-  t = (t2.tv_sec - t1.tv_sec) * 1000;
-  t += (t2.tv_nsec - t1.tv_nsec) / 1000000;
-  return t;
-}
-#endif
-
 int Mobot_enableRecordDataShift(mobot_t* comms)
 {
   comms->shiftDataGlobalEnable = 1;
@@ -120,21 +110,10 @@ void* Mobot_recordAngleThread(void* arg)
   isMoving = (int*)malloc(sizeof(int) * rArg->num);
 #ifndef _WIN32
   int i;
-  struct timespec cur_time, itime;
-  unsigned int dt;
   double start_time;
+  mobotPeriodic_t* timing = &rArg->comms->recordTiming[rArg->id-1];
+  Mobot_periodicStart(timing, rArg->msecs);
   for(i = 0; i < rArg->num; i++) {
-#ifndef __MACH__
-    clock_gettime(CLOCK_REALTIME, &cur_time);
-#else
-    clock_serv_t cclock;
-    mach_timespec_t mts;
-    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-    clock_get_time(cclock, &mts);
-    mach_port_deallocate(mach_task_self(), cclock);
-    cur_time.tv_sec = mts.tv_sec;
-    cur_time.tv_nsec = mts.tv_nsec;
-#endif
     //Mobot_getJointAngleTime(rArg->comms, rArg->id, &rArg->time[i], &rArg->angle[i]);
     while(
         (rc = Mobot_getJointAnglesTimeIsMoving(
@@ -158,27 +137,14 @@ void* Mobot_recordAngleThread(void* arg)
     rArg->time[i] = rArg->time[i] - start_time;
     /* Convert angle to degrees */
     rArg->angle[i] = RAD2DEG(rArg->angle[i]);
-#ifndef __MACH__
-    clock_gettime(CLOCK_REALTIME, &itime);
-#else
-    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-    clock_get_time(cclock, &mts);
-    mach_port_deallocate(mach_task_self(), cclock);
-    cur_time.tv_sec = mts.tv_sec;
-    cur_time.tv_nsec = mts.tv_nsec;
-#endif
-    dt = diff_msecs(cur_time, itime);
-    if(dt < (rArg->msecs)) {
-      usleep(rArg->msecs*1000 - dt*1000);
-    }
+    Mobot_periodicWait(timing);
   }
 #else
   int i;
-  DWORD cur_time, itime;
-  unsigned int dt;
   double start_time;
+  mobotPeriodic_t* timing = &rArg->comms->recordTiming[rArg->id-1];
+  Mobot_periodicStart(timing, rArg->msecs);
   for(i = 0; i < rArg->num; i++) {
-    cur_time = GetTickCount();
     while(
         (rc = Mobot_getJointAnglesTimeIsMoving(
                                                rArg->comms, 
@@ -201,11 +167,7 @@ void* Mobot_recordAngleThread(void* arg)
     rArg->time[i] = rArg->time[i] - start_time;
     /* Convert angle to degrees */
     rArg->angle[i] = RAD2DEG(rArg->angle[i]);
-    itime = GetTickCount();
-    dt = itime - cur_time;
-    if(dt < (rArg->msecs)) {
-      Sleep(rArg->msecs - dt);
-    }
+    Mobot_periodicWait(timing);
   }
 #endif
   double shiftTime;
@@ -245,9 +207,9 @@ void* Mobot_recordAngleBeginThread(void* arg)
   COND_SIGNAL(rArg->comms->recordingActive_cond);
   MUTEX_UNLOCK(rArg->comms->recordingActive_lock);
 #ifndef _WIN32
-  struct timespec cur_time, itime;
-  unsigned int dt;
   double start_time;
+  mobotPeriodic_t* timing = &rArg->comms->recordTiming[rArg->id-1];
+  Mobot_periodicStart(timing, rArg->msecs);
   MUTEX_LOCK(rArg->comms->recordingLock);
   for(i = 0; rArg->comms->recordingEnabled[rArg->id-1] ; i++) {
     MUTEX_UNLOCK(rArg->comms->recordingLock);
@@ -266,17 +228,6 @@ void* Mobot_recordAngleBeginThread(void* arg)
       free(*rArg->angle_p);
       *rArg->angle_p = newBuf;
     }
-#ifndef __MACH__
-    clock_gettime(CLOCK_REALTIME, &cur_time);
-#else
-    clock_serv_t cclock;
-    mach_timespec_t mts;
-    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-    clock_get_time(cclock, &mts);
-    mach_port_deallocate(mach_task_self(), cclock);
-    cur_time.tv_sec = mts.tv_sec;
-    cur_time.tv_nsec = mts.tv_nsec;
-#endif
     //Mobot_getJointAngleTime(rArg->comms, rArg->id, &((*rArg->time_p)[i]), &((*rArg->angle_p)[i]));
     while(
         (rc = Mobot_getJointAnglesTimeIsMoving(
@@ -300,19 +251,7 @@ void* Mobot_recordAngleBeginThread(void* arg)
     (*rArg->time_p)[i] = (*rArg->time_p)[i] - start_time;
     /* Convert angle to degrees */
     (*rArg->angle_p)[i] = RAD2DEG((*rArg->angle_p)[i]);
-#ifndef __MACH__
-    clock_gettime(CLOCK_REALTIME, &itime);
-#else
-    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-    clock_get_time(cclock, &mts);
-    mach_port_deallocate(mach_task_self(), cclock);
-    cur_time.tv_sec = mts.tv_sec;
-    cur_time.tv_nsec = mts.tv_nsec;
-#endif
-    dt = diff_msecs(cur_time, itime);
-    if(dt < (rArg->msecs)) {
-      usleep(rArg->msecs*1000 - dt*1000);
-    }
+    Mobot_periodicWait(timing);
     if(!isMoving && shiftDataIsEnabled(rArg->comms)) {
       i--;
     }
@@ -320,9 +259,9 @@ void* Mobot_recordAngleBeginThread(void* arg)
   }
   MUTEX_UNLOCK(rArg->comms->recordingLock);
 #else
-  DWORD cur_time, itime;
-  unsigned int dt;
   double start_time;
+  mobotPeriodic_t* timing = &rArg->comms->recordTiming[rArg->id-1];
+  Mobot_periodicStart(timing, rArg->msecs);
   for(i = 0; rArg->comms->recordingEnabled[rArg->id-1] ; i++) {
     MUTEX_LOCK(rArg->comms->recordingLock);
     rArg->i = i;
@@ -340,7 +279,6 @@ void* Mobot_recordAngleBeginThread(void* arg)
       free(*rArg->angle_p);
       *rArg->angle_p = newBuf;
     }
-    cur_time = GetTickCount();
     //Mobot_getJointAngleTime(rArg->comms, rArg->id, &((*rArg->time_p)[i]), &((*rArg->angle_p)[i]));
     while(
         (rc = Mobot_getJointAnglesTimeIsMoving(
@@ -364,11 +302,7 @@ void* Mobot_recordAngleBeginThread(void* arg)
     (*rArg->time_p)[i] = (*rArg->time_p)[i] - start_time;
     /* Convert angle to degrees */
     (*rArg->angle_p)[i] = RAD2DEG((*rArg->angle_p)[i]);
-    itime = GetTickCount();
-    dt = itime - cur_time;
-    if(dt < (rArg->msecs)) {
-      Sleep(rArg->msecs - dt);
-    }
+    Mobot_periodicWait(timing);
     if(!isMoving && shiftDataIsEnabled(rArg->comms)) {
       i--;
     }
@@ -440,6 +374,27 @@ int Mobot_recordAngleEnd(mobot_t* comms, robotJointId_t id, int *num)
   return 0;
 }
 
+int Mobot_getRecordJitter(mobot_t* comms, robotJointId_t id, double* mean, double* stddev, double* max, int* overruns)
+{
+  mobotPeriodic_t* timing;
+  double var;
+  if(id < ROBOT_JOINT1 || id > ROBOT_JOINT4) {
+    return -1;
+  }
+  timing = &comms->recordTiming[id-1];
+  if(timing->ticks == 0) {
+    *mean = 0;
+    *stddev = 0;
+  } else {
+    *mean = timing->jitterSum / timing->ticks;
+    var = timing->jitterSqSum / timing->ticks - (*mean) * (*mean);
+    *stddev = var > 0 ? sqrt(var) : 0;
+  }
+  *max = timing->jitterMax;
+  *overruns = timing->overruns;
+  return 0;
+}
+
 int Mobot_recordDistanceBegin(mobot_t* comms,
                                      robotJointId_t id,
                                      double **time,
@@ -509,21 +464,10 @@ void* recordAnglesThread(void* arg)
   int retries = 0;
 #ifndef _WIN32
   int i;
-  struct timespec cur_time, itime;
-  unsigned int dt;
   double start_time;
+  mobotPeriodic_t* timing = &rArg->comms->recordTiming[0];
+  Mobot_periodicStart(timing, rArg->msecs);
   for(i = 0; i < rArg->num; i++) {
-#ifndef __MACH__
-    clock_gettime(CLOCK_REALTIME, &cur_time);
-#else
-    clock_serv_t cclock;
-    mach_timespec_t mts;
-    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-    clock_get_time(cclock, &mts);
-    mach_port_deallocate(mach_task_self(), cclock);
-    cur_time.tv_sec = mts.tv_sec;
-    cur_time.tv_nsec = mts.tv_nsec;
-#endif
     while( 
         (rc = Mobot_getJointAnglesTimeIsMoving(
                                                rArg->comms, 
@@ -551,27 +495,14 @@ void* recordAnglesThread(void* arg)
     rArg->angle2[i] = RAD2DEG(rArg->angle2[i]);
     rArg->angle3[i] = RAD2DEG(rArg->angle3[i]);
     rArg->angle4[i] = RAD2DEG(rArg->angle4[i]);
-#ifndef __MACH__
-    clock_gettime(CLOCK_REALTIME, &itime);
-#else
-    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-    clock_get_time(cclock, &mts);
-    mach_port_deallocate(mach_task_self(), cclock);
-    cur_time.tv_sec = mts.tv_sec;
-    cur_time.tv_nsec = mts.tv_nsec;
-#endif
-    dt = diff_msecs(cur_time, itime);
-    if(dt < (rArg->msecs)) {
-      usleep(rArg->msecs*1000 - dt*1000);
-    }
+    Mobot_periodicWait(timing);
   }
 #else
   int i;
-  DWORD cur_time, itime;
-  unsigned int dt;
   double start_time;
+  mobotPeriodic_t* timing = &rArg->comms->recordTiming[0];
+  Mobot_periodicStart(timing, rArg->msecs);
   for(i = 0; i < rArg->num; i++) {
-    cur_time = GetTickCount();
     while(
         (rc = Mobot_getJointAnglesTimeIsMoving(
                                                rArg->comms, 
@@ -599,11 +530,7 @@ void* recordAnglesThread(void* arg)
     rArg->angle2[i] = RAD2DEG(rArg->angle2[i]);
     rArg->angle3[i] = RAD2DEG(rArg->angle3[i]);
     rArg->angle4[i] = RAD2DEG(rArg->angle4[i]);
-    itime = GetTickCount();
-    dt = itime - cur_time;
-    if(dt < (rArg->msecs)) {
-      Sleep(rArg->msecs - dt);
-    }
+    Mobot_periodicWait(timing);
   }
 #endif
   double shiftTime;
@@ -654,9 +581,9 @@ void* Mobot_recordAnglesBeginThread(void* arg)
   COND_SIGNAL(rArg->comms->recordingActive_cond);
   MUTEX_UNLOCK(rArg->comms->recordingActive_lock);
 #ifndef _WIN32
-  struct timespec cur_time, itime;
-  unsigned int dt;
   double start_time;
+  mobotPeriodic_t* timing = &rArg->comms->recordTiming[0];
+  Mobot_periodicStart(timing, rArg->msecs);
   MUTEX_LOCK(rArg->comms->recordingLock);
   for(i = 0; rArg->comms->recordingEnabled[0] ; i++) {
     MUTEX_UNLOCK(rArg->comms->recordingLock);
@@ -691,17 +618,6 @@ void* Mobot_recordAnglesBeginThread(void* arg)
       free(*rArg->angle4_p);
       *rArg->angle4_p = newBuf;
     }
-#ifndef __MACH__
-    clock_gettime(CLOCK_REALTIME, &cur_time);
-#else
-    clock_serv_t cclock;
-    mach_timespec_t mts;
-    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-    clock_get_time(cclock, &mts);
-    mach_port_deallocate(mach_task_self(), cclock);
-    cur_time.tv_sec = mts.tv_sec;
-    cur_time.tv_nsec = mts.tv_nsec;
-#endif
     while(rc = Mobot_getJointAnglesTime(
         rArg->comms, 
         &((*rArg->time_p)[i]), 
@@ -728,26 +644,14 @@ void* Mobot_recordAnglesBeginThread(void* arg)
     (*rArg->angle2_p)[i] = RAD2DEG((*rArg->angle2_p)[i]);
     (*rArg->angle3_p)[i] = RAD2DEG((*rArg->angle3_p)[i]);
     (*rArg->angle4_p)[i] = RAD2DEG((*rArg->angle4_p)[i]);
-#ifndef __MACH__
-    clock_gettime(CLOCK_REALTIME, &itime);
-#else
-    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-    clock_get_time(cclock, &mts);
-    mach_port_deallocate(mach_task_self(), cclock);
-    cur_time.tv_sec = mts.tv_sec;
-    cur_time.tv_nsec = mts.tv_nsec;
-#endif
-    dt = diff_msecs(cur_time, itime);
-    if(dt < (rArg->msecs)) {
-      usleep(rArg->msecs*1000 - dt*1000);
-    }
+    Mobot_periodicWait(timing);
     MUTEX_LOCK(rArg->comms->recordingLock);
   }
   MUTEX_UNLOCK(rArg->comms->recordingLock);
 #else
-  DWORD cur_time, itime;
-  unsigned int dt;
   double start_time;
+  mobotPeriodic_t* timing = &rArg->comms->recordTiming[0];
+  Mobot_periodicStart(timing, rArg->msecs);
   for(i = 0; rArg->comms->recordingEnabled[0] ; i++) {
     MUTEX_LOCK(rArg->comms->recordingLock);
     rArg->i = i;
@@ -781,7 +685,6 @@ void* Mobot_recordAnglesBeginThread(void* arg)
       free(*rArg->angle4_p);
       *rArg->angle4_p = newBuf;
     }
-    cur_time = GetTickCount();
     while(
         (rc = Mobot_getJointAnglesTime(
                                        rArg->comms, 
@@ -808,11 +711,7 @@ void* Mobot_recordAnglesBeginThread(void* arg)
     (*rArg->angle2_p)[i] = RAD2DEG((*rArg->angle2_p)[i]);
     (*rArg->angle3_p)[i] = RAD2DEG((*rArg->angle3_p)[i]);
     (*rArg->angle4_p)[i] = RAD2DEG((*rArg->angle4_p)[i]);
-    itime = GetTickCount();
-    dt = itime - cur_time;
-    if(dt < (rArg->msecs)) {
-      Sleep(rArg->msecs - dt);
-    }
+    Mobot_periodicWait(timing);
     MUTEX_UNLOCK(rArg->comms->recordingLock);
   }
 #endif
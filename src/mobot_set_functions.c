@@ -60,6 +60,7 @@
 #endif
 
 #include "commands.h"
+#include "codec.h"
 
 #include "rgbhashtable.h"
 
@@ -146,12 +147,11 @@ int Mobot_setBuzzerFrequencyOn(mobot_t* comms, unsigned int frequency)
   uint16_t f;
   f = frequency;
   int status;
-  buf[0] = (f>>8) & 0x00ff;
-  buf[1] = f & 0x00ff;
-  status = MobotMsgTransaction(comms, BTCMD(CMD_BUZZERFREQ), buf, 2);
+  codecPutU16BE(&buf[0], f);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_BUZZERFREQ), buf, CODEC_REQ(CMD_BUZZERFREQ));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 3) {
+  if(CODEC_VIEW(buf, CMD_BUZZERFREQ) == NULL) {
     return -1;
   }
   return 0;
@@ -173,12 +173,23 @@ int Mobot_setHWRev(mobot_t* comms, uint8_t rev)
   uint8_t buf[20];
   int status;
   buf[0] = rev;
-  if(status = MobotMsgTransaction(comms, BTCMD(CMD_GETHWREV), buf, 1)) {
+  if(status = MobotMsgTransaction(comms, BTCMD(CMD_SETHWREV), buf, CODEC_REQ(CMD_SETHWREV))) {
     return status;
   }
-  if(buf[0] != RESP_OK) {
+  if(CODEC_VIEW(buf, CMD_SETHWREV) == NULL) {
     return -1;
   }
+  comms->hwRev = rev;
+  comms->propertiesKnown |= MOBOT_PROP_HWREV;
+  Mobot_propertiesStore(comms);
+  return 0;
+}
+
+int Mobot_setJointCacheMaxAge(mobot_t* comms, int msecs)
+{
+  MUTEX_LOCK(comms->jointCache_lock);
+  comms->jointCacheMaxAge = msecs;
+  MUTEX_UNLOCK(comms->jointCache_lock);
   return 0;
 }
 
@@ -211,10 +222,15 @@ int Mobot_setJointDirection(mobot_t* comms, robotJointId_t id, robotJointState_t
   } else {
     buf[1] = (uint8_t) dir;
   }
-  status = MobotMsgTransaction(comms, BTCMD(CMD_SETMOTORDIR), buf, 2);
+  /* Letting a joint go limp is a stop, so it gets to jump the queue */
+  if(dir == ROBOT_NEUTRAL) {
+    status = MobotMsgTransactionPriority(comms, BTCMD(CMD_SETMOTORDIR), buf, CODEC_REQ(CMD_SETMOTORDIR));
+  } else {
+    status = MobotMsgTransaction(comms, BTCMD(CMD_SETMOTORDIR), buf, CODEC_REQ(CMD_SETMOTORDIR));
+  }
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 3) {
+  if(CODEC_VIEW(buf, CMD_SETMOTORDIR) == NULL) {
     return -1;
   }
   return 0;
@@ -242,14 +258,12 @@ int Mobot_setJointMovementStateTime(mobot_t* comms, robotJointId_t id, robotJoin
 int Mobot_setJointSafetyAngle(mobot_t* comms, double angle)
 {
   uint8_t buf[32];
-  float f;
   int status;
-  f = angle;
-  memcpy(&buf[0], &f, 4);
-  status = MobotMsgTransaction(comms, BTCMD(CMD_SETMOTORSAFETYLIMIT), buf, 4);
+  codecPutFloat(&buf[0], angle);
+  status = MobotMsgTransactionPriority(comms, BTCMD(CMD_SETMOTORSAFETYLIMIT), buf, CODEC_REQ(CMD_SETMOTORSAFETYLIMIT));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 3) {
+  if(CODEC_VIEW(buf, CMD_SETMOTORSAFETYLIMIT) == NULL) {
     return -1;
   }
   return 0;
@@ -258,14 +272,12 @@ int Mobot_setJointSafetyAngle(mobot_t* comms, double angle)
 int Mobot_setJointSafetyAngleTimeout(mobot_t* comms, double seconds)
 {
   uint8_t buf[32];
-  float f;
   int status;
-  f = seconds;
-  memcpy(&buf[0], &f, 4);
-  status = MobotMsgTransaction(comms, BTCMD(CMD_SETMOTORSAFETYTIMEOUT), buf, 4);
+  codecPutFloat(&buf[0], seconds);
+  status = MobotMsgTransactionPriority(comms, BTCMD(CMD_SETMOTORSAFETYTIMEOUT), buf, CODEC_REQ(CMD_SETMOTORSAFETYTIMEOUT));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 3) {
+  if(CODEC_VIEW(buf, CMD_SETMOTORSAFETYTIMEOUT) == NULL) {
     return -1;
   }
   return 0;
@@ -274,7 +286,6 @@ int Mobot_setJointSafetyAngleTimeout(mobot_t* comms, double seconds)
 int Mobot_setJointSpeed(mobot_t* comms, robotJointId_t id, double speed)
 {
   uint8_t buf[32];
-  float f;
   int status;
   if(speed > comms->maxSpeed[id-1]) {
     fprintf(stderr, 
@@ -282,13 +293,12 @@ int Mobot_setJointSpeed(mobot_t* comms, robotJointId_t id, double speed)
         "beyond the maximum limit, %.2lf degrees/second.\n",
         id, RAD2DEG(speed), RAD2DEG(comms->maxSpeed[id-1]));
   }
-  f = speed;
   buf[0] = (uint8_t)id-1;
-  memcpy(&buf[1], &f, 4);
-  status = MobotMsgTransaction(comms, BTCMD(CMD_SETMOTORSPEED), buf, 5);
+  codecPutFloat(&buf[1], speed);
+  status = MobotMsgTransactionCoalesced(comms, BTCMD(CMD_SETMOTORSPEED), id, buf, CODEC_REQ(CMD_SETMOTORSPEED));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 3) {
+  if(CODEC_VIEW(buf, CMD_SETMOTORSPEED) == NULL) {
     return -1;
   }
   comms->jointSpeeds[id-1] = speed;
@@ -326,13 +336,11 @@ int Mobot_setMotorPower(mobot_t* comms, robotJointId_t id, int power)
   memset(buf, 0, sizeof(uint8_t)*32);
   buf[0] = (1<<(id-1));
   _power = power;
-  //memcpy(&buf[1+(id-1)*2], &_power, 2);
-  buf[1+(id-1)*2] = _power>>8;
-  buf[2+(id-1)*2] = (_power&0x00ff);
-  status = MobotMsgTransaction(comms, BTCMD(CMD_SETMOTORPOWER), buf, 10);
+  codecPutU16BE(&buf[1+(id-1)*2], _power);
+  status = MobotMsgTransactionCoalesced(comms, BTCMD(CMD_SETMOTORPOWER), id, buf, CODEC_REQ(CMD_SETMOTORPOWER));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 3) {
+  if(CODEC_VIEW(buf, CMD_SETMOTORPOWER) == NULL) {
     return -1;
   }
   return 0;
@@ -372,12 +380,22 @@ int Mobot_setMovementStateNB(mobot_t* comms,
   for(i = 0; i < 4; i++) {
     buf[i*6 + 1] = dirs[i];
     buf[i*6 + 2] = ROBOT_HOLD;
-    memcpy(&buf[i*6 + 3], &msecs, 4);
+    codecPutU32LE(&buf[i*6 + 3], msecs);
+  }
+  if(
+      (dir1 == ROBOT_NEUTRAL) &&
+      (dir2 == ROBOT_NEUTRAL) &&
+      (dir3 == ROBOT_NEUTRAL) &&
+      (dir4 == ROBOT_NEUTRAL)
+    )
+  {
+    status = MobotMsgTransactionPriority(comms, BTCMD(CMD_TIMEDACTION), buf, CODEC_REQ(CMD_TIMEDACTION));
+  } else {
+    status = MobotMsgTransaction(comms, BTCMD(CMD_TIMEDACTION), buf, CODEC_REQ(CMD_TIMEDACTION));
   }
-  status = MobotMsgTransaction(comms, BTCMD(CMD_TIMEDACTION), buf, 6*4 + 1);
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 3) {
+  if(CODEC_VIEW(buf, CMD_TIMEDACTION) == NULL) {
     return -1;
   }
   return 0;
@@ -443,12 +461,12 @@ int Mobot_setMovementStateTimeNB(mobot_t* comms,
   for(i = 0; i < 4; i++) {
     buf[i*6 + 1] = dirs[i];
     buf[i*6 + 2] = ROBOT_HOLD;
-    memcpy(&buf[i*6 + 3], &msecs, 4);
+    codecPutU32LE(&buf[i*6 + 3], msecs);
   }
-  status = MobotMsgTransaction(comms, BTCMD(CMD_TIMEDACTION), buf, 6*4 + 1);
+  status = MobotMsgTransaction(comms, BTCMD(CMD_TIMEDACTION), buf, CODEC_REQ(CMD_TIMEDACTION));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 3) {
+  if(CODEC_VIEW(buf, CMD_TIMEDACTION) == NULL) {
     return -1;
   }
   return 0;
@@ -466,10 +484,10 @@ int Mobot_setColorRGB(mobot_t* comms, int r, int g, int b)
   buf[4] = (uint8_t)g;
   buf[5] = (uint8_t)b;
 
-  status = MobotMsgTransaction(comms, BTCMD(CMD_RGBLED), buf, 6);
+  status = MobotMsgTransactionCoalesced(comms, BTCMD(CMD_RGBLED), 0, buf, CODEC_REQ(CMD_RGBLED));
   if(status < 0) return status;
   /* Make sure the data size is correct */
-  if(buf[1] != 3) {
+  if(CODEC_VIEW(buf, CMD_RGBLED) == NULL) {
     return -1;
   }
   return 0;
@@ -496,10 +514,10 @@ int Mobot_setColor(mobot_t* comms, char * color)
 	buf[4] = (uint8_t)getRGB[1];
 	buf[5] = (uint8_t)getRGB[2];
 
-	status = MobotMsgTransaction(comms, BTCMD(CMD_RGBLED), buf, 6);
+	status = MobotMsgTransaction(comms, BTCMD(CMD_RGBLED), buf, CODEC_REQ(CMD_RGBLED));
 	if(status < 0) return status;
 	/* Make sure the data size is correct */
-	if(buf[1] != 3){
+	if(CODEC_VIEW(buf, CMD_RGBLED) == NULL){
 	  return -1;
 	}
 	return 0;
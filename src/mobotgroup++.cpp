@@ -25,17 +25,27 @@
 #define DEPRECATED(from, to) \
   fprintf(stderr, "Warning: The function \"%s()\" is deprecated. Please use \"%s()\"\n" , from, to)
 
+typedef struct groupMotionArg_s
+{
+  CMobotGroup* group;
+  int i;
+  double d;
+} groupMotionArg_t;
+
 CMobotGroup::CMobotGroup()
 {
   _numRobots = 0;
-  _motionInProgress = 0;
-  _thread = (THREAD_T*)malloc(sizeof(THREAD_T));
+  _motionQueue = Mobot_taskQueueNew();
+  _mirror = NULL;
   _numAllocated = 0;
   _robots = NULL;
 }
 
 CMobotGroup::~CMobotGroup()
 {
+  stopMirror();
+  Mobot_taskQueueWait(_motionQueue);
+  Mobot_taskQueueFree(_motionQueue);
 }
 
 int CMobotGroup::addRobot(CMobot& robot)
@@ -97,293 +107,240 @@ int CMobotGroup::resetToZeroNB()
   return 0;
 }
 
-int CMobotGroup::motionArch(double angle) 
+int CMobotGroup::motionArch(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  motionArchThread(this);
-  return 0;
+  return runMotion(motionArchThread, 0, angle, 0);
 }
 
-int CMobotGroup::motionArchNB(double angle) 
+int CMobotGroup::motionArchNB(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionArchThread, this);
-  return 0;
+  return runMotion(motionArchThread, 0, angle, 1);
 }
 
 void* CMobotGroup::motionArchThread(void* arg) 
 {
-  CMobotGroup *cmg = (CMobotGroup*)arg;
-  cmg->moveJointToNB(ROBOT_JOINT2, -cmg->argDouble/2);
-  cmg->moveJointToNB(ROBOT_JOINT3, cmg->argDouble/2);
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup *cmg = garg->group;
+  cmg->moveJointToNB(ROBOT_JOINT2, -garg->d/2);
+  cmg->moveJointToNB(ROBOT_JOINT3, garg->d/2);
   cmg->moveJointWait(ROBOT_JOINT2);
   cmg->moveJointWait(ROBOT_JOINT3);
-  cmg->_motionInProgress--;
+  free(garg);
   return NULL;
 }
 
 int CMobotGroup::motionDistance(double distance, double radius)
 {
-  argDouble = distance / radius;
-  _motionInProgress++;
-  motionDistanceThread(this);
-  return 0;
+  return runMotion(motionDistanceThread, 0, distance / radius, 0);
 }
 
 int CMobotGroup::motionDistanceNB(double distance, double radius)
 {
-  argDouble = distance / radius;
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionDistanceThread, this);
-  return 0;
+  return runMotion(motionDistanceThread, 0, distance / radius, 1);
 }
 
 void* CMobotGroup::motionDistanceThread(void* arg)
 {
-  CMobotGroup *cmg = (CMobotGroup*)arg;
-  cmg->move(RAD2DEG(cmg->argDouble), 0, 0, RAD2DEG(cmg->argDouble));
-  cmg->_motionInProgress--;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup *cmg = garg->group;
+  cmg->move(RAD2DEG(garg->d), 0, 0, RAD2DEG(garg->d));
+  free(garg);
   return NULL;
 }
 
 int CMobotGroup::motionInchwormLeft(int num)
 {
-  argInt = num;
-  _motionInProgress++;
-  motionInchwormLeftThread(this);
-  return 0;
+  return runMotion(motionInchwormLeftThread, num, 0, 0);
 }
 
 int CMobotGroup::motionInchwormLeftNB(int num)
 {
-  argInt = num;
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionInchwormLeftThread, this);
-  return 0;
+  return runMotion(motionInchwormLeftThread, num, 0, 1);
 }
 
 void* CMobotGroup::motionInchwormLeftThread(void* arg)
 {
   int i;
-  CMobotGroup *cmg = (CMobotGroup*)arg;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup *cmg = garg->group;
   cmg->moveJointToNB(ROBOT_JOINT2, 0);
   cmg->moveJointToNB(ROBOT_JOINT3, 0);
   cmg->moveWait();
-  for(i = 0; i < cmg->argInt ; i++) {
+  for(i = 0; i < garg->i ; i++) {
     cmg->moveJointTo(ROBOT_JOINT2, -50);
     cmg->moveJointTo(ROBOT_JOINT3, 50);
     cmg->moveJointTo(ROBOT_JOINT2, 0);
     cmg->moveJointTo(ROBOT_JOINT3, 0);
   }
-  cmg->_motionInProgress--;
+  free(garg);
   return NULL;
 }
 
 int CMobotGroup::motionInchwormRight(int num)
 {
-  argInt = num;
-  _motionInProgress++;
-  motionInchwormRightThread(this);
-  return 0;
+  return runMotion(motionInchwormRightThread, num, 0, 0);
 }
 
 int CMobotGroup::motionInchwormRightNB(int num)
 {
-  argInt = num;
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionInchwormRightThread, this);
-  return 0;
+  return runMotion(motionInchwormRightThread, num, 0, 1);
 }
 
 void* CMobotGroup::motionInchwormRightThread(void* arg)
 {
   int i;
-  CMobotGroup *cmg = (CMobotGroup*)arg;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup *cmg = garg->group;
 
   cmg->moveJointToNB(ROBOT_JOINT2, 0);
   cmg->moveJointToNB(ROBOT_JOINT3, 0);
   cmg->moveWait();
-  for(i = 0; i < cmg->argInt; i++) {
+  for(i = 0; i < garg->i; i++) {
     cmg->moveJointTo(ROBOT_JOINT3, 50);
     cmg->moveJointTo(ROBOT_JOINT2, -50);
     cmg->moveJointTo(ROBOT_JOINT3, 0);
     cmg->moveJointTo(ROBOT_JOINT2, 0);
   }
-  cmg->_motionInProgress--;
+  free(garg);
   return NULL;
 }
 
 int CMobotGroup::motionRollBackward(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  motionRollBackwardThread(this);
-  return 0;
+  return runMotion(motionRollBackwardThread, 0, angle, 0);
 }
 
 int CMobotGroup::motionRollBackwardNB(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionRollBackwardThread, this);
-  return 0;
+  return runMotion(motionRollBackwardThread, 0, angle, 1);
 }
 
 void* CMobotGroup::motionRollBackwardThread(void* arg)
 {
-  CMobotGroup *cmg = (CMobotGroup*)arg;
-  cmg->move(-cmg->argDouble, 0, 0, -cmg->argDouble);
-  cmg->_motionInProgress--;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup *cmg = garg->group;
+  cmg->move(-garg->d, 0, 0, -garg->d);
+  free(garg);
   return NULL;
 }
 
 int CMobotGroup::motionRollForward(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  motionRollForwardThread(this);
-  return 0;
+  return runMotion(motionRollForwardThread, 0, angle, 0);
 }
 
 int CMobotGroup::motionRollForwardNB(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionRollForwardThread, this);
-  return 0;
+  return runMotion(motionRollForwardThread, 0, angle, 1);
 }
 
 void* CMobotGroup::motionRollForwardThread(void* arg)
 {
-  CMobotGroup *cmg = (CMobotGroup*)arg;
-  cmg->move(cmg->argDouble, 0, 0, cmg->argDouble);
-  cmg->_motionInProgress--;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup *cmg = garg->group;
+  cmg->move(garg->d, 0, 0, garg->d);
+  free(garg);
   return NULL;
 }
 
 int CMobotGroup::motionSkinny(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  motionSkinnyThread(this);
-  return 0;
+  return runMotion(motionSkinnyThread, 0, angle, 0);
 }
 
 int CMobotGroup::motionSkinnyNB(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionSkinnyThread, this);
-  return 0;
+  return runMotion(motionSkinnyThread, 0, angle, 1);
 }
 
 void* CMobotGroup::motionSkinnyThread(void* arg)
 {
-  CMobotGroup *cmg = (CMobotGroup*)arg;
-  cmg->moveJointToNB(ROBOT_JOINT2, cmg->argDouble);
-  cmg->moveJointToNB(ROBOT_JOINT3, cmg->argDouble);
-  cmg->_motionInProgress--;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup *cmg = garg->group;
+  cmg->moveJointToNB(ROBOT_JOINT2, garg->d);
+  cmg->moveJointToNB(ROBOT_JOINT3, garg->d);
+  free(garg);
   return NULL;
 }
 
 int CMobotGroup::motionStand()
 {
-  _motionInProgress++;
-  motionStandThread(this);
-  return 0;
+  return runMotion(motionStandThread, 0, 0, 0);
 }
 
 int CMobotGroup::motionStandNB()
 {
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionStandThread, NULL);
-  return 0;
+  return runMotion(motionStandThread, 0, 0, 1);
 }
 
 void* CMobotGroup::motionStandThread(void* arg)
 {
-  CMobotGroup* cmg = (CMobotGroup*)arg;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup* cmg = garg->group;
   cmg->resetToZero();
   cmg->moveJointTo(ROBOT_JOINT2, -85);
   cmg->moveJointTo(ROBOT_JOINT3, 70);
   cmg->moveWait();
   cmg->moveJointTo(ROBOT_JOINT1, 45);
   cmg->moveJointTo(ROBOT_JOINT2, 20);
-  cmg->_motionInProgress--;
-  return 0;
+  free(garg);
+  return NULL;
 }
 
 int CMobotGroup::motionTurnLeft(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  motionTurnLeftThread(this);
-  return 0;
+  return runMotion(motionTurnLeftThread, 0, angle, 0);
 }
 
 int CMobotGroup::motionTurnLeftNB(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionTurnLeftThread, this);
-  return 0;
+  return runMotion(motionTurnLeftThread, 0, angle, 1);
 }
 
 void* CMobotGroup::motionTurnLeftThread(void* arg)
 {
-  CMobotGroup* cmg = (CMobotGroup*)arg;
-  cmg->move(-cmg->argDouble, 0, 0, cmg->argDouble);
-  cmg->_motionInProgress--;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup* cmg = garg->group;
+  cmg->move(-garg->d, 0, 0, garg->d);
+  free(garg);
   return NULL;
 }
 
 int CMobotGroup::motionTurnRight(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  motionTurnRightThread(this);
-  return 0;
+  return runMotion(motionTurnRightThread, 0, angle, 0);
 }
 
 int CMobotGroup::motionTurnRightNB(double angle)
 {
-  argDouble = angle;
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionTurnRightThread, this);
-  return 0;
+  return runMotion(motionTurnRightThread, 0, angle, 1);
 }
 
 void* CMobotGroup::motionTurnRightThread(void* arg)
 {
-  CMobotGroup* cmg = (CMobotGroup*)arg;
-  cmg->move(cmg->argDouble, 0, 0, -cmg->argDouble);
-  cmg->_motionInProgress--;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup* cmg = garg->group;
+  cmg->move(garg->d, 0, 0, -garg->d);
+  free(garg);
   return NULL;
 }
 
 int CMobotGroup::motionTumbleRight(int num)
 {
-  argInt = num;
-  _motionInProgress++;
-  motionTumbleRightThread(this);
-  return 0;
+  return runMotion(motionTumbleRightThread, num, 0, 0);
 }
 
 int CMobotGroup::motionTumbleRightNB(int num)
 {
-  argInt = num;
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionTumbleRightThread, this);
-  return 0;
+  return runMotion(motionTumbleRightThread, num, 0, 1);
 }
 
 void* CMobotGroup::motionTumbleRightThread(void* arg)
 {
   int i;
-  CMobotGroup* cmg = (CMobotGroup*)arg;
-  int num = cmg->argInt;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup* cmg = garg->group;
+  int num = garg->i;
 
   cmg->resetToZero();
 #ifndef _WIN32
@@ -412,31 +369,26 @@ void* CMobotGroup::motionTumbleRightThread(void* arg)
   cmg->moveJointToNB(ROBOT_JOINT2, 0);
   cmg->moveWait();
 
-  cmg->_motionInProgress--;
+  free(garg);
   return NULL;
 }
 
 int CMobotGroup::motionTumbleLeft(int num)
 {
-  argInt = num;
-  _motionInProgress++;
-  motionTumbleLeftThread(this);
-  return 0;
+  return runMotion(motionTumbleLeftThread, num, 0, 0);
 }
 
 int CMobotGroup::motionTumbleLeftNB(int num)
 {
-  argInt = num;
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionTumbleLeftThread, this);
-  return 0;
+  return runMotion(motionTumbleLeftThread, num, 0, 1);
 }
 
 void* CMobotGroup::motionTumbleLeftThread(void* arg)
 {
   int i;
-  CMobotGroup* cmg = (CMobotGroup*)arg;
-  int num = cmg->argInt;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup* cmg = garg->group;
+  int num = garg->i;
 
   cmg->resetToZero();
 #ifndef _WIN32
@@ -464,47 +416,52 @@ void* CMobotGroup::motionTumbleLeftThread(void* arg)
   cmg->moveJointToNB(ROBOT_JOINT2, 0);
   cmg->moveJointToNB(ROBOT_JOINT3, 0);
   cmg->moveWait();
-  cmg->_motionInProgress--;
+  free(garg);
   return NULL;
 }
 
 int CMobotGroup::motionUnstand()
 {
-  _motionInProgress++;
-  motionUnstandThread(this);
-  return 0;
+  return runMotion(motionUnstandThread, 0, 0, 0);
 }
 
 int CMobotGroup::motionUnstandNB()
 {
-  _motionInProgress++;
-  THREAD_CREATE(_thread, motionUnstandThread, NULL);
-  return 0;
+  return runMotion(motionUnstandThread, 0, 0, 1);
 }
 
 void* CMobotGroup::motionUnstandThread(void* arg)
 {
-  CMobotGroup* cmg = (CMobotGroup*)arg;
+  groupMotionArg_t* garg = (groupMotionArg_t*)arg;
+  CMobotGroup* cmg = garg->group;
   cmg->moveToDirect(0, 0, 0, 0);
   cmg->moveJointTo(ROBOT_JOINT3, 45);
   cmg->moveJointTo(ROBOT_JOINT2, -85);
   cmg->moveWait();
   cmg->moveToDirect(0, 0, 0, 0);
   cmg->moveJointTo(ROBOT_JOINT2, 20);
-  cmg->_motionInProgress--;
-  return 0;
+  free(garg);
+  return NULL;
 }
 
 int CMobotGroup::motionWait()
 {
-  while(_motionInProgress > 0) {
-#ifdef _WIN32
-    Sleep(200);
-#else
-    usleep(200000);
-#endif
+  return Mobot_taskQueueWait(_motionQueue);
+}
+
+/* Each motion gets its own copy of its arguments, so back to back NB calls
+ * cannot overwrite each other's. The thread function frees it. */
+int CMobotGroup::runMotion(void* (*func)(void*), int i, double d, int nb)
+{
+  groupMotionArg_t* garg = (groupMotionArg_t*)malloc(sizeof(groupMotionArg_t));
+  garg->group = this;
+  garg->i = i;
+  garg->d = d;
+  if(!nb) {
+    func(garg);
+    return 0;
   }
-  return 0;
+  return Mobot_taskDetach(Mobot_taskSubmit(_motionQueue, func, garg));
 }
 
 int CMobotGroup::driveJointToDirect(robotJointId_t id, double angle)
@@ -565,12 +522,30 @@ int CMobotGroup::driveToNB(double angle1, double angle2, double angle3, double a
 
 int CMobotGroup::isMoving()
 {
+  int moving = 0;
+  mobot_t** comms;
+  mobotGroupSnapshot_t* snap;
+  if(_numRobots == 0) {
+    return 0;
+  }
+  snap = Mobot_groupSnapshotNew(_numRobots);
+  if(snap == NULL) {
+    return -1;
+  }
+  comms = new mobot_t*[_numRobots];
   for(int i = 0; i < _numRobots; i++) {
-    if(_robots[i]->isMoving()) {
-      return 1;
+    comms[i] = _robots[i]->_comms;
+  }
+  Mobot_groupSnapshot(comms, _numRobots, MOBOT_SNAPSHOT_JOINTS, GROUP_QUERY_DEADLINE, snap);
+  /* Like CMobot::isMoving, a robot that did not answer is not moving */
+  for(int i = 0; i < _numRobots; i++) {
+    if(snap->status[i] == 0 && snap->moving[i]) {
+      moving = 1;
     }
   }
-  return 0;
+  Mobot_groupSnapshotFree(snap);
+  delete[] comms;
+  return moving;
 }
 
 int CMobotGroup::move(double angle1, double angle2, double angle3, double angle4)
@@ -757,10 +732,13 @@ int CMobotGroup::moveToZero()
 
 int CMobotGroup::stopAllJoints()
 {
+  mobot_t** comms = new mobot_t*[_numRobots];
   for(int i = 0; i < _numRobots; i++) {
-    _robots[i]->stopAllJoints();
+    comms[i] = _robots[i]->_comms;
   }
-  return 0;
+  int rc = Mobot_broadcastStop(comms, _numRobots);
+  delete[] comms;
+  return rc;
 }
 
 int CMobotGroup::stopOneJoint(robotJointId_t id)
@@ -960,3 +938,107 @@ int CMobotGroup::turnRightNB(double angle, double radius, double tracklength)
   return 0;
 }
 
+int CMobotGroup::mirror(CMobot& leader, double hz)
+{
+  int rc;
+  stopMirror();
+  _mirror = Mobot_mirrorNew(leader._comms);
+  if(_mirror == NULL) {
+    return -1;
+  }
+  rc = 0;
+  for(int i = 0; i < _numRobots && !rc; i++) {
+    rc = Mobot_mirrorAddFollower(_mirror, _robots[i]->_comms, NULL, NULL, NULL);
+  }
+  if(!rc) {
+    rc = Mobot_mirrorStart(_mirror, hz);
+  }
+  if(rc) {
+    Mobot_mirrorFree(_mirror);
+    _mirror = NULL;
+  }
+  return rc;
+}
+
+int CMobotGroup::flushMirror()
+{
+  if(_mirror == NULL) {
+    return -1;
+  }
+  return Mobot_mirrorFlush(_mirror);
+}
+
+int CMobotGroup::stopMirror()
+{
+  if(_mirror == NULL) {
+    return 0;
+  }
+  Mobot_mirrorFree(_mirror);
+  _mirror = NULL;
+  return 0;
+}
+
+int CMobotGroup::getMirrorLatency(double &mean, double &max)
+{
+  if(_mirror == NULL) {
+    return -1;
+  }
+  return Mobot_mirrorGetLatency(_mirror, NULL, NULL, &mean, &max);
+}
+
+int CMobotGroup::uploadPoses(const double* poses, int num)
+{
+  int rc;
+  double* rad = new double[4*num];
+  mobot_t** comms = new mobot_t*[_numRobots];
+  for(int i = 0; i < 4*num; i++) {
+    rad[i] = DEG2RAD(poses[i]);
+  }
+  for(int i = 0; i < _numRobots; i++) {
+    comms[i] = _robots[i]->_comms;
+  }
+  rc = Mobot_uploadPosesGroup(comms, _numRobots, rad, num);
+  delete[] comms;
+  delete[] rad;
+  return rc;
+}
+
+int CMobotGroup::getJointAngles(double* angles)
+{
+  int rc;
+  mobot_t** comms;
+  mobotGroupSnapshot_t* snap;
+  if(_numRobots == 0) {
+    return 0;
+  }
+  snap = Mobot_groupSnapshotNew(_numRobots);
+  if(snap == NULL) {
+    return -1;
+  }
+  comms = new mobot_t*[_numRobots];
+  for(int i = 0; i < _numRobots; i++) {
+    comms[i] = _robots[i]->_comms;
+  }
+  rc = Mobot_groupSnapshot(comms, _numRobots, MOBOT_SNAPSHOT_JOINTS, GROUP_QUERY_DEADLINE, snap);
+  for(int i = 0; i < 4*_numRobots; i++) {
+    angles[i] = snap->status[i/4] == 0 ? RAD2DEG(snap->angles[i]) : 0;
+  }
+  Mobot_groupSnapshotFree(snap);
+  delete[] comms;
+  return rc;
+}
+
+int CMobotGroup::playPoses(int groupId)
+{
+  int rc;
+  mobot_t** comms = new mobot_t*[_numRobots];
+  for(int i = 0; i < _numRobots; i++) {
+    comms[i] = _robots[i]->_comms;
+  }
+  rc = Mobot_formPoseGroup(comms, _numRobots, groupId);
+  if(rc == 0) {
+    rc = Mobot_playPoses(comms[0], groupId);
+  }
+  delete[] comms;
+  return rc;
+}
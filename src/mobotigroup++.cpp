@@ -28,8 +28,6 @@
 CLinkbotIGroup::CLinkbotIGroup()
 {
   _numRobots = 0;
-  _motionInProgress = 0;
-  _thread = (THREAD_T*)malloc(sizeof(THREAD_T));
   _robots = (CLinkbotI**)CMobotGroup::_robots;
 }
 
@@ -0,0 +1,66 @@
+/* Tests for Mobot_burstFilter, which turns a burst of readings into one
+ * estimate. */
+
+#include <math.h>
+#include <stdint.h>
+#include "mobot.h"
+#include "mobot_internal.h"
+#include "testing.h"
+
+static int near(double a, double b)
+{
+  return fabs(a - b) < 1e-9;
+}
+
+static void testMean(void)
+{
+  double x[4] = {1, 2, 3, 10};
+  CHECK(near(Mobot_burstFilter(x, 4, MOBOT_FILTER_MEAN, 0), 4));
+}
+
+static void testMedian(void)
+{
+  double odd[5] = {9, 1, 100, 3, 2};
+  double even[4] = {4, 1, 3, 2};
+  CHECK(near(Mobot_burstFilter(odd, 5, MOBOT_FILTER_MEDIAN, 0), 3));
+  CHECK(near(Mobot_burstFilter(even, 4, MOBOT_FILTER_MEDIAN, 0), 2.5));
+}
+
+static void testTrimmedMean(void)
+{
+  double x[10] = {100, 1, 2, 3, 4, 5, 6, 7, 8, -100};
+  double few[3] = {1, 2, 30};
+  /* 10% off each end drops the two outliers */
+  CHECK(near(Mobot_burstFilter(x, 10, MOBOT_FILTER_TRIMMED_MEAN, 0.1), 4.5));
+  /* Trimming never leaves nothing: at most all but the middle reading go */
+  CHECK(near(Mobot_burstFilter(few, 3, MOBOT_FILTER_TRIMMED_MEAN, 0.5), 2));
+}
+
+static void testExponential(void)
+{
+  double x[3] = {0, 10, 10};
+  double y[3] = {0, 10, 10};
+  /* 0 -> 5 -> 7.5 */
+  CHECK(near(Mobot_burstFilter(x, 3, MOBOT_FILTER_EXPONENTIAL, 0.5), 7.5));
+  /* Out of range weights fall back to 1, the last reading */
+  CHECK(near(Mobot_burstFilter(y, 3, MOBOT_FILTER_EXPONENTIAL, 2), 10));
+}
+
+static void testSingle(void)
+{
+  double x[1] = {42};
+  CHECK(near(Mobot_burstFilter(x, 1, MOBOT_FILTER_MEAN, 0), 42));
+  CHECK(near(Mobot_burstFilter(x, 1, MOBOT_FILTER_MEDIAN, 0), 42));
+  CHECK(near(Mobot_burstFilter(x, 1, MOBOT_FILTER_TRIMMED_MEAN, 0.4), 42));
+  CHECK(near(Mobot_burstFilter(x, 1, MOBOT_FILTER_EXPONENTIAL, 0.3), 42));
+}
+
+int main()
+{
+  testMean();
+  testMedian();
+  testTrimmedMean();
+  testExponential();
+  testSingle();
+  return TEST_EXIT();
+}
@@ -0,0 +1,113 @@
+/* Tests for the latest-value channels: Mobot_readLatest must report new,
+ * unchanged and overwritten values correctly, and must never return a value
+ * that is half one write and half another. */
+
+#include <pthread.h>
+#include <stdint.h>
+#include "mobot.h"
+#include "mobot_internal.h"
+#include "testing.h"
+
+#define NUM_WRITES 2000000
+
+static void testCursor(mobot_t* comms)
+{
+  mobotEvent_t event;
+  unsigned int cursor = 0;
+  unsigned int skipped = 99;
+  double angles[4] = {1, 2, 3, 4};
+  double accel[3] = {0.5, 0.25, 1};
+
+  CHECK(Mobot_readLatest(comms, MOBOT_EVENT_JOINT, &event, &cursor, &skipped) == -1);
+  CHECK(Mobot_readLatest(comms, MOBOT_EVENT_BUTTON, &event, &cursor, &skipped) == -1);
+
+  Mobot_channelWrite(&comms->jointChannel, 100, angles, 4);
+  CHECK(Mobot_readLatest(comms, MOBOT_EVENT_JOINT, &event, &cursor, &skipped) == 0);
+  CHECK(skipped == 0);
+  CHECK(event.type == MOBOT_EVENT_JOINT && event.robot == comms);
+  CHECK(event.millis == 100 && event.joints[3] == 4);
+  CHECK(Mobot_readLatest(comms, MOBOT_EVENT_JOINT, &event, &cursor, &skipped) == 1);
+  CHECK(skipped == 0);
+
+  /* Three more writes: the reader sees the last and has skipped two */
+  angles[0] = 5;
+  Mobot_channelWrite(&comms->jointChannel, 200, angles, 4);
+  angles[0] = 6;
+  Mobot_channelWrite(&comms->jointChannel, 300, angles, 4);
+  angles[0] = 7;
+  Mobot_channelWrite(&comms->jointChannel, 400, angles, 4);
+  CHECK(Mobot_readLatest(comms, MOBOT_EVENT_JOINT, &event, &cursor, &skipped) == 0);
+  CHECK(skipped == 2);
+  CHECK(event.millis == 400 && event.joints[0] == 7);
+
+  /* Without a cursor every read counts as new */
+  CHECK(Mobot_readLatest(comms, MOBOT_EVENT_JOINT, &event, NULL, NULL) == 0);
+
+  /* The channels are independent */
+  cursor = 0;
+  CHECK(Mobot_readLatest(comms, MOBOT_EVENT_ACCEL, &event, &cursor, &skipped) == -1);
+  Mobot_channelWrite(&comms->accelChannel, 500, accel, 3);
+  CHECK(Mobot_readLatest(comms, MOBOT_EVENT_ACCEL, &event, &cursor, &skipped) == 0);
+  CHECK(event.type == MOBOT_EVENT_ACCEL && event.accel[1] == 0.25);
+}
+
+/* Every write stores millis = i and all four values = i */
+static void* writer(void* arg)
+{
+  mobotChannel_t* channel = (mobotChannel_t*)arg;
+  double values[4];
+  uint32_t i;
+  int j;
+  for(i = 1; i <= NUM_WRITES; i++) {
+    for(j = 0; j < 4; j++) {
+      values[j] = i;
+    }
+    Mobot_channelWrite(channel, i, values, 4);
+  }
+  return NULL;
+}
+
+static void testTorn(mobot_t* comms)
+{
+  pthread_t thread;
+  mobotEvent_t event;
+  unsigned int cursor = 0;
+  unsigned int skipped;
+  unsigned int reads = 0;
+  int torn = 0;
+  int backwards = 0;
+  uint32_t last = 0;
+  int j;
+
+  Mobot_init(comms);
+  pthread_create(&thread, NULL, writer, &comms->jointChannel);
+  while(last < NUM_WRITES) {
+    if(Mobot_readLatest(comms, MOBOT_EVENT_JOINT, &event, &cursor, &skipped) != 0) {
+      continue;
+    }
+    reads++;
+    for(j = 0; j < 4; j++) {
+      if(event.joints[j] != event.millis) {
+        torn++;
+        break;
+      }
+    }
+    if(event.millis <= last || cursor != event.millis) {
+      backwards++;
+    }
+    last = event.millis;
+  }
+  pthread_join(thread, NULL);
+  CHECK(reads > 0);
+  CHECK(torn == 0);
+  CHECK(backwards == 0);
+}
+
+int main()
+{
+  mobot_t comms;
+  Mobot_init(&comms);
+  testCursor(&comms);
+  testTorn(&comms);
+  return TEST_EXIT();
+}
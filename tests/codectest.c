@@ -0,0 +1,85 @@
+/* Tests for the command layouts and field helpers in codec.h */
+
+#include <stdint.h>
+#include <string.h>
+#include "codec.h"
+#include "testing.h"
+
+static void testSizes()
+{
+  /* A response length counts [RESP_OK] [length] ... [RESP_END] */
+  CHECK(CODEC_RESP_LEN(CMD_STATUS) == 3);
+  CHECK(CODEC_RESP_LEN(CMD_GETMOTORANGLEABS) == 7);
+  CHECK(CODEC_RESP_LEN(CMD_GETMOTORANGLESTIMESTAMPABS) == 23);
+  CHECK(CODEC_REQ(CMD_GETMOTORANGLEABS) == 1);
+  CHECK(CODEC_REQ(CMD_TIMEDACTION) == 25);
+}
+
+static void testView()
+{
+  uint8_t buf[32];
+  memset(buf, 0, sizeof(buf));
+  buf[0] = RESP_OK;
+  buf[1] = 7;
+  CHECK(CODEC_VIEW(buf, CMD_GETMOTORANGLEABS) == &buf[2]);
+  /* The exact view takes neither shorter nor longer frames */
+  buf[1] = 6;
+  CHECK(CODEC_VIEW(buf, CMD_GETMOTORANGLEABS) == NULL);
+  buf[1] = 8;
+  CHECK(CODEC_VIEW(buf, CMD_GETMOTORANGLEABS) == NULL);
+  /* Nor errors */
+  buf[0] = RESP_ERR;
+  buf[1] = 7;
+  CHECK(CODEC_VIEW(buf, CMD_GETMOTORANGLEABS) == NULL);
+}
+
+static void testViewMin()
+{
+  uint8_t buf[32];
+  memset(buf, 0, sizeof(buf));
+  buf[0] = RESP_OK;
+  buf[1] = CODEC_RESP_LEN(CMD_GET_POSE_DATA);
+  CHECK(CODEC_VIEW_MIN(buf, CMD_GET_POSE_DATA) == &buf[2]);
+  buf[1]++;
+  CHECK(CODEC_VIEW_MIN(buf, CMD_GET_POSE_DATA) == &buf[2]);
+  buf[1] -= 2;
+  CHECK(CODEC_VIEW_MIN(buf, CMD_GET_POSE_DATA) == NULL);
+  buf[0] = RESP_ERR;
+  buf[1] = CODEC_RESP_LEN(CMD_GET_POSE_DATA);
+  CHECK(CODEC_VIEW_MIN(buf, CMD_GET_POSE_DATA) == NULL);
+}
+
+static void testFields()
+{
+  /* Odd offsets, to make sure nothing relies on alignment */
+  uint8_t buf[16];
+  float f;
+  memset(buf, 0, sizeof(buf));
+
+  codecPutU32LE(&buf[1], 0x12345678);
+  CHECK(buf[1] == 0x78 && buf[2] == 0x56 && buf[3] == 0x34 && buf[4] == 0x12);
+  CHECK(codecGetU32LE(&buf[1]) == 0x12345678);
+
+  codecPutU16BE(&buf[5], 0xabcd);
+  CHECK(buf[5] == 0xab && buf[6] == 0xcd);
+  CHECK(codecGetU16BE(&buf[5]) == 0xabcd);
+
+  buf[7] = 0x00;
+  buf[8] = 0xc0;
+  CHECK(codecGetI16LE(&buf[7]) == -16384);
+
+  /* 1.5f is 0x3fc00000 */
+  codecPutFloat(&buf[9], 1.5f);
+  CHECK(buf[9] == 0x00 && buf[10] == 0x00 && buf[11] == 0xc0 && buf[12] == 0x3f);
+  f = codecGetFloat(&buf[9]);
+  CHECK(f == 1.5f);
+}
+
+int main()
+{
+  testSizes();
+  testView();
+  testViewMin();
+  testFields();
+  return TEST_EXIT();
+}
@@ -0,0 +1,111 @@
+/* Tests for Mobot_socketParse: messages read off a socket in arbitrary
+ * pieces must come out whole, one at a time. */
+
+#include <stdint.h>
+#include <string.h>
+#include "mobot.h"
+#include "mobot_internal.h"
+#include "commands.h"
+#include "testing.h"
+
+static const uint8_t g_first[7] = {RESP_OK, 7, 1, 2, 3, 4, RESP_END};
+static const uint8_t g_second[5] = {RESP_OK, 5, 9, 8, RESP_END};
+
+static void reset(mobot_t* comms)
+{
+  comms->recvBuf_ready = 0;
+  comms->recvDest = NULL;
+  comms->recvBuf_data = comms->recvBuf;
+  comms->commsEngine_bytes = 0;
+}
+
+static int received(mobot_t* comms, const uint8_t* msg, int len)
+{
+  return comms->recvBuf_ready &&
+    comms->recvBuf_bytes == len &&
+    !memcmp(comms->recvBuf_data, msg, len);
+}
+
+/* Every way of cutting one message in two */
+static void testSplit(mobot_t* comms)
+{
+  int cut;
+  for(cut = 1; cut < (int)sizeof(g_first); cut++) {
+    reset(comms);
+    Mobot_socketParse(comms, g_first, cut);
+    CHECK(!comms->recvBuf_ready);
+    Mobot_socketParse(comms, g_first + cut, sizeof(g_first) - cut);
+    CHECK(received(comms, g_first, sizeof(g_first)));
+  }
+}
+
+static void testByteByByte(mobot_t* comms)
+{
+  int i;
+  reset(comms);
+  for(i = 0; i < (int)sizeof(g_first); i++) {
+    CHECK(!comms->recvBuf_ready);
+    Mobot_socketParse(comms, &g_first[i], 1);
+  }
+  CHECK(received(comms, g_first, sizeof(g_first)));
+}
+
+/* Two messages in one read: the first goes to the registered buffer, the
+ * second to recvBuf */
+static void testTwoInOne(mobot_t* comms)
+{
+  uint8_t chunk[sizeof(g_first) + sizeof(g_second)];
+  uint8_t dest[32];
+  memcpy(chunk, g_first, sizeof(g_first));
+  memcpy(chunk + sizeof(g_first), g_second, sizeof(g_second));
+  reset(comms);
+  memset(dest, 0, sizeof(dest));
+  comms->recvDest = dest;
+  Mobot_socketParse(comms, chunk, sizeof(chunk));
+  CHECK(!memcmp(dest, g_first, sizeof(g_first)));
+  CHECK(received(comms, g_second, sizeof(g_second)));
+  CHECK(comms->recvBuf_data == comms->recvBuf);
+}
+
+/* The end of one message and the start of the next in the same read */
+static void testStraddle(mobot_t* comms)
+{
+  uint8_t chunk[sizeof(g_first) + sizeof(g_second)];
+  uint8_t dest[32];
+  memcpy(chunk, g_first, sizeof(g_first));
+  memcpy(chunk + sizeof(g_first), g_second, sizeof(g_second));
+  reset(comms);
+  comms->recvDest = dest;
+  Mobot_socketParse(comms, chunk, 4);
+  Mobot_socketParse(comms, chunk + 4, sizeof(g_first) - 4 + 2);
+  CHECK(!memcmp(dest, g_first, sizeof(g_first)));
+  CHECK(comms->commsEngine_bytes == 2);
+  Mobot_socketParse(comms, chunk + sizeof(g_first) + 2, sizeof(g_second) - 2);
+  CHECK(received(comms, g_second, sizeof(g_second)));
+}
+
+/* A length byte that cannot frame anything throws away the rest of the
+ * read, and the next read starts over */
+static void testGarbage(mobot_t* comms)
+{
+  uint8_t junk[4] = {RESP_OK, 1, RESP_OK, 7};
+  reset(comms);
+  Mobot_socketParse(comms, junk, sizeof(junk));
+  CHECK(!comms->recvBuf_ready);
+  CHECK(comms->commsEngine_bytes == 0);
+  Mobot_socketParse(comms, g_first, sizeof(g_first));
+  CHECK(received(comms, g_first, sizeof(g_first)));
+}
+
+int main()
+{
+  mobot_t comms;
+  Mobot_init(&comms);
+  comms.connectionMode = MOBOTCONNECT_TCP;
+  testSplit(&comms);
+  testByteByByte(&comms);
+  testTwoInOne(&comms);
+  testStraddle(&comms);
+  testGarbage(&comms);
+  return TEST_EXIT();
+}
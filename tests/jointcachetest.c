@@ -0,0 +1,71 @@
+/* Tests for the joint angle cache: a motion command must invalidate it, and
+ * neither a late response nor a late event may bring old angles back. */
+
+#include <stdint.h>
+#include <string.h>
+#include "mobot.h"
+#include "mobot_internal.h"
+#include "testing.h"
+
+static const double g_old[4] = {10, 20, 30, 40};
+static const double g_new[4] = {-1, -2, -3, -4};
+
+static int cached(mobot_t* comms, const double expect[4])
+{
+  double angles[4];
+  if(Mobot_jointCacheLookup(comms, 1000, NULL, angles)) {
+    return 0;
+  }
+  return !memcmp(angles, expect, sizeof(angles));
+}
+
+static void testResponse(mobot_t* comms)
+{
+  double angles[4];
+  double time;
+  unsigned int gen = Mobot_jointCacheGeneration(comms);
+  CHECK(Mobot_jointCacheLookup(comms, 1000, NULL, angles) == -1);
+  Mobot_jointCacheStore(comms, 1500, g_old, 0, gen);
+  CHECK(Mobot_jointCacheLookup(comms, 1000, &time, angles) == 0);
+  CHECK(!memcmp(angles, g_old, sizeof(angles)));
+  CHECK(time == 1.5);
+  /* A negative age never hits */
+  CHECK(Mobot_jointCacheLookup(comms, -1, NULL, angles) == -1);
+}
+
+/* A response to a request sent before a motion command is stale */
+static void testLateResponse(mobot_t* comms)
+{
+  unsigned int gen = Mobot_jointCacheGeneration(comms);
+  Mobot_jointCacheInvalidate(comms);
+  CHECK(!cached(comms, g_old));
+  Mobot_jointCacheStore(comms, 2000, g_new, 0, gen);
+  CHECK(!cached(comms, g_new));
+  gen = Mobot_jointCacheGeneration(comms);
+  Mobot_jointCacheStore(comms, 2000, g_new, 0, gen);
+  CHECK(cached(comms, g_new));
+}
+
+/* Events only refresh a valid cache, and only with newer angles */
+static void testEvents(mobot_t* comms)
+{
+  Mobot_jointCacheStore(comms, 1900, g_old, 1, 0);
+  CHECK(cached(comms, g_new));
+  Mobot_jointCacheStore(comms, 2000, g_old, 1, 0);
+  CHECK(cached(comms, g_new));
+  Mobot_jointCacheStore(comms, 2100, g_old, 1, 0);
+  CHECK(cached(comms, g_old));
+  Mobot_jointCacheInvalidate(comms);
+  Mobot_jointCacheStore(comms, 2200, g_new, 1, 0);
+  CHECK(!cached(comms, g_new));
+}
+
+int main()
+{
+  mobot_t comms;
+  Mobot_init(&comms);
+  testResponse(&comms);
+  testLateResponse(&comms);
+  testEvents(&comms);
+  return TEST_EXIT();
+}
@@ -0,0 +1,22 @@
+#ifndef _BAROBO_TESTING_H_
+#define _BAROBO_TESTING_H_
+
+/* Bare minimum for the unit tests: CHECK reports a failed condition and
+ * carries on, and TEST_EXIT turns the tally into the exit status ctest
+ * looks at. */
+
+#include <stdio.h>
+
+static int g_testFailures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if(!(cond)) { \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      g_testFailures++; \
+    } \
+  } while(0)
+
+#define TEST_EXIT() (g_testFailures ? 1 : 0)
+
+#endif